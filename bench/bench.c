@@ -0,0 +1,665 @@
+// Throughput benchmark for the compiler pipeline over generated programs.
+//
+//   tiny-bench [--shapes=a,b] [--sizes=1K,1M] [--seed=N] [--min-time=SECONDS]
+//              [--results=FILE] [--revision=REV]
+//   tiny-bench --generate --shapes=SHAPE --sizes=SIZE > program.tiny
+//   tiny-bench --loops=1K,64K [--min-time=SECONDS] [--results=FILE]
+//   tiny-bench --codegen-threads=1,2,4,8 [--shapes=a,b] [--sizes=16M]
+//   tiny-bench --context-threads=1,2,4,8 [--shapes=a,b] [--sizes=1K]
+//
+// Every phase runs until it has taken at least --min-time seconds and the
+// fastest run is reported. "parse" includes the lexing the parser drives;
+// "parse_shared" is the same with repeated expressions shared (see
+// Parser.share_expressions); "codegen" and "json" start from an already
+// parsed tree. Results are
+// printed as a table and appended to FILE, one JSON object per phase.
+//
+// --loops compares, for each iteration count, a program written with a while
+// loop against the same work unrolled statement by statement; "compile" is
+// the whole pipeline including the loop optimizations.
+//
+// --codegen-threads times generate_code_parallel over the same tree with
+// each thread count and prints the speedup over the first one; the output
+// is checked to match the serial code generator's.
+//
+// --context-threads compiles the same program over and over on each thread
+// count, every thread with its own TinyContext, and prints the combined
+// throughput with the speedup and efficiency against the first count. Each
+// output is checked against a single-threaded compile. Nothing is asserted
+// about the scaling; loaded machines measure it poorly.
+//
+// Where perf_event_open is allowed, the fastest run's hardware counters are
+// reported too (IPC, cache and branch misses per thousand instructions);
+// elsewhere, e.g. in most containers, those fields are null.
+#include "generate.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include "../src/codegen.h"
+#include "../src/compiler.h"
+#include "../src/perfcount.h"
+#include "../src/parcodegen.h"
+#include "../src/tiny.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_SIZES 16
+#define DEFAULT_RESULTS "bench/results/native.jsonl"
+
+typedef struct {
+    const char* source;
+    size_t length;
+    ASTNode* ast;
+    size_t token_count;
+    ThreadPool* pool;    // for codegen_parallel_phase
+} BenchInput;
+
+typedef void (*PhaseFunction)(BenchInput* input);
+
+typedef struct {
+    const char* name;
+    PhaseFunction run;
+} Phase;
+
+typedef struct {
+    int shapes[SHAPE_COUNT];
+    int shape_count;
+    size_t sizes[MAX_SIZES];
+    int size_count;
+    size_t loops[MAX_SIZES];
+    int loop_count;
+    size_t threads[MAX_SIZES];
+    int thread_count;
+    int context_threads;    // `threads` is for --context-threads, not --codegen-threads
+    uint32_t seed;
+    double min_time;
+    const char* results;
+    const char* revision;
+    int generate;
+} BenchOptions;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void lex_phase(BenchInput* input) {
+    Lexer* lexer = init_lexer_with_length((char*)input->source, input->length);
+    size_t count = 0;
+
+    for (;;) {
+        Token* token = get_next_token(lexer);
+        TokenType type = token->type;
+        free_token(lexer, token);
+        count++;
+        if (type == TOKEN_EOF) break;
+    }
+
+    free_lexer(lexer);
+    input->token_count = count;
+}
+
+static ASTNode* parse_input(BenchInput* input, int share_expressions) {
+    Lexer* lexer = init_lexer_with_length((char*)input->source, input->length);
+    Parser* parser = init_parser(lexer);
+    parser->share_expressions = share_expressions;
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+static void parse_phase(BenchInput* input) {
+    free_ast(parse_input(input, 0));
+}
+
+static void parse_shared_phase(BenchInput* input) {
+    free_ast(parse_input(input, 1));
+}
+
+static void codegen_phase(BenchInput* input) {
+    free(generate_code(input->ast));
+}
+
+static void codegen_parallel_phase(BenchInput* input) {
+    free(generate_code_parallel(input->ast, input->pool, NULL, NULL, NULL));
+}
+
+static void json_phase(BenchInput* input) {
+    free(ast_to_json(input->ast));
+}
+
+static void tokenize_json_phase(BenchInput* input) {
+    free(tokenize_source(input->source, input->length, NULL));
+}
+
+static void compile_phase(BenchInput* input) {
+    free(compile_source(input->source, input->length, NULL));
+}
+
+static const Phase phases[] = {
+    { "lex", lex_phase },
+    { "parse", parse_phase },
+    { "parse_shared", parse_shared_phase },
+    { "codegen", codegen_phase },
+    { "json", json_phase },
+    { "tokenize_json", tokenize_json_phase },
+};
+
+static const Phase loop_phases[] = {
+    { "lex", lex_phase },
+    { "parse", parse_phase },
+    { "compile", compile_phase },
+};
+
+// Returns the fastest run and stores its counter deltas in `best_counters`
+static double time_phase(const Phase* phase, BenchInput* input, double min_time, int* runs,
+                         const PerfCounters* counters, CounterSample* best_counters) {
+    double best = 0;
+    double total = 0;
+    *runs = 0;
+
+    do {
+        CounterSample before, after;
+        read_perf_counters(counters, &before);
+        double start = now_seconds();
+        phase->run(input);
+        double elapsed = now_seconds() - start;
+        read_perf_counters(counters, &after);
+
+        if (*runs == 0 || elapsed < best) {
+            best = elapsed;
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                best_counters->values[i] = after.values[i] - before.values[i];
+            }
+        }
+        total += elapsed;
+        (*runs)++;
+    } while (total < min_time);
+
+    return best;
+}
+
+// `numerator` per `denominator` times `scale`, or a negative value when
+// either counter is unavailable
+static double counter_ratio(const PerfCounters* counters, const CounterSample* sample,
+                            CounterKind numerator, CounterKind denominator, double scale) {
+    if (counters->fds[numerator] < 0 || counters->fds[denominator] < 0 ||
+        sample->values[denominator] == 0) {
+        return -1;
+    }
+    return scale * sample->values[numerator] / sample->values[denominator];
+}
+
+static void print_ratio(double ratio) {
+    if (ratio < 0) {
+        printf(" %10s", "-");
+    } else {
+        printf(" %10.2f", ratio);
+    }
+}
+
+static void write_ratio(FILE* results, const char* name, double ratio) {
+    if (ratio < 0) {
+        fprintf(results, ",\"%s\":null", name);
+    } else {
+        fprintf(results, ",\"%s\":%.4f", name, ratio);
+    }
+}
+
+static size_t parse_size(const char* text) {
+    char* end;
+    size_t size = strtoull(text, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': size *= 1024; break;
+        case 'm': case 'M': size *= 1024 * 1024; break;
+        case 'g': case 'G': size *= 1024 * 1024 * 1024; break;
+    }
+    return size;
+}
+
+// Splits a comma-separated list in place and calls `add` for each item;
+// returns 0 when an item is rejected
+static int parse_list(char* list, int (*add)(BenchOptions*, const char*), BenchOptions* options) {
+    for (char* item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        if (!add(options, item)) return 0;
+    }
+    return 1;
+}
+
+static int add_shape(BenchOptions* options, const char* name) {
+    int shape = shape_from_name(name);
+    if (shape < 0 || options->shape_count == SHAPE_COUNT) {
+        fprintf(stderr, "Error: Unknown shape '%s'\n", name);
+        return 0;
+    }
+    options->shapes[options->shape_count++] = shape;
+    return 1;
+}
+
+static int add_size(BenchOptions* options, const char* text) {
+    size_t size = parse_size(text);
+    if (size == 0 || options->size_count == MAX_SIZES) {
+        fprintf(stderr, "Error: Invalid size '%s'\n", text);
+        return 0;
+    }
+    options->sizes[options->size_count++] = size;
+    return 1;
+}
+
+static int add_loop(BenchOptions* options, const char* text) {
+    size_t iterations = parse_size(text);
+    if (iterations == 0 || options->loop_count == MAX_SIZES) {
+        fprintf(stderr, "Error: Invalid iteration count '%s'\n", text);
+        return 0;
+    }
+    options->loops[options->loop_count++] = iterations;
+    return 1;
+}
+
+static int add_threads(BenchOptions* options, const char* text) {
+    size_t threads = parse_size(text);
+    if (threads == 0 || options->thread_count == MAX_SIZES) {
+        fprintf(stderr, "Error: Invalid thread count '%s'\n", text);
+        return 0;
+    }
+    options->threads[options->thread_count++] = threads;
+    return 1;
+}
+
+static int parse_options(int argc, char** argv, BenchOptions* options) {
+    memset(options, 0, sizeof(BenchOptions));
+    options->seed = 1;
+    options->min_time = 0.5;
+    options->results = DEFAULT_RESULTS;
+
+    for (int i = 1; i < argc; i++) {
+        char* arg = argv[i];
+        if (strncmp(arg, "--shapes=", 9) == 0) {
+            if (!parse_list(arg + 9, add_shape, options)) return 0;
+        } else if (strncmp(arg, "--sizes=", 8) == 0) {
+            if (!parse_list(arg + 8, add_size, options)) return 0;
+        } else if (strncmp(arg, "--loops=", 8) == 0) {
+            if (!parse_list(arg + 8, add_loop, options)) return 0;
+        } else if (strncmp(arg, "--codegen-threads=", 18) == 0) {
+            if (!parse_list(arg + 18, add_threads, options)) return 0;
+        } else if (strncmp(arg, "--context-threads=", 18) == 0) {
+            options->context_threads = 1;
+            if (!parse_list(arg + 18, add_threads, options)) return 0;
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            options->seed = (uint32_t)strtoul(arg + 7, NULL, 10);
+        } else if (strncmp(arg, "--min-time=", 11) == 0) {
+            options->min_time = atof(arg + 11);
+        } else if (strncmp(arg, "--results=", 10) == 0) {
+            options->results = arg + 10;
+        } else if (strncmp(arg, "--revision=", 11) == 0) {
+            options->revision = arg + 11;
+        } else if (strcmp(arg, "--generate") == 0) {
+            options->generate = 1;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s\n", arg);
+            return 0;
+        }
+    }
+
+    if (options->shape_count == 0) {
+        for (int shape = 0; shape < SHAPE_COUNT; shape++) {
+            options->shapes[options->shape_count++] = shape;
+        }
+    }
+    if (options->size_count == 0 && options->context_threads) {
+        options->sizes[options->size_count++] = 1024;
+    }
+    if (options->size_count == 0) {
+        options->sizes[options->size_count++] = 64 * 1024;
+        options->sizes[options->size_count++] = 1024 * 1024;
+    }
+    return 1;
+}
+
+// Creates the parent directories of `path`
+static void make_parent_dirs(const char* path) {
+    char* copy = strdup(path);
+    for (char* slash = strchr(copy + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(copy, 0755);
+        *slash = '/';
+    }
+    free(copy);
+}
+
+// `iterations` is only written for the --loops programs and `threads` for
+// --codegen-threads (0 otherwise)
+static void write_result(FILE* results, const BenchOptions* options, const char* timestamp,
+                         const char* shape, size_t iterations, size_t threads,
+                         const BenchInput* input,
+                         const char* phase, double seconds, int runs, const PerfCounters* counters,
+                         const CounterSample* sample) {
+    fprintf(results, "{\"timestamp\":\"%s\",\"revision\":", timestamp);
+    if (options->revision && options->revision[0]) {
+        fprintf(results, "\"%s\"", options->revision);
+    } else {
+        fprintf(results, "null");
+    }
+    fprintf(results, ",\"shape\":\"%s\",\"seed\":%u,\"bytes\":%zu,\"tokens\":%zu,\"phase\":\"%s\","
+                     "\"seconds\":%.9f,\"mb_per_s\":%.3f,\"ns_per_token\":%.3f,\"runs\":%d",
+            shape, options->seed, input->length, input->token_count, phase, seconds,
+            input->length / seconds / 1e6, seconds * 1e9 / input->token_count, runs);
+    if (iterations > 0) {
+        fprintf(results, ",\"iterations\":%zu", iterations);
+    }
+    if (threads > 0) {
+        fprintf(results, ",\"threads\":%zu", threads);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters->fds[i] < 0) {
+            fprintf(results, ",\"%s\":null", counter_name(i));
+        } else {
+            fprintf(results, ",\"%s\":%llu", counter_name(i), (unsigned long long)sample->values[i]);
+        }
+    }
+    write_ratio(results, "ipc", counter_ratio(counters, sample, COUNTER_INSTRUCTIONS, COUNTER_CYCLES, 1));
+    write_ratio(results, "cache_mpki",
+                counter_ratio(counters, sample, COUNTER_CACHE_MISSES, COUNTER_INSTRUCTIONS, 1000));
+    write_ratio(results, "branch_mpki",
+                counter_ratio(counters, sample, COUNTER_BRANCH_MISSES, COUNTER_INSTRUCTIONS, 1000));
+    fputs("}\n", results);
+}
+
+// Each iteration count as a loop and unrolled: source and output size, and
+// the time of every phase next to the unrolled/looped ratio
+static void compare_loops(const BenchOptions* options, FILE* results, const char* timestamp,
+                          const PerfCounters* counters) {
+    static const char* variants[] = { "loop", "unrolled" };
+    size_t phase_count = sizeof(loop_phases) / sizeof(loop_phases[0]);
+
+    printf("%-9s %10s %12s %10s %12s  %-8s %12s %8s\n",
+           "variant", "iterations", "bytes", "tokens", "JS bytes", "phase", "ms", "ratio");
+
+    for (int i = 0; i < options->loop_count; i++) {
+        double looped[sizeof(loop_phases) / sizeof(loop_phases[0])];
+
+        for (int unrolled = 0; unrolled < 2; unrolled++) {
+            BenchInput input;
+            input.source = generate_loop_program(options->loops[i], unrolled, &input.length);
+            lex_phase(&input);
+            input.ast = NULL;
+
+            char* output = compile_source(input.source, input.length, NULL);
+            size_t output_length = strlen(output);
+            free(output);
+
+            for (size_t k = 0; k < phase_count; k++) {
+                int runs;
+                CounterSample sample;
+                double seconds = time_phase(&loop_phases[k], &input, options->min_time, &runs,
+                                            counters, &sample);
+
+                printf("%-9s %10zu %12zu %10zu %12zu  %-8s %12.3f",
+                       variants[unrolled], options->loops[i], input.length, input.token_count,
+                       output_length, loop_phases[k].name, seconds * 1e3);
+                if (unrolled) {
+                    printf(" %7.1fx\n", seconds / looped[k]);
+                } else {
+                    looped[k] = seconds;
+                    printf(" %8s\n", "-");
+                }
+                write_result(results, options, timestamp, variants[unrolled], options->loops[i], 0,
+                             &input, loop_phases[k].name, seconds, runs, counters, &sample);
+            }
+            free((char*)input.source);
+        }
+    }
+}
+
+// Code generation of each shape and size on every thread count, with the
+// speedup over the first count
+static void compare_codegen_threads(const BenchOptions* options, FILE* results,
+                                    const char* timestamp, const PerfCounters* counters) {
+    static const Phase phase = { "codegen_parallel", codegen_parallel_phase };
+
+    printf("%-12s %10s %10s %8s %12s %10s %8s\n",
+           "shape", "bytes", "statements", "threads", "ms", "MB/s", "speedup");
+
+    for (int i = 0; i < options->shape_count; i++) {
+        const char* shape = shape_name(options->shapes[i]);
+
+        for (int j = 0; j < options->size_count; j++) {
+            BenchInput input;
+            input.source = generate_program(options->shapes[i], options->sizes[j], options->seed,
+                                            &input.length);
+            lex_phase(&input);
+            input.ast = parse_input(&input, 0);
+            char* serial = generate_code(input.ast);
+            double first = 0;
+
+            for (int k = 0; k < options->thread_count; k++) {
+                int runs;
+                CounterSample sample;
+                input.pool = init_threadpool((int)options->threads[k]);
+
+                char* output = generate_code_parallel(input.ast, input.pool, NULL, NULL, NULL);
+                if (strcmp(output, serial) != 0) {
+                    fprintf(stderr, "Error: %zu threads generated different code for %s\n",
+                            options->threads[k], shape);
+                    exit(1);
+                }
+                free(output);
+
+                double seconds = time_phase(&phase, &input, options->min_time, &runs, counters,
+                                            &sample);
+                if (k == 0) first = seconds;
+                printf("%-12s %10zu %10zu %8zu %12.3f %10.1f %7.2fx\n",
+                       shape, input.length, input.ast->data.program.statement_count,
+                       options->threads[k], seconds * 1e3, input.length / seconds / 1e6,
+                       first / seconds);
+                write_result(results, options, timestamp, shape, 0, options->threads[k], &input,
+                             phase.name, seconds, runs, counters, &sample);
+                free_threadpool(input.pool);
+            }
+
+            free(serial);
+            free_ast(input.ast);
+            free((char*)input.source);
+        }
+    }
+}
+
+typedef struct {
+    const BenchInput* input;
+    const char* expected;
+    int compiles;
+} ContextWorker;
+
+static void* context_worker(void* arg) {
+    ContextWorker* worker = arg;
+    TinyContext* context = tiny_create_context(NULL);
+
+    for (int i = 0; i < worker->compiles; i++) {
+        const char* output;
+        size_t length;
+        if (tiny_compile(context, worker->input->source, worker->input->length, &output,
+                         &length) != TINY_OK || strcmp(output, worker->expected) != 0) {
+            fprintf(stderr, "Error: a context compiled different code on a thread\n");
+            exit(1);
+        }
+    }
+
+    tiny_destroy_context(context);
+    return NULL;
+}
+
+// Seconds for `thread_count` threads to each compile `compiles` times
+static double run_context_threads(const BenchInput* input, const char* expected,
+                                  size_t thread_count, int compiles) {
+    pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+    ContextWorker worker = { input, expected, compiles };
+
+    double start = now_seconds();
+    for (size_t i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, context_worker, &worker);
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = now_seconds() - start;
+
+    free(threads);
+    return seconds;
+}
+
+// Compiles of each shape and size per second on every thread count; each
+// thread does as many compiles as one thread manages in --min-time. The
+// counters only see the calling thread, so none are recorded.
+static void compare_context_threads(const BenchOptions* options, FILE* results,
+                                    const char* timestamp) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    PerfCounters none;
+    CounterSample sample;
+    memset(&none, 0, sizeof(none));
+    memset(&sample, 0, sizeof(sample));
+    for (int i = 0; i < COUNTER_COUNT; i++) none.fds[i] = -1;
+
+    printf("%-12s %10s %8s %10s %12s %8s %10s\n",
+           "shape", "bytes", "threads", "compiles", "compiles/s", "speedup", "efficiency");
+
+    for (int i = 0; i < options->shape_count; i++) {
+        const char* shape = shape_name(options->shapes[i]);
+
+        for (int j = 0; j < options->size_count; j++) {
+            BenchInput input;
+            input.source = generate_program(options->shapes[i], options->sizes[j], options->seed,
+                                            &input.length);
+            lex_phase(&input);
+            char* expected = compile_source(input.source, input.length, NULL);
+
+            int compiles = 1;
+            double seconds;
+            while ((seconds = run_context_threads(&input, expected, 1, compiles)) <
+                   options->min_time) {
+                compiles *= 2;
+            }
+
+            // Threads beyond the cores cannot add throughput
+            double first = 0, first_ideal = 1;
+            for (int k = 0; k < options->thread_count; k++) {
+                size_t threads = options->threads[k];
+                double ideal = (double)(threads < (size_t)cores ? threads : (size_t)cores);
+                seconds = run_context_threads(&input, expected, threads, compiles);
+                double throughput = threads * compiles / seconds;
+                if (k == 0) {
+                    first = throughput;
+                    first_ideal = ideal;
+                }
+                double speedup = throughput / first;
+                printf("%-12s %10zu %8zu %10d %12.0f %7.2fx %9.0f%%\n", shape, input.length, threads,
+                       compiles, throughput, speedup, speedup / (ideal / first_ideal) * 100);
+                write_result(results, options, timestamp, shape, 0, threads, &input,
+                             "context_compile", seconds / compiles, compiles, &none, &sample);
+            }
+
+            free(expected);
+            free((char*)input.source);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        fprintf(stderr, "Usage: %s [--shapes=LIST] [--sizes=LIST] [--seed=N] [--min-time=SECONDS] "
+                        "[--results=FILE] [--revision=REV] [--generate] [--loops=LIST] "
+                        "[--codegen-threads=LIST] [--context-threads=LIST]\n", argv[0]);
+        return 2;
+    }
+
+    if (options.generate) {
+        size_t length;
+        char* source = generate_program(options.shapes[0], options.sizes[0], options.seed, &length);
+        fwrite(source, 1, length, stdout);
+        free(source);
+        return 0;
+    }
+
+    make_parent_dirs(options.results);
+    FILE* results = fopen(options.results, "a");
+    if (!results) {
+        perror(options.results);
+        return 1;
+    }
+
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    PerfCounters counters;
+    open_perf_counters(&counters);
+    if (!counters.available) {
+        printf("Hardware counters unavailable (%s)\n",
+               counters.error ? strerror(counters.error) : "not supported on this platform");
+    }
+
+    if (options.loop_count > 0 || options.thread_count > 0) {
+        if (options.loop_count > 0) {
+            compare_loops(&options, results, timestamp, &counters);
+        } else if (options.context_threads) {
+            compare_context_threads(&options, results, timestamp);
+        } else {
+            compare_codegen_threads(&options, results, timestamp, &counters);
+        }
+        close_perf_counters(&counters);
+        fclose(results);
+        printf("Results appended to %s\n", options.results);
+        return 0;
+    }
+
+    printf("%-12s %10s %10s  %-14s %10s %12s %6s %10s %10s %10s\n",
+           "shape", "bytes", "tokens", "phase", "MB/s", "ns/token", "runs",
+           "IPC", "cache MPKI", "branch MPKI");
+
+    for (int i = 0; i < options.shape_count; i++) {
+        const char* shape = shape_name(options.shapes[i]);
+
+        for (int j = 0; j < options.size_count; j++) {
+            BenchInput input;
+            input.source = generate_program(options.shapes[i], options.sizes[j], options.seed,
+                                            &input.length);
+            lex_phase(&input);
+            input.ast = parse_input(&input, 0);
+
+            for (size_t k = 0; k < sizeof(phases) / sizeof(phases[0]); k++) {
+                int runs;
+                CounterSample sample;
+                double seconds = time_phase(&phases[k], &input, options.min_time, &runs,
+                                            &counters, &sample);
+
+                printf("%-12s %10zu %10zu  %-14s %10.1f %12.2f %6d",
+                       shape, input.length, input.token_count, phases[k].name,
+                       input.length / seconds / 1e6, seconds * 1e9 / input.token_count, runs);
+                print_ratio(counter_ratio(&counters, &sample, COUNTER_INSTRUCTIONS, COUNTER_CYCLES, 1));
+                print_ratio(counter_ratio(&counters, &sample, COUNTER_CACHE_MISSES,
+                                          COUNTER_INSTRUCTIONS, 1000));
+                print_ratio(counter_ratio(&counters, &sample, COUNTER_BRANCH_MISSES,
+                                          COUNTER_INSTRUCTIONS, 1000));
+                putchar('\n');
+                write_result(results, &options, timestamp, shape, 0, 0, &input, phases[k].name,
+                             seconds, runs, &counters, &sample);
+            }
+
+            free_ast(input.ast);
+            free((char*)input.source);
+        }
+    }
+
+    close_perf_counters(&counters);
+    fclose(results);
+    printf("Results appended to %s\n", options.results);
+    return 0;
+}
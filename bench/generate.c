@@ -0,0 +1,205 @@
+#include "generate.h"
+#include "../src/strbuf.h"
+#include <string.h>
+
+#define CHAIN_OPERANDS 64
+#define NESTING_DEPTH 48
+#define VARIABLE_COUNT 1000
+#define REPEATED_OPERANDS 4
+
+static const char* shape_names[SHAPE_COUNT] = {
+    "flat", "chain", "nested", "comments", "identifiers", "repeated"
+};
+
+const char* shape_name(ProgramShape shape) {
+    return shape_names[shape];
+}
+
+int shape_from_name(const char* name) {
+    for (int i = 0; i < SHAPE_COUNT; i++) {
+        if (strcmp(name, shape_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// xorshift32: fixed output for a given seed on every platform
+static uint32_t next_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void append_variable(StringBuilder* sb, uint32_t* random) {
+    append_char(sb, 'v');
+    append_int(sb, next_random(random) % VARIABLE_COUNT);
+}
+
+static void append_operand(StringBuilder* sb, uint32_t* random) {
+    if (next_random(random) & 1) {
+        append_variable(sb, random);
+    } else {
+        append_int(sb, next_random(random) % 10000);
+    }
+}
+
+static void append_flat(StringBuilder* sb, uint32_t* random) {
+    append_variable(sb, random);
+    append_bytes(sb, " = ", 3);
+    append_operand(sb, random);
+    append_bytes(sb, ";\n", 2);
+}
+
+static void append_chain(StringBuilder* sb, uint32_t* random) {
+    static const char operators[] = "+-*/";
+
+    append_variable(sb, random);
+    append_bytes(sb, " = ", 3);
+    append_operand(sb, random);
+    for (int i = 1; i < CHAIN_OPERANDS; i++) {
+        append_char(sb, ' ');
+        append_char(sb, operators[next_random(random) % 4]);
+        append_char(sb, ' ');
+        append_operand(sb, random);
+    }
+    append_bytes(sb, ";\n", 2);
+}
+
+static void append_nested(StringBuilder* sb, uint32_t* random, int depth) {
+    append_repeated(sb, ' ', (NESTING_DEPTH - depth) * 4);
+    if (depth == 0) {
+        append_bytes(sb, "print(", 6);
+        append_variable(sb, random);
+        append_bytes(sb, ");\n", 3);
+        return;
+    }
+
+    append_bytes(sb, "if (", 4);
+    append_variable(sb, random);
+    append_bytes(sb, " >= ", 4);
+    append_int(sb, next_random(random) % 100);
+    append_bytes(sb, ") {\n", 4);
+    append_nested(sb, random, depth - 1);
+    append_repeated(sb, ' ', (NESTING_DEPTH - depth) * 4);
+    append_bytes(sb, "} else {\n", 9);
+    append_repeated(sb, ' ', (NESTING_DEPTH - depth + 1) * 4);
+    append_flat(sb, random);
+    append_repeated(sb, ' ', (NESTING_DEPTH - depth) * 4);
+    append_bytes(sb, "}\n", 2);
+}
+
+static void append_comments(StringBuilder* sb, uint32_t* random) {
+    static const char* words[] = {
+        "update", "the", "running", "total", "before", "printing", "it", "again"
+    };
+
+    int lines = 4 + next_random(random) % 4;
+    for (int i = 0; i < lines; i++) {
+        append_bytes(sb, "//", 2);
+        int count = 6 + next_random(random) % 10;
+        for (int j = 0; j < count; j++) {
+            append_char(sb, ' ');
+            append_string(sb, words[next_random(random) % 8]);
+        }
+        append_char(sb, '\n');
+    }
+    append_flat(sb, random);
+}
+
+static void append_long_identifier(StringBuilder* sb, uint32_t* random) {
+    uint32_t name = next_random(random) % VARIABLE_COUNT;
+    uint32_t state = name + 1;
+
+    // Derived from the name alone so the same variable is spelled the
+    // same way every time it appears
+    int length = 64 + next_random(&state) % 193;
+    for (int i = 0; i < length; i++) {
+        append_char(sb, "abcdefghijklmnopqrstuvwxyz_"[next_random(&state) % 27]);
+    }
+    append_int(sb, name);
+}
+
+static void append_identifiers(StringBuilder* sb, uint32_t* random) {
+    append_long_identifier(sb, random);
+    append_bytes(sb, " = ", 3);
+    append_long_identifier(sb, random);
+    append_bytes(sb, " + ", 3);
+    append_long_identifier(sb, random);
+    append_bytes(sb, ";\n", 2);
+}
+
+static void append_sum(StringBuilder* sb, uint32_t a, uint32_t b) {
+    append_bytes(sb, "(v", 2);
+    append_int(sb, a);
+    append_bytes(sb, " + v", 4);
+    append_int(sb, b);
+    append_char(sb, ')');
+}
+
+// `(a + b) * (c - d) + (a + b)` over a handful of variables, so most
+// expressions were already parsed many times before
+static void append_common_terms(StringBuilder* sb, uint32_t* random) {
+    uint32_t a = next_random(random) % REPEATED_OPERANDS;
+    uint32_t b = next_random(random) % REPEATED_OPERANDS;
+
+    append_variable(sb, random);
+    append_bytes(sb, " = ", 3);
+    append_sum(sb, a, b);
+    append_bytes(sb, " * (v", 5);
+    append_int(sb, next_random(random) % REPEATED_OPERANDS);
+    append_bytes(sb, " - v", 4);
+    append_int(sb, next_random(random) % REPEATED_OPERANDS);
+    append_bytes(sb, ") + ", 4);
+    append_sum(sb, a, b);
+    append_bytes(sb, ";\n", 2);
+}
+
+char* generate_program(ProgramShape shape, size_t size, uint32_t seed, size_t* length) {
+    StringBuilder* sb = init_string_builder();
+    uint32_t random = seed ? seed : 1;
+
+    reserve_string_builder(sb, size + 4096);
+    while (sb->size < size) {
+        switch (shape) {
+            case SHAPE_FLAT: append_flat(sb, &random); break;
+            case SHAPE_CHAIN: append_chain(sb, &random); break;
+            case SHAPE_NESTED: append_nested(sb, &random, NESTING_DEPTH); break;
+            case SHAPE_COMMENTS: append_comments(sb, &random); break;
+            case SHAPE_IDENTIFIERS: append_identifiers(sb, &random); break;
+            case SHAPE_REPEATED: append_common_terms(sb, &random); break;
+            default: break;
+        }
+    }
+
+    if (length) *length = sb->size;
+    return finalize_string_builder(sb);
+}
+
+char* generate_loop_program(size_t iterations, int unrolled, size_t* length) {
+    StringBuilder* sb = init_string_builder();
+
+    append_string(sb, "a = 7;\nb = 5;\ns = 0;\nt = 0;\n");
+    if (unrolled) {
+        reserve_string_builder(sb, iterations * 56 + 64);
+        for (size_t i = 0; i < iterations; i++) {
+            append_bytes(sb, "s = s + ", 8);
+            append_int(sb, (long long)i);
+            append_bytes(sb, " * 3 + a * b;\nt = t + ", 22);
+            append_int(sb, (long long)i);
+            append_bytes(sb, " * 7 - a;\n", 10);
+        }
+    } else {
+        append_string(sb, "i = 0;\nwhile (i < ");
+        append_int(sb, (long long)iterations);
+        append_string(sb, ") {\n"
+                          "    s = s + i * 3 + a * b;\n"
+                          "    t = t + i * 7 - a;\n"
+                          "    i = i + 1;\n"
+                          "}\n");
+    }
+    append_string(sb, "print(s);\nprint(t);\n");
+
+    if (length) *length = sb->size;
+    return finalize_string_builder(sb);
+}
@@ -0,0 +1,34 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Workload shapes for the benchmarks; each stresses a different part of
+// the pipeline
+typedef enum {
+    SHAPE_FLAT,          // short assignments, one per line
+    SHAPE_CHAIN,         // long left-associative operator chains
+    SHAPE_NESTED,        // deeply nested if/else blocks
+    SHAPE_COMMENTS,      // mostly comment lines between a few statements
+    SHAPE_IDENTIFIERS,   // identifiers hundreds of bytes long
+    SHAPE_REPEATED,      // the same few subexpressions over and over
+    SHAPE_COUNT
+} ProgramShape;
+
+const char* shape_name(ProgramShape shape);
+int shape_from_name(const char* name);
+
+// Returns a valid Tiny program of about `size` bytes: it stops at the first
+// top-level statement boundary past `size`, so nested programs are never
+// smaller than one 48-level statement (about 20 KB). The same shape, size and seed always
+// produce the same bytes.
+char* generate_program(ProgramShape shape, size_t size, uint32_t seed, size_t* length);
+
+// Returns a program that runs the same accumulation `iterations` times,
+// either as a while loop or unrolled into one statement pair per
+// iteration the way generators had to before Tiny had loops. Both print
+// the same values.
+char* generate_loop_program(size_t iterations, int unrolled, size_t* length);
+
+#endif
@@ -0,0 +1,157 @@
+// Times generated programs under Node with print() as one console.log per
+// call and through the --buffer-output buffer, and checks that both write
+// the same bytes.
+//
+//   node bench/runtime_harness.js [--compiler=PATH] [--prints=N,...] [--runs=N] [--results=FILE]
+//
+// Each print count runs as a `loop` program (two prints in a while loop) and
+// a `flat` one (one print statement per line). Output goes to a pipe, as
+// when a program's output is read by another process. Times include Node's
+// startup, which `empty` (a program printing nothing) measures. Results are
+// printed as a table and appended to FILE, one JSON object per program.
+'use strict';
+
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { execFileSync, execSync, spawnSync } = require('child_process');
+const { performance } = require('perf_hooks');
+
+function parseCount(text) {
+    const scale = { k: 1e3, K: 1e3, m: 1e6, M: 1e6 }[text.slice(-1)] || 1;
+    return Math.round(parseFloat(text) * scale);
+}
+
+function parseArgs(argv) {
+    const options = {
+        compiler: path.join(__dirname, '..', 'build', 'tiny-compiler'),
+        prints: [1e3, 1e4, 1e5, 1e6],
+        runs: 5,
+        results: path.join(__dirname, 'results', 'runtime.jsonl')
+    };
+    for (const arg of argv) {
+        const [key, value] = arg.split('=');
+        if (key === '--compiler') options.compiler = value;
+        else if (key === '--prints') options.prints = value.split(',').map(parseCount);
+        else if (key === '--runs') options.runs = parseInt(value, 10);
+        else if (key === '--results') options.results = value;
+        else throw new Error(`Unknown option ${arg}`);
+    }
+    return options;
+}
+
+function median(samples) {
+    const sorted = samples.slice().sort((a, b) => a - b);
+    return sorted[sorted.length >> 1];
+}
+
+// Integers, fractions, -0 and booleans, so every kind of value is printed
+const SHAPES = {
+    loop: prints => `i = 0;\nwhile (i < ${Math.ceil(prints / 2)}) {\n` +
+                    '  print(i / 8);\n  print(i >= 2);\n  i = i + 1;\n}\n',
+    flat: prints => Array.from({ length: prints }, (_, i) => i % 3 ? `print((${i % 5} - 4) * 0);`
+                                                               : `print(${i} - ${i} * 2);`).join('\n') + '\n'
+};
+
+function compile(compiler, source, dir, name, flags) {
+    const input = path.join(dir, `${name}.tiny`);
+    const output = path.join(dir, `${name}${flags.length ? '-buffered' : ''}.js`);
+    fs.writeFileSync(input, source);
+    execFileSync(compiler, [...flags, input, output], { stdio: ['ignore', 'ignore', 'inherit'] });
+    return output;
+}
+
+function run(script) {
+    const start = performance.now();
+    const result = spawnSync(process.execPath, [script], { maxBuffer: 1 << 30,
+                                                           stdio: ['ignore', 'pipe', 'inherit'] });
+    const elapsed = performance.now() - start;
+    if (result.status !== 0) {
+        throw new Error(`${script} exited with ${result.status}`);
+    }
+    return { elapsed, output: result.stdout };
+}
+
+function measure(scripts, runs) {
+    const samples = scripts.map(() => []);
+    const outputs = [];
+    // Alternating keeps drift in the machine's load from favouring either
+    for (let i = 0; i < runs; i++) {
+        scripts.forEach((script, k) => {
+            const { elapsed, output } = run(script);
+            samples[k].push(elapsed);
+            outputs[k] = output;
+        });
+    }
+    return { times: samples.map(median), outputs };
+}
+
+function gitRevision() {
+    try {
+        return execSync('git rev-parse --short HEAD', { stdio: ['ignore', 'pipe', 'ignore'] }).toString().trim();
+    } catch (error) {
+        return null;
+    }
+}
+
+function printTable(results) {
+    const columns = Object.keys(results[0]);
+    const rows = results.map(result => columns.map(column => {
+        const value = result[column];
+        return typeof value === 'number' && !Number.isInteger(value) ? value.toFixed(2) : String(value);
+    }));
+    const widths = columns.map((column, i) => Math.max(column.length, ...rows.map(row => row[i].length)));
+    const format = values => values.map((value, i) => value.padStart(widths[i])).join('  ');
+
+    console.log(format(columns));
+    rows.forEach(row => console.log(format(row)));
+}
+
+function main() {
+    const options = parseArgs(process.argv.slice(2));
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'tiny-runtime-'));
+    const results = [];
+    let mismatches = 0;
+
+    try {
+        const empty = compile(options.compiler, 'x = 1;\n', dir, 'empty', []);
+        const startup = measure([empty], options.runs).times[0];
+
+        for (const [shape, generate] of Object.entries(SHAPES)) {
+            for (const prints of options.prints) {
+                const source = generate(prints);
+                const name = `${shape}-${prints}`;
+                const scripts = [compile(options.compiler, source, dir, name, []),
+                                 compile(options.compiler, source, dir, name, ['--buffer-output'])];
+                const { times, outputs } = measure(scripts, options.runs);
+                const identical = outputs[0].equals(outputs[1]);
+                if (!identical) {
+                    console.error(`${name}: buffered output differs from console.log output`);
+                    mismatches++;
+                }
+                results.push({
+                    shape, prints,
+                    output_bytes: outputs[0].length,
+                    startup_ms: startup,
+                    console_log_ms: times[0],
+                    buffered_ms: times[1],
+                    speedup: (times[0] - startup) / Math.max(times[1] - startup, 0.01),
+                    identical
+                });
+            }
+        }
+    } finally {
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+    printTable(results);
+
+    const revision = gitRevision();
+    const timestamp = new Date().toISOString();
+    fs.mkdirSync(path.dirname(options.results), { recursive: true });
+    fs.appendFileSync(options.results,
+                      results.map(result => JSON.stringify({ timestamp, revision, ...result })).join('\n') + '\n');
+
+    if (mismatches > 0) process.exit(1);
+}
+
+main();
@@ -0,0 +1,207 @@
+// Records size, startup time and compile latency of WASM builds so that
+// regressions show up from one commit to the next.
+//
+//   node bench/wasm_harness.js [--runs=N] [--results=FILE] [--budget=FILE] DIR...
+//
+// Each DIR holds a tiny-compiler.js/.wasm pair whose glue can run under Node
+// (`make wasm-bench` builds the release variants that way). Results are
+// printed as a table and appended to FILE, one JSON object per build. With a
+// budget file, any metric above its limit makes the harness exit non-zero.
+'use strict';
+
+const fs = require('fs');
+const path = require('path');
+const vm = require('vm');
+const zlib = require('zlib');
+const { execSync } = require('child_process');
+const { performance } = require('perf_hooks');
+
+const PROGRAM_SIZES = { small: 10, medium: 1000, large: 10000 };
+
+function parseArgs(argv) {
+    const options = { runs: 10, results: path.join(__dirname, 'results', 'wasm.jsonl'), budget: null, dirs: [] };
+    for (const arg of argv) {
+        const [key, value] = arg.split('=');
+        if (key === '--runs') options.runs = parseInt(value, 10);
+        else if (key === '--results') options.results = value;
+        else if (key === '--budget') options.budget = value;
+        else options.dirs.push(arg);
+    }
+    return options;
+}
+
+function median(samples) {
+    const sorted = samples.slice().sort((a, b) => a - b);
+    return sorted[sorted.length >> 1];
+}
+
+// Same deterministic statement mix as public/ast_benchmark.html
+function generateProgram(statements) {
+    const lines = [];
+    for (let i = 0; i < statements; i++) {
+        switch (i % 4) {
+            case 0: lines.push(`v${i} = (v${Math.max(i - 4, 0)} + ${i}) * 3 - ${i} / 2;`); break;
+            case 1: lines.push(`if (v${i - 1} >= ${i}) { print(v${i - 1}); } else { w = ${i}; }`); break;
+            case 2: lines.push(`print(v${i - 2} != 3);`); break;
+            case 3: lines.push(`x${i} = ${i};`); break;
+        }
+    }
+    return lines.join('\n');
+}
+
+// Loads the glue into a fresh context so every run pays the full startup.
+// With `compiled`, the glue instantiates that WebAssembly.Module instead of
+// reading and compiling the binary, as the playground does on a repeat visit.
+function loadModule(dir, compiled = null) {
+    const gluePath = path.join(dir, 'tiny-compiler.js');
+    const glue = fs.readFileSync(gluePath, 'utf8');
+
+    return new Promise((resolve, reject) => {
+        const start = performance.now();
+        const sandbox = {
+            require, process, console, Buffer, URL, WebAssembly, performance,
+            TextDecoder, TextEncoder, setTimeout, clearTimeout,
+            __dirname: dir, __filename: gluePath
+        };
+        sandbox.Module = {
+            print: () => {},
+            printErr: () => {},
+            onAbort: reject,
+            onRuntimeInitialized: () => resolve({ module: sandbox.Module, elapsed: performance.now() - start })
+        };
+        if (compiled) {
+            sandbox.Module.instantiateWasm = (imports, receive) => {
+                WebAssembly.instantiate(compiled, imports).then(instance => receive(instance, compiled), reject);
+                return {};
+            };
+        }
+        vm.runInNewContext(glue, sandbox, { filename: gluePath });
+    });
+}
+
+async function measure(dir, runs) {
+    const wasm = fs.readFileSync(path.join(dir, 'tiny-compiler.wasm'));
+    const glue = fs.readFileSync(path.join(dir, 'tiny-compiler.js'));
+    const result = {
+        build: path.basename(path.resolve(dir)),
+        wasm_bytes: wasm.length,
+        wasm_gzip_bytes: zlib.gzipSync(wasm, { level: 9 }).length,
+        js_bytes: glue.length,
+        js_gzip_bytes: zlib.gzipSync(glue, { level: 9 }).length
+    };
+
+    const compileSamples = [];
+    for (let i = 0; i < runs; i++) {
+        const start = performance.now();
+        await WebAssembly.compile(wasm);
+        compileSamples.push(performance.now() - start);
+    }
+    result.wasm_compile_ms = median(compileSamples);
+    const compiled = await WebAssembly.compile(wasm);
+
+    const startupSamples = [];
+    let module;
+    for (let i = 0; i < runs; i++) {
+        const loaded = await loadModule(dir);
+        startupSamples.push(loaded.elapsed);
+        module = loaded.module;
+    }
+    result.instantiate_ms = median(startupSamples);
+
+    const cachedSamples = [];
+    for (let i = 0; i < runs; i++) {
+        cachedSamples.push((await loadModule(dir, compiled)).elapsed);
+    }
+    result.instantiate_cached_ms = median(cachedSamples);
+
+    const compile = module.cwrap('compile', 'number', ['string']);
+    for (const [name, statements] of Object.entries(PROGRAM_SIZES)) {
+        const program = generateProgram(statements);
+        const samples = [];
+        try {
+            for (let i = 0; i < runs; i++) {
+                // A unique first line keeps the playground cache from answering
+                const source = `// run ${i}\n${program}`;
+                const start = performance.now();
+                module._free_result(compile(source));
+                samples.push(performance.now() - start);
+            }
+            result[`compile_${name}_ms`] = median(samples);
+        } catch (error) {
+            // Older builds cannot compile every size; record the gap
+            console.error(`${result.build}: ${name} program failed: ${error.message}`);
+            result[`compile_${name}_ms`] = null;
+            break;
+        }
+    }
+
+    return result;
+}
+
+function gitRevision() {
+    try {
+        return execSync('git rev-parse --short HEAD', { stdio: ['ignore', 'pipe', 'ignore'] }).toString().trim();
+    } catch (error) {
+        return null;
+    }
+}
+
+function printTable(results) {
+    const columns = Object.keys(results[0]);
+    const rows = results.map(result => columns.map(column => {
+        const value = result[column];
+        if (value === null || value === undefined) return '-';
+        return typeof value === 'number' && !Number.isInteger(value) ? value.toFixed(2) : String(value);
+    }));
+    const widths = columns.map((column, i) => Math.max(column.length, ...rows.map(row => row[i].length)));
+    const format = values => values.map((value, i) => value.padStart(widths[i])).join('  ');
+
+    console.log(format(columns));
+    rows.forEach(row => console.log(format(row)));
+}
+
+function checkBudget(results, budget) {
+    let failures = 0;
+    for (const result of results) {
+        for (const [metric, limit] of Object.entries(budget)) {
+            if (result[metric] === null) {
+                console.error(`${result.build}: ${metric} could not be measured`);
+                failures++;
+            } else if (result[metric] !== undefined && result[metric] > limit) {
+                console.error(`${result.build}: ${metric} = ${result[metric]} exceeds budget ${limit}`);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+async function main() {
+    const options = parseArgs(process.argv.slice(2));
+    if (options.dirs.length === 0) {
+        console.error('Usage: node bench/wasm_harness.js [--runs=N] [--results=FILE] [--budget=FILE] DIR...');
+        process.exit(2);
+    }
+
+    const results = [];
+    for (const dir of options.dirs) {
+        results.push(await measure(dir, options.runs));
+    }
+    printTable(results);
+
+    const revision = gitRevision();
+    const timestamp = new Date().toISOString();
+    fs.mkdirSync(path.dirname(options.results), { recursive: true });
+    fs.appendFileSync(options.results,
+                      results.map(result => JSON.stringify({ timestamp, revision, ...result })).join('\n') + '\n');
+
+    if (options.budget) {
+        const budget = JSON.parse(fs.readFileSync(options.budget, 'utf8'));
+        if (checkBudget(results, budget) > 0) process.exit(1);
+    }
+}
+
+main().catch(error => {
+    console.error(error);
+    process.exit(1);
+});
@@ -0,0 +1,198 @@
+// Decoder for the flat binary AST produced by parse_ast_binary (layout in
+// src/astbin.h). A view made with fromModule reads straight out of the WASM
+// heap, so it is only valid until the buffer is passed to free_result or the
+// heap grows; fromBuffer reads a copy that outlives both.
+const TinyAst = (() => {
+    const MAGIC = 0x54534154;
+    const VERSION = 1;
+    const HEADER_WORDS = 8;
+    const NODE_WORDS = 4;
+    const NONE = -1;
+
+    const NODE_TYPES = ['PROGRAM', 'VARIABLE', 'NUMBER', 'BINARY_OP', 'ASSIGN', 'IF', 'PRINT', 'WHILE',
+                        'FUNCTION', 'CALL', 'RETURN', 'CONSTANT'];
+    const [PROGRAM, VARIABLE, NUMBER, BINARY_OP, ASSIGN, IF, PRINT, WHILE,
+           FUNCTION, CALL, RETURN, CONSTANT] = NODE_TYPES.keys();
+
+    // Comparisons are stored as single-character markers
+    const OPERATORS = { G: '>=', L: '<=', '=': '==', '!': '!=' };
+
+    const textDecoder = new TextDecoder();
+
+    class AstView {
+        // `heap32` and `heapU8` are the module's HEAP32/HEAPU8 views, read
+        // after the call that produced `ptr`
+        constructor(heap32, heapU8, ptr) {
+            const base = ptr >> 2;
+            if (heap32[base] !== MAGIC || heap32[base + 1] !== VERSION) {
+                throw new Error('Not a binary AST (version ' + VERSION + ')');
+            }
+
+            const length = heap32[base + 2];
+            this.words = heap32.subarray(base, base + (length >> 2));
+            this.bytes = heapU8.subarray(ptr, ptr + length);
+            this.nodeCount = this.words[3];
+            this.listBase = this.words[4] >> 2;
+            this.stringBase = this.words[6];
+        }
+
+        kind(index) {
+            return this.words[HEADER_WORDS + index * NODE_WORDS];
+        }
+
+        type(index) {
+            return NODE_TYPES[this.kind(index)];
+        }
+
+        // Raw record fields a, b, c (1-3) as described in astbin.h
+        field(index, n) {
+            return this.words[HEADER_WORDS + index * NODE_WORDS + n];
+        }
+
+        // Statement node indices of a PROGRAM node, as a view into the buffer
+        statements(index) {
+            const start = this.listBase + this.field(index, 2);
+            return this.words.subarray(start, start + this.field(index, 1));
+        }
+
+        // Node indices of a FUNCTION's or CALL's list: the name node, then
+        // the parameters or arguments
+        operands(index) {
+            const start = this.listBase + this.field(index, 2);
+            return this.words.subarray(start, start + 1 + this.field(index, 1));
+        }
+
+        // Identifier of a VARIABLE or ASSIGN node, text of a CONSTANT
+        name(index) {
+            const start = this.stringBase + this.field(index, 1);
+            return textDecoder.decode(this.bytes.subarray(start, start + this.field(index, 2)));
+        }
+
+        operator(index) {
+            const op = String.fromCharCode(this.field(index, 1));
+            return OPERATORS[op] || op;
+        }
+
+        // Calls visit(index, depth) for every node in preorder without
+        // building any objects
+        walk(visit, index = 0, depth = 0) {
+            visit(index, depth);
+            switch (this.kind(index)) {
+                case PROGRAM:
+                    for (const child of this.statements(index)) this.walk(visit, child, depth + 1);
+                    break;
+                case BINARY_OP:
+                    this.walk(visit, this.field(index, 2), depth + 1);
+                    this.walk(visit, this.field(index, 3), depth + 1);
+                    break;
+                case IF:
+                    for (let n = 1; n <= 3; n++) {
+                        const child = this.field(index, n);
+                        if (child !== NONE) this.walk(visit, child, depth + 1);
+                    }
+                    break;
+                case ASSIGN:
+                    this.walk(visit, this.field(index, 3), depth + 1);
+                    break;
+                case PRINT:
+                    this.walk(visit, this.field(index, 1), depth + 1);
+                    break;
+                case WHILE:
+                    this.walk(visit, this.field(index, 1), depth + 1);
+                    this.walk(visit, this.field(index, 2), depth + 1);
+                    break;
+                case FUNCTION:
+                    this.walk(visit, this.field(index, 3), depth + 1);
+                    break;
+                case CALL:
+                    for (const child of this.operands(index).subarray(1)) this.walk(visit, child, depth + 1);
+                    break;
+                case RETURN:
+                    this.walk(visit, this.field(index, 1), depth + 1);
+                    break;
+            }
+        }
+
+        // Builds the same object shape JSON.parse gives for parse_ast output,
+        // with the node index as the id. `statementLimit` caps how many
+        // statements of this node are expanded; statement_count stays exact.
+        toObject(index = 0, statementLimit = Infinity) {
+            const node = { type: this.type(index), id: index };
+
+            switch (this.kind(index)) {
+                case PROGRAM: {
+                    const statements = this.statements(index);
+                    const shown = statements.subarray(0, Math.min(statements.length, statementLimit));
+                    node.statement_count = statements.length;
+                    node.statements = Array.from(shown, child => this.toObject(child));
+                    break;
+                }
+                case VARIABLE:
+                    node.name = this.name(index);
+                    break;
+                case NUMBER:
+                    node.value = this.field(index, 1);
+                    break;
+                case BINARY_OP:
+                    node.operator = this.operator(index);
+                    node.left = this.toObject(this.field(index, 2));
+                    node.right = this.toObject(this.field(index, 3));
+                    break;
+                case ASSIGN:
+                    node.variable = this.name(index);
+                    node.value = this.toObject(this.field(index, 3));
+                    break;
+                case IF:
+                    node.condition = this.toObject(this.field(index, 1));
+                    node.if_body = this.toObject(this.field(index, 2));
+                    if (this.field(index, 3) !== NONE) {
+                        node.else_body = this.toObject(this.field(index, 3));
+                    }
+                    break;
+                case PRINT:
+                    node.expression = this.toObject(this.field(index, 1));
+                    break;
+                case WHILE:
+                    node.condition = this.toObject(this.field(index, 1));
+                    node.body = this.toObject(this.field(index, 2));
+                    break;
+                case FUNCTION: {
+                    const [name, ...parameters] = this.operands(index);
+                    node.name = this.name(name);
+                    node.parameters = parameters.map(child => this.name(child));
+                    node.body = this.toObject(this.field(index, 3));
+                    break;
+                }
+                case CALL: {
+                    const [name, ...args] = this.operands(index);
+                    node.name = this.name(name);
+                    node.arguments = args.map(child => this.toObject(child));
+                    break;
+                }
+                case RETURN:
+                    node.value = this.toObject(this.field(index, 1));
+                    break;
+                case CONSTANT:
+                    node.text = this.name(index);
+                    break;
+            }
+
+            return node;
+        }
+    }
+
+    function fromModule(module, ptr) {
+        return new AstView(module.HEAP32, module.HEAPU8, ptr);
+    }
+
+    // View over a buffer copied out of the heap, e.g. by a worker
+    function fromBuffer(buffer) {
+        return new AstView(new Int32Array(buffer), new Uint8Array(buffer), 0);
+    }
+
+    return { AstView, fromModule, fromBuffer, NODE_TYPES, NONE };
+})();
+
+if (typeof module !== 'undefined') {
+    module.exports = TinyAst;
+}
@@ -0,0 +1,222 @@
+// Keeps the WASM compiler off the main thread by spreading requests over a
+// few compiler-worker.js instances. Only the newest request of each kind
+// matters while the user is typing:
+//   - a newer request replaces an older one of the same kind that is still
+//     waiting for a worker,
+//   - replies to superseded requests are dropped,
+//   - a worker stuck on a superseded request for STALE_TERMINATE_MS is
+//     terminated and replaced, since WASM calls cannot be interrupted.
+// Superseded requests resolve to { cancelled: true }.
+// Every worker, including one that replaces another, instantiates the same
+// WebAssembly.Module (see wasm-loader.js) rather than compiling its own.
+class CompilerPool {
+    static STALE_TERMINATE_MS = 250;
+
+    // `wasmModule` is a compiled WebAssembly.Module or a promise for one; a
+    // null module or a rejected promise leaves loading to each worker
+    constructor(size = CompilerPool.defaultSize(), scriptUrl = 'compiler-worker.js', wasmModule = null) {
+        this.scriptUrl = scriptUrl;
+        this.wasmModule = Promise.resolve(wasmModule).catch(() => null);
+        this.slots = [];
+        this.waiting = new Map();
+        this.latest = new Map();
+        this.nextId = 0;
+        this.tokenTypes = null;
+        this.canAnalyze = false;
+
+        this.ready = new Promise((resolve, reject) => {
+            this.resolveReady = resolve;
+            this.rejectReady = reject;
+        });
+
+        for (let i = 0; i < size; i++) {
+            this.slots.push({ worker: null, ready: false, busy: null });
+            this.spawn(this.slots[i]);
+        }
+    }
+
+    // One worker per kind of request, leaving a core for the page
+    static defaultSize() {
+        const cores = navigator.hardwareConcurrency || 2;
+        return Math.max(1, Math.min(3, cores - 1));
+    }
+
+    spawn(slot) {
+        slot.ready = false;
+        slot.busy = null;
+        const worker = new Worker(this.scriptUrl);
+        slot.worker = worker;
+        this.wasmModule.then(module => worker.postMessage({ type: 'module', module }));
+        slot.worker.onmessage = event => this.onMessage(slot, event.data);
+        slot.worker.onerror = event => {
+            event.preventDefault();
+            if (!slot.ready) {
+                // Workers cannot start at all (e.g. file:// pages)
+                this.rejectReady(new Error(event.message || 'Compiler worker failed to load'));
+                return;
+            }
+            this.retire(slot, { error: event.message || 'Compiler worker crashed' });
+        };
+    }
+
+    // Replaces the slot's worker, settling whatever it was running
+    retire(slot, outcome) {
+        const request = slot.busy;
+        slot.worker.terminate();
+        this.spawn(slot);
+        if (request) {
+            this.settle(request, outcome);
+        }
+    }
+
+    onMessage(slot, message) {
+        if (message.type === 'ready') {
+            slot.ready = true;
+            this.tokenTypes = message.tokenTypes;
+            this.canAnalyze = message.canAnalyze;
+            this.resolveReady(this);
+            this.dispatch();
+            return;
+        }
+
+        const request = slot.busy;
+        if (!request || request.id !== message.id) return;
+        slot.busy = null;
+
+        if (message.type === 'error') {
+            if (message.fatal) {
+                this.retire(slot, { error: message.message });
+                return;
+            }
+            this.settle(request, { error: message.message });
+        } else {
+            this.settle(request, message);
+        }
+        this.dispatch();
+    }
+
+    settle(request, outcome) {
+        if (this.latest.get(request.kind) !== request.id) {
+            request.resolve({ cancelled: true });
+        } else if (outcome.error !== undefined) {
+            request.reject(new Error(outcome.error));
+        } else {
+            request.resolve(outcome);
+        }
+    }
+
+    // With `outputs` (any of 'tokens', 'ast', 'js'), every view comes from
+    // one lex and parse; see runRequest
+    request(kind, source, outputs) {
+        const id = ++this.nextId;
+        this.latest.set(kind, id);
+
+        const superseded = this.waiting.get(kind);
+        if (superseded) {
+            superseded.resolve({ cancelled: true });
+        }
+
+        const promise = new Promise((resolve, reject) => {
+            this.waiting.set(kind, { id, kind, source, outputs, resolve, reject });
+        });
+
+        for (const slot of this.slots) {
+            if (slot.busy && slot.busy.kind === kind) {
+                this.scheduleStaleCheck(slot, slot.busy);
+            }
+        }
+
+        this.dispatch();
+        return promise;
+    }
+
+    scheduleStaleCheck(slot, request) {
+        const age = performance.now() - request.startedAt;
+        setTimeout(() => {
+            if (slot.busy === request && this.latest.get(request.kind) !== request.id) {
+                this.retire(slot, { error: 'cancelled' });
+            }
+        }, Math.max(0, CompilerPool.STALE_TERMINATE_MS - age));
+    }
+
+    dispatch() {
+        for (const [kind, request] of this.waiting) {
+            const slot = this.slots.find(slot => slot.ready && !slot.busy);
+            if (!slot) return;
+
+            this.waiting.delete(kind);
+            request.startedAt = performance.now();
+            slot.busy = request;
+            slot.worker.postMessage({ id: request.id, kind, source: request.source, outputs: request.outputs });
+        }
+    }
+}
+
+// Same request() interface backed by a module on the main thread, for pages
+// where workers cannot be started
+class InlineCompiler {
+    constructor(module) {
+        this.module = module;
+        this.tokenTypes = module._token_type_name ? TinyTokens.loadTypeNames(module) : null;
+        this.canAnalyze = Boolean(module._analyze_buf);
+    }
+
+    request(kind, source, outputs) {
+        const start = performance.now();
+        try {
+            const result = runRequest(this.module, kind, source, outputs);
+            return Promise.resolve({ kind, elapsed: performance.now() - start, ...result });
+        } catch (error) {
+            return Promise.reject(error);
+        }
+    }
+}
+
+// Turns a reply from either compiler into what the page renders
+const CompilerResults = (() => {
+    const textDecoder = new TextDecoder();
+
+    function text(result) {
+        return textDecoder.decode(result.buffers[0]);
+    }
+
+    // Returns { ast, nodeCount }; only the first `statementLimit` top-level
+    // statements are expanded into objects
+    function ast(result, statementLimit) {
+        if (result.format === 'binary') {
+            const view = TinyAst.fromBuffer(result.buffers[0]);
+            return { ast: view.toObject(0, statementLimit), nodeCount: view.nodeCount };
+        }
+        const tree = JSON.parse(text(result));
+        if (tree.statements) {
+            tree.statements = tree.statements.slice(0, statementLimit);
+        }
+        return { ast: tree, nodeCount: null };
+    }
+
+    // Returns { tokens, count } with at most `limit` token objects
+    function tokens(result, tokenTypes, limit) {
+        if (result.format === 'triples') {
+            const view = TinyTokens.fromBuffers(result.buffers[0], new Uint8Array(result.buffers[1]), tokenTypes);
+            return { tokens: TinyTokens.toObjects(view, limit), count: view.count };
+        }
+        const all = JSON.parse(text(result));
+        return { tokens: all.slice(0, limit), count: all.length };
+    }
+
+    // Splits an analysis reply into one reply per view, each accepted by the
+    // functions above; views that were not produced are null
+    function views(result) {
+        const { parts, buffers } = result;
+        const view = (name, format, count) => parts[name] === undefined ? null :
+            { format, buffers: buffers.slice(parts[name], parts[name] + count) };
+        return {
+            tokens: view('tokens', 'triples', 2),
+            ast: view('ast', 'binary', 1),
+            js: view('js', 'text', 1),
+            diagnostics: result.diagnostics
+        };
+    }
+
+    return { text, ast, tokens, views };
+})();
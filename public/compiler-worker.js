@@ -0,0 +1,206 @@
+// Runs compile/ast/tokens requests against one instance of the WASM
+// compiler. Loaded as a worker by compiler-pool.js, or as a plain script
+// when workers are unavailable, in which case the page calls runRequest()
+// itself. Every result is packed into ArrayBuffers so a worker can transfer
+// them instead of copying.
+
+// Raised for programs that do not compile; the instance stays usable
+class CompileError extends Error {}
+
+// TINY_ANALYZE_* flags from tiny.h
+const ANALYZE_TOKENS = 0x1;
+const ANALYZE_AST_BINARY = 0x4;
+const ANALYZE_JAVASCRIPT = 0x8;
+
+// Calls the *_buf exports. The source is encoded straight into an input
+// buffer that is kept across calls, and result pointers and lengths come
+// back through slots allocated once, so nothing is copied onto the stack,
+// scanned for a NUL or freed per call.
+function createBufferCaller(module) {
+    const textEncoder = new TextEncoder();
+    const textDecoder = new TextDecoder();
+    const slots = module._malloc(32);
+    let input = 0;
+    let capacity = 0;
+
+    function encode(source) {
+        // UTF-8 needs at most three bytes per UTF-16 code unit
+        const needed = source.length * 3 + 1;
+        if (needed > capacity) {
+            module._free(input);
+            capacity = Math.max(needed, capacity * 2, 4096);
+            input = module._malloc(capacity);
+        }
+        return textEncoder.encodeInto(source, module.HEAPU8.subarray(input, input + capacity)).written;
+    }
+
+    // (pointer, length) pair `n` of the slots; read the views only after the
+    // call, which may have grown the heap
+    function slot(n, scale = 1) {
+        const ptr = module.HEAP32[(slots >> 2) + n * 2] >>> 0;
+        return module.HEAPU8.subarray(ptr, ptr + module.HEAP32[(slots >> 2) + n * 2 + 1] * scale);
+    }
+
+    function call(name, source) {
+        const written = encode(source);
+        const status = module['_' + name](input, written, slots, slots + 4);
+        const output = slot(0);
+        if (status !== 0) {
+            throw new CompileError(textDecoder.decode(output));
+        }
+        return { output, input: module.HEAPU8.subarray(input, input + written) };
+    }
+
+    // Lexes and parses once for all of `outputs` ('tokens', 'ast', 'js');
+    // tokens come back even when the source does not parse
+    function analyze(source, outputs) {
+        const flags = (outputs.includes('tokens') ? ANALYZE_TOKENS : 0) |
+                      (outputs.includes('ast') ? ANALYZE_AST_BINARY : 0) |
+                      (outputs.includes('js') ? ANALYZE_JAVASCRIPT : 0);
+        const written = encode(source);
+        const status = module._analyze_buf(input, written, flags, slots);
+        return {
+            tokens: slot(0, 12),
+            ast: slot(1),
+            js: slot(2),
+            diagnostics: status !== 0 ? textDecoder.decode(slot(3)) : null,
+            input: module.HEAPU8.subarray(input, input + written)
+        };
+    }
+
+    return { call, analyze };
+}
+
+// With `outputs`, the request is answered from a single analyze call and
+// `kind` only groups requests for cancellation
+function runRequest(module, kind, source, outputs) {
+    if (module._compile_buf) {
+        module.tinyCall = module.tinyCall || createBufferCaller(module);
+
+        // Results live in the compiler's context until the next call, so
+        // they are copied into buffers the caller owns
+        if (outputs) {
+            const result = module.tinyCall.analyze(source, outputs);
+            const buffers = [];
+            const parts = {};
+            const part = (name, ...views) => {
+                parts[name] = buffers.length;
+                buffers.push(...views.map(view => view.slice().buffer));
+            };
+
+            if (outputs.includes('tokens')) part('tokens', result.tokens, result.input);
+            if (result.diagnostics === null) {
+                if (outputs.includes('ast')) part('ast', result.ast);
+                if (outputs.includes('js')) part('js', result.js);
+            }
+            return { format: 'analysis', parts, diagnostics: result.diagnostics, buffers };
+        }
+
+        switch (kind) {
+            case 'compile':
+                return { format: 'text', buffers: [module.tinyCall.call('compile_buf', source).output.slice().buffer] };
+
+            case 'ast':
+                return { format: 'binary', buffers: [module.tinyCall.call('parse_binary_buf', source).output.slice().buffer] };
+
+            case 'tokens': {
+                const { output, input } = module.tinyCall.call('tokenize_typed_buf', source);
+                return { format: 'triples', buffers: [output.slice().buffer, input.slice().buffer] };
+            }
+        }
+        throw new Error('Unknown request kind: ' + kind);
+    }
+
+    return runLegacyRequest(module, kind, source);
+}
+
+// Builds that predate the *_buf exports; these exit on syntax errors
+function runLegacyRequest(module, kind, source) {
+    // Builds that predate the binary exports do not expose the heap views
+    const hasHeap = Boolean(module._parse_ast_binary);
+    const heapCopy = (ptr, length) => module.HEAPU8.slice(ptr, ptr + length).buffer;
+
+    // Calls a char* (const char*) export and copies the NUL-terminated result
+    function textExport(name, free) {
+        const ptr = module.cwrap(name, 'number', ['string'])(source);
+        const buffer = hasHeap ? heapCopy(ptr, module.HEAPU8.indexOf(0, ptr) - ptr)
+                               : new TextEncoder().encode(module.UTF8ToString(ptr)).buffer;
+        module['_' + free](ptr);
+        return buffer;
+    }
+
+    switch (kind) {
+        case 'compile':
+            return { format: 'text', buffers: [textExport('compile', 'free_result')] };
+
+        case 'ast':
+            if (module._parse_ast_binary) {
+                const ptr = module.cwrap('parse_ast_binary', 'number', ['string'])(source);
+                const buffer = heapCopy(ptr, module.HEAP32[(ptr >> 2) + 2]);
+                module._free_result(ptr);
+                return { format: 'binary', buffers: [buffer] };
+            }
+            return { format: 'json', buffers: [textExport('parse_ast', 'free_ast_json')] };
+
+        case 'tokens':
+            if (module._tokenize_typed) {
+                const tokens = TinyTokens.tokenize(module, source);
+                const triples = tokens.triples.slice().buffer;
+                tokens.release();
+                return { format: 'triples', buffers: [triples, tokens.bytes.buffer] };
+            }
+            return { format: 'json', buffers: [textExport('tokenize', 'free_tokens')] };
+    }
+
+    throw new Error('Unknown request kind: ' + kind);
+}
+
+if (typeof WorkerGlobalScope !== 'undefined' && self instanceof WorkerGlobalScope) {
+    importScripts('token-array.js', 'wasm-loader.js');
+
+    // Syntax errors are reported on stderr; collect them for the reply
+    let errorOutput = [];
+
+    var Module = {
+        printErr: text => errorOutput.push(text),
+        onRuntimeInitialized: () => {
+            postMessage({
+                type: 'ready',
+                tokenTypes: Module._token_type_name ? TinyTokens.loadTypeNames(Module) : null,
+                canAnalyze: Boolean(Module._analyze_buf)
+            });
+        }
+    };
+
+    // The first message is { type: 'module', module } with the module the
+    // page compiled, or null to have the glue fetch and compile the binary.
+    // Requests are { id, kind, source, outputs }; replies echo the id.
+    self.onmessage = event => {
+        if (event.data.type === 'module') {
+            if (event.data.module) {
+                Module.instantiateWasm = TinyWasm.instantiateWith(event.data.module);
+            }
+            importScripts('tiny-compiler.js');
+            return;
+        }
+
+        const { id, kind, source, outputs } = event.data;
+        const start = performance.now();
+        errorOutput = [];
+
+        try {
+            const result = runRequest(Module, kind, source, outputs);
+            postMessage({ type: 'result', id, kind, elapsed: performance.now() - start, ...result },
+                        result.buffers);
+        } catch (error) {
+            if (error instanceof CompileError) {
+                postMessage({ type: 'error', id, kind, message: error.message, fatal: false });
+                return;
+            }
+            // Older builds exit on syntax errors, which leaves this instance
+            // unusable; the pool replaces it
+            const message = errorOutput.length ? errorOutput.join('\n') : String(error);
+            postMessage({ type: 'error', id, kind, message, fatal: true });
+        }
+    };
+}
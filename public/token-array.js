@@ -0,0 +1,82 @@
+// Reader for the token triples produced by tokenize_typed: a count followed
+// by (type, start, length) for every token, start and length being byte
+// offsets into the UTF-8 source passed in. The triples are read in place,
+// either from the WASM heap or from a buffer a worker transferred over.
+const TinyTokens = (() => {
+    const textEncoder = new TextEncoder();
+    const textDecoder = new TextDecoder();
+
+    let typeNames = null;
+
+    // Token type names straight from the compiler, so the enum is never
+    // duplicated here
+    function loadTypeNames(module) {
+        if (!typeNames) {
+            typeNames = [];
+            for (let type = 0; type < 256; type++) {
+                const name = module.UTF8ToString(module._token_type_name(type));
+                typeNames.push(name);
+                if (name === 'EOF') break;
+            }
+        }
+        return typeNames;
+    }
+
+    function createView(triples, bytes, names, release) {
+        return {
+            count: triples.length / 3,
+            triples,
+            bytes,
+            names,
+            type(i) { return triples[i * 3]; },
+            start(i) { return triples[i * 3 + 1]; },
+            length(i) { return triples[i * 3 + 2]; },
+            typeName(i) { return names[triples[i * 3]]; },
+            text(i) {
+                const start = triples[i * 3 + 1];
+                return textDecoder.decode(bytes.subarray(start, start + triples[i * 3 + 2]));
+            },
+            release
+        };
+    }
+
+    // Tokenizes `source` and returns a view over the triples in the heap;
+    // call release() before the next WASM call that might grow the heap
+    function tokenize(module, source) {
+        const bytes = textEncoder.encode(source);
+        const sourcePtr = module._malloc(bytes.length + 1);
+        module.HEAPU8.set(bytes, sourcePtr);
+
+        const tokensPtr = module._tokenize_typed(sourcePtr, bytes.length);
+        module._free(sourcePtr);
+
+        const base = tokensPtr >> 2;
+        const count = module.HEAP32[base];
+        const triples = module.HEAP32.subarray(base + 1, base + 1 + count * 3);
+
+        return createView(triples, bytes, loadTypeNames(module), () => module._free_tokens(tokensPtr));
+    }
+
+    // View over triples copied out of the heap, e.g. by a worker
+    function fromBuffers(triplesBuffer, bytes, names) {
+        return createView(new Int32Array(triplesBuffer), bytes, names, () => {});
+    }
+
+    // Same shape as JSON.parse of the tokenize export; `limit` caps how many
+    // tokens are turned into objects
+    function toObjects(tokens, limit = tokens.count) {
+        const count = Math.min(limit, tokens.count);
+        const objects = new Array(count);
+        for (let i = 0; i < count; i++) {
+            const name = tokens.typeName(i);
+            objects[i] = { type: name, value: name === 'EOF' ? null : tokens.text(i) };
+        }
+        return objects;
+    }
+
+    return { tokenize, fromBuffers, toObjects, loadTypeNames };
+})();
+
+if (typeof module !== 'undefined') {
+    module.exports = TinyTokens;
+}
@@ -0,0 +1,109 @@
+// Compiles tiny-compiler.wasm once and shares the result. The page compiles
+// the module while it downloads (WebAssembly.compileStreaming), keeps it in
+// IndexedDB under the SHA-256 the build writes to tiny-compiler.wasm.sha256,
+// and hands it to the Emscripten glue of every worker, which then only
+// instantiates it. A repeat visit with an unchanged build neither downloads
+// nor compiles the binary. Browsers that refuse to store a WebAssembly.Module
+// get the bytes stored instead, which still saves the download.
+const TinyWasm = (() => {
+    const DB_NAME = 'tiny-compiler';
+    const STORE = 'modules';
+
+    function openDatabase() {
+        return new Promise((resolve, reject) => {
+            const request = indexedDB.open(DB_NAME, 1);
+            request.onupgradeneeded = () => request.result.createObjectStore(STORE);
+            request.onsuccess = () => resolve(request.result);
+            request.onerror = () => reject(request.error);
+        });
+    }
+
+    // Resolves with the result of the request `body` makes on the store once
+    // its transaction has completed
+    function transact(db, mode, body) {
+        return new Promise((resolve, reject) => {
+            const transaction = db.transaction(STORE, mode);
+            const request = body(transaction.objectStore(STORE));
+            transaction.oncomplete = () => resolve(request.result);
+            transaction.onerror = () => reject(transaction.error);
+            transaction.onabort = () => reject(transaction.error);
+        });
+    }
+
+    // Only the current build is kept
+    async function store(db, hash, module, bytes) {
+        try {
+            await transact(db, 'readwrite', objects => {
+                objects.clear();
+                return objects.put(module, hash);
+            });
+        } catch (error) {
+            const copy = await bytes;
+            await transact(db, 'readwrite', objects => {
+                objects.clear();
+                return objects.put(copy, hash);
+            });
+        }
+    }
+
+    async function contentHash(url) {
+        try {
+            const response = await fetch(url + '.sha256', { cache: 'no-cache' });
+            return response.ok ? (await response.text()).trim() : null;
+        } catch (error) {
+            return null;
+        }
+    }
+
+    // Resolves with { module, source }, where source is 'cache' or 'network'
+    async function load(url = 'tiny-compiler.wasm') {
+        const hash = await contentHash(url);
+        const db = hash && typeof indexedDB !== 'undefined' ? await openDatabase().catch(() => null)
+                                                             : null;
+
+        if (db) {
+            const cached = await transact(db, 'readonly', objects => objects.get(hash)).catch(() => null);
+            if (cached instanceof WebAssembly.Module) {
+                return { module: cached, source: 'cache' };
+            }
+            if (cached instanceof ArrayBuffer) {
+                return { module: await WebAssembly.compile(cached), source: 'cache' };
+            }
+        }
+
+        // The hash in the URL keeps HTTP caches from pairing it with an
+        // older binary
+        const response = await fetch(hash ? `${url}?${hash}` : url);
+        if (!response.ok) {
+            throw new Error(`Could not load ${url}: HTTP ${response.status}`);
+        }
+        const bytes = response.clone().arrayBuffer();
+        let module;
+        try {
+            module = await WebAssembly.compileStreaming(response);
+        } catch (error) {
+            // Servers that do not send application/wasm, and browsers
+            // without compileStreaming
+            module = await WebAssembly.compile(await bytes);
+        }
+
+        if (db) {
+            store(db, hash, module, bytes).catch(() => {});
+        }
+        return { module, source: 'network' };
+    }
+
+    // A Module.instantiateWasm for the glue that instantiates `module` (or
+    // what a promise for one resolves to) instead of fetching the binary.
+    // A failure is rethrown outside the promise so it reaches onerror.
+    function instantiateWith(module) {
+        return (imports, receive) => {
+            Promise.resolve(module).then(compiled => WebAssembly.instantiate(compiled, imports)
+                .then(instance => receive(instance, compiled)))
+                .catch(error => setTimeout(() => { throw error; }));
+            return {};
+        };
+    }
+
+    return { load, instantiateWith };
+})();
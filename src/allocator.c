@@ -0,0 +1,184 @@
+#include "allocator.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void* libc_alloc(void* user, size_t size) {
+    (void)user;
+    return malloc(size);
+}
+
+static void* libc_realloc(void* user, void* memory, size_t size) {
+    (void)user;
+    return realloc(memory, size);
+}
+
+static void libc_free(void* user, void* memory) {
+    (void)user;
+    free(memory);
+}
+
+const Allocator libc_allocator = { libc_alloc, libc_realloc, libc_free, NULL };
+
+void* allocate(const Allocator* allocator, size_t size) {
+    if (!allocator) allocator = &libc_allocator;
+
+    void* memory = allocator->alloc(allocator->user, size);
+    if (!memory) report_fatal(NULL, "Error: Out of memory allocating %zu bytes", size);
+    return memory;
+}
+
+void* reallocate(const Allocator* allocator, void* memory, size_t size) {
+    if (!allocator) allocator = &libc_allocator;
+
+    memory = allocator->realloc(allocator->user, memory, size);
+    if (!memory) report_fatal(NULL, "Error: Out of memory allocating %zu bytes", size);
+    return memory;
+}
+
+void deallocate(const Allocator* allocator, void* memory) {
+    if (!memory) return;
+    if (!allocator) allocator = &libc_allocator;
+
+    allocator->free(allocator->user, memory);
+}
+
+// NUL-terminated copy of the first `length` bytes of `str`
+char* copy_string(const Allocator* allocator, const char* str, size_t length) {
+    char* copy = allocate(allocator, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// Header in front of every counted block; the size keeps the payload
+// 16-byte aligned
+struct CountedBlock {
+    CountedBlock* prev;
+    CountedBlock* next;
+    size_t size;
+    size_t padding;
+};
+
+void init_counting_allocator(CountingAllocator* counting, const Allocator* parent, size_t limit,
+                             Diagnostics* diagnostics) {
+    memset(counting, 0, sizeof(CountingAllocator));
+    counting->parent = parent ? parent : &libc_allocator;
+    counting->limit = limit;
+    counting->diagnostics = diagnostics;
+}
+
+static void link_block(CountingAllocator* counting, CountedBlock* block, size_t size) {
+    block->size = size;
+    block->prev = NULL;
+    block->next = counting->blocks;
+    if (counting->blocks) counting->blocks->prev = block;
+    counting->blocks = block;
+
+    counting->alloc_count++;
+    counting->alloc_bytes += size;
+    counting->live_bytes += size;
+    if (counting->live_bytes > counting->peak_bytes) {
+        counting->peak_bytes = counting->live_bytes;
+    }
+}
+
+static void unlink_block(CountingAllocator* counting, CountedBlock* block) {
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        counting->blocks = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+    counting->live_bytes -= block->size;
+}
+
+static int over_limit(CountingAllocator* counting, size_t growth) {
+    return counting->limit > 0 && counting->live_bytes + growth > counting->limit;
+}
+
+// Reports a refused allocation; does not return when the diagnostics can
+// recover, otherwise allocate() exits on the NULL
+static void* refuse(CountingAllocator* counting, size_t growth) {
+    counting->failed = 1;
+    if (counting->diagnostics && counting->diagnostics->recover) {
+        if (over_limit(counting, growth)) {
+            report_fatal(counting->diagnostics, "Error: Memory limit of %zu bytes exceeded",
+                         counting->limit);
+        }
+        report_fatal(counting->diagnostics, "Error: Out of memory");
+    }
+    return NULL;
+}
+
+static void* counting_alloc(void* user, size_t size) {
+    CountingAllocator* counting = user;
+    if (over_limit(counting, size)) return refuse(counting, size);
+
+    CountedBlock* block = counting->parent->alloc(counting->parent->user, sizeof(CountedBlock) + size);
+    if (!block) return refuse(counting, size);
+
+    link_block(counting, block, size);
+    return block + 1;
+}
+
+static void* counting_realloc(void* user, void* memory, size_t size) {
+    CountingAllocator* counting = user;
+    if (!memory) return counting_alloc(user, size);
+
+    CountedBlock* block = (CountedBlock*)memory - 1;
+    size_t growth = size > block->size ? size - block->size : 0;
+    if (over_limit(counting, growth)) return refuse(counting, growth);
+
+    // On failure the parent leaves the block, and so the list, untouched
+    CountedBlock* moved = counting->parent->realloc(counting->parent->user, block,
+                                                    sizeof(CountedBlock) + size);
+    if (!moved) return refuse(counting, growth);
+
+    if (moved->prev) {
+        moved->prev->next = moved;
+    } else {
+        counting->blocks = moved;
+    }
+    if (moved->next) moved->next->prev = moved;
+
+    counting->alloc_count++;
+    counting->alloc_bytes += size;
+    counting->live_bytes = counting->live_bytes - moved->size + size;
+    if (counting->live_bytes > counting->peak_bytes) {
+        counting->peak_bytes = counting->live_bytes;
+    }
+    moved->size = size;
+    return moved + 1;
+}
+
+static void counting_free(void* user, void* memory) {
+    CountingAllocator* counting = user;
+    CountedBlock* block = (CountedBlock*)memory - 1;
+
+    unlink_block(counting, block);
+    counting->parent->free(counting->parent->user, block);
+}
+
+Allocator counting_allocator(CountingAllocator* counting) {
+    Allocator allocator = { counting_alloc, counting_realloc, counting_free, counting };
+    return allocator;
+}
+
+// Starts new totals for the next compilation; live blocks stay tracked
+void reset_allocation_counts(CountingAllocator* counting) {
+    counting->alloc_count = 0;
+    counting->alloc_bytes = 0;
+    counting->peak_bytes = counting->live_bytes;
+    counting->failed = 0;
+}
+
+void release_counted_blocks(CountingAllocator* counting) {
+    CountedBlock* block = counting->blocks;
+    while (block) {
+        CountedBlock* next = block->next;
+        counting->parent->free(counting->parent->user, block);
+        block = next;
+    }
+    counting->blocks = NULL;
+    counting->live_bytes = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+#include "diagnostics.h"
+
+// Where the compiler gets its memory. Every function receives `user`;
+// `free` may be a no-op for allocators that release memory in bulk. A NULL
+// Allocator* anywhere in the compiler means libc_allocator.
+typedef struct {
+    void* (*alloc)(void* user, size_t size);
+    void* (*realloc)(void* user, void* memory, size_t size);
+    void (*free)(void* user, void* memory);
+    void* user;
+} Allocator;
+
+extern const Allocator libc_allocator;
+
+// Exit with a message when the allocator returns NULL
+void* allocate(const Allocator* allocator, size_t size);
+void* reallocate(const Allocator* allocator, void* memory, size_t size);
+void deallocate(const Allocator* allocator, void* memory);
+char* copy_string(const Allocator* allocator, const char* str, size_t length);
+
+typedef struct CountedBlock CountedBlock;
+
+// Counts what passes through to `parent` and keeps the live blocks in a
+// list. An allocation that would take the live bytes over `limit` (0 for
+// none), or that the parent refuses, sets `failed` and is reported as fatal
+// to `diagnostics`, jumping back to its recover point;
+// release_counted_blocks then frees what the abandoned compilation held.
+typedef struct {
+    const Allocator* parent;
+    Diagnostics* diagnostics;
+    size_t limit;
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t live_bytes;
+    size_t peak_bytes;
+    int failed;
+    CountedBlock* blocks;
+} CountingAllocator;
+
+void init_counting_allocator(CountingAllocator* counting, const Allocator* parent, size_t limit,
+                             Diagnostics* diagnostics);
+Allocator counting_allocator(CountingAllocator* counting);
+void reset_allocation_counts(CountingAllocator* counting);
+void release_counted_blocks(CountingAllocator* counting);
+
+#endif
@@ -0,0 +1,41 @@
+#include "stats.h"
+#include <stdlib.h>
+
+// Counts every heap allocation in the process for --stats by wrapping
+// glibc's allocator. Sanitizer builds and other C libraries bring their own
+// malloc, so allocations are simply not counted there.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+
+static size_t allocation_count;
+static size_t allocation_bytes;
+
+static void record_allocation(size_t size) {
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&allocation_bytes, size, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size) {
+    record_allocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    record_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    record_allocation(size);
+    return __libc_realloc(pointer, size);
+}
+
+void count_allocations(size_t* count, size_t* bytes) {
+    *count = __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&allocation_bytes, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+
+static ArenaChunk* new_chunk(size_t size, ArenaChunk* next) {
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+    chunk->next = next;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void init_arena(Arena* arena, size_t chunk_size) {
+    arena->head = NULL;
+    arena->chunk_size = chunk_size;
+}
+
+static size_t align(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = align(size);
+
+    if (!arena->head || arena->head->used + size > arena->head->size) {
+        size_t chunk_size = arena->chunk_size;
+        while (chunk_size < size) {
+            chunk_size *= 2;
+        }
+        arena->head = new_chunk(chunk_size, arena->head);
+    }
+
+    void* memory = arena->head->data + arena->head->used;
+    arena->head->used += size;
+    return memory;
+}
+
+// Collapses the chunk list into a single chunk large enough for everything
+// the last round needed, so steady-state rounds never call malloc
+void reset_arena(Arena* arena) {
+    if (!arena->head) return;
+
+    if (arena->head->next) {
+        size_t total = 0;
+        for (ArenaChunk* chunk = arena->head; chunk; chunk = chunk->next) {
+            total += chunk->size;
+        }
+        free_arena(arena);
+        arena->head = new_chunk(total, NULL);
+    }
+
+    arena->head->used = 0;
+}
+
+void free_arena(Arena* arena) {
+    ArenaChunk* chunk = arena->head;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+}
+
+// Allocations through arena_allocator carry their size so realloc can copy;
+// the header keeps the payload aligned
+typedef struct {
+    size_t size;
+    size_t padding;
+} ArenaBlock;
+
+static void* arena_allocator_alloc(void* user, size_t size) {
+    ArenaBlock* block = arena_alloc(user, sizeof(ArenaBlock) + size);
+    block->size = size;
+    return block + 1;
+}
+
+// Grows the newest block in place when its chunk has room, which is the
+// common case for a string builder appending to its buffer
+static void* arena_allocator_realloc(void* user, void* memory, size_t size) {
+    Arena* arena = user;
+    if (!memory) return arena_allocator_alloc(user, size);
+
+    ArenaBlock* block = (ArenaBlock*)memory - 1;
+    if (size <= block->size) return memory;
+
+    ArenaChunk* chunk = arena->head;
+    char* start = (char*)block;
+    if (start >= chunk->data && start < chunk->data + chunk->used) {
+        size_t offset = (size_t)(start - chunk->data);
+        size_t old_end = offset + align(sizeof(ArenaBlock) + block->size);
+        size_t new_end = offset + align(sizeof(ArenaBlock) + size);
+
+        if (old_end == chunk->used && new_end <= chunk->size) {
+            chunk->used = new_end;
+            block->size = size;
+            return memory;
+        }
+    }
+
+    void* moved = arena_allocator_alloc(user, size);
+    memcpy(moved, memory, block->size);
+    return moved;
+}
+
+static void arena_allocator_free(void* user, void* memory) {
+    (void)user;
+    (void)memory;
+}
+
+// Allocator over `arena`: frees are no-ops and everything is released by
+// reset_arena or free_arena
+Allocator arena_allocator(Arena* arena) {
+    Allocator allocator = { arena_allocator_alloc, arena_allocator_realloc, arena_allocator_free,
+                            arena };
+    return allocator;
+}
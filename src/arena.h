@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "allocator.h"
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+// Bump allocator: individual allocations are never freed, the whole arena
+// is reset at once and keeps its memory for the next round.
+typedef struct {
+    ArenaChunk* head;
+    size_t chunk_size;
+} Arena;
+
+void init_arena(Arena* arena, size_t chunk_size);
+void* arena_alloc(Arena* arena, size_t size);
+void reset_arena(Arena* arena);
+void free_arena(Arena* arena);
+Allocator arena_allocator(Arena* arena);
+
+#endif
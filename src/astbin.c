@@ -0,0 +1,226 @@
+#include "astbin.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char* strings;
+    int32_t node_count;
+    int32_t list_count;
+    size_t string_length;
+    NodeMap shared;    // shared nodes measured or written so far, see parser.h
+} BinaryWriter;
+
+// First pass: sizes every region so the buffer is allocated exactly once
+static void measure_node(BinaryWriter* writer, ASTNode* node) {
+    if (!node) return;
+    if (node->shares > 0 && !node_map_add(&writer->shared, node, 0)) return;
+    writer->node_count++;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            writer->list_count += (int32_t)node->data.program.statement_count;
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                measure_node(writer, node->data.program.statements[i]);
+            }
+            break;
+        case AST_VARIABLE:
+            writer->string_length += strlen(node->data.variable.name);
+            break;
+        case AST_NUMBER:
+            break;
+        case AST_BINARY_OP:
+            measure_node(writer, node->data.binary_op.left);
+            measure_node(writer, node->data.binary_op.right);
+            break;
+        case AST_ASSIGN:
+            writer->string_length += strlen(node->data.assign.name);
+            measure_node(writer, node->data.assign.value);
+            break;
+        case AST_IF:
+            measure_node(writer, node->data.if_statement.condition);
+            measure_node(writer, node->data.if_statement.if_body);
+            measure_node(writer, node->data.if_statement.else_body);
+            break;
+        case AST_PRINT:
+            measure_node(writer, node->data.print.expression);
+            break;
+        case AST_WHILE:
+            measure_node(writer, node->data.while_loop.condition);
+            measure_node(writer, node->data.while_loop.body);
+            break;
+        case AST_FUNCTION:
+            // The name and parameters are written as VARIABLE nodes
+            writer->node_count += 1 + (int32_t)node->data.function.param_count;
+            writer->list_count += 1 + (int32_t)node->data.function.param_count;
+            writer->string_length += strlen(node->data.function.name);
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                writer->string_length += strlen(node->data.function.params[i]);
+            }
+            measure_node(writer, node->data.function.body);
+            break;
+        case AST_CALL:
+            writer->node_count++;
+            writer->list_count += 1 + (int32_t)node->data.call.arg_count;
+            writer->string_length += strlen(node->data.call.name);
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                measure_node(writer, node->data.call.args[i]);
+            }
+            break;
+        case AST_RETURN:
+            measure_node(writer, node->data.return_statement.value);
+            break;
+        case AST_CONSTANT:
+            writer->string_length += strlen(node->data.constant.text);
+            break;
+    }
+}
+
+static int32_t write_string(BinaryWriter* writer, const char* str, int32_t* length) {
+    size_t size = strlen(str);
+    int32_t offset = (int32_t)writer->string_length;
+    memcpy(writer->strings + offset, str, size);
+    writer->string_length += size;
+    *length = (int32_t)size;
+    return offset;
+}
+
+static int32_t write_name_node(BinaryWriter* writer, int32_t* nodes, const char* name) {
+    int32_t index = writer->node_count++;
+    int32_t* record = nodes + (size_t)index * AST_BINARY_NODE_WORDS;
+    record[0] = AST_VARIABLE;
+    record[1] = write_string(writer, name, &record[2]);
+    record[3] = 0;
+    return index;
+}
+
+// Second pass: returns the preorder index the node was written at; a
+// shared node is only written the first time
+static int32_t write_node(BinaryWriter* writer, int32_t* nodes, int32_t* lists, ASTNode* node) {
+    if (!node) return AST_BINARY_NONE;
+    if (node->shares > 0) {
+        int32_t written = node_map_get(&writer->shared, node);
+        if (written >= 0) return written;
+    }
+
+    int32_t index = writer->node_count++;
+    if (node->shares > 0) node_map_add(&writer->shared, node, index);
+    int32_t* record = nodes + (size_t)index * AST_BINARY_NODE_WORDS;
+    record[0] = (int32_t)node->type;
+    record[1] = record[2] = record[3] = 0;
+
+    switch (node->type) {
+        case AST_PROGRAM: {
+            // Reserve the child list before recursing so nested programs
+            // take the entries after it
+            int32_t first = writer->list_count;
+            int32_t count = (int32_t)node->data.program.statement_count;
+            writer->list_count += count;
+            record[1] = count;
+            record[2] = first;
+            for (int32_t i = 0; i < count; i++) {
+                lists[first + i] = write_node(writer, nodes, lists, node->data.program.statements[i]);
+            }
+            break;
+        }
+        case AST_VARIABLE:
+            record[1] = write_string(writer, node->data.variable.name, &record[2]);
+            break;
+        case AST_NUMBER:
+            record[1] = node->data.number.value;
+            break;
+        case AST_BINARY_OP:
+            record[1] = (unsigned char)node->data.binary_op.op;
+            record[2] = write_node(writer, nodes, lists, node->data.binary_op.left);
+            record[3] = write_node(writer, nodes, lists, node->data.binary_op.right);
+            break;
+        case AST_ASSIGN:
+            record[1] = write_string(writer, node->data.assign.name, &record[2]);
+            record[3] = write_node(writer, nodes, lists, node->data.assign.value);
+            break;
+        case AST_IF:
+            record[1] = write_node(writer, nodes, lists, node->data.if_statement.condition);
+            record[2] = write_node(writer, nodes, lists, node->data.if_statement.if_body);
+            record[3] = write_node(writer, nodes, lists, node->data.if_statement.else_body);
+            break;
+        case AST_PRINT:
+            record[1] = write_node(writer, nodes, lists, node->data.print.expression);
+            break;
+        case AST_WHILE:
+            record[1] = write_node(writer, nodes, lists, node->data.while_loop.condition);
+            record[2] = write_node(writer, nodes, lists, node->data.while_loop.body);
+            break;
+        case AST_FUNCTION: {
+            int32_t first = writer->list_count;
+            int32_t count = (int32_t)node->data.function.param_count;
+            writer->list_count += 1 + count;
+            record[1] = count;
+            record[2] = first;
+            lists[first] = write_name_node(writer, nodes, node->data.function.name);
+            for (int32_t i = 0; i < count; i++) {
+                lists[first + 1 + i] = write_name_node(writer, nodes, node->data.function.params[i]);
+            }
+            record[3] = write_node(writer, nodes, lists, node->data.function.body);
+            break;
+        }
+        case AST_CALL: {
+            int32_t first = writer->list_count;
+            int32_t count = (int32_t)node->data.call.arg_count;
+            writer->list_count += 1 + count;
+            record[1] = count;
+            record[2] = first;
+            lists[first] = write_name_node(writer, nodes, node->data.call.name);
+            for (int32_t i = 0; i < count; i++) {
+                lists[first + 1 + i] = write_node(writer, nodes, lists, node->data.call.args[i]);
+            }
+            break;
+        }
+        case AST_RETURN:
+            record[1] = write_node(writer, nodes, lists, node->data.return_statement.value);
+            break;
+        case AST_CONSTANT:
+            record[1] = write_string(writer, node->data.constant.text, &record[2]);
+            break;
+    }
+
+    return index;
+}
+
+char* ast_to_binary(ASTNode* node, size_t* length) {
+    return ast_to_binary_with_allocator(node, length, NULL);
+}
+
+// Returns a buffer from `allocator` in the layout described in astbin.h
+char* ast_to_binary_with_allocator(ASTNode* node, size_t* length, const Allocator* allocator) {
+    BinaryWriter writer = {0};
+    init_node_map(&writer.shared, allocator);
+    measure_node(&writer, node);
+    free_node_map(&writer.shared);
+
+    size_t nodes_offset = AST_BINARY_HEADER_WORDS * 4;
+    size_t lists_offset = nodes_offset + (size_t)writer.node_count * AST_BINARY_NODE_WORDS * 4;
+    size_t strings_offset = lists_offset + (size_t)writer.list_count * 4;
+    size_t total = (strings_offset + writer.string_length + 3) & ~(size_t)3;
+
+    char* buffer = allocate(allocator, total);
+    memset(buffer, 0, total);
+    int32_t* header = (int32_t*)buffer;
+    header[0] = (int32_t)AST_BINARY_MAGIC;
+    header[1] = AST_BINARY_VERSION;
+    header[2] = (int32_t)total;
+    header[3] = writer.node_count;
+    header[4] = (int32_t)lists_offset;
+    header[5] = writer.list_count;
+    header[6] = (int32_t)strings_offset;
+    header[7] = (int32_t)writer.string_length;
+
+    writer.strings = buffer + strings_offset;
+    writer.node_count = 0;
+    writer.list_count = 0;
+    writer.string_length = 0;
+    init_node_map(&writer.shared, allocator);
+    write_node(&writer, (int32_t*)(buffer + nodes_offset), (int32_t*)(buffer + lists_offset), node);
+    free_node_map(&writer.shared);
+
+    if (length) *length = total;
+    return buffer;
+}
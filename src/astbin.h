@@ -0,0 +1,57 @@
+#ifndef ASTBIN_H
+#define ASTBIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "parser.h"
+
+// Flat binary AST, built so JavaScript can read it straight out of the WASM
+// heap through Int32Array/Uint8Array views. Every field is a native-endian
+// (little-endian on WASM) 32-bit integer and every region starts on a 4-byte
+// boundary.
+//
+//   header (8 words):
+//     0 magic (AST_BINARY_MAGIC)    4 byte offset of the child lists
+//     1 version                     5 number of child list entries
+//     2 total byte length           6 byte offset of the string table
+//     3 node count                  7 string table length in bytes
+//
+//   nodes: node count records of 4 words { kind, a, b, c } starting right
+//   after the header, in preorder, so node 0 is the root. `kind` is the
+//   ASTNodeType value; a missing child is AST_BINARY_NONE. An expression
+//   the parser shared (see ASTNode.shares) is written once, where it first
+//   appears, and every later parent refers back to that index.
+//
+//     PROGRAM    a = statement count, b = index of the first child list entry
+//     VARIABLE   a = name offset in the string table, b = name length
+//     NUMBER     a = value
+//     BINARY_OP  a = operator character, b = left node, c = right node
+//                (comparisons use 'G' >=, 'L' <=, '=' ==, '!' !=)
+//     ASSIGN     a = name offset, b = name length, c = value node
+//     IF         a = condition node, b = if body node, c = else body node
+//     PRINT      a = expression node
+//     WHILE      a = condition node, b = body node
+//     FUNCTION   a = parameter count, b = index of the first child list entry,
+//                c = body node; the list holds a VARIABLE node with the
+//                function's name, then one VARIABLE node per parameter
+//     CALL       a = argument count, b = index of the first child list entry;
+//                the list holds a VARIABLE node with the callee's name, then
+//                the argument nodes
+//     RETURN     a = value node
+//     CONSTANT   a = text offset, b = text length
+//
+//   child lists: node indices of each program's statements and of each
+//   function's or call's name and operands, back to back.
+//   strings: identifier and constant bytes (UTF-8, not NUL-terminated),
+//   zero padded.
+
+#define AST_BINARY_MAGIC 0x54534154u   // "TAST"
+#define AST_BINARY_VERSION 1
+#define AST_BINARY_HEADER_WORDS 8
+#define AST_BINARY_NODE_WORDS 4
+#define AST_BINARY_NONE (-1)
+
+char* ast_to_binary(ASTNode* node, size_t* length);
+char* ast_to_binary_with_allocator(ASTNode* node, size_t* length, const Allocator* allocator);
+
+#endif
@@ -0,0 +1,349 @@
+#include "batch.h"
+#include "compiler.h"
+#include "threadpool.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define WORKER_ARENA_SIZE (256 * 1024)
+#define SOURCE_EXTENSION ".tiny"
+
+typedef struct {
+    char* path;
+    const char* relative;
+    size_t size;
+    char* output_path;
+    int skipped;    // shares its output path with another input
+} BatchFile;
+
+typedef struct {
+    BatchFile* files;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+typedef struct {
+    Arena arena;
+    Diagnostics diagnostics;
+} BatchWorker;
+
+typedef struct {
+    const BatchOptions* options;
+    BatchWorker* workers;
+    size_t bytes;
+    int failed;
+} BatchRun;
+
+typedef struct {
+    BatchRun* run;
+    BatchFile* file;
+} BatchTask;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int has_extension(const char* path, const char* extension) {
+    size_t length = strlen(path);
+    size_t extension_length = strlen(extension);
+    return length > extension_length &&
+           strcmp(path + length - extension_length, extension) == 0;
+}
+
+// `relative_offset` marks where the output-relative part of `path` begins
+static void add_file(FileList* list, const char* path, size_t relative_offset, size_t size) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->files = realloc(list->files, sizeof(BatchFile) * list->capacity);
+    }
+
+    BatchFile* file = &list->files[list->count++];
+    file->path = strdup(path);
+    file->relative = file->path + relative_offset;
+    file->size = size;
+    file->output_path = NULL;
+    file->skipped = 0;
+}
+
+static void collect_directory(FileList* list, const char* dir, size_t relative_offset) {
+    DIR* handle = opendir(dir);
+    if (!handle) {
+        fprintf(stderr, "Error: Could not open directory %s\n", dir);
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        size_t length = strlen(dir) + strlen(entry->d_name) + 2;
+        char* path = malloc(length);
+        snprintf(path, length, "%s/%s", dir, entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info) == 0) {
+            if (S_ISDIR(info.st_mode)) {
+                collect_directory(list, path, relative_offset);
+            } else if (S_ISREG(info.st_mode) && has_extension(path, SOURCE_EXTENSION)) {
+                add_file(list, path, relative_offset, info.st_size);
+            }
+        }
+
+        free(path);
+    }
+
+    closedir(handle);
+}
+
+// Returns the number of inputs that could not be used
+static int collect_inputs(FileList* list, const BatchOptions* options, char** inputs,
+                          int input_count) {
+    int missing = 0;
+
+    for (int i = 0; i < input_count; i++) {
+        struct stat info;
+        if (stat(inputs[i], &info) != 0) {
+            fprintf(stderr, "Error: Could not open file %s\n", inputs[i]);
+            missing++;
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode)) {
+            if (!options->recursive) {
+                fprintf(stderr, "Error: %s is a directory (use -r)\n", inputs[i]);
+                missing++;
+                continue;
+            }
+            // Outputs mirror the tree below the directory that was named
+            size_t length = strlen(inputs[i]);
+            while (length > 1 && inputs[i][length - 1] == '/') length--;
+            char* root = strndup(inputs[i], length);
+            collect_directory(list, root, length + 1);
+            free(root);
+        } else {
+            const char* base = strrchr(inputs[i], '/');
+            add_file(list, inputs[i], base ? (size_t)(base - inputs[i] + 1) : 0, info.st_size);
+        }
+    }
+
+    return missing;
+}
+
+static int compare_largest_first(const void* a, const void* b) {
+    size_t size_a = ((const BatchFile*)a)->size;
+    size_t size_b = ((const BatchFile*)b)->size;
+    return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+// foo/bar.tiny -> <output_dir>/foo/bar.js
+static char* output_path_for(const char* output_dir, const char* relative) {
+    size_t relative_length = strlen(relative);
+    if (has_extension(relative, SOURCE_EXTENSION)) {
+        relative_length -= strlen(SOURCE_EXTENSION);
+    }
+    size_t path_size = strlen(output_dir) + relative_length + 8;
+    char* path = malloc(path_size);
+    snprintf(path, path_size, "%s/%.*s.js", output_dir, (int)relative_length, relative);
+    return path;
+}
+
+static int compare_output_paths(const void* a, const void* b) {
+    const BatchFile* file_a = *(const BatchFile* const*)a;
+    const BatchFile* file_b = *(const BatchFile* const*)b;
+    return strcmp(file_a->output_path, file_b->output_path);
+}
+
+// Gives every file its output path. Inputs that would write the same one,
+// such as a/x.tiny and b/x.tiny named on the command line, are reported
+// and skipped; returns how many were.
+static int skip_colliding_outputs(FileList* list, const char* output_dir) {
+    BatchFile** sorted = malloc(sizeof(BatchFile*) * (list->count ? list->count : 1));
+    for (size_t i = 0; i < list->count; i++) {
+        list->files[i].output_path = output_path_for(output_dir, list->files[i].relative);
+        sorted[i] = &list->files[i];
+    }
+    qsort(sorted, list->count, sizeof(BatchFile*), compare_output_paths);
+
+    int skipped = 0;
+    for (size_t i = 0; i < list->count;) {
+        size_t end = i + 1;
+        while (end < list->count && strcmp(sorted[end]->output_path, sorted[i]->output_path) == 0) {
+            fprintf(stderr, "Error: %s and %s would both be written to %s\n",
+                    sorted[i]->path, sorted[end]->path, sorted[i]->output_path);
+            end++;
+        }
+        if (end - i > 1) {
+            for (size_t k = i; k < end; k++) sorted[k]->skipped = 1;
+            skipped += (int)(end - i);
+        }
+        i = end;
+    }
+
+    free(sorted);
+    return skipped;
+}
+
+static void make_parent_dirs(char* path) {
+    for (char* slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+            *slash = '/';
+            return;
+        }
+        *slash = '/';
+    }
+}
+
+static char* read_source(Arena* arena, const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* buffer = arena_alloc(arena, file_size + 1);
+    size_t bytes_read = fread(buffer, 1, file_size, file);
+    buffer[bytes_read] = '\0';
+    fclose(file);
+
+    *size = bytes_read;
+    return buffer;
+}
+
+static void compile_file(void* arg, int worker) {
+    BatchTask* task = arg;
+    BatchRun* run = task->run;
+    BatchFile* file = task->file;
+    BatchWorker* state = &run->workers[worker];
+
+    reset_arena(&state->arena);
+    reset_diagnostics(&state->diagnostics);
+
+    size_t size;
+    char* source = read_source(&state->arena, file->path, &size);
+    if (!source) {
+        fprintf(stderr, "Error: Could not open file %s\n", file->path);
+        __atomic_fetch_add(&run->failed, 1, __ATOMIC_RELAXED);
+        free(task);
+        return;
+    }
+    __atomic_fetch_add(&run->bytes, size, __ATOMIC_RELAXED);
+
+    // Compiled in the worker's arena next to the source
+    Allocator arena = arena_allocator(&state->arena);
+    const Allocator* allocator = &arena;
+    CountingAllocator counting;
+    Allocator limited;
+    if (run->options->memory_limit > 0) {
+        init_counting_allocator(&counting, &arena, run->options->memory_limit, &state->diagnostics);
+        limited = counting_allocator(&counting);
+        allocator = &limited;
+    }
+
+    CompileCache* cache = run->options->cache;
+    unsigned flags = run->options->flags;
+    char* cached = cache ? cache_lookup(cache, source, size, flags) : NULL;
+    char* output = cached;
+    if (!output) {
+        Analysis analysis;
+        analyze_source(source, size, &state->diagnostics, ANALYZE_JAVASCRIPT | flags, &analysis,
+                       NULL, allocator);
+        output = analysis.javascript;
+        if (output && cache) {
+            cache_store(cache, source, size, flags, output);
+        }
+    }
+
+    if (state->diagnostics.length > 0) {
+        fprintf(stderr, "%s: %s", file->path, state->diagnostics.text);
+    }
+
+    if (!output) {
+        __atomic_fetch_add(&run->failed, 1, __ATOMIC_RELAXED);
+        free(task);
+        return;
+    }
+
+    char* output_path = file->output_path;
+    make_parent_dirs(output_path);
+
+    FILE* out = fopen(output_path, "w");
+    if (!out || fputs(output, out) < 0 || fclose(out) != 0) {
+        fprintf(stderr, "Error: Could not write output file %s\n", output_path);
+        __atomic_fetch_add(&run->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    free(cached);
+    free(task);
+}
+
+// Compiles every input (and, with `recursive`, every .tiny file below input
+// directories) into options->output_dir. Returns the number of failures.
+int compile_batch(const BatchOptions* options, char** inputs, int input_count) {
+    FileList list = { NULL, 0, 0 };
+    int missing = collect_inputs(&list, options, inputs, input_count);
+
+    // Starting with the largest files keeps one straggler from finishing
+    // long after the other workers have gone idle
+    qsort(list.files, list.count, sizeof(BatchFile), compare_largest_first);
+    int skipped = skip_colliding_outputs(&list, options->output_dir);
+
+    mkdir(options->output_dir, 0777);
+
+    ThreadPool* pool = init_threadpool(options->thread_count);
+    int worker_count = threadpool_size(pool);
+
+    BatchRun run;
+    run.options = options;
+    run.bytes = 0;
+    run.failed = missing + skipped;
+    run.workers = calloc(worker_count, sizeof(BatchWorker));
+    for (int i = 0; i < worker_count; i++) {
+        init_arena(&run.workers[i].arena, WORKER_ARENA_SIZE);
+        init_diagnostics(&run.workers[i].diagnostics);
+    }
+
+    double start = now_seconds();
+
+    for (size_t i = 0; i < list.count; i++) {
+        if (list.files[i].skipped) continue;
+        BatchTask* task = malloc(sizeof(BatchTask));
+        task->run = &run;
+        task->file = &list.files[i];
+        threadpool_submit(pool, compile_file, task);
+    }
+
+    threadpool_wait(pool);
+    double elapsed = now_seconds() - start;
+    free_threadpool(pool);
+
+    size_t compiled = list.count - (size_t)skipped;
+    double megabytes = run.bytes / (1024.0 * 1024.0);
+    if (elapsed <= 0) elapsed = 1e-9;
+    fprintf(stderr, "Compiled %zu files (%.2f MB) in %.3f s with %d threads: "
+            "%.1f files/s, %.2f MB/s, %d failed\n",
+            compiled, megabytes, elapsed, worker_count,
+            compiled / elapsed, megabytes / elapsed, run.failed);
+
+    for (int i = 0; i < worker_count; i++) {
+        free_arena(&run.workers[i].arena);
+        free_diagnostics(&run.workers[i].diagnostics);
+    }
+    free(run.workers);
+
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.files[i].path);
+        free(list.files[i].output_path);
+    }
+    free(list.files);
+
+    return run.failed;
+}
@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cache.h"
+
+typedef struct {
+    int thread_count;
+    const char* output_dir;
+    int recursive;
+    CompileCache* cache;
+    size_t memory_limit;    // per file, 0 for no limit
+    unsigned flags;         // analyze_pipeline_flags or 0; also part of the cache key
+} BatchOptions;
+
+int compile_batch(const BatchOptions* options, char** inputs, int input_count);
+
+#endif
@@ -0,0 +1,383 @@
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define INITIAL_BUCKETS 256
+
+typedef struct CacheEntry {
+    uint64_t hash;
+    uint32_t options;
+    char* source;
+    size_t source_length;
+    char* output;
+    size_t output_length;
+    _Atomic int referenced;    // hit since the clock hand last passed
+    struct CacheEntry* next;
+    struct CacheEntry* ring_prev;    // every entry, in the order they were stored
+    struct CacheEntry* ring_next;
+} CacheEntry;
+
+struct CompileCache {
+    pthread_rwlock_t lock;
+    CacheEntry** buckets;
+    size_t bucket_count;
+    size_t entry_count;
+    size_t bytes;
+    size_t byte_budget;
+    char* disk_dir;
+    CacheEntry* hand;    // next entry the evictor looks at; NULL when empty
+    uint64_t scans;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t disk_hits;
+    _Atomic uint64_t evictions;
+};
+
+static uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Processes eight bytes per step; only used as a cache key, not for security
+uint64_t cache_hash(const char* data, size_t length, uint32_t options) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)options << 32) ^ CACHE_FORMAT_VERSION;
+    h ^= length * 0x100000001b3ULL;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        uint64_t k;
+        memcpy(&k, data + i, 8);
+        h ^= mix64(k);
+        h = ((h << 27) | (h >> 37)) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < length; i++, shift += 8) {
+        tail |= (uint64_t)(unsigned char)data[i] << shift;
+    }
+    h ^= mix64(tail);
+
+    return mix64(h);
+}
+
+static size_t entry_bytes(CacheEntry* entry) {
+    return sizeof(CacheEntry) + entry->source_length + entry->output_length + 2;
+}
+
+static void free_entry(CacheEntry* entry) {
+    free(entry->source);
+    free(entry->output);
+    free(entry);
+}
+
+CompileCache* init_cache(size_t byte_budget, const char* disk_dir) {
+    CompileCache* cache = calloc(1, sizeof(CompileCache));
+    pthread_rwlock_init(&cache->lock, NULL);
+    cache->bucket_count = INITIAL_BUCKETS;
+    cache->buckets = calloc(cache->bucket_count, sizeof(CacheEntry*));
+    cache->byte_budget = byte_budget;
+    cache->disk_dir = disk_dir ? strdup(disk_dir) : NULL;
+
+    if (cache->disk_dir) {
+        mkdir(cache->disk_dir, 0777);
+    }
+
+    return cache;
+}
+
+static CacheEntry* find_entry(CompileCache* cache, uint64_t hash, const char* source,
+                              size_t length, uint32_t options) {
+    CacheEntry* entry = cache->buckets[hash & (cache->bucket_count - 1)];
+
+    while (entry) {
+        if (entry->hash == hash && entry->options == options &&
+            entry->source_length == length && memcmp(entry->source, source, length) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+
+    return NULL;
+}
+
+static char* disk_path(CompileCache* cache, uint64_t hash) {
+    size_t size = strlen(cache->disk_dir) + 32;
+    char* path = malloc(size);
+    snprintf(path, size, "%s/%016llx.js", cache->disk_dir, (unsigned long long)hash);
+    return path;
+}
+
+// On-disk entries start with a header line carrying the source length and a
+// second, differently seeded hash so a key collision cannot return wrong code.
+static char* disk_lookup(CompileCache* cache, uint64_t hash, const char* source,
+                         size_t length, uint32_t options) {
+    char* path = disk_path(cache, hash);
+    FILE* file = fopen(path, "rb");
+    free(path);
+    if (!file) return NULL;
+
+    unsigned int version;
+    unsigned long long stored_length, stored_check;
+    char* output = NULL;
+
+    if (fscanf(file, "tinycache %u %llu %llx\n", &version, &stored_length, &stored_check) == 3 &&
+        version == CACHE_FORMAT_VERSION && stored_length == length &&
+        stored_check == cache_hash(source, length, ~options)) {
+        long start = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, start, SEEK_SET);
+
+        output = malloc(end - start + 1);
+        size_t bytes_read = fread(output, 1, end - start, file);
+        output[bytes_read] = '\0';
+    }
+
+    fclose(file);
+    return output;
+}
+
+static void disk_store(CompileCache* cache, uint64_t hash, const char* source,
+                       size_t length, uint32_t options, const char* output) {
+    char* path = disk_path(cache, hash);
+    size_t tmp_size = strlen(path) + 8;
+    char* tmp_path = malloc(tmp_size);
+    snprintf(tmp_path, tmp_size, "%s.XXXXXX", path);
+
+    // Write to a temp file of our own and rename so concurrent compilers,
+    // in this process or another, never observe a partially written entry
+    int fd = mkstemp(tmp_path);
+    FILE* file = NULL;
+    if (fd >= 0) {
+        // mkstemp makes the file private; entries are as readable as before
+        fchmod(fd, 0644);
+        file = fdopen(fd, "wb");
+        if (!file) {
+            close(fd);
+            remove(tmp_path);
+        }
+    }
+    if (file) {
+        fprintf(file, "tinycache %u %llu %016llx\n", CACHE_FORMAT_VERSION,
+                (unsigned long long)length,
+                (unsigned long long)cache_hash(source, length, ~options));
+        fputs(output, file);
+
+        if (fclose(file) == 0) {
+            rename(tmp_path, path);
+        } else {
+            remove(tmp_path);
+        }
+    }
+
+    free(tmp_path);
+    free(path);
+}
+
+static void memory_store(CompileCache* cache, uint64_t hash, const char* source, size_t length,
+                         uint32_t options, const char* output);
+
+char* cache_lookup(CompileCache* cache, const char* source, size_t length, uint32_t options) {
+    uint64_t hash = cache_hash(source, length, options);
+    char* result = NULL;
+
+    // Readers share the lock; a hit only sets the entry's referenced bit,
+    // so it never needs exclusive access
+    pthread_rwlock_rdlock(&cache->lock);
+    CacheEntry* entry = find_entry(cache, hash, source, length, options);
+    if (entry) {
+        if (!atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+            atomic_store_explicit(&entry->referenced, 1, memory_order_relaxed);
+        }
+        result = malloc(entry->output_length + 1);
+        memcpy(result, entry->output, entry->output_length + 1);
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    if (result) {
+        atomic_fetch_add(&cache->hits, 1);
+        return result;
+    }
+
+    if (cache->disk_dir) {
+        result = disk_lookup(cache, hash, source, length, options);
+        if (result) {
+            atomic_fetch_add(&cache->hits, 1);
+            atomic_fetch_add(&cache->disk_hits, 1);
+            memory_store(cache, hash, source, length, options, result);
+            return result;
+        }
+    }
+
+    atomic_fetch_add(&cache->misses, 1);
+    return NULL;
+}
+
+static void grow_buckets(CompileCache* cache) {
+    size_t new_count = cache->bucket_count * 2;
+    CacheEntry** new_buckets = calloc(new_count, sizeof(CacheEntry*));
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        CacheEntry* entry = cache->buckets[i];
+        while (entry) {
+            CacheEntry* next = entry->next;
+            size_t index = entry->hash & (new_count - 1);
+            entry->next = new_buckets[index];
+            new_buckets[index] = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = new_buckets;
+    cache->bucket_count = new_count;
+}
+
+// CLOCK (second chance): the hand clears the referenced bit of entries hit
+// since it last passed and evicts the first entry without one. Each step
+// past an entry pays for an earlier hit, so eviction is O(1) amortized and
+// approximates least recently used. Caller holds the write lock.
+static void evict_least_recent(CompileCache* cache) {
+    CacheEntry* entry = cache->hand;
+    if (!entry) return;
+
+    while (atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+        atomic_store_explicit(&entry->referenced, 0, memory_order_relaxed);
+        entry = entry->ring_next;
+        cache->scans++;
+    }
+    cache->scans++;
+
+    if (entry->ring_next == entry) {
+        cache->hand = NULL;
+    } else {
+        entry->ring_prev->ring_next = entry->ring_next;
+        entry->ring_next->ring_prev = entry->ring_prev;
+        cache->hand = entry->ring_next;
+    }
+
+    // Buckets hold about one entry each, see memory_store
+    CacheEntry** link = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+    cache->entry_count--;
+    cache->bytes -= entry_bytes(entry);
+    free_entry(entry);
+    atomic_fetch_add(&cache->evictions, 1);
+}
+
+static void memory_store(CompileCache* cache, uint64_t hash, const char* source, size_t length,
+                         uint32_t options, const char* output) {
+    size_t output_length = strlen(output);
+    CacheEntry* entry = malloc(sizeof(CacheEntry));
+    entry->hash = hash;
+    entry->options = options;
+    entry->source_length = length;
+    entry->output_length = output_length;
+    entry->next = NULL;
+
+    // Entries larger than the whole budget would only evict everything else
+    if (entry_bytes(entry) > cache->byte_budget) {
+        free(entry);
+        return;
+    }
+
+    entry->source = malloc(length + 1);
+    memcpy(entry->source, source, length);
+    entry->source[length] = '\0';
+    entry->output = malloc(output_length + 1);
+    memcpy(entry->output, output, output_length + 1);
+
+    pthread_rwlock_wrlock(&cache->lock);
+
+    if (find_entry(cache, hash, source, length, options)) {
+        // Another thread stored the same result first
+        pthread_rwlock_unlock(&cache->lock);
+        free_entry(entry);
+        return;
+    }
+
+    while (cache->entry_count > 0 && cache->bytes + entry_bytes(entry) > cache->byte_budget) {
+        evict_least_recent(cache);
+    }
+
+    if (cache->entry_count >= cache->bucket_count) {
+        grow_buckets(cache);
+    }
+
+    // Just behind the hand, so the new entry is the last one it reaches
+    atomic_init(&entry->referenced, 0);
+    if (cache->hand) {
+        entry->ring_next = cache->hand;
+        entry->ring_prev = cache->hand->ring_prev;
+        entry->ring_prev->ring_next = entry;
+        cache->hand->ring_prev = entry;
+    } else {
+        entry->ring_next = entry->ring_prev = entry;
+        cache->hand = entry;
+    }
+
+    size_t index = hash & (cache->bucket_count - 1);
+    entry->next = cache->buckets[index];
+    cache->buckets[index] = entry;
+    cache->entry_count++;
+    cache->bytes += entry_bytes(entry);
+
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+void cache_store(CompileCache* cache, const char* source, size_t length, uint32_t options,
+                 const char* output) {
+    if (!output) return;
+
+    uint64_t hash = cache_hash(source, length, options);
+
+    if (cache->disk_dir) {
+        disk_store(cache, hash, source, length, options, output);
+    }
+
+    memory_store(cache, hash, source, length, options, output);
+}
+
+CacheStats cache_stats(CompileCache* cache) {
+    CacheStats stats;
+
+    pthread_rwlock_rdlock(&cache->lock);
+    stats.entries = cache->entry_count;
+    stats.bytes = cache->bytes;
+    stats.eviction_scans = cache->scans;
+    pthread_rwlock_unlock(&cache->lock);
+
+    stats.hits = atomic_load(&cache->hits);
+    stats.misses = atomic_load(&cache->misses);
+    stats.disk_hits = atomic_load(&cache->disk_hits);
+    stats.evictions = atomic_load(&cache->evictions);
+    return stats;
+}
+
+void free_cache(CompileCache* cache) {
+    if (!cache) return;
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        CacheEntry* entry = cache->buckets[i];
+        while (entry) {
+            CacheEntry* next = entry->next;
+            free_entry(entry);
+            entry = next;
+        }
+    }
+
+    pthread_rwlock_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache->disk_dir);
+    free(cache);
+}
@@ -0,0 +1,32 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump whenever generated code changes so stale on-disk entries miss
+#define CACHE_FORMAT_VERSION 3
+
+#define CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+typedef struct CompileCache CompileCache;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t disk_hits;
+    uint64_t evictions;
+    uint64_t eviction_scans;    // entries the evictor looked at, at most evictions + hits
+    size_t entries;
+    size_t bytes;
+} CacheStats;
+
+uint64_t cache_hash(const char* data, size_t length, uint32_t options);
+CompileCache* init_cache(size_t byte_budget, const char* disk_dir);
+char* cache_lookup(CompileCache* cache, const char* source, size_t length, uint32_t options);
+void cache_store(CompileCache* cache, const char* source, size_t length, uint32_t options,
+                 const char* output);
+CacheStats cache_stats(CompileCache* cache);
+void free_cache(CompileCache* cache);
+
+#endif
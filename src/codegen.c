@@ -1,58 +1,41 @@
 #include "codegen.h"
+#include "strbuf.h"
+#include "scope.h"
+#include "profile.h"
 #include <stdio.h>
 #include <string.h>
-
-#define INITIAL_BUFFER_SIZE 1024
+#include <setjmp.h>
 
 typedef struct {
-    char* buffer;
-    size_t size;
-    size_t capacity;
-} StringBuilder;
-
-StringBuilder* init_string_builder() {
-    StringBuilder* sb = malloc(sizeof(StringBuilder));
-    sb->capacity = INITIAL_BUFFER_SIZE;
-    sb->buffer = malloc(sb->capacity);
-    sb->size = 0;
-    sb->buffer[0] = '\0';
-    return sb;
-}
-
-void append_string(StringBuilder* sb, const char* str) {
-    size_t len = strlen(str);
-    
-    if (sb->size + len + 1 > sb->capacity) {
-        while (sb->size + len + 1 > sb->capacity) {
-            sb->capacity *= 2;
-        }
-        sb->buffer = realloc(sb->buffer, sb->capacity);
-    }
-    
-    strcat(sb->buffer + sb->size, str);
-    sb->size += len;
-}
+    StringBuilder* sb;
+    Diagnostics* diagnostics;
+    Scope scope;    // variables already declared with `let`
+    Scope enclosing;    // the top-level scope while in_function
+    int in_function;
+    int instrument;
+    int buffer_output;
+    size_t next_site;    // see profile.h for the numbering
+} CodeGenerator;
 
-char* finalize_string_builder(StringBuilder* sb) {
-    char* result = sb->buffer;
-    free(sb);
-    return result;
-}
+void generate_expression(CodeGenerator* gen, ASTNode* node) {
+    StringBuilder* sb = gen->sb;
 
-void generate_expression(StringBuilder* sb, ASTNode* node) {
     switch (node->type) {
         case AST_NUMBER:
-            sprintf(sb->buffer + sb->size, "%d", node->data.number.value);
-            sb->size += strlen(sb->buffer + sb->size);
+            append_int(sb, node->data.number.value);
             break;
             
         case AST_VARIABLE:
             append_string(sb, node->data.variable.name);
             break;
+
+        case AST_CONSTANT:
+            append_string(sb, node->data.constant.text);
+            break;
             
         case AST_BINARY_OP:
             append_string(sb, "(");
-            generate_expression(sb, node->data.binary_op.left);
+            generate_expression(gen, node->data.binary_op.left);
             
             // Map our special operator markers
             char op = node->data.binary_op.op;
@@ -78,50 +61,109 @@ void generate_expression(StringBuilder* sb, ASTNode* node) {
             } else if (op == 'L') { // Less or equal (<=)
                 append_string(sb, " <= ");
             } else {
-                fprintf(stderr, "Error: Unknown binary operator: %c\n", op);
-                exit(1);
+                report_fatal(gen->diagnostics, "Error: Unknown binary operator: %c", op);
             }
             
-            generate_expression(sb, node->data.binary_op.right);
+            generate_expression(gen, node->data.binary_op.right);
+            append_string(sb, ")");
+            break;
+
+        case AST_CALL:
+            append_string(sb, node->data.call.name);
+            append_string(sb, "(");
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                if (i > 0) append_string(sb, ", ");
+                generate_expression(gen, node->data.call.args[i]);
+            }
             append_string(sb, ")");
             break;
             
         default:
-            fprintf(stderr, "Error: Unknown node type in expression\n");
-            exit(1);
+            report_fatal(gen->diagnostics, "Error: Unknown node type in expression");
+    }
+}
+
+void generate_statement(CodeGenerator* gen, ASTNode* node);
+
+// Counts one more run of the next site, followed by `separator`
+static void count_site(CodeGenerator* gen, const char* separator) {
+    append_string(gen->sb, "$profile[");
+    append_int(gen->sb, (int)gen->next_site++);
+    append_string(gen->sb, "]++;");
+    append_string(gen->sb, separator);
+}
+
+// An if or else arm counts itself on a line of its own
+static void count_arm(CodeGenerator* gen) {
+    if (gen->instrument) {
+        append_string(gen->sb, "  ");
+        count_site(gen, "\n");
     }
 }
 
-void generate_statement(StringBuilder* sb, ASTNode* node) {
+// Statements of an if or while body, in a block scope of their own
+static void generate_block(CodeGenerator* gen, ASTNode* body) {
+    enter_block(&gen->scope);
+    for (size_t i = 0; i < body->data.program.statement_count; i++) {
+        append_string(gen->sb, "  ");
+        generate_statement(gen, body->data.program.statements[i]);
+    }
+    leave_block(&gen->scope);
+}
+
+// A function body only sees its parameters and the variables it assigns,
+// so it starts from a scope of its own
+static void generate_function(CodeGenerator* gen, ASTNode* node) {
+    StringBuilder* sb = gen->sb;
+    gen->enclosing = gen->scope;
+    gen->in_function = 1;
+
+    append_string(sb, "function ");
+    append_string(sb, node->data.function.name);
+    append_string(sb, "(");
+    init_scope(&gen->scope, gen->enclosing.allocator);
+    for (size_t i = 0; i < node->data.function.param_count; i++) {
+        if (i > 0) append_string(sb, ", ");
+        append_string(sb, node->data.function.params[i]);
+        declare_name(&gen->scope, node->data.function.params[i]);
+    }
+    append_string(sb, ") {\n");
+    generate_block(gen, node->data.function.body);
+    append_string(sb, "}\n");
+    free_scope(&gen->scope);
+    gen->scope = gen->enclosing;
+    gen->in_function = 0;
+}
+
+void generate_statement(CodeGenerator* gen, ASTNode* node) {
+    StringBuilder* sb = gen->sb;
+
+    if (gen->instrument) count_site(gen, " ");
     switch (node->type) {
         case AST_ASSIGN:
-            append_string(sb, "let ");
+            // Only the first assignment in scope declares the variable, so
+            // loops can update what was declared outside them
+            if (declare_once(&gen->scope, node->data.assign.name)) {
+                append_string(sb, "let ");
+            }
             append_string(sb, node->data.assign.name);
             append_string(sb, " = ");
-            generate_expression(sb, node->data.assign.value);
+            generate_expression(gen, node->data.assign.value);
             append_string(sb, ";\n");
             break;
             
         case AST_IF:
             append_string(sb, "if (");
-            generate_expression(sb, node->data.if_statement.condition);
+            generate_expression(gen, node->data.if_statement.condition);
             append_string(sb, ") {\n");
-            
-            for (size_t i = 0; i < node->data.if_statement.if_body->data.program.statement_count; i++) {
-                append_string(sb, "  ");
-                generate_statement(sb, node->data.if_statement.if_body->data.program.statements[i]);
-            }
-            
+            count_arm(gen);
+            generate_block(gen, node->data.if_statement.if_body);
             append_string(sb, "}");
             
             if (node->data.if_statement.else_body) {
                 append_string(sb, " else {\n");
-                
-                for (size_t i = 0; i < node->data.if_statement.else_body->data.program.statement_count; i++) {
-                    append_string(sb, "  ");
-                    generate_statement(sb, node->data.if_statement.else_body->data.program.statements[i]);
-                }
-                
+                count_arm(gen);
+                generate_block(gen, node->data.if_statement.else_body);
                 append_string(sb, "}");
             }
             
@@ -129,31 +171,204 @@ void generate_statement(StringBuilder* sb, ASTNode* node) {
             break;
             
         case AST_PRINT:
-            append_string(sb, "console.log(");
-            generate_expression(sb, node->data.print.expression);
+            append_string(sb, gen->buffer_output ? "$print(" : "console.log(");
+            generate_expression(gen, node->data.print.expression);
             append_string(sb, ");\n");
             break;
+
+        case AST_WHILE:
+            append_string(sb, "while (");
+            generate_expression(gen, node->data.while_loop.condition);
+            append_string(sb, ") {\n");
+            generate_block(gen, node->data.while_loop.body);
+            append_string(sb, "}\n");
+            break;
+
+        case AST_FUNCTION:
+            generate_function(gen, node);
+            break;
+
+        case AST_CALL:
+            generate_expression(gen, node);
+            append_string(sb, ";\n");
+            break;
+
+        case AST_RETURN:
+            append_string(sb, "return ");
+            generate_expression(gen, node->data.return_statement.value);
+            append_string(sb, ";\n");
+            break;
             
         default:
-            fprintf(stderr, "Error: Unknown node type in statement\n");
-            exit(1);
+            report_fatal(gen->diagnostics, "Error: Unknown node type in statement");
     }
 }
 
-char* generate_code(ASTNode* node) {
+char* generate_code_with_diagnostics(ASTNode* node, Diagnostics* diagnostics) {
+    return generate_code_traced(node, diagnostics, NULL, NULL);
+}
+
+// Writes the counters of an instrumented program and the hook that saves
+// them on exit, under Node; elsewhere they stay in $profile
+static void append_profile_header(CodeGenerator* gen, ASTNode* program) {
+    uint64_t hash;
+    char text[32];
+    size_t sites = profile_sites(program, &hash);
+
+    append_string(gen->sb, "// Counts per statement and if arm, saved on exit to $TINY_PROFILE or profile.json\n");
+    append_string(gen->sb, "const $profile = new Float64Array(");
+    append_int(gen->sb, (int)sites);
+    append_string(gen->sb, ");\n");
+    append_string(gen->sb, "globalThis.process?.on(\"exit\", () => require(\"fs\").writeFileSync(\n");
+    append_string(gen->sb, "  globalThis.process.env.TINY_PROFILE || \"profile.json\",\n");
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    append_string(gen->sb, "  JSON.stringify({ program: \"");
+    append_string(gen->sb, text);
+    append_string(gen->sb, "\", counts: Array.from($profile) }) + \"\\n\"));\n\n");
+}
+
+// The buffer print() writes to. Under Node it goes to stdout, flushed on
+// exit too so that output before an uncaught error is not lost; elsewhere
+// each flush is one console.log. console.log prints -0 as "-0", which
+// string concatenation would not.
+static void append_print_runtime(CodeGenerator* gen) {
+    append_string(gen->sb, "// print() output, written out in pieces of up to ");
+    append_int(gen->sb, CODEGEN_PRINT_BUFFER_SIZE);
+    append_string(gen->sb, " characters\n");
+    append_string(gen->sb, "let $output = \"\";\n");
+    append_string(gen->sb, "const $flush = () => {\n");
+    append_string(gen->sb, "  if (!$output) return;\n");
+    append_string(gen->sb, "  if (globalThis.process?.stdout) globalThis.process.stdout.write($output);\n");
+    append_string(gen->sb, "  else console.log($output.slice(0, -1));\n");
+    append_string(gen->sb, "  $output = \"\";\n");
+    append_string(gen->sb, "};\n");
+    append_string(gen->sb, "const $print = value => {\n");
+    append_string(gen->sb, "  $output += (Object.is(value, -0) ? \"-0\" : value) + \"\\n\";\n");
+    append_string(gen->sb, "  if ($output.length >= ");
+    append_int(gen->sb, CODEGEN_PRINT_BUFFER_SIZE);
+    append_string(gen->sb, ") $flush();\n");
+    append_string(gen->sb, "};\n");
+    append_string(gen->sb, "globalThis.process?.on(\"exit\", $flush);\n\n");
+}
+
+// Statements [first, last) of `program`, each a trace span with a tracing
+// `stats`. A fatal error frees what `gen` holds before it goes on to the
+// caller's recover point.
+static void generate_range(CodeGenerator* gen, ASTNode* program, size_t first, size_t last,
+                           CompileStats* stats) {
+    jmp_buf recover;
+    jmp_buf* outer = gen->diagnostics ? gen->diagnostics->recover : NULL;
+    if (outer) {
+        gen->diagnostics->recover = &recover;
+        if (setjmp(recover) != 0) {
+            const Allocator* allocator = gen->sb->allocator;
+            gen->diagnostics->recover = outer;
+            if (gen->in_function) free_scope(&gen->enclosing);
+            free_scope(&gen->scope);
+            deallocate(allocator, finalize_string_builder(gen->sb));
+            longjmp(*outer, 1);
+        }
+    }
+
+    for (size_t i = first; i < last; i++) {
+        ASTNode* statement = program->data.program.statements[i];
+        if (stats && stats->trace) {
+            size_t offset = gen->sb->size;
+            uint64_t start = stats_now_ns();
+            generate_statement(gen, statement);
+            trace_event(stats, ast_node_type_to_string(statement->type), "codegen", start,
+                        stats_now_ns(), (long)i, offset);
+        } else {
+            generate_statement(gen, statement);
+        }
+    }
+
+    if (outer) gen->diagnostics->recover = outer;
+}
+
+static char* generate_program(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                              const Allocator* allocator, unsigned options) {
     if (node->type != AST_PROGRAM) {
-        fprintf(stderr, "Error: Expected program node for code generation\n");
+        report_error(diagnostics, "Error: Expected program node for code generation");
         return NULL;
     }
     
-    StringBuilder* sb = init_string_builder();
-    append_string(sb, "// Generated by TinyCompiler\n\n");
+    CodeGenerator gen;
+    gen.sb = init_string_builder_with_allocator(allocator);
+    gen.diagnostics = diagnostics;
+    gen.in_function = 0;
+    gen.instrument = (options & CODEGEN_INSTRUMENT) != 0;
+    gen.buffer_output = (options & CODEGEN_BUFFER_OUTPUT) != 0;
+    gen.next_site = 0;
+    init_scope(&gen.scope, allocator);
+    append_string(gen.sb, CODEGEN_HEADER);
+    if (gen.instrument) append_profile_header(&gen, node);
+    if (gen.buffer_output) append_print_runtime(&gen);
     
-    for (size_t i = 0; i < node->data.program.statement_count; i++) {
-        generate_statement(sb, node->data.program.statements[i]);
-    }
+    generate_range(&gen, node, 0, node->data.program.statement_count, stats);
+    if (gen.buffer_output) append_string(gen.sb, "$flush();\n");
     
-    return finalize_string_builder(sb);
+    free_scope(&gen.scope);
+    return finalize_string_builder(gen.sb);
+}
+
+// With a tracing `stats`, each top-level statement is recorded as a span
+// whose offset is where its code starts in the output. The output comes
+// from `allocator`.
+char* generate_code_traced(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                           const Allocator* allocator) {
+    return generate_program(node, diagnostics, stats, allocator, 0);
+}
+
+// generate_code_traced with a counter in front of every statement and at
+// the start of every if arm; run under Node, the program writes the
+// profile parse_profile reads when it exits
+char* generate_code_instrumented(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                                 const Allocator* allocator) {
+    return generate_code_with_options(node, diagnostics, stats, allocator, CODEGEN_INSTRUMENT);
+}
+
+// generate_code_traced with any CODEGEN_* `options`
+char* generate_code_with_options(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                                 const Allocator* allocator, unsigned options) {
+    return generate_program(node, diagnostics, stats, allocator, options);
+}
+
+// Only an assignment directly in the program declares a name that later
+// top-level statements see; blocks and functions have scopes of their own
+void declare_top_level_names(Scope* scope, ASTNode* statement) {
+    if (statement->type == AST_ASSIGN) {
+        declare_once(scope, statement->data.assign.name);
+    }
+}
+
+// Statements [first, last) of `program`, without the header, as
+// generate_code writes them once the top-level names in `declared` exist.
+// The code comes from libc.
+char* generate_statements(ASTNode* program, size_t first, size_t last, const char* const* declared,
+                          size_t declared_count, Diagnostics* diagnostics, size_t* length,
+                          const Allocator* allocator) {
+    CodeGenerator gen;
+    gen.sb = init_string_builder_with_allocator(allocator);
+    gen.diagnostics = diagnostics;
+    gen.in_function = 0;
+    gen.instrument = 0;
+    gen.buffer_output = 0;
+    gen.next_site = 0;
+    init_scope(&gen.scope, allocator);
+    for (size_t i = 0; i < declared_count; i++) {
+        declare_name(&gen.scope, declared[i]);
+    }
+
+    generate_range(&gen, program, first, last, NULL);
+
+    free_scope(&gen.scope);
+    *length = gen.sb->size;
+    return finalize_string_builder(gen.sb);
+}
+
+char* generate_code(ASTNode* node) {
+    return generate_code_with_diagnostics(node, NULL);
 }
 
 void free_code(char* code) {
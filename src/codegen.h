@@ -2,8 +2,37 @@
 #define CODEGEN_H
 
 #include "parser.h"
+#include "diagnostics.h"
+#include "scope.h"
+
+// Every generated program starts with this
+#define CODEGEN_HEADER "// Generated by TinyCompiler\n\n"
+
+// Options for generate_code_with_options, combined with |
+typedef enum {
+    // Count every statement and if arm, see generate_code_instrumented
+    CODEGEN_INSTRUMENT = 0x1,
+    // print() appends to a buffer written out in large pieces instead of
+    // calling console.log each time; the output is the same
+    CODEGEN_BUFFER_OUTPUT = 0x2
+} CodegenOption;
+
+// Prints collected before a flush, in UTF-16 code units
+#define CODEGEN_PRINT_BUFFER_SIZE 65536
 
 char* generate_code(ASTNode* node);
+char* generate_code_with_diagnostics(ASTNode* node, Diagnostics* diagnostics);
+char* generate_code_traced(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                           const Allocator* allocator);
+char* generate_code_instrumented(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                                 const Allocator* allocator);
+char* generate_code_with_options(ASTNode* node, Diagnostics* diagnostics, CompileStats* stats,
+                                 const Allocator* allocator, unsigned options);
 void free_code(char* code);
 
+void declare_top_level_names(Scope* scope, ASTNode* statement);
+char* generate_statements(ASTNode* program, size_t first, size_t last, const char* const* declared,
+                          size_t declared_count, Diagnostics* diagnostics, size_t* length,
+                          const Allocator* allocator);
+
 #endif 
\ No newline at end of file
@@ -0,0 +1,403 @@
+#include "compiler.h"
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "astbin.h"
+#include "strbuf.h"
+
+// Debug builds (-DTINY_VERIFY_PASSES) check the tree after the passes of
+// every compile, as ANALYZE_VERIFY_PASSES does for one
+#ifdef TINY_VERIFY_PASSES
+#define VERIFY_EVERY_COMPILE 1
+#else
+#define VERIFY_EVERY_COMPILE 0
+#endif
+
+// Token list in the tokenize_source format; every value is the token's text
+static char* tokens_to_json(const char* source, const int32_t* tokens, size_t count,
+                            const Allocator* allocator) {
+    StringBuilder* sb = init_string_builder_with_allocator(allocator);
+    reserve_string_builder(sb, count * 32);
+    append_char(sb, '[');
+
+    for (size_t i = 0; i < count; i++) {
+        const int32_t* token = tokens + 3 * i;
+
+        if (i > 0) append_char(sb, ',');
+        append_bytes(sb, "{\"type\":\"", 9);
+        append_string(sb, token_type_to_string((TokenType)token[0]));
+        append_bytes(sb, "\",\"value\":", 10);
+        if (token[0] == TOKEN_EOF) {
+            append_bytes(sb, "null", 4);
+        } else {
+            append_json_string(sb, source + token[1], (size_t)token[2]);
+        }
+        append_char(sb, '}');
+    }
+
+    append_char(sb, ']');
+    return finalize_string_builder(sb);
+}
+
+// Lexes the rest of the source into the lexer's record
+static void lex_remaining(Lexer* lexer) {
+    TokenRecord* record = lexer->record;
+    while (record->used == 1 || record->words[record->used - 3] != TOKEN_EOF) {
+        free_token(lexer, get_next_token(lexer));
+    }
+}
+
+// Lexing runs interleaved with parsing and reading counters per token
+// would cost more than the token, so with counters attached a separate
+// lexing pass is counted into `lexing` and taken out of the front end
+static void count_lex_pass(const char* source, size_t length, const PerfCounters* counters,
+                           CounterSample* lexing) {
+    Diagnostics diagnostics;
+    CounterSample before;
+    Lexer* lexer = init_lexer_with_length((char*)source, length);
+    init_diagnostics(&diagnostics);
+    lexer->diagnostics = &diagnostics;
+
+    read_perf_counters(counters, &before);
+    for (;;) {
+        Token* token = get_next_token(lexer);
+        TokenType type = token->type;
+        free_token(lexer, token);
+        if (type == TOKEN_EOF) break;
+    }
+    read_perf_counters(counters, lexing);
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        lexing->values[i] -= before.values[i];
+    }
+    free_lexer(lexer);
+    free_diagnostics(&diagnostics);
+}
+
+// Splits the counters since begin_phase between lex and parse
+static void add_front_end_counters(CompileStats* stats, const CounterSample* lexing) {
+    CounterSample now;
+    read_perf_counters(stats->counters, &now);
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        uint64_t front_end = now.values[i] - stats->counter_base.values[i];
+        stats->phase_counters[PHASE_LEX].values[i] += lexing->values[i];
+        stats->phase_counters[PHASE_PARSE].values[i] +=
+            front_end > lexing->values[i] ? front_end - lexing->values[i] : 0;
+    }
+}
+
+// Lexes and parses once, then builds every requested output from the same
+// tokens and tree; when only tokens are requested nothing is parsed.
+// Returns 0 on success and 1 on a syntax error, in which case only the
+// tokens are produced and the messages are left in `diagnostics`. Without
+// diagnostics, errors are printed and the process exits. `stats` may be
+// NULL; otherwise the measurements are added to it. Everything, including
+// the outputs, is allocated from `allocator` (NULL for libc).
+int analyze_source(const char* source, size_t length, Diagnostics* diagnostics,
+                   unsigned outputs, Analysis* analysis, CompileStats* stats,
+                   const Allocator* allocator) {
+    return analyze_source_with_hooks(source, length, diagnostics, outputs, analysis, stats,
+                                     allocator, NULL);
+}
+
+// analyze_source with the JavaScript generated by `hooks->codegen`, and
+// with the passes and the layout guided by `hooks->profile`. A profile
+// recorded for a different program is reported as a warning and ignored.
+int analyze_source_with_hooks(const char* source, size_t length, Diagnostics* diagnostics,
+                              unsigned outputs, Analysis* analysis, CompileStats* stats,
+                              const Allocator* allocator, const AnalyzeHooks* hooks) {
+    jmp_buf recover;
+    TokenRecord record;
+    Lexer* lexer = init_lexer_with_allocator((char*)source, length, allocator);
+    Parser* volatile parser = NULL;
+    ASTNode* volatile ast = NULL;
+    volatile int status = 1;
+    volatile int want_tokens = (outputs & (ANALYZE_TOKENS | ANALYZE_TOKENS_JSON)) != 0;
+    // The bits from ANALYZE_PIPELINE up are options, not outputs
+    unsigned tree_outputs = outputs & (ANALYZE_PIPELINE - 1) & ~(ANALYZE_TOKENS | ANALYZE_TOKENS_JSON);
+    CounterSample lexing = {{0}};
+
+    memset(analysis, 0, sizeof(Analysis));
+    analysis->allocator = allocator;
+    lexer->diagnostics = diagnostics;
+    lexer->stats = stats;
+    if (stats && stats->counters && stats->counters->available && tree_outputs) {
+        // Before the allocation baseline, so the extra pass is not counted
+        count_lex_pass(source, length, stats->counters, &lexing);
+    }
+    if (stats) {
+        begin_compile_stats(stats);
+        stats->source_bytes += length;
+    }
+    if (diagnostics) {
+        diagnostics->recover = &recover;
+    }
+
+    if (!tree_outputs) {
+        status = 0;
+    } else if (setjmp(recover) == 0) {
+        if (want_tokens) {
+            init_token_record(&record, length, allocator);
+            lexer->record = &record;
+        }
+
+        uint64_t start = stats ? begin_phase(stats) : 0;
+        uint64_t lex_before = stats ? stats->phase_ns[PHASE_LEX] : 0;
+        parser = init_parser(lexer);
+        parser->share_expressions = (outputs & ANALYZE_SHARE_EXPRESSIONS) != 0;
+        ast = parse(parser);
+        if (stats) {
+            // Lexing happened inside the parse and is reported on its own
+            uint64_t end = stats_now_ns();
+            stats->phase_ns[PHASE_PARSE] += end - start - (stats->phase_ns[PHASE_LEX] - lex_before);
+            if (stats->counters && stats->counters->available) {
+                add_front_end_counters(stats, &lexing);
+            }
+            trace_event(stats, "parse", "phase", start, end, -1, 0);
+            stats->node_count += count_unique_ast_nodes(ast);
+            start = begin_phase(stats);
+        }
+
+        if (outputs & (ANALYZE_AST_JSON | ANALYZE_AST_COMPACT_JSON)) {
+            JsonStyle style = outputs & ANALYZE_AST_COMPACT_JSON ? JSON_COMPACT : JSON_PRETTY;
+            analysis->ast_json = ast_to_json_with_allocator(ast, style, allocator);
+            analysis->ast_json_length = strlen(analysis->ast_json);
+        }
+        if (outputs & ANALYZE_AST_BINARY) {
+            analysis->ast_binary = ast_to_binary_with_allocator(ast, &analysis->ast_binary_length,
+                                                               allocator);
+        }
+        if (stats && (outputs & (ANALYZE_AST_JSON | ANALYZE_AST_COMPACT_JSON | ANALYZE_AST_BINARY))) {
+            add_phase_time(stats, PHASE_SERIALIZE, start);
+            start = begin_phase(stats);
+        }
+
+        // The tree outputs above show the program as written; only the
+        // JavaScript is generated from the optimized tree
+        if (outputs & (ANALYZE_JAVASCRIPT | ANALYZE_CALL_GRAPH)) {
+            CallGraph graph;
+            NodeMap counts;
+            int want_graph = (outputs & ANALYZE_CALL_GRAPH) != 0;
+            int profiled = 0;
+            PassPipeline pipeline = outputs & ANALYZE_PIPELINE ? outputs >> ANALYZE_PIPELINE_SHIFT
+                                                               : optimization_level_pipeline(2);
+            if (outputs & ANALYZE_INSTRUMENT) pipeline = 0;
+            init_node_map(&counts, allocator);
+            if (hooks && hooks->profile) {
+                profiled = apply_profile(hooks->profile, ast, allocator, &counts) == 0;
+                if (!profiled) {
+                    report_warning(diagnostics, "Warning: Ignoring a profile recorded for a "
+                                                "different program");
+                }
+            }
+            if (outputs & ANALYZE_VERIFY_PASSES || VERIFY_EVERY_COMPILE) {
+                if (run_passes_verified(ast, pipeline, allocator, want_graph ? &graph : NULL, stats,
+                                        profiled ? &counts : NULL, diagnostics) != 0) {
+                    // Leaked: freeing a broken tree is not safe
+                    ast = NULL;
+                    free_node_map(&counts);
+                    if (want_graph) free_call_graph(&graph);
+                    longjmp(recover, 1);
+                }
+            } else {
+                run_passes_with_profile(ast, pipeline, allocator, want_graph ? &graph : NULL, stats,
+                                        profiled ? &counts : NULL);
+            }
+            if (profiled) {
+                order_hot_functions(ast, &counts, allocator);
+            }
+            free_node_map(&counts);
+            if (want_graph) {
+                analysis->call_graph = call_graph_to_dot(&graph, allocator);
+                analysis->call_graph_length = strlen(analysis->call_graph);
+                free_call_graph(&graph);
+            }
+            if (stats) {
+                add_phase_time(stats, PHASE_OPTIMIZE, start);
+                start = begin_phase(stats);
+            }
+        }
+        if (outputs & ANALYZE_JAVASCRIPT) {
+            const CodegenHook* codegen = hooks ? hooks->codegen : NULL;
+            unsigned options = (outputs & ANALYZE_INSTRUMENT ? CODEGEN_INSTRUMENT : 0) |
+                               (outputs & ANALYZE_BUFFER_OUTPUT ? CODEGEN_BUFFER_OUTPUT : 0);
+            if (options) {
+                analysis->javascript = generate_code_with_options(ast, diagnostics, stats, allocator,
+                                                                  options);
+            } else if (codegen) {
+                analysis->javascript = codegen->generate(ast, diagnostics, stats, allocator,
+                                                         codegen->data);
+            } else {
+                analysis->javascript = generate_code_traced(ast, diagnostics, stats, allocator);
+            }
+            analysis->javascript_length = strlen(analysis->javascript);
+            if (stats) {
+                add_phase_time(stats, PHASE_CODEGEN, start);
+            }
+        }
+        status = 0;
+    }
+
+    // Re-armed so an allocator refusing memory while the tokens are built
+    // lands here too instead of exiting; the tokens are then dropped
+    if (want_tokens && diagnostics) {
+        if (setjmp(recover) != 0) {
+            want_tokens = 0;
+            status = 1;
+        }
+    }
+
+    if (want_tokens) {
+        if (!lexer->record) {
+            init_token_record(&record, length, allocator);
+            lexer->record = &record;
+        }
+
+        // A syntax error stops the parser early; the rest of the source is
+        // still lexed so the token list is always complete
+        if (stats && !tree_outputs) begin_phase(stats);
+        lex_remaining(lexer);
+        if (stats && !tree_outputs) add_phase_counters(stats, PHASE_LEX);
+        int32_t* tokens = finish_token_record(&record, &analysis->token_count);
+
+        if (outputs & ANALYZE_TOKENS_JSON) {
+            uint64_t start = stats ? begin_phase(stats) : 0;
+            analysis->tokens_json = tokens_to_json(source, tokens + 1, analysis->token_count,
+                                                    allocator);
+            analysis->tokens_json_length = strlen(analysis->tokens_json);
+            if (stats) add_phase_time(stats, PHASE_SERIALIZE, start);
+        }
+        if (outputs & ANALYZE_TOKENS) {
+            analysis->tokens = tokens;
+        } else {
+            deallocate(allocator, tokens);
+        }
+    }
+
+    if (diagnostics) {
+        diagnostics->recover = NULL;
+    }
+
+    free_ast_with_allocator(ast, allocator);
+    if (parser) {
+        free_parser(parser);
+    }
+    free_lexer(lexer);
+
+    if (stats) {
+        stats->output_bytes += analysis->javascript_length + analysis->ast_json_length +
+                               analysis->ast_binary_length + analysis->tokens_json_length +
+                               analysis->call_graph_length;
+        if (analysis->tokens) {
+            stats->output_bytes += (1 + 3 * analysis->token_count) * sizeof(int32_t);
+        }
+        end_compile_stats(stats);
+    }
+
+    return status;
+}
+
+void free_analysis(Analysis* analysis) {
+    const Allocator* allocator = analysis->allocator;
+    deallocate(allocator, analysis->tokens);
+    deallocate(allocator, analysis->tokens_json);
+    deallocate(allocator, analysis->ast_json);
+    deallocate(allocator, analysis->ast_binary);
+    deallocate(allocator, analysis->javascript);
+    deallocate(allocator, analysis->call_graph);
+    memset(analysis, 0, sizeof(Analysis));
+}
+
+// Outputs flags that make analyze_source run `pipeline`; the default -O2
+// pipeline gives 0, so it shares cache keys with flags that name none
+unsigned analyze_pipeline_flags(PassPipeline pipeline) {
+    if (pipeline == optimization_level_pipeline(2)) return 0;
+    return ANALYZE_PIPELINE | pipeline << ANALYZE_PIPELINE_SHIFT;
+}
+
+// Runs analyze_source for a single output and returns it
+static char* run_pipeline(const char* source, size_t length, Diagnostics* diagnostics,
+                          AnalyzeOutput kind, size_t* output_length) {
+    Analysis analysis;
+    analyze_source(source, length, diagnostics, kind, &analysis, NULL, NULL);
+
+    if (kind == ANALYZE_JAVASCRIPT) {
+        return analysis.javascript;
+    } else if (kind == ANALYZE_AST_BINARY) {
+        *output_length = analysis.ast_binary_length;
+        return analysis.ast_binary;
+    } else if (kind == ANALYZE_TOKENS_JSON) {
+        return analysis.tokens_json;
+    }
+    return analysis.ast_json;
+}
+
+char* compile_source(const char* source, size_t length, Diagnostics* diagnostics) {
+    return run_pipeline(source, length, diagnostics, ANALYZE_JAVASCRIPT, NULL);
+}
+
+char* parse_source_to_json(const char* source, size_t length, Diagnostics* diagnostics) {
+    return run_pipeline(source, length, diagnostics, ANALYZE_AST_JSON, NULL);
+}
+
+// Same tree as parse_source_to_json without indentation, for programs that
+// only feed the result to a JSON parser
+char* parse_source_to_compact_json(const char* source, size_t length, Diagnostics* diagnostics) {
+    return run_pipeline(source, length, diagnostics, ANALYZE_AST_COMPACT_JSON, NULL);
+}
+
+// Flat binary tree in the layout documented in astbin.h
+char* parse_source_to_binary(const char* source, size_t length, Diagnostics* diagnostics,
+                             size_t* output_length) {
+    return run_pipeline(source, length, diagnostics, ANALYZE_AST_BINARY, output_length);
+}
+
+char* tokenize_source(const char* source, size_t length, Diagnostics* diagnostics) {
+    return run_pipeline(source, length, diagnostics, ANALYZE_TOKENS_JSON, NULL);
+}
+
+// Returns { count, type, start, length, type, start, length, ... } with one
+// triple per token including the final EOF; start and length are byte
+// offsets into `source`
+int32_t* tokenize_source_to_array(const char* source, size_t length, Diagnostics* diagnostics,
+                                  size_t* token_count) {
+    Analysis analysis;
+    analyze_source(source, length, diagnostics, ANALYZE_TOKENS, &analysis, NULL, NULL);
+    if (token_count) *token_count = analysis.token_count;
+    return analysis.tokens;
+}
+
+// Compiles to JavaScript, adding phase times and counts to `stats`
+char* compile_source_with_stats(const char* source, size_t length, Diagnostics* diagnostics,
+                                CompileStats* stats) {
+    Analysis analysis;
+    analyze_source(source, length, diagnostics, ANALYZE_JAVASCRIPT, &analysis, stats, NULL);
+    return analysis.javascript;
+}
+
+char* compile_string(const char* source) {
+    return compile_source(source, strlen(source), NULL);
+}
+
+char* tokenize_string(const char* source) {
+    return tokenize_source(source, strlen(source), NULL);
+}
+
+char* parse_to_ast(const char* source) {
+    return parse_source_to_json(source, strlen(source), NULL);
+}
+
+// Returns a cached copy when this exact source was compiled before with the
+// same options; the result is owned by the caller either way
+char* compile_string_cached(CompileCache* cache, const char* source, uint32_t options) {
+    if (!cache) return compile_string(source);
+
+    size_t length = strlen(source);
+    char* output = cache_lookup(cache, source, length, options);
+    if (output) return output;
+
+    output = compile_string(source);
+    cache_store(cache, source, length, options, output);
+    return output;
+}
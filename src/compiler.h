@@ -0,0 +1,99 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "diagnostics.h"
+#include "cache.h"
+#include "stats.h"
+#include "allocator.h"
+#include "passes.h"
+#include "profile.h"
+
+// Outputs analyze_source can produce from a single lex and parse
+typedef enum {
+    ANALYZE_TOKENS = 0x1,
+    ANALYZE_AST_JSON = 0x2,
+    ANALYZE_AST_COMPACT_JSON = 0x4,
+    ANALYZE_AST_BINARY = 0x8,
+    ANALYZE_JAVASCRIPT = 0x10,
+    ANALYZE_TOKENS_JSON = 0x20,
+    ANALYZE_CALL_GRAPH = 0x40,
+    // Not an output: the bits from ANALYZE_PIPELINE_SHIFT up hold the
+    // PassPipeline to optimize with instead of the default -O2 one, see
+    // analyze_pipeline_flags
+    ANALYZE_PIPELINE = 0x80,
+    // Not an output either: parse with parser->share_expressions set
+    ANALYZE_SHARE_EXPRESSIONS = 0x100,
+    // Nor this: generate_code_instrumented JavaScript from the tree as
+    // parsed, without running any pass, so the counts match its sites
+    ANALYZE_INSTRUMENT = 0x200,
+    // Nor this: print() in the JavaScript through CODEGEN_BUFFER_OUTPUT
+    ANALYZE_BUFFER_OUTPUT = 0x400,
+    // Nor this: check the tree after every pass with run_passes_verified
+    // and fail the compile when one broke it. Always on in builds with
+    // TINY_VERIFY_PASSES defined.
+    ANALYZE_VERIFY_PASSES = 0x800
+} AnalyzeOutput;
+
+#define ANALYZE_PIPELINE_SHIFT 12
+
+// Fields for outputs that were not requested, or that need a tree when the
+// source has a syntax error, are NULL
+typedef struct {
+    int32_t* tokens;            // count word, then triples as from tokenize_source_to_array
+    size_t token_count;
+    char* tokens_json;
+    size_t tokens_json_length;
+    char* ast_json;             // compact when ANALYZE_AST_COMPACT_JSON was requested
+    size_t ast_json_length;
+    char* ast_binary;
+    size_t ast_binary_length;
+    char* javascript;
+    size_t javascript_length;
+    char* call_graph;           // Graphviz source, see call_graph_to_dot
+    size_t call_graph_length;
+    const Allocator* allocator;   // every output was allocated from it
+} Analysis;
+
+// Generates the JavaScript in place of generate_code_traced, e.g. on
+// several threads (see parcodegen.h); `data` is passed through
+typedef struct {
+    char* (*generate)(ASTNode* program, Diagnostics* diagnostics, CompileStats* stats,
+                      const Allocator* allocator, void* data);
+    void* data;
+} CodegenHook;
+
+// What analyze_source_with_hooks takes beyond analyze_source; either may
+// be NULL
+typedef struct {
+    const CodegenHook* codegen;    // not used with ANALYZE_INSTRUMENT or ANALYZE_BUFFER_OUTPUT
+    const Profile* profile;        // counts from an instrumented run to optimize with
+} AnalyzeHooks;
+
+int analyze_source(const char* source, size_t length, Diagnostics* diagnostics,
+                   unsigned outputs, Analysis* analysis, CompileStats* stats,
+                   const Allocator* allocator);
+int analyze_source_with_hooks(const char* source, size_t length, Diagnostics* diagnostics,
+                              unsigned outputs, Analysis* analysis, CompileStats* stats,
+                              const Allocator* allocator, const AnalyzeHooks* hooks);
+void free_analysis(Analysis* analysis);
+unsigned analyze_pipeline_flags(PassPipeline pipeline);
+
+char* compile_source(const char* source, size_t length, Diagnostics* diagnostics);
+char* compile_source_with_stats(const char* source, size_t length, Diagnostics* diagnostics,
+                                CompileStats* stats);
+char* tokenize_source(const char* source, size_t length, Diagnostics* diagnostics);
+int32_t* tokenize_source_to_array(const char* source, size_t length, Diagnostics* diagnostics,
+                                  size_t* token_count);
+char* parse_source_to_json(const char* source, size_t length, Diagnostics* diagnostics);
+char* parse_source_to_compact_json(const char* source, size_t length, Diagnostics* diagnostics);
+char* parse_source_to_binary(const char* source, size_t length, Diagnostics* diagnostics,
+                             size_t* output_length);
+
+char* compile_string(const char* source);
+char* tokenize_string(const char* source);
+char* parse_to_ast(const char* source);
+char* compile_string_cached(CompileCache* cache, const char* source, uint32_t options);
+
+#endif
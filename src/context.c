@@ -0,0 +1,177 @@
+#include "tiny.h"
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct TinyContext {
+    TinyOptions options;
+    Allocator host;                // the embedder's allocator, or libc
+    CountingAllocator counting;    // over `host`, for limits and stats
+    Allocator counted;
+    const Allocator* allocator;    // what the compiler is given
+    Diagnostics diagnostics;
+    Analysis analysis;
+    CompileStats stats;
+};
+
+TinyContext* tiny_create_context(const TinyOptions* options) {
+    TinyContext* context = calloc(1, sizeof(TinyContext));
+    if (options) {
+        context->options = *options;
+    }
+    init_diagnostics(&context->diagnostics);
+    init_compile_stats(&context->stats, 0);
+
+    const TinyAllocator* host = context->options.allocator;
+    if (host) {
+        context->host.alloc = host->alloc;
+        context->host.realloc = host->realloc;
+        context->host.free = host->free;
+        context->host.user = host->user;
+    } else {
+        context->host = libc_allocator;
+    }
+    context->allocator = &context->host;
+
+    // Counting costs a header per allocation, so only when something needs it
+    if (context->options.memory_limit > 0 || (context->options.flags & TINY_COLLECT_STATS)) {
+        init_counting_allocator(&context->counting, &context->host, context->options.memory_limit,
+                                &context->diagnostics);
+        context->counted = counting_allocator(&context->counting);
+        context->allocator = &context->counted;
+    }
+    return context;
+}
+
+void tiny_destroy_context(TinyContext* context) {
+    if (!context) return;
+
+    free_analysis(&context->analysis);
+    release_counted_blocks(&context->counting);
+    free_compile_stats(&context->stats);
+    free_diagnostics(&context->diagnostics);
+    free(context);
+}
+
+// Replaces the previous results with `outputs` (ANALYZE_* flags) for `source`
+static TinyStatus run(TinyContext* context, const char* source, size_t length, unsigned outputs) {
+    free_analysis(&context->analysis);
+    reset_diagnostics(&context->diagnostics);
+
+    reset_allocation_counts(&context->counting);
+
+    if (context->options.flags & TINY_BUFFER_OUTPUT) outputs |= ANALYZE_BUFFER_OUTPUT;
+
+    CompileStats* stats = NULL;
+    if (context->options.flags & TINY_COLLECT_STATS) {
+        reset_compile_stats(&context->stats);
+        stats = &context->stats;
+    }
+
+    int status = analyze_source(source, length, &context->diagnostics, outputs,
+                                &context->analysis, stats, context->allocator);
+
+    if (context->counting.failed) {
+        // The compilation was abandoned part way; whatever it still held is
+        // only known to the counting allocator
+        free_analysis(&context->analysis);
+        release_counted_blocks(&context->counting);
+    }
+    if (stats) {
+        stats->alloc_count = context->counting.alloc_count;
+        stats->alloc_bytes = context->counting.alloc_bytes;
+    }
+    return status == 0 ? TINY_OK : TINY_ERROR;
+}
+
+static TinyStatus text_result(TinyStatus status, char* text, size_t text_length,
+                              const char** output, size_t* output_length) {
+    if (output) *output = text;
+    if (output_length) *output_length = text_length;
+    return status;
+}
+
+TinyStatus tiny_compile(TinyContext* context, const char* source, size_t length,
+                        const char** output, size_t* output_length) {
+    TinyStatus status = run(context, source, length, ANALYZE_JAVASCRIPT);
+    Analysis* result = &context->analysis;
+    return text_result(status, result->javascript, result->javascript_length, output, output_length);
+}
+
+TinyStatus tiny_tokenize(TinyContext* context, const char* source, size_t length,
+                         const char** output, size_t* output_length) {
+    TinyStatus status = run(context, source, length, ANALYZE_TOKENS_JSON);
+    Analysis* result = &context->analysis;
+    return text_result(status, result->tokens_json, result->tokens_json_length, output, output_length);
+}
+
+TinyStatus tiny_tokenize_array(TinyContext* context, const char* source, size_t length,
+                               const int32_t** tokens, size_t* token_count) {
+    TinyStatus status = run(context, source, length, ANALYZE_TOKENS);
+
+    if (tokens) *tokens = context->analysis.tokens ? context->analysis.tokens + 1 : NULL;
+    if (token_count) *token_count = context->analysis.token_count;
+    return status;
+}
+
+TinyStatus tiny_parse(TinyContext* context, const char* source, size_t length,
+                      const char** output, size_t* output_length) {
+    unsigned outputs = context->options.flags & TINY_COMPACT_JSON ? ANALYZE_AST_COMPACT_JSON
+                                                                  : ANALYZE_AST_JSON;
+    TinyStatus status = run(context, source, length, outputs);
+    Analysis* result = &context->analysis;
+    return text_result(status, result->ast_json, result->ast_json_length, output, output_length);
+}
+
+TinyStatus tiny_parse_binary(TinyContext* context, const char* source, size_t length,
+                             const char** output, size_t* output_length) {
+    TinyStatus status = run(context, source, length, ANALYZE_AST_BINARY);
+    Analysis* result = &context->analysis;
+    return text_result(status, result->ast_binary, result->ast_binary_length, output, output_length);
+}
+
+TinyStatus tiny_analyze(TinyContext* context, const char* source, size_t length,
+                        uint32_t outputs, TinyAnalysis* analysis) {
+    unsigned requested = 0;
+    if (outputs & TINY_ANALYZE_TOKENS) requested |= ANALYZE_TOKENS;
+    if (outputs & TINY_ANALYZE_AST) {
+        requested |= context->options.flags & TINY_COMPACT_JSON ? ANALYZE_AST_COMPACT_JSON
+                                                                 : ANALYZE_AST_JSON;
+    }
+    if (outputs & TINY_ANALYZE_AST_BINARY) requested |= ANALYZE_AST_BINARY;
+    if (outputs & TINY_ANALYZE_JAVASCRIPT) requested |= ANALYZE_JAVASCRIPT;
+
+    TinyStatus status = run(context, source, length, requested);
+    Analysis* result = &context->analysis;
+
+    analysis->tokens = result->tokens ? result->tokens + 1 : NULL;
+    analysis->token_count = result->token_count;
+    analysis->ast = result->ast_json;
+    analysis->ast_length = result->ast_json_length;
+    analysis->ast_binary = result->ast_binary;
+    analysis->ast_binary_length = result->ast_binary_length;
+    analysis->javascript = result->javascript;
+    analysis->javascript_length = result->javascript_length;
+
+    return status;
+}
+
+void tiny_get_stats(const TinyContext* context, TinyStats* stats) {
+    const CompileStats* source = &context->stats;
+
+    stats->lex_ms = source->phase_ns[PHASE_LEX] / 1e6;
+    stats->parse_ms = source->phase_ns[PHASE_PARSE] / 1e6;
+    stats->codegen_ms = source->phase_ns[PHASE_CODEGEN] / 1e6;
+    stats->serialize_ms = source->phase_ns[PHASE_SERIALIZE] / 1e6;
+    stats->token_count = source->token_count;
+    stats->node_count = source->node_count;
+    stats->alloc_count = source->alloc_count;
+    stats->alloc_bytes = source->alloc_bytes;
+    stats->peak_rss_bytes = source->peak_rss_bytes;
+    stats->output_bytes = source->output_bytes;
+    stats->optimize_ms = source->phase_ns[PHASE_OPTIMIZE] / 1e6;
+}
+
+const char* tiny_diagnostics(const TinyContext* context) {
+    return context->diagnostics.text ? context->diagnostics.text : "";
+}
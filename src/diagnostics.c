@@ -0,0 +1,95 @@
+#include "diagnostics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+void init_diagnostics(Diagnostics* diagnostics) {
+    diagnostics->text = NULL;
+    diagnostics->length = 0;
+    diagnostics->capacity = 0;
+    diagnostics->error_count = 0;
+    diagnostics->warning_count = 0;
+    diagnostics->recover = NULL;
+}
+
+void reset_diagnostics(Diagnostics* diagnostics) {
+    diagnostics->length = 0;
+    diagnostics->error_count = 0;
+    diagnostics->warning_count = 0;
+    if (diagnostics->text) {
+        diagnostics->text[0] = '\0';
+    }
+}
+
+void free_diagnostics(Diagnostics* diagnostics) {
+    free(diagnostics->text);
+    init_diagnostics(diagnostics);
+}
+
+static void append_message(Diagnostics* diagnostics, const char* format, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int needed = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    if (needed < 0) return;
+
+    // One message per line, each terminated by '\n'
+    size_t required = diagnostics->length + needed + 2;
+    if (required > diagnostics->capacity) {
+        diagnostics->capacity = required * 2;
+        diagnostics->text = realloc(diagnostics->text, diagnostics->capacity);
+    }
+
+    vsnprintf(diagnostics->text + diagnostics->length, needed + 1, format, args);
+    diagnostics->length += needed;
+    diagnostics->text[diagnostics->length++] = '\n';
+    diagnostics->text[diagnostics->length] = '\0';
+}
+
+void report_error(Diagnostics* diagnostics, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    if (diagnostics) {
+        append_message(diagnostics, format, args);
+        diagnostics->error_count++;
+    } else {
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+    }
+
+    va_end(args);
+}
+
+void report_warning(Diagnostics* diagnostics, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    if (diagnostics) {
+        append_message(diagnostics, format, args);
+        diagnostics->warning_count++;
+    } else {
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+    }
+
+    va_end(args);
+}
+
+_Noreturn void report_fatal(Diagnostics* diagnostics, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    if (diagnostics && diagnostics->recover) {
+        append_message(diagnostics, format, args);
+        diagnostics->error_count++;
+        va_end(args);
+        longjmp(*diagnostics->recover, 1);
+    }
+
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(1);
+}
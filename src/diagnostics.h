@@ -0,0 +1,26 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <setjmp.h>
+#include <stddef.h>
+
+// Collects compiler messages for one compilation. When `recover` is set,
+// fatal errors jump back to it instead of terminating the process. Warnings
+// share the text but are not counted as errors.
+typedef struct {
+    char* text;
+    size_t length;
+    size_t capacity;
+    int error_count;
+    int warning_count;
+    jmp_buf* recover;
+} Diagnostics;
+
+void init_diagnostics(Diagnostics* diagnostics);
+void reset_diagnostics(Diagnostics* diagnostics);
+void free_diagnostics(Diagnostics* diagnostics);
+void report_error(Diagnostics* diagnostics, const char* format, ...);
+void report_warning(Diagnostics* diagnostics, const char* format, ...);
+_Noreturn void report_fatal(Diagnostics* diagnostics, const char* format, ...);
+
+#endif
@@ -0,0 +1,950 @@
+#include "evaluate.h"
+#include "scope.h"
+#include "strbuf.h"
+#include <math.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_STEPS (1 << 22)      // nodes evaluated in the whole program
+#define MAX_OUTPUT (1 << 20)     // bytes of precomputed output
+#define MAX_CALL_DEPTH 256
+#define NO_BINDING ((size_t)-1)
+
+typedef enum {
+    VALUE_UNKNOWN,    // last assigned by a statement left to run
+    VALUE_NUMBER,
+    VALUE_BOOLEAN,
+    VALUE_UNDEFINED
+} ValueKind;
+
+typedef struct {
+    ValueKind kind;
+    double number;    // 0 or 1 for booleans
+} Value;
+
+// A parameter, or a `let` of the generated code while its block runs
+typedef struct {
+    size_t name;          // index into names
+    size_t previous;      // binding of the same name it shadows
+    size_t frame;
+    int initialized;      // not in its temporal dead zone any more
+    int dirty;            // top level: changed since the output last assigned it
+    Value value;
+} Binding;
+
+// A top-level binding as it was before the running statement changed it
+typedef struct {
+    size_t index;
+    Binding saved;
+} Undo;
+
+typedef struct {
+    ASTNode** nodes;
+    size_t count;
+    size_t capacity;
+} NodeList;
+
+typedef struct {
+    const Allocator* allocator;
+    const char** names;         // every identifier in the program, sorted
+    size_t name_count;
+    ASTNode** functions;        // the definition each name calls, if any
+    size_t* innermost;          // the newest binding of each name
+    size_t* marks;              // when each name was last seen, see mark_names
+    size_t mark;
+    size_t* marked;             // names seen since the mark was last moved
+    size_t marked_count;
+    NodeList declarations;      // assignments the generated code declares, sorted
+
+    Binding* bindings;
+    size_t binding_count;
+    size_t binding_capacity;
+    size_t* frames;             // first binding of each open block
+    size_t frame_count;
+    size_t frame_capacity;
+    size_t base;                // frame of the running function's parameters
+    size_t global_count;        // bindings of the top level, all in frame 0
+    size_t depth;
+    Value* arguments;           // evaluated for calls not entered yet
+    size_t argument_count;
+    size_t argument_capacity;
+    Value returned;
+
+    Undo* undo;
+    size_t undo_count;
+    size_t undo_capacity;
+    StringBuilder* output;      // printed by the running statement
+    StringBuilder* folded;      // printed by the statements run since the last one left
+    size_t steps;
+    jmp_buf fault;
+} Evaluator;
+
+// Identifiers the generated JavaScript cannot declare, or whose
+// declaration changes what console.log or the constants mean
+static const char* const RESERVED_NAMES[] = {
+    "Infinity", "NaN", "arguments", "await", "break", "case", "catch", "class", "console",
+    "const", "continue", "debugger", "default", "delete", "do", "else", "enum", "eval",
+    "export", "extends", "false", "finally", "for", "function", "if", "implements", "import",
+    "in", "instanceof", "interface", "let", "new", "null", "package", "private", "protected",
+    "public", "return", "static", "super", "switch", "this", "throw", "true", "try", "typeof",
+    "undefined", "var", "void", "while", "with", "yield"
+};
+
+static void add_node(Evaluator* ev, NodeList* list, ASTNode* node) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->nodes = reallocate(ev->allocator, list->nodes, list->capacity * sizeof(ASTNode*));
+    }
+    list->nodes[list->count++] = node;
+}
+
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int compare_nodes(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(ASTNode* const*)a;
+    uintptr_t y = (uintptr_t)*(ASTNode* const*)b;
+    return x < y ? -1 : x > y;
+}
+
+static size_t find_name(Evaluator* ev, const char* name) {
+    // The list is NULL for a program without names
+    if (ev->name_count == 0) return NO_BINDING;
+    const char** found = bsearch(&name, ev->names, ev->name_count, sizeof(const char*),
+                                 compare_strings);
+    return found ? (size_t)(found - ev->names) : NO_BINDING;
+}
+
+static int is_declaration(Evaluator* ev, ASTNode* node) {
+    return bsearch(&node, ev->declarations.nodes, ev->declarations.count, sizeof(ASTNode*),
+                   compare_nodes) != NULL;
+}
+
+static void add_name(Evaluator* ev, size_t* capacity, const char* name) {
+    if (ev->name_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        ev->names = reallocate(ev->allocator, ev->names, *capacity * sizeof(const char*));
+    }
+    ev->names[ev->name_count++] = name;
+}
+
+static void collect_names(Evaluator* ev, ASTNode* node, size_t* capacity) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                collect_names(ev, node->data.program.statements[i], capacity);
+            }
+            break;
+        case AST_VARIABLE:
+            add_name(ev, capacity, node->data.variable.name);
+            break;
+        case AST_BINARY_OP:
+            collect_names(ev, node->data.binary_op.left, capacity);
+            collect_names(ev, node->data.binary_op.right, capacity);
+            break;
+        case AST_ASSIGN:
+            add_name(ev, capacity, node->data.assign.name);
+            collect_names(ev, node->data.assign.value, capacity);
+            break;
+        case AST_IF:
+            collect_names(ev, node->data.if_statement.condition, capacity);
+            collect_names(ev, node->data.if_statement.if_body, capacity);
+            collect_names(ev, node->data.if_statement.else_body, capacity);
+            break;
+        case AST_PRINT:
+            collect_names(ev, node->data.print.expression, capacity);
+            break;
+        case AST_WHILE:
+            collect_names(ev, node->data.while_loop.condition, capacity);
+            collect_names(ev, node->data.while_loop.body, capacity);
+            break;
+        case AST_FUNCTION:
+            add_name(ev, capacity, node->data.function.name);
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                add_name(ev, capacity, node->data.function.params[i]);
+            }
+            collect_names(ev, node->data.function.body, capacity);
+            break;
+        case AST_CALL:
+            add_name(ev, capacity, node->data.call.name);
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                collect_names(ev, node->data.call.args[i], capacity);
+            }
+            break;
+        case AST_RETURN:
+            collect_names(ev, node->data.return_statement.value, capacity);
+            break;
+        default:
+            break;
+    }
+}
+
+static void find_declarations(Evaluator* ev, Scope* scope, ASTNode* block);
+
+static void find_block_declarations(Evaluator* ev, Scope* scope, ASTNode* block) {
+    enter_block(scope);
+    find_declarations(ev, scope, block);
+    leave_block(scope);
+}
+
+// The assignments generate_statement declares with `let`, found the same
+// way, so each block can start with its bindings in their dead zone
+static void find_declarations(Evaluator* ev, Scope* scope, ASTNode* block) {
+    for (size_t i = 0; i < block->data.program.statement_count; i++) {
+        ASTNode* statement = block->data.program.statements[i];
+
+        switch (statement->type) {
+            case AST_ASSIGN:
+                if (declare_once(scope, statement->data.assign.name)) {
+                    add_node(ev, &ev->declarations, statement);
+                }
+                break;
+            case AST_IF:
+                find_block_declarations(ev, scope, statement->data.if_statement.if_body);
+                if (statement->data.if_statement.else_body) {
+                    find_block_declarations(ev, scope, statement->data.if_statement.else_body);
+                }
+                break;
+            case AST_WHILE:
+                find_block_declarations(ev, scope, statement->data.while_loop.body);
+                break;
+            case AST_FUNCTION: {
+                Scope inner;
+                init_scope(&inner, ev->allocator);
+                for (size_t j = 0; j < statement->data.function.param_count; j++) {
+                    declare_name(&inner, statement->data.function.params[j]);
+                }
+                find_block_declarations(ev, &inner, statement->data.function.body);
+                free_scope(&inner);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// Whether the generated JavaScript loads and means what the evaluator
+// assumes: a top-level `let` and a function of the same name are a syntax
+// error, and a few names are not Tiny's to declare
+static int is_loadable(Evaluator* ev, ASTNode* program) {
+    for (size_t i = 0; i < sizeof(RESERVED_NAMES) / sizeof(RESERVED_NAMES[0]); i++) {
+        if (find_name(ev, RESERVED_NAMES[i]) != NO_BINDING) return 0;
+    }
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* statement = program->data.program.statements[i];
+        if (statement->type == AST_ASSIGN && is_declaration(ev, statement) &&
+            ev->functions[find_name(ev, statement->data.assign.name)]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void fault(Evaluator* ev) {
+    longjmp(ev->fault, 1);
+}
+
+static void step(Evaluator* ev) {
+    if (++ev->steps > MAX_STEPS) fault(ev);
+}
+
+static Value number_value(double number) {
+    Value value = { VALUE_NUMBER, number };
+    return value;
+}
+
+static Value boolean_value(int truth) {
+    Value value = { VALUE_BOOLEAN, truth ? 1 : 0 };
+    return value;
+}
+
+static Value undefined_value(void) {
+    Value value = { VALUE_UNDEFINED, 0 };
+    return value;
+}
+
+static void open_frame(Evaluator* ev) {
+    if (ev->frame_count == ev->frame_capacity) {
+        ev->frame_capacity = ev->frame_capacity ? ev->frame_capacity * 2 : 32;
+        ev->frames = reallocate(ev->allocator, ev->frames, ev->frame_capacity * sizeof(size_t));
+    }
+    ev->frames[ev->frame_count++] = ev->binding_count;
+}
+
+static void close_frame(Evaluator* ev) {
+    size_t first = ev->frames[--ev->frame_count];
+    while (ev->binding_count > first) {
+        Binding* binding = &ev->bindings[--ev->binding_count];
+        ev->innermost[binding->name] = binding->previous;
+    }
+}
+
+static void push_binding(Evaluator* ev, size_t name, int initialized, Value value) {
+    if (ev->binding_count == ev->binding_capacity) {
+        ev->binding_capacity = ev->binding_capacity ? ev->binding_capacity * 2 : 64;
+        ev->bindings = reallocate(ev->allocator, ev->bindings,
+                                  ev->binding_capacity * sizeof(Binding));
+    }
+    Binding* binding = &ev->bindings[ev->binding_count];
+    binding->name = name;
+    binding->previous = ev->innermost[name];
+    binding->frame = ev->frame_count - 1;
+    binding->initialized = initialized;
+    binding->dirty = 0;
+    binding->value = value;
+    ev->innermost[name] = ev->binding_count++;
+}
+
+// The binding `name` refers to where the running code is: the innermost
+// one of the running function, or of the top level. Blocks of callers
+// further up are not visible.
+static size_t resolve(Evaluator* ev, size_t name) {
+    size_t index = ev->innermost[name];
+    while (index != NO_BINDING && ev->bindings[index].frame > 0 &&
+           ev->bindings[index].frame < ev->base) {
+        index = ev->bindings[index].previous;
+    }
+    return index;
+}
+
+static void set_binding(Evaluator* ev, size_t index, Value value) {
+    if (index < ev->global_count) {
+        if (ev->undo_count == ev->undo_capacity) {
+            ev->undo_capacity = ev->undo_capacity ? ev->undo_capacity * 2 : 64;
+            ev->undo = reallocate(ev->allocator, ev->undo, ev->undo_capacity * sizeof(Undo));
+        }
+        ev->undo[ev->undo_count].index = index;
+        ev->undo[ev->undo_count].saved = ev->bindings[index];
+        ev->undo_count++;
+        ev->bindings[index].dirty = 1;
+    }
+    ev->bindings[index].initialized = 1;
+    ev->bindings[index].value = value;
+}
+
+// Enters a block with the bindings it declares in their dead zone, as
+// `let` hoists them in JavaScript
+static void open_block(Evaluator* ev, ASTNode* block) {
+    open_frame(ev);
+    for (size_t i = 0; i < block->data.program.statement_count; i++) {
+        ASTNode* statement = block->data.program.statements[i];
+        if (statement->type == AST_ASSIGN && is_declaration(ev, statement)) {
+            push_binding(ev, find_name(ev, statement->data.assign.name), 0, undefined_value());
+        }
+    }
+}
+
+static double to_number(Value value) {
+    return value.kind == VALUE_UNDEFINED ? NAN : value.number;
+}
+
+static int is_truthy(Value value) {
+    return value.kind != VALUE_UNDEFINED && value.number != 0 && !isnan(value.number);
+}
+
+static int strictly_equal(Value a, Value b) {
+    if (a.kind != b.kind) return 0;
+    return a.kind == VALUE_UNDEFINED || a.number == b.number;
+}
+
+static Value evaluate_expression(Evaluator* ev, ASTNode* node);
+static int execute_statement(Evaluator* ev, ASTNode* node);
+
+static Value apply_operator(Evaluator* ev, char op, Value left, Value right) {
+    double a = to_number(left);
+    double b = to_number(right);
+
+    switch (op) {
+        case '+': return number_value(a + b);
+        case '-': return number_value(a - b);
+        case '*': return number_value(a * b);
+        case '/':
+            // Infinity or NaN in JavaScript, but most likely a mistake the
+            // program should show when it runs
+            if (b == 0) fault(ev);
+            return number_value(a / b);
+        case '<': return boolean_value(a < b);
+        case '>': return boolean_value(a > b);
+        case 'L': return boolean_value(a <= b);
+        case 'G': return boolean_value(a >= b);
+        case '=': return boolean_value(strictly_equal(left, right));
+        case '!': return boolean_value(!strictly_equal(left, right));
+    }
+    fault(ev);
+    return left;
+}
+
+static Value read_variable(Evaluator* ev, const char* name) {
+    size_t index = resolve(ev, find_name(ev, name));
+    if (index == NO_BINDING || !ev->bindings[index].initialized ||
+        ev->bindings[index].value.kind == VALUE_UNKNOWN) {
+        fault(ev);
+    }
+    return ev->bindings[index].value;
+}
+
+static Value call_function(Evaluator* ev, ASTNode* call) {
+    size_t name = find_name(ev, call->data.call.name);
+    ASTNode* function = ev->functions[name];
+
+    // A variable of the same name hides the function
+    if (!function || resolve(ev, name) != NO_BINDING) fault(ev);
+
+    size_t first = ev->argument_count;
+    for (size_t i = 0; i < call->data.call.arg_count; i++) {
+        Value value = evaluate_expression(ev, call->data.call.args[i]);
+        if (ev->argument_count == ev->argument_capacity) {
+            ev->argument_capacity = ev->argument_capacity ? ev->argument_capacity * 2 : 16;
+            ev->arguments = reallocate(ev->allocator, ev->arguments,
+                                       ev->argument_capacity * sizeof(Value));
+        }
+        ev->arguments[ev->argument_count++] = value;
+    }
+    if (++ev->depth > MAX_CALL_DEPTH) fault(ev);
+
+    size_t base = ev->base;
+    open_frame(ev);
+    ev->base = ev->frame_count - 1;
+    for (size_t i = 0; i < function->data.function.param_count; i++) {
+        size_t param = find_name(ev, function->data.function.params[i]);
+        if (ev->innermost[param] != NO_BINDING &&
+            ev->bindings[ev->innermost[param]].frame == ev->base) {
+            fault(ev);
+        }
+        // Missing arguments are undefined, extra ones are evaluated only
+        push_binding(ev, param, 1,
+                     i < call->data.call.arg_count ? ev->arguments[first + i] : undefined_value());
+    }
+    ev->argument_count = first;
+
+    ASTNode* body = function->data.function.body;
+    Value result = undefined_value();
+    open_block(ev, body);
+    for (size_t i = 0; i < body->data.program.statement_count; i++) {
+        if (execute_statement(ev, body->data.program.statements[i])) {
+            result = ev->returned;
+            break;
+        }
+    }
+    close_frame(ev);
+    close_frame(ev);
+    ev->base = base;
+    ev->depth--;
+    return result;
+}
+
+static Value evaluate_expression(Evaluator* ev, ASTNode* node) {
+    step(ev);
+
+    switch (node->type) {
+        case AST_NUMBER:
+            return number_value(node->data.number.value);
+        case AST_VARIABLE:
+            return read_variable(ev, node->data.variable.name);
+        case AST_BINARY_OP: {
+            Value left = evaluate_expression(ev, node->data.binary_op.left);
+            Value right = evaluate_expression(ev, node->data.binary_op.right);
+            return apply_operator(ev, node->data.binary_op.op, left, right);
+        }
+        case AST_CALL:
+            return call_function(ev, node);
+        default:
+            fault(ev);
+            return undefined_value();
+    }
+}
+
+// Runs the statements of an if or while body; returns whether one of
+// them returned
+static int execute_block(Evaluator* ev, ASTNode* block) {
+    int returned = 0;
+    open_block(ev, block);
+    for (size_t i = 0; i < block->data.program.statement_count && !returned; i++) {
+        returned = execute_statement(ev, block->data.program.statements[i]);
+    }
+    close_frame(ev);
+    return returned;
+}
+
+// Number::toString digits: the fewest that read back as the same double
+static void format_number(char* buffer, double value) {
+    if (isnan(value)) {
+        strcpy(buffer, "NaN");
+        return;
+    }
+    if (isinf(value)) {
+        strcpy(buffer, value < 0 ? "-Infinity" : "Infinity");
+        return;
+    }
+    if (value == 0) {
+        // console.log shows the sign of a negative zero
+        strcpy(buffer, signbit(value) ? "-0" : "0");
+        return;
+    }
+    if (value < 0) {
+        *buffer++ = '-';
+        value = -value;
+    }
+
+    // value is about mantissa * 10^scale; the correctly rounded mantissa
+    // of a given length may miss by one where the gap between doubles
+    // changes, so its neighbours are tried too
+    unsigned long long mantissa = 0;
+    int scale = 0;
+    for (int precision = 1; precision <= 17; precision++) {
+        char text[40];
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        char* exponent = strchr(text, 'e');
+        unsigned long long digits = 0;
+        for (char* c = text; c < exponent; c++) {
+            if (*c != '.') digits = digits * 10 + (unsigned long long)(*c - '0');
+        }
+        scale = atoi(exponent + 1) - (precision - 1);
+
+        unsigned long long candidates[3] = { digits, digits + 1, digits - 1 };
+        int found = 0;
+        for (int i = 0; i < 3 && !found; i++) {
+            snprintf(text, sizeof(text), "%llue%d", candidates[i], scale);
+            if (strtod(text, NULL) == value) {
+                mantissa = candidates[i];
+                found = 1;
+            }
+        }
+        if (found || precision == 17) {
+            if (!found) mantissa = digits;
+            break;
+        }
+    }
+    while (mantissa % 10 == 0) {
+        mantissa /= 10;
+        scale++;
+    }
+
+    // The k digits stand for digits * 10^(n - k)
+    char digits[24];
+    int k = snprintf(digits, sizeof(digits), "%llu", mantissa);
+    int n = k + scale;
+    if (k <= n && n <= 21) {
+        memcpy(buffer, digits, (size_t)k);
+        memset(buffer + k, '0', (size_t)(n - k));
+        buffer[n] = '\0';
+    } else if (0 < n && n <= 21) {
+        sprintf(buffer, "%.*s.%s", n, digits, digits + n);
+    } else if (-6 < n && n <= 0) {
+        memcpy(buffer, "0.", 2);
+        memset(buffer + 2, '0', (size_t)-n);
+        strcpy(buffer + 2 - n, digits);
+    } else {
+        sprintf(buffer, "%c%s%se%c%d", digits[0], k > 1 ? "." : "", digits + 1,
+                n - 1 < 0 ? '-' : '+', abs(n - 1));
+    }
+}
+
+// What console.log prints for the value
+static void append_value(StringBuilder* sb, Value value) {
+    char number[40];
+
+    switch (value.kind) {
+        case VALUE_NUMBER:
+            format_number(number, value.number);
+            append_string(sb, number);
+            break;
+        case VALUE_BOOLEAN:
+            append_string(sb, value.number ? "true" : "false");
+            break;
+        default:
+            append_string(sb, "undefined");
+            break;
+    }
+}
+
+// Returns whether a return statement ran
+static int execute_statement(Evaluator* ev, ASTNode* node) {
+    step(ev);
+
+    switch (node->type) {
+        case AST_ASSIGN: {
+            Value value = evaluate_expression(ev, node->data.assign.value);
+            size_t name = find_name(ev, node->data.assign.name);
+            if (is_declaration(ev, node)) {
+                set_binding(ev, ev->innermost[name], value);
+            } else {
+                size_t index = resolve(ev, name);
+                if (index == NO_BINDING || !ev->bindings[index].initialized) fault(ev);
+                set_binding(ev, index, value);
+            }
+            return 0;
+        }
+        case AST_IF: {
+            Value condition = evaluate_expression(ev, node->data.if_statement.condition);
+            ASTNode* body = is_truthy(condition) ? node->data.if_statement.if_body
+                                                 : node->data.if_statement.else_body;
+            return body ? execute_block(ev, body) : 0;
+        }
+        case AST_PRINT:
+            append_value(ev->output, evaluate_expression(ev, node->data.print.expression));
+            append_char(ev->output, '\n');
+            if (ev->folded->size + ev->output->size > MAX_OUTPUT) fault(ev);
+            return 0;
+        case AST_WHILE:
+            while (is_truthy(evaluate_expression(ev, node->data.while_loop.condition))) {
+                if (execute_block(ev, node->data.while_loop.body)) return 1;
+            }
+            return 0;
+        case AST_CALL:
+            call_function(ev, node);
+            return 0;
+        case AST_RETURN:
+            ev->returned = evaluate_expression(ev, node->data.return_statement.value);
+            return 1;
+        case AST_FUNCTION:
+            // Hoisted: defined before the program starts
+            return 0;
+        default:
+            fault(ev);
+            return 0;
+    }
+}
+
+// Runs a top-level statement; on a fault, everything it changed is undone
+// and 0 returned
+static int run_statement(Evaluator* ev, ASTNode* statement) {
+    ev->undo_count = 0;
+    ev->output->size = 0;
+    ev->output->buffer[0] = '\0';
+
+    if (setjmp(ev->fault) == 0) {
+        execute_statement(ev, statement);
+        return 1;
+    }
+
+    while (ev->frame_count > 1) close_frame(ev);
+    ev->base = 0;
+    ev->depth = 0;
+    ev->argument_count = 0;
+    while (ev->undo_count > 0) {
+        Undo* undo = &ev->undo[--ev->undo_count];
+        ev->bindings[undo->index] = undo->saved;
+    }
+    return 0;
+}
+
+static ASTNode* new_node(Evaluator* ev, ASTNodeType type) {
+    ASTNode* node = allocate(ev->allocator, sizeof(ASTNode));
+    memset(node, 0, sizeof(ASTNode));
+    node->type = type;
+    return node;
+}
+
+static ASTNode* new_constant(Evaluator* ev, const char* text, size_t length) {
+    ASTNode* node = new_node(ev, AST_CONSTANT);
+    node->data.constant.text = copy_string(ev->allocator, text, length);
+    return node;
+}
+
+// An expression with the value; a number when Tiny can spell it
+static ASTNode* value_expression(Evaluator* ev, Value value) {
+    double number = value.number;
+
+    if (value.kind == VALUE_NUMBER && number >= -2147483647.0 && number <= 2147483647.0 &&
+        number == (int)number && !(number == 0 && signbit(number))) {
+        ASTNode* node = new_node(ev, AST_NUMBER);
+        node->data.number.value = (int)number;
+        return node;
+    }
+
+    StringBuilder* sb = init_string_builder_with_allocator(ev->allocator);
+    append_value(sb, value);
+    ASTNode* node = new_constant(ev, sb->buffer, sb->size);
+    deallocate(ev->allocator, finalize_string_builder(sb));
+    return node;
+}
+
+// Everything printed since the last remaining statement, as one print of
+// a string literal
+static void flush_output(Evaluator* ev, NodeList* statements) {
+    StringBuilder* folded = ev->folded;
+    if (folded->size == 0) return;
+
+    StringBuilder* literal = init_string_builder_with_allocator(ev->allocator);
+    append_json_string(literal, folded->buffer, folded->size - 1);
+    ASTNode* print = new_node(ev, AST_PRINT);
+    print->data.print.expression = new_constant(ev, literal->buffer, literal->size);
+    deallocate(ev->allocator, finalize_string_builder(literal));
+    add_node(ev, statements, print);
+
+    folded->size = 0;
+    folded->buffer[0] = '\0';
+}
+
+// Returns whether the name was seen before
+static int mark_name(Evaluator* ev, const char* name) {
+    size_t index = find_name(ev, name);
+    if (ev->marks[index] == ev->mark) return 1;
+
+    ev->marks[index] = ev->mark;
+    ev->marked[ev->marked_count++] = index;
+    return 0;
+}
+
+static void move_mark(Evaluator* ev) {
+    ev->mark++;
+    ev->marked_count = 0;
+}
+
+// Marks every name the node mentions, and those of the functions it may
+// call, with the current mark
+static void mark_names(Evaluator* ev, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                mark_names(ev, node->data.program.statements[i]);
+            }
+            break;
+        case AST_VARIABLE:
+            mark_name(ev, node->data.variable.name);
+            break;
+        case AST_BINARY_OP:
+            mark_names(ev, node->data.binary_op.left);
+            mark_names(ev, node->data.binary_op.right);
+            break;
+        case AST_ASSIGN:
+            mark_name(ev, node->data.assign.name);
+            mark_names(ev, node->data.assign.value);
+            break;
+        case AST_IF:
+            mark_names(ev, node->data.if_statement.condition);
+            mark_names(ev, node->data.if_statement.if_body);
+            mark_names(ev, node->data.if_statement.else_body);
+            break;
+        case AST_PRINT:
+            mark_names(ev, node->data.print.expression);
+            break;
+        case AST_WHILE:
+            mark_names(ev, node->data.while_loop.condition);
+            mark_names(ev, node->data.while_loop.body);
+            break;
+        case AST_CALL: {
+            ASTNode* function = ev->functions[find_name(ev, node->data.call.name)];
+            if (!mark_name(ev, node->data.call.name) && function) {
+                mark_names(ev, function->data.function.body);
+            }
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                mark_names(ev, node->data.call.args[i]);
+            }
+            break;
+        }
+        case AST_RETURN:
+            mark_names(ev, node->data.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+static int compare_indices(const void* a, const void* b) {
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Assigns the top-level variables the statement, or a function it calls,
+// may read their computed values, unless the output already holds them
+static void materialize(Evaluator* ev, NodeList* statements, ASTNode* statement) {
+    size_t* indices = NULL;
+    size_t count = 0;
+
+    move_mark(ev);
+    mark_names(ev, statement);
+    for (size_t i = 0; i < ev->marked_count; i++) {
+        size_t index = ev->innermost[ev->marked[i]];
+        if (index == NO_BINDING || !ev->bindings[index].dirty ||
+            ev->bindings[index].value.kind == VALUE_UNKNOWN) {
+            continue;
+        }
+        if (!indices) indices = allocate(ev->allocator, ev->global_count * sizeof(size_t));
+        indices[count++] = index;
+    }
+
+    if (count > 1) qsort(indices, count, sizeof(size_t), compare_indices);
+    for (size_t i = 0; i < count; i++) {
+        Binding* binding = &ev->bindings[indices[i]];
+        const char* name = ev->names[binding->name];
+        ASTNode* assign = new_node(ev, AST_ASSIGN);
+        assign->data.assign.name = copy_string(ev->allocator, name, strlen(name));
+        assign->data.assign.value = value_expression(ev, binding->value);
+        add_node(ev, statements, assign);
+        binding->dirty = 0;
+    }
+    deallocate(ev->allocator, indices);
+}
+
+// After a statement is left to run, what it assigns is no longer known
+static void forget_assigned(Evaluator* ev, ASTNode* node, int top) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                forget_assigned(ev, node->data.program.statements[i], 0);
+            }
+            break;
+        case AST_ASSIGN: {
+            size_t index = ev->innermost[find_name(ev, node->data.assign.name)];
+            if (index == NO_BINDING) break;
+            Binding* binding = &ev->bindings[index];
+            if (top) binding->initialized = 1;
+            if (binding->initialized) {
+                binding->value.kind = VALUE_UNKNOWN;
+                binding->dirty = 0;
+            }
+            break;
+        }
+        case AST_IF:
+            forget_assigned(ev, node->data.if_statement.if_body, 0);
+            forget_assigned(ev, node->data.if_statement.else_body, 0);
+            break;
+        case AST_WHILE:
+            forget_assigned(ev, node->data.while_loop.body, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+// Keeps the last definition of each function a remaining statement may
+// call; the others go with the statements that ran
+static size_t drop_unused_functions(Evaluator* ev, NodeList* statements, NodeList* dropped) {
+    size_t kept = 0;
+
+    move_mark(ev);
+    for (size_t i = 0; i < statements->count; i++) {
+        if (statements->nodes[i]->type != AST_FUNCTION) mark_names(ev, statements->nodes[i]);
+    }
+    for (size_t i = 0; i < statements->count; i++) {
+        ASTNode* statement = statements->nodes[i];
+        if (statement->type == AST_FUNCTION) {
+            size_t name = find_name(ev, statement->data.function.name);
+            if (ev->marks[name] != ev->mark || ev->functions[name] != statement) {
+                add_node(ev, dropped, statement);
+                continue;
+            }
+        }
+        statements->nodes[kept++] = statement;
+    }
+    return kept;
+}
+
+static void evaluate_statements(Evaluator* ev, ASTNode* program, PartialEvaluation* result) {
+    NodeList statements = {0};
+    NodeList dropped = {0};    // freed last, since names point into them
+
+    ev->output = init_string_builder_with_allocator(ev->allocator);
+    ev->folded = init_string_builder_with_allocator(ev->allocator);
+    ev->marks = allocate(ev->allocator, (ev->name_count + 1) * sizeof(size_t));
+    ev->marked = allocate(ev->allocator, (ev->name_count + 1) * sizeof(size_t));
+    memset(ev->marks, 0, (ev->name_count + 1) * sizeof(size_t));
+
+    open_block(ev, program);
+    ev->global_count = ev->binding_count;
+
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* statement = program->data.program.statements[i];
+
+        if (statement->type == AST_FUNCTION) {
+            add_node(ev, &statements, statement);
+        } else if (run_statement(ev, statement)) {
+            append_bytes(ev->folded, ev->output->buffer, ev->output->size);
+            add_node(ev, &dropped, statement);
+            result->folded++;
+        } else {
+            flush_output(ev, &statements);
+            materialize(ev, &statements, statement);
+            add_node(ev, &statements, statement);
+            forget_assigned(ev, statement, 1);
+            result->residual++;
+        }
+    }
+    flush_output(ev, &statements);
+
+    deallocate(ev->allocator, program->data.program.statements);
+    program->data.program.statements = statements.nodes;
+    program->data.program.statement_count = drop_unused_functions(ev, &statements, &dropped);
+    result->steps = ev->steps < MAX_STEPS ? ev->steps : MAX_STEPS;
+
+    for (size_t i = 0; i < dropped.count; i++) {
+        free_ast_with_allocator(dropped.nodes[i], ev->allocator);
+    }
+    deallocate(ev->allocator, dropped.nodes);
+
+    close_frame(ev);
+    deallocate(ev->allocator, finalize_string_builder(ev->output));
+    deallocate(ev->allocator, finalize_string_builder(ev->folded));
+}
+
+void evaluate_program(ASTNode* program, const Allocator* allocator, PartialEvaluation* result) {
+    PartialEvaluation local;
+    Evaluator ev;
+    size_t capacity = 0;
+    memset(&ev, 0, sizeof(Evaluator));
+    ev.allocator = allocator;
+    if (!result) result = &local;
+    memset(result, 0, sizeof(PartialEvaluation));
+
+    collect_names(&ev, program, &capacity);
+    if (ev.name_count > 1) qsort(ev.names, ev.name_count, sizeof(const char*), compare_strings);
+    size_t unique = 0;
+    for (size_t i = 0; i < ev.name_count; i++) {
+        if (unique == 0 || strcmp(ev.names[unique - 1], ev.names[i]) != 0) {
+            ev.names[unique++] = ev.names[i];
+        }
+    }
+    ev.name_count = unique;
+
+    Scope scope;
+    init_scope(&scope, allocator);
+    find_declarations(&ev, &scope, program);
+    free_scope(&scope);
+    if (ev.declarations.count > 1) {
+        qsort(ev.declarations.nodes, ev.declarations.count, sizeof(ASTNode*), compare_nodes);
+    }
+
+    ev.functions = allocate(allocator, (ev.name_count + 1) * sizeof(ASTNode*));
+    ev.innermost = allocate(allocator, (ev.name_count + 1) * sizeof(size_t));
+    memset(ev.functions, 0, (ev.name_count + 1) * sizeof(ASTNode*));
+    for (size_t i = 0; i < ev.name_count; i++) {
+        ev.innermost[i] = NO_BINDING;
+    }
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* statement = program->data.program.statements[i];
+        if (statement->type == AST_FUNCTION) {
+            ev.functions[find_name(&ev, statement->data.function.name)] = statement;
+        }
+    }
+
+    if (is_loadable(&ev, program)) {
+        evaluate_statements(&ev, program, result);
+    } else {
+        result->residual = program->data.program.statement_count;
+    }
+
+    deallocate(allocator, ev.names);
+    deallocate(allocator, ev.declarations.nodes);
+    deallocate(allocator, ev.functions);
+    deallocate(allocator, ev.innermost);
+    deallocate(allocator, ev.marks);
+    deallocate(allocator, ev.marked);
+    deallocate(allocator, ev.bindings);
+    deallocate(allocator, ev.frames);
+    deallocate(allocator, ev.arguments);
+    deallocate(allocator, ev.undo);
+}
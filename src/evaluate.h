@@ -0,0 +1,37 @@
+#ifndef EVALUATE_H
+#define EVALUATE_H
+
+#include "parser.h"
+
+// What evaluate_program did to the top-level statements
+typedef struct {
+    size_t folded;       // run at compile time and replaced by their output
+    size_t residual;     // left to run, since evaluating them would fault
+    size_t steps;        // nodes evaluated
+} PartialEvaluation;
+
+// Runs the program at compile time; a Tiny program has no inputs, so
+// everything it prints is known unless running it would fault. Each
+// top-level statement either runs completely, and its prints join a single
+// precomputed console.log of the output so far, or stays as it is:
+//
+//   x = 6;                             console.log("42\n7");
+//   print(x * 7);             =>       let x = 6;
+//   print(x + 1);                      let y = (x / 0);
+//   y = x / 0;                         console.log(y);
+//   print(y);
+//
+// A statement stays when it divides by zero, reads a variable in its
+// temporal dead zone or one a remaining statement assigned, calls something
+// that is not a function, or runs past the step or output budget. Values
+// follow JavaScript: numbers are doubles, comparisons give booleans and a
+// call without return gives undefined. Variables a remaining statement
+// reads get their computed value right before it, and definitions of
+// functions no remaining statement calls are dropped. Programs the
+// generated JavaScript could not even load, such as ones declaring both a
+// variable and a function of the same name, are left alone. New nodes come
+// from `allocator`, which must be the one the tree was parsed with.
+// `result` may be NULL.
+void evaluate_program(ASTNode* program, const Allocator* allocator, PartialEvaluation* result);
+
+#endif
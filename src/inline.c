@@ -0,0 +1,948 @@
+#include "inline.h"
+#include "scope.h"
+#include "strbuf.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INLINE_SIZE 64    // nodes in the largest body worth copying
+#define CALL_OVERHEAD 8       // nodes' worth of work one executed call costs
+#define LOOP_WEIGHT 8         // iterations assumed for each loop around a call
+#define MAX_LOOP_DEPTH 4
+#define NO_FUNCTION ((size_t)-1)
+
+typedef struct {
+    const char* name;
+    size_t index;
+} NamedFunction;
+
+// What a variable of the function being copied becomes in the copy
+typedef struct {
+    const char* from;
+    char* to;           // new name, NULL when the argument is used as it is
+    ASTNode* value;     // that argument, a variable or number of the caller
+} Rename;
+
+typedef struct {
+    ASTNode** statements;
+    size_t count;
+    size_t capacity;
+} StatementList;
+
+typedef struct {
+    const Allocator* allocator;
+    CallGraph* graph;
+    const NodeMap* profile;
+    int32_t executions;         // of the statement collect_calls is in, -1 when unknown
+    ASTNode** definitions;      // parallel to graph->functions
+    NamedFunction* by_name;     // the definition each name resolves to, sorted
+    size_t name_count;
+    size_t* edge_start;         // first edge of each caller
+    size_t* references;         // calls left to each function after inlining
+    int next_name;
+    Rename* renames;
+    size_t rename_count;
+    size_t rename_capacity;
+
+    // Tarjan's strongly connected components, to find recursion and to
+    // visit callees before their callers
+    size_t* visit_order;
+    size_t* low;
+    size_t* stack;
+    size_t stack_count;
+    char* on_stack;
+    size_t visited;
+    size_t* order;
+    size_t order_count;
+} Inliner;
+
+static ASTNode* new_node(Inliner* in, ASTNodeType type) {
+    ASTNode* node = allocate(in->allocator, sizeof(ASTNode));
+    memset(node, 0, sizeof(ASTNode));
+    node->type = type;
+    return node;
+}
+
+static ASTNode* new_variable(Inliner* in, const char* name) {
+    ASTNode* node = new_node(in, AST_VARIABLE);
+    node->data.variable.name = copy_string(in->allocator, name, strlen(name));
+    return node;
+}
+
+static ASTNode* new_assign(Inliner* in, const char* name, ASTNode* value) {
+    ASTNode* node = new_node(in, AST_ASSIGN);
+    node->data.assign.name = copy_string(in->allocator, name, strlen(name));
+    node->data.assign.value = value;
+    return node;
+}
+
+// `name` without any suffix an earlier copy gave it, numbered afresh
+static char* fresh_name(Inliner* in, const char* name) {
+    char number[16];
+    size_t base = strcspn(name, "$");
+    int digits = snprintf(number, sizeof(number), "$%d", in->next_name++);
+    char* fresh = allocate(in->allocator, base + (size_t)digits + 1);
+    memcpy(fresh, name, base);
+    memcpy(fresh + base, number, (size_t)digits + 1);
+    return fresh;
+}
+
+static void add_statement(Inliner* in, StatementList* list, ASTNode* statement) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->statements = reallocate(in->allocator, list->statements,
+                                      list->capacity * sizeof(ASTNode*));
+    }
+    list->statements[list->count++] = statement;
+}
+
+static int compare_functions(const void* a, const void* b) {
+    const NamedFunction* x = a;
+    const NamedFunction* y = b;
+    int order = strcmp(x->name, y->name);
+    if (order != 0) return order;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static int compare_names(const void* key, const void* entry) {
+    return strcmp(key, ((const NamedFunction*)entry)->name);
+}
+
+static size_t find_function(Inliner* in, const char* name) {
+    NamedFunction* found = bsearch(name, in->by_name, in->name_count, sizeof(NamedFunction),
+                                   compare_names);
+    return found ? found->index : NO_FUNCTION;
+}
+
+static int compare_edges(const void* a, const void* b) {
+    const CallEdge* x = a;
+    const CallEdge* y = b;
+    if (x->caller != y->caller) return x->caller < y->caller ? -1 : 1;
+    return x->callee < y->callee ? -1 : x->callee > y->callee;
+}
+
+static void collect_definitions(Inliner* in, ASTNode* program) {
+    CallGraph* graph = in->graph;
+    size_t count = 0;
+
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        count += program->data.program.statements[i]->type == AST_FUNCTION;
+    }
+    graph->functions = allocate(in->allocator, (count + 1) * sizeof(FunctionInfo));
+    in->definitions = allocate(in->allocator, (count + 1) * sizeof(ASTNode*));
+    in->by_name = allocate(in->allocator, (count + 1) * sizeof(NamedFunction));
+
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* node = program->data.program.statements[i];
+        if (node->type != AST_FUNCTION) continue;
+
+        FunctionInfo* info = &graph->functions[graph->function_count];
+        memset(info, 0, sizeof(FunctionInfo));
+        info->name = copy_string(in->allocator, node->data.function.name,
+                                 strlen(node->data.function.name));
+        info->param_count = node->data.function.param_count;
+        info->decision = INLINE_YES;
+        in->by_name[graph->function_count].name = info->name;
+        in->by_name[graph->function_count].index = graph->function_count;
+        in->definitions[graph->function_count++] = node;
+    }
+
+    // Like JavaScript, the last definition of a name is the one called
+    qsort(in->by_name, count, sizeof(NamedFunction), compare_functions);
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && strcmp(in->by_name[i].name, in->by_name[i + 1].name) == 0) {
+            graph->functions[in->by_name[i].index].decision = INLINE_REDEFINED;
+        } else {
+            in->by_name[in->name_count++] = in->by_name[i];
+        }
+    }
+}
+
+static void add_edge(Inliner* in, size_t caller, size_t callee, size_t* capacity) {
+    CallGraph* graph = in->graph;
+    if (graph->edge_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        graph->edges = reallocate(in->allocator, graph->edges, *capacity * sizeof(CallEdge));
+    }
+    graph->edges[graph->edge_count].caller = caller;
+    graph->edges[graph->edge_count].callee = callee;
+    graph->edges[graph->edge_count++].count = 1;
+}
+
+static void collect_calls(Inliner* in, ASTNode* node, size_t caller, int loops,
+                          size_t* capacity) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            // Nothing of a statement is walked after the blocks inside it,
+            // so this holds for its calls
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                in->executions = profile_count(in->profile, node->data.program.statements[i]);
+                collect_calls(in, node->data.program.statements[i], caller, loops, capacity);
+            }
+            break;
+        case AST_BINARY_OP:
+            collect_calls(in, node->data.binary_op.left, caller, loops, capacity);
+            collect_calls(in, node->data.binary_op.right, caller, loops, capacity);
+            break;
+        case AST_ASSIGN:
+            collect_calls(in, node->data.assign.value, caller, loops, capacity);
+            break;
+        case AST_IF:
+            collect_calls(in, node->data.if_statement.condition, caller, loops, capacity);
+            collect_calls(in, node->data.if_statement.if_body, caller, loops, capacity);
+            collect_calls(in, node->data.if_statement.else_body, caller, loops, capacity);
+            break;
+        case AST_PRINT:
+            collect_calls(in, node->data.print.expression, caller, loops, capacity);
+            break;
+        case AST_WHILE:
+            collect_calls(in, node->data.while_loop.condition, caller, loops + 1, capacity);
+            collect_calls(in, node->data.while_loop.body, caller, loops + 1, capacity);
+            break;
+        case AST_RETURN:
+            collect_calls(in, node->data.return_statement.value, caller, loops, capacity);
+            break;
+        case AST_CALL: {
+            size_t callee = find_function(in, node->data.call.name);
+            if (callee != NO_FUNCTION) {
+                FunctionInfo* info = &in->graph->functions[callee];
+                size_t weight = 1;
+                for (int i = 0; i < loops && i < MAX_LOOP_DEPTH; i++) weight *= LOOP_WEIGHT;
+                if (in->executions >= 0) weight = (size_t)in->executions;
+                info->call_sites++;
+                info->weight += weight;
+                add_edge(in, caller, callee, capacity);
+            }
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                collect_calls(in, node->data.call.args[i], caller, loops, capacity);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Builds the edges, one per caller and callee, and indexes them by caller
+static void build_call_graph(Inliner* in, ASTNode* program) {
+    CallGraph* graph = in->graph;
+    size_t top_level = graph->function_count;
+    size_t capacity = 0;
+
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* node = program->data.program.statements[i];
+        in->executions = profile_count(in->profile, node);
+        if (node->type != AST_FUNCTION) collect_calls(in, node, top_level, 0, &capacity);
+    }
+    for (size_t i = 0; i < graph->function_count; i++) {
+        collect_calls(in, in->definitions[i]->data.function.body, i, 0, &capacity);
+    }
+
+    if (graph->edge_count > 1) {
+        qsort(graph->edges, graph->edge_count, sizeof(CallEdge), compare_edges);
+    }
+    size_t merged = 0;
+    for (size_t i = 0; i < graph->edge_count; i++) {
+        CallEdge* last = merged ? &graph->edges[merged - 1] : NULL;
+        if (last && last->caller == graph->edges[i].caller &&
+            last->callee == graph->edges[i].callee) {
+            last->count++;
+        } else {
+            graph->edges[merged++] = graph->edges[i];
+        }
+    }
+    graph->edge_count = merged;
+
+    in->edge_start = allocate(in->allocator, (top_level + 2) * sizeof(size_t));
+    memset(in->edge_start, 0, (top_level + 2) * sizeof(size_t));
+    for (size_t i = 0; i < graph->edge_count; i++) {
+        in->edge_start[graph->edges[i].caller + 1]++;
+    }
+    for (size_t i = 0; i <= top_level; i++) {
+        in->edge_start[i + 1] += in->edge_start[i];
+    }
+}
+
+static void find_components(Inliner* in, size_t function) {
+    CallGraph* graph = in->graph;
+    in->visit_order[function] = in->low[function] = ++in->visited;
+    in->stack[in->stack_count++] = function;
+    in->on_stack[function] = 1;
+
+    int calls_itself = 0;
+    for (size_t i = in->edge_start[function]; i < in->edge_start[function + 1]; i++) {
+        size_t callee = graph->edges[i].callee;
+        calls_itself |= callee == function;
+        if (!in->visit_order[callee]) {
+            find_components(in, callee);
+            if (in->low[callee] < in->low[function]) in->low[function] = in->low[callee];
+        } else if (in->on_stack[callee] && in->visit_order[callee] < in->low[function]) {
+            in->low[function] = in->visit_order[callee];
+        }
+    }
+    if (in->low[function] != in->visit_order[function]) return;
+
+    // Components finish callees first
+    size_t first = in->stack_count;
+    do first--; while (in->stack[first] != function);
+    int recursive = calls_itself || in->stack_count - first > 1;
+    for (size_t i = first; i < in->stack_count; i++) {
+        size_t member = in->stack[i];
+        in->on_stack[member] = 0;
+        if (recursive && graph->functions[member].decision == INLINE_YES) {
+            graph->functions[member].decision = INLINE_RECURSIVE;
+        }
+        in->order[in->order_count++] = member;
+    }
+    in->stack_count = first;
+}
+
+static int contains_return(ASTNode* node) {
+    if (!node) return 0;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                if (contains_return(node->data.program.statements[i])) return 1;
+            }
+            return 0;
+        case AST_IF:
+            return contains_return(node->data.if_statement.if_body) ||
+                   contains_return(node->data.if_statement.else_body);
+        case AST_WHILE:
+            return contains_return(node->data.while_loop.body);
+        case AST_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int ends_with_return(ASTNode* body) {
+    size_t count = body->data.program.statement_count;
+    return count > 0 && body->data.program.statements[count - 1]->type == AST_RETURN;
+}
+
+static int returns_early(ASTNode* body) {
+    size_t count = body->data.program.statement_count;
+    for (size_t i = 0; i < count; i++) {
+        ASTNode* statement = body->data.program.statements[i];
+        if (statement->type == AST_RETURN ? i + 1 < count : contains_return(statement)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int reads_undeclared(Scope* scope, ASTNode* node) {
+    switch (node->type) {
+        case AST_VARIABLE:
+            return !is_declared(scope, node->data.variable.name);
+        case AST_BINARY_OP:
+            return reads_undeclared(scope, node->data.binary_op.left) ||
+                   reads_undeclared(scope, node->data.binary_op.right);
+        case AST_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                if (reads_undeclared(scope, node->data.call.args[i])) return 1;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+// Whether the block reads a variable not declared where it is read,
+// following the block scoping the generated JavaScript has
+static int reads_outer_variables(Scope* scope, ASTNode* block) {
+    int found = 0;
+    enter_block(scope);
+
+    for (size_t i = 0; i < block->data.program.statement_count && !found; i++) {
+        ASTNode* statement = block->data.program.statements[i];
+
+        switch (statement->type) {
+            case AST_ASSIGN:
+                found = reads_undeclared(scope, statement->data.assign.value);
+                declare_once(scope, statement->data.assign.name);
+                break;
+            case AST_IF:
+                found = reads_undeclared(scope, statement->data.if_statement.condition) ||
+                        reads_outer_variables(scope, statement->data.if_statement.if_body) ||
+                        (statement->data.if_statement.else_body &&
+                         reads_outer_variables(scope, statement->data.if_statement.else_body));
+                break;
+            case AST_PRINT:
+                found = reads_undeclared(scope, statement->data.print.expression);
+                break;
+            case AST_WHILE:
+                found = reads_undeclared(scope, statement->data.while_loop.condition) ||
+                        reads_outer_variables(scope, statement->data.while_loop.body);
+                break;
+            case AST_RETURN:
+                found = reads_undeclared(scope, statement->data.return_statement.value);
+                break;
+            case AST_CALL:
+                found = reads_undeclared(scope, statement);
+                break;
+            default:
+                break;
+        }
+    }
+
+    leave_block(scope);
+    return found;
+}
+
+static int is_closed(Inliner* in, ASTNode* function) {
+    Scope scope;
+    init_scope(&scope, in->allocator);
+    for (size_t i = 0; i < function->data.function.param_count; i++) {
+        declare_name(&scope, function->data.function.params[i]);
+    }
+    int closed = !reads_outer_variables(&scope, function->data.function.body);
+    free_scope(&scope);
+    return closed;
+}
+
+// The cost model: copies of a body of `size` nodes at every call site,
+// minus the definition that goes away, against the calls no longer made
+static void decide(Inliner* in, size_t index) {
+    FunctionInfo* info = &in->graph->functions[index];
+    ASTNode* function = in->definitions[index];
+    ASTNode* body = function->data.function.body;
+
+    info->size = count_ast_nodes(body);
+    if (info->decision != INLINE_YES) return;
+
+    if (info->call_sites == 0) {
+        info->decision = INLINE_NOT_CALLED;
+    } else if (info->weight == 0) {
+        // Only a profile weighs a call site at nothing
+        info->decision = INLINE_COLD;
+    } else if (returns_early(body)) {
+        info->decision = INLINE_EARLY_RETURN;
+    } else if (!is_closed(in, function)) {
+        info->decision = INLINE_OUTER_VARIABLES;
+    } else if (info->size > MAX_INLINE_SIZE) {
+        info->decision = INLINE_TOO_LARGE;
+    } else if (info->size > CALL_OVERHEAD) {
+        size_t growth = info->call_sites * (info->size + info->param_count) - info->size;
+        if (growth > info->weight * CALL_OVERHEAD) info->decision = INLINE_NOT_WORTH_IT;
+    }
+}
+
+// The definition a call is replaced with, or NULL when it stays a call
+static ASTNode* inline_target(Inliner* in, ASTNode* call, int as_statement) {
+    size_t index = find_function(in, call->data.call.name);
+    if (index == NO_FUNCTION || in->graph->functions[index].decision != INLINE_YES) return NULL;
+
+    ASTNode* function = in->definitions[index];
+    if (call->data.call.arg_count != function->data.function.param_count) return NULL;
+    // Without a return the call's value is undefined, which Tiny cannot spell
+    if (!as_statement && !ends_with_return(function->data.function.body)) return NULL;
+    return function;
+}
+
+static int contains_call(ASTNode* node) {
+    switch (node->type) {
+        case AST_BINARY_OP:
+            return contains_call(node->data.binary_op.left) ||
+                   contains_call(node->data.binary_op.right);
+        case AST_CALL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int has_inline_call(Inliner* in, ASTNode* node, int as_statement) {
+    switch (node->type) {
+        case AST_BINARY_OP:
+            return has_inline_call(in, node->data.binary_op.left, 0) ||
+                   has_inline_call(in, node->data.binary_op.right, 0);
+        case AST_CALL:
+            if (inline_target(in, node, as_statement)) return 1;
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                if (has_inline_call(in, node->data.call.args[i], 0)) return 1;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static int assigns_name(ASTNode* node, const char* name) {
+    if (!node) return 0;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                if (assigns_name(node->data.program.statements[i], name)) return 1;
+            }
+            return 0;
+        case AST_ASSIGN:
+            return strcmp(node->data.assign.name, name) == 0;
+        case AST_IF:
+            return assigns_name(node->data.if_statement.if_body, name) ||
+                   assigns_name(node->data.if_statement.else_body, name);
+        case AST_WHILE:
+            return assigns_name(node->data.while_loop.body, name);
+        default:
+            return 0;
+    }
+}
+
+static Rename* add_rename(Inliner* in, const char* from, char* to, ASTNode* value) {
+    if (in->rename_count == in->rename_capacity) {
+        in->rename_capacity = in->rename_capacity ? in->rename_capacity * 2 : 16;
+        in->renames = reallocate(in->allocator, in->renames, in->rename_capacity * sizeof(Rename));
+    }
+    Rename* rename = &in->renames[in->rename_count++];
+    rename->from = from;
+    rename->to = to;
+    rename->value = value;
+    return rename;
+}
+
+// Every variable in a copied body belongs to the function, so each gets a
+// new name the first time it is seen
+static Rename* find_rename(Inliner* in, const char* name) {
+    for (size_t i = 0; i < in->rename_count; i++) {
+        if (strcmp(in->renames[i].from, name) == 0) return &in->renames[i];
+    }
+    return add_rename(in, name, fresh_name(in, name), NULL);
+}
+
+static ASTNode* copy_node(Inliner* in, ASTNode* node) {
+    if (!node) return NULL;
+
+    ASTNode* copy = new_node(in, node->type);
+    switch (node->type) {
+        case AST_PROGRAM: {
+            size_t count = node->data.program.statement_count;
+            copy->data.program.statements = allocate(in->allocator, (count + 1) * sizeof(ASTNode*));
+            copy->data.program.statement_count = count;
+            for (size_t i = 0; i < count; i++) {
+                copy->data.program.statements[i] = copy_node(in, node->data.program.statements[i]);
+            }
+            break;
+        }
+        case AST_VARIABLE: {
+            Rename* rename = find_rename(in, node->data.variable.name);
+            if (rename->value) {
+                // The caller's own variable or number; copied, not renamed
+                *copy = *rename->value;
+                copy->shares = 0;
+                if (copy->type == AST_VARIABLE) {
+                    const char* name = rename->value->data.variable.name;
+                    copy->data.variable.name = copy_string(in->allocator, name, strlen(name));
+                }
+            } else {
+                copy->data.variable.name = copy_string(in->allocator, rename->to, strlen(rename->to));
+            }
+            break;
+        }
+        case AST_NUMBER:
+            copy->data.number.value = node->data.number.value;
+            break;
+        case AST_BINARY_OP:
+            copy->data.binary_op.op = node->data.binary_op.op;
+            copy->data.binary_op.left = copy_node(in, node->data.binary_op.left);
+            copy->data.binary_op.right = copy_node(in, node->data.binary_op.right);
+            break;
+        case AST_ASSIGN: {
+            ASTNode* value = copy_node(in, node->data.assign.value);
+            const char* name = find_rename(in, node->data.assign.name)->to;
+            copy->data.assign.name = copy_string(in->allocator, name, strlen(name));
+            copy->data.assign.value = value;
+            break;
+        }
+        case AST_IF:
+            copy->data.if_statement.condition = copy_node(in, node->data.if_statement.condition);
+            copy->data.if_statement.if_body = copy_node(in, node->data.if_statement.if_body);
+            copy->data.if_statement.else_body = copy_node(in, node->data.if_statement.else_body);
+            break;
+        case AST_PRINT:
+            copy->data.print.expression = copy_node(in, node->data.print.expression);
+            break;
+        case AST_WHILE:
+            copy->data.while_loop.condition = copy_node(in, node->data.while_loop.condition);
+            copy->data.while_loop.body = copy_node(in, node->data.while_loop.body);
+            break;
+        case AST_CALL: {
+            size_t count = node->data.call.arg_count;
+            copy->data.call.name = copy_string(in->allocator, node->data.call.name,
+                                               strlen(node->data.call.name));
+            copy->data.call.args = allocate(in->allocator, (count + 1) * sizeof(ASTNode*));
+            copy->data.call.arg_count = count;
+            for (size_t i = 0; i < count; i++) {
+                copy->data.call.args[i] = copy_node(in, node->data.call.args[i]);
+            }
+            break;
+        }
+        case AST_RETURN:
+            copy->data.return_statement.value = copy_node(in, node->data.return_statement.value);
+            break;
+        case AST_CONSTANT:
+            copy->data.constant.text = copy_string(in->allocator, node->data.constant.text,
+                                                   strlen(node->data.constant.text));
+            break;
+        default:
+            break;
+    }
+    return copy;
+}
+
+// Evaluates `value` into a new temporary named after `base` and returns a
+// read of it
+static ASTNode* bind(Inliner* in, StatementList* list, ASTNode* value, const char* base) {
+    char* name = fresh_name(in, base);
+    add_statement(in, list, new_assign(in, name, value));
+    ASTNode* variable = new_variable(in, name);
+    deallocate(in->allocator, name);
+    return variable;
+}
+
+// Adds the statements of `function`'s body for `call` to `list` and frees
+// the call. Returns what the call evaluated to, or NULL as a statement.
+static ASTNode* inline_call(Inliner* in, StatementList* list, ASTNode* call, ASTNode* function,
+                            int as_statement) {
+    ASTNode* body = function->data.function.body;
+    size_t count = body->data.program.statement_count;
+    int returns = ends_with_return(body);
+    ASTNode* result = NULL;
+
+    in->rename_count = 0;
+    for (size_t i = 0; i < function->data.function.param_count; i++) {
+        const char* param = function->data.function.params[i];
+        ASTNode* arg = call->data.call.args[i];
+        if ((arg->type == AST_VARIABLE || arg->type == AST_NUMBER) && !assigns_name(body, param)) {
+            add_rename(in, param, NULL, arg);
+        } else {
+            char* name = fresh_name(in, param);
+            add_statement(in, list, new_assign(in, name, arg));
+            add_rename(in, param, name, NULL);
+            call->data.call.args[i] = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < count - returns; i++) {
+        add_statement(in, list, copy_node(in, body->data.program.statements[i]));
+    }
+
+    if (returns) {
+        ASTNode* value = copy_node(in, body->data.program.statements[count - 1]->data.return_statement.value);
+        if (!contains_call(value)) {
+            result = value;
+        } else if (as_statement && value->type == AST_CALL) {
+            add_statement(in, list, value);
+        } else {
+            result = bind(in, list, value, function->data.function.name);
+        }
+        if (as_statement) {
+            free_ast_with_allocator(result, in->allocator);
+            result = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < in->rename_count; i++) {
+        deallocate(in->allocator, in->renames[i].to);
+    }
+    in->rename_count = 0;
+    free_ast_with_allocator(call, in->allocator);
+    in->graph->inlined_calls++;
+    return result;
+}
+
+// Replaces the calls in the expression at `slot` in evaluation order:
+// inlined ones by their body and value, the others by a temporary, so
+// everything with an effect still happens in the same order
+static void expand_expression(Inliner* in, StatementList* list, ASTNode** slot) {
+    ASTNode* node = *slot;
+
+    if (node->type == AST_BINARY_OP) {
+        expand_expression(in, list, &node->data.binary_op.left);
+        expand_expression(in, list, &node->data.binary_op.right);
+    } else if (node->type == AST_CALL) {
+        for (size_t i = 0; i < node->data.call.arg_count; i++) {
+            expand_expression(in, list, &node->data.call.args[i]);
+        }
+        ASTNode* function = inline_target(in, node, 0);
+        *slot = function ? inline_call(in, list, node, function, 0)
+                         : bind(in, list, node, node->data.call.name);
+    }
+}
+
+static void expand_slot(Inliner* in, StatementList* list, ASTNode** slot) {
+    if (has_inline_call(in, *slot, 0)) expand_expression(in, list, slot);
+}
+
+// Puts the statements of `list` in front of the statement at `index`, or
+// in its place when `replace` is set; returns how many now stand there
+static size_t splice_statements(Inliner* in, ASTNode* block, size_t index, StatementList* list,
+                                int replace) {
+    size_t count = block->data.program.statement_count;
+    size_t kept = replace ? 0 : 1;
+    size_t total = count - 1 + list->count + kept;
+    ASTNode** statements = allocate(in->allocator, (total + 1) * sizeof(ASTNode*));
+
+    memcpy(statements, block->data.program.statements, index * sizeof(ASTNode*));
+    if (list->count) memcpy(statements + index, list->statements, list->count * sizeof(ASTNode*));
+    if (kept) statements[index + list->count] = block->data.program.statements[index];
+    memcpy(statements + index + list->count + kept, block->data.program.statements + index + 1,
+           (count - index - 1) * sizeof(ASTNode*));
+
+    deallocate(in->allocator, block->data.program.statements);
+    block->data.program.statements = statements;
+    block->data.program.statement_count = total;
+    return list->count + kept;
+}
+
+static void inline_block(Inliner* in, ASTNode* block) {
+    for (size_t i = 0; i < block->data.program.statement_count;) {
+        ASTNode* statement = block->data.program.statements[i];
+        StatementList list = {0};
+        int replace = 0;
+
+        switch (statement->type) {
+            case AST_ASSIGN:
+                expand_slot(in, &list, &statement->data.assign.value);
+                break;
+            case AST_IF:
+                expand_slot(in, &list, &statement->data.if_statement.condition);
+                inline_block(in, statement->data.if_statement.if_body);
+                if (statement->data.if_statement.else_body) {
+                    inline_block(in, statement->data.if_statement.else_body);
+                }
+                break;
+            case AST_PRINT:
+                expand_slot(in, &list, &statement->data.print.expression);
+                break;
+            case AST_WHILE:
+                // The condition runs before every iteration, not once here
+                inline_block(in, statement->data.while_loop.body);
+                break;
+            case AST_RETURN:
+                expand_slot(in, &list, &statement->data.return_statement.value);
+                break;
+            case AST_CALL:
+                if (has_inline_call(in, statement, 1)) {
+                    for (size_t j = 0; j < statement->data.call.arg_count; j++) {
+                        expand_expression(in, &list, &statement->data.call.args[j]);
+                    }
+                    ASTNode* function = inline_target(in, statement, 1);
+                    if (function) {
+                        inline_call(in, &list, statement, function, 1);
+                        replace = 1;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        i += list.count || replace ? splice_statements(in, block, i, &list, replace) : 1;
+        deallocate(in->allocator, list.statements);
+    }
+}
+
+static void count_references(Inliner* in, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                count_references(in, node->data.program.statements[i]);
+            }
+            break;
+        case AST_BINARY_OP:
+            count_references(in, node->data.binary_op.left);
+            count_references(in, node->data.binary_op.right);
+            break;
+        case AST_ASSIGN:
+            count_references(in, node->data.assign.value);
+            break;
+        case AST_IF:
+            count_references(in, node->data.if_statement.condition);
+            count_references(in, node->data.if_statement.if_body);
+            count_references(in, node->data.if_statement.else_body);
+            break;
+        case AST_PRINT:
+            count_references(in, node->data.print.expression);
+            break;
+        case AST_WHILE:
+            count_references(in, node->data.while_loop.condition);
+            count_references(in, node->data.while_loop.body);
+            break;
+        case AST_FUNCTION:
+            count_references(in, node->data.function.body);
+            break;
+        case AST_RETURN:
+            count_references(in, node->data.return_statement.value);
+            break;
+        case AST_CALL: {
+            size_t index = find_function(in, node->data.call.name);
+            if (index != NO_FUNCTION) in->references[index]++;
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                count_references(in, node->data.call.args[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Drops the definitions of inlined functions nothing calls any more
+static void remove_inlined(Inliner* in, ASTNode* program) {
+    CallGraph* graph = in->graph;
+    size_t kept = 0;
+    size_t function = 0;
+
+    in->references = allocate(in->allocator, (graph->function_count + 1) * sizeof(size_t));
+    memset(in->references, 0, (graph->function_count + 1) * sizeof(size_t));
+    count_references(in, program);
+
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* statement = program->data.program.statements[i];
+        if (statement->type == AST_FUNCTION) {
+            FunctionInfo* info = &graph->functions[function];
+            if (info->decision == INLINE_YES && in->references[function] == 0) {
+                info->removed = 1;
+                free_ast_with_allocator(statement, in->allocator);
+                function++;
+                continue;
+            }
+            function++;
+        }
+        program->data.program.statements[kept++] = statement;
+    }
+    program->data.program.statement_count = kept;
+}
+
+void inline_functions(ASTNode* program, const Allocator* allocator, CallGraph* graph) {
+    inline_functions_with_profile(program, allocator, graph, NULL);
+}
+
+void inline_functions_with_profile(ASTNode* program, const Allocator* allocator, CallGraph* graph,
+                                   const NodeMap* profile) {
+    CallGraph local;
+    Inliner in;
+    memset(&in, 0, sizeof(Inliner));
+    in.allocator = allocator;
+    in.profile = profile;
+    in.graph = graph ? graph : &local;
+    memset(in.graph, 0, sizeof(CallGraph));
+    in.graph->allocator = allocator;
+
+    // Without definitions no call can be inlined, so the tree is not walked
+    collect_definitions(&in, program);
+    size_t count = in.graph->function_count;
+    if (count > 0) {
+        build_call_graph(&in, program);
+        in.visit_order = allocate(allocator, count * sizeof(size_t));
+        in.low = allocate(allocator, count * sizeof(size_t));
+        in.stack = allocate(allocator, count * sizeof(size_t));
+        in.order = allocate(allocator, count * sizeof(size_t));
+        in.on_stack = allocate(allocator, count);
+        memset(in.visit_order, 0, count * sizeof(size_t));
+        memset(in.on_stack, 0, count);
+        for (size_t i = 0; i < count; i++) {
+            if (!in.visit_order[i]) find_components(&in, i);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            size_t function = in.order[i];
+            inline_block(&in, in.definitions[function]->data.function.body);
+            decide(&in, function);
+        }
+        inline_block(&in, program);
+        remove_inlined(&in, program);
+
+        deallocate(allocator, in.visit_order);
+        deallocate(allocator, in.low);
+        deallocate(allocator, in.stack);
+        deallocate(allocator, in.order);
+        deallocate(allocator, in.on_stack);
+    }
+
+    deallocate(allocator, in.definitions);
+    deallocate(allocator, in.by_name);
+    deallocate(allocator, in.edge_start);
+    deallocate(allocator, in.references);
+    deallocate(allocator, in.renames);
+    if (!graph) free_call_graph(&local);
+}
+
+const char* inline_decision_to_string(InlineDecision decision) {
+    switch (decision) {
+        case INLINE_YES: return "inlined";
+        case INLINE_NOT_CALLED: return "not called";
+        case INLINE_RECURSIVE: return "recursive";
+        case INLINE_REDEFINED: return "redefined later";
+        case INLINE_EARLY_RETURN: return "returns early";
+        case INLINE_OUTER_VARIABLES: return "reads outer variables";
+        case INLINE_TOO_LARGE: return "too large";
+        case INLINE_NOT_WORTH_IT: return "not worth it";
+        case INLINE_COLD: return "cold";
+        default: return "unknown";
+    }
+}
+
+static void append_node_id(StringBuilder* sb, const CallGraph* graph, size_t index) {
+    if (index == graph->function_count) {
+        append_string(sb, "program");
+    } else {
+        append_char(sb, 'f');
+        append_int(sb, (long long)index);
+    }
+}
+
+char* call_graph_to_dot(const CallGraph* graph, const Allocator* allocator) {
+    StringBuilder* sb = init_string_builder_with_allocator(allocator);
+
+    append_string(sb, "digraph calls {\n");
+    append_string(sb, "    program [shape=box, label=\"<program>\"];\n");
+    for (size_t i = 0; i < graph->function_count; i++) {
+        const FunctionInfo* info = &graph->functions[i];
+        append_string(sb, "    ");
+        append_node_id(sb, graph, i);
+        append_string(sb, " [label=\"");
+        append_string(sb, info->name);
+        append_string(sb, "\\n");
+        append_int(sb, (long long)info->size);
+        append_string(sb, " nodes, ");
+        append_int(sb, (long long)info->call_sites);
+        append_string(sb, info->call_sites == 1 ? " call site\\n" : " call sites\\n");
+        append_string(sb, inline_decision_to_string(info->decision));
+        append_string(sb, info->removed ? "\", style=dashed];\n" : "\"];\n");
+    }
+    for (size_t i = 0; i < graph->edge_count; i++) {
+        const CallEdge* edge = &graph->edges[i];
+        append_string(sb, "    ");
+        append_node_id(sb, graph, edge->caller);
+        append_string(sb, " -> ");
+        append_node_id(sb, graph, edge->callee);
+        if (edge->count > 1) {
+            append_string(sb, " [label=\"");
+            append_int(sb, (long long)edge->count);
+            append_string(sb, "\"]");
+        }
+        append_string(sb, ";\n");
+    }
+    append_string(sb, "}\n");
+
+    return finalize_string_builder(sb);
+}
+
+void free_call_graph(CallGraph* graph) {
+    for (size_t i = 0; i < graph->function_count; i++) {
+        deallocate(graph->allocator, graph->functions[i].name);
+    }
+    deallocate(graph->allocator, graph->functions);
+    deallocate(graph->allocator, graph->edges);
+    memset(graph, 0, sizeof(CallGraph));
+}
@@ -0,0 +1,82 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "parser.h"
+
+// Why a function was or was not inlined
+typedef enum {
+    INLINE_YES,
+    INLINE_NOT_CALLED,
+    INLINE_RECURSIVE,
+    INLINE_REDEFINED,          // a later definition with the same name wins
+    INLINE_EARLY_RETURN,       // returns from somewhere other than its last statement
+    INLINE_OUTER_VARIABLES,    // reads variables it never assigned
+    INLINE_TOO_LARGE,
+    INLINE_NOT_WORTH_IT,       // the copies would add more than the calls cost
+    INLINE_COLD                // none of its calls ran in the profile
+} InlineDecision;
+
+typedef struct {
+    char* name;
+    size_t param_count;
+    size_t size;          // nodes in the body once its own callees were inlined
+    size_t call_sites;
+    size_t weight;        // call sites weighted by the loops around them, or by the profile
+    InlineDecision decision;
+    int removed;          // every call was inlined and the definition dropped
+} FunctionInfo;
+
+// How often `caller` names `callee` in the program as written
+typedef struct {
+    size_t caller;    // index into functions; function_count for top-level code
+    size_t callee;
+    size_t count;
+} CallEdge;
+
+typedef struct {
+    const Allocator* allocator;
+    FunctionInfo* functions;    // in definition order
+    size_t function_count;
+    CallEdge* edges;            // sorted by caller, then callee
+    size_t edge_count;
+    size_t inlined_calls;
+} CallGraph;
+
+// Replaces calls to small non-recursive functions with a copy of their
+// body, callees before callers, and drops definitions nothing calls any
+// more. A function is inlined everywhere or nowhere; the cost model weighs
+// the nodes its copies add against the calls they save, counting a call
+// inside k loops 8^k times. Only functions that return from their last
+// statement, if at all, and read nothing but their parameters and their own
+// variables qualify, so a copy behaves exactly like the call:
+//
+//   def area(a, b) {                   let s$0 = (w + 1);
+//       s = a + 1;              =>     let y = ((s$0 * h) + 1);
+//       return s * b;
+//   }
+//   y = area(w, h) + 1;
+//
+// A parameter that is never assigned takes a variable or number argument
+// as it is; other arguments and the calls left in the statement are
+// evaluated into temporaries in their original order, so output appears in
+// the same order too. Copied variables are renamed to `name$N`, which no
+// Tiny identifier can collide with. Calls in a while condition are never
+// inlined. New nodes come from `allocator`, which must be the one the tree
+// was parsed with. When `graph` is not NULL it receives the call graph and
+// every decision, and must be released with free_call_graph.
+void inline_functions(ASTNode* program, const Allocator* allocator, CallGraph* graph);
+
+// inline_functions with each call weighed by how often its statement ran
+// according to `profile` (see apply_profile) instead of by its loops; a
+// function none of whose calls ran is left alone. Calls the profile knows
+// nothing about are weighed by their loops.
+void inline_functions_with_profile(ASTNode* program, const Allocator* allocator, CallGraph* graph,
+                                   const NodeMap* profile);
+
+// Graphviz rendering of the call graph, each function labelled with its
+// size, call sites and decision; allocated from `allocator`
+char* call_graph_to_dot(const CallGraph* graph, const Allocator* allocator);
+void free_call_graph(CallGraph* graph);
+const char* inline_decision_to_string(InlineDecision decision);
+
+#endif
@@ -1,11 +1,27 @@
 #include "lexer.h"
 
 Lexer* init_lexer(char* src) {
-    Lexer* lexer = malloc(sizeof(Lexer));
+    return init_lexer_with_length(src, strlen(src));
+}
+
+// The source is only read, and only its first `length` bytes, so callers can
+// lex a buffer in place without copying or NUL-terminating it
+Lexer* init_lexer_with_length(char* src, size_t length) {
+    return init_lexer_with_allocator(src, length, NULL);
+}
+
+// The lexer, its tokens and their values come from `allocator`
+Lexer* init_lexer_with_allocator(char* src, size_t length, const Allocator* allocator) {
+    Lexer* lexer = allocate(allocator, sizeof(Lexer));
+    lexer->allocator = allocator;
     lexer->src = src;
     lexer->position = 0;
-    lexer->length = strlen(src);
+    lexer->length = length;
     lexer->current_char = lexer->length > 0 ? src[0] : '\0';
+    lexer->token_start = 0;
+    lexer->diagnostics = NULL;
+    lexer->record = NULL;
+    lexer->stats = NULL;
     return lexer;
 }
 
@@ -23,10 +39,12 @@ void skip_whitespace(Lexer* lexer) {
     }
 }
 
-Token* create_token(TokenType type, char* value) {
-    Token* token = malloc(sizeof(Token));
+Token* create_token(Lexer* lexer, TokenType type, char* value) {
+    Token* token = allocate(lexer->allocator, sizeof(Token));
     token->type = type;
     token->value = value;
+    token->start = 0;
+    token->length = 0;
     return token;
 }
 
@@ -38,7 +56,7 @@ char* read_identifier(Lexer* lexer) {
     }
     
     size_t length = lexer->position - start;
-    char* value = malloc(length + 1);
+    char* value = allocate(lexer->allocator, length + 1);
     strncpy(value, &lexer->src[start], length);
     value[length] = '\0';
     
@@ -53,7 +71,7 @@ char* read_number(Lexer* lexer) {
     }
     
     size_t length = lexer->position - start;
-    char* value = malloc(length + 1);
+    char* value = allocate(lexer->allocator, length + 1);
     strncpy(value, &lexer->src[start], length);
     value[length] = '\0';
     
@@ -72,8 +90,10 @@ void skip_comment(Lexer* lexer) {
     }
 }
 
-Token* get_next_token(Lexer* lexer) {
+static Token* scan_token(Lexer* lexer) {
     while (lexer->current_char != '\0') {
+        lexer->token_start = lexer->position;
+        
         // Skip whitespace
         if (isspace(lexer->current_char)) {
             skip_whitespace(lexer);
@@ -92,67 +112,73 @@ Token* get_next_token(Lexer* lexer) {
             char* value = read_identifier(lexer);
             
             if (strcmp(value, "if") == 0) {
-                return create_token(TOKEN_IF, value);
+                return create_token(lexer, TOKEN_IF, value);
             } else if (strcmp(value, "else") == 0) {
-                return create_token(TOKEN_ELSE, value);
+                return create_token(lexer, TOKEN_ELSE, value);
             } else if (strcmp(value, "print") == 0) {
-                return create_token(TOKEN_PRINT, value);
+                return create_token(lexer, TOKEN_PRINT, value);
+            } else if (strcmp(value, "while") == 0) {
+                return create_token(lexer, TOKEN_WHILE, value);
+            } else if (strcmp(value, "def") == 0) {
+                return create_token(lexer, TOKEN_DEF, value);
+            } else if (strcmp(value, "return") == 0) {
+                return create_token(lexer, TOKEN_RETURN, value);
             } else {
-                return create_token(TOKEN_ID, value);
+                return create_token(lexer, TOKEN_ID, value);
             }
         }
         
         // Numbers
         if (isdigit(lexer->current_char)) {
-            return create_token(TOKEN_NUMBER, read_number(lexer));
+            return create_token(lexer, TOKEN_NUMBER, read_number(lexer));
         }
         
         // Operators and special characters
         switch (lexer->current_char) {
             case '+': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '+';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_PLUS, value);
+                return create_token(lexer, TOKEN_PLUS, value);
             }
             case '-': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '-';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_MINUS, value);
+                return create_token(lexer, TOKEN_MINUS, value);
             }
             case '*': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '*';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_MULTIPLY, value);
+                return create_token(lexer, TOKEN_MULTIPLY, value);
             }
             case '/': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '/';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_DIVIDE, value);
+                return create_token(lexer, TOKEN_DIVIDE, value);
             }
             case '=': {
                 advance(lexer);
                 // Check if it's == (equality)
                 if (lexer->current_char == '=') {
                     advance(lexer);
-                    char* value = malloc(3);
+                    char* value = allocate(lexer->allocator, 3);
                     value[0] = '=';
                     value[1] = '=';
                     value[2] = '\0';
-                    return create_token(TOKEN_EQUAL, value);
+                    return create_token(lexer, TOKEN_EQUAL, value);
                 } else {
                     // It's just = (assignment)
-                    char* value = malloc(2);
+                    char* value = allocate(lexer->allocator, 2);
                     value[0] = '=';
                     value[1] = '\0';
-                    return create_token(TOKEN_ASSIGN, value);
+                    return create_token(lexer, TOKEN_ASSIGN, value);
                 }
             }
             case '>': {
@@ -160,17 +186,17 @@ Token* get_next_token(Lexer* lexer) {
                 // Check if it's >= (greater or equal)
                 if (lexer->current_char == '=') {
                     advance(lexer);
-                    char* value = malloc(3);
+                    char* value = allocate(lexer->allocator, 3);
                     value[0] = '>';
                     value[1] = '=';
                     value[2] = '\0';
-                    return create_token(TOKEN_GREATER_EQUAL, value);
+                    return create_token(lexer, TOKEN_GREATER_EQUAL, value);
                 } else {
                     // It's just > (greater than)
-                    char* value = malloc(2);
+                    char* value = allocate(lexer->allocator, 2);
                     value[0] = '>';
                     value[1] = '\0';
-                    return create_token(TOKEN_GREATER, value);
+                    return create_token(lexer, TOKEN_GREATER, value);
                 }
             }
             case '<': {
@@ -178,17 +204,17 @@ Token* get_next_token(Lexer* lexer) {
                 // Check if it's <= (less or equal)
                 if (lexer->current_char == '=') {
                     advance(lexer);
-                    char* value = malloc(3);
+                    char* value = allocate(lexer->allocator, 3);
                     value[0] = '<';
                     value[1] = '=';
                     value[2] = '\0';
-                    return create_token(TOKEN_LESS_EQUAL, value);
+                    return create_token(lexer, TOKEN_LESS_EQUAL, value);
                 } else {
                     // It's just < (less than)
-                    char* value = malloc(2);
+                    char* value = allocate(lexer->allocator, 2);
                     value[0] = '<';
                     value[1] = '\0';
-                    return create_token(TOKEN_LESS, value);
+                    return create_token(lexer, TOKEN_LESS, value);
                 }
             }
             case '!': {
@@ -196,64 +222,150 @@ Token* get_next_token(Lexer* lexer) {
                 // Check if it's != (not equal)
                 if (lexer->current_char == '=') {
                     advance(lexer);
-                    char* value = malloc(3);
+                    char* value = allocate(lexer->allocator, 3);
                     value[0] = '!';
                     value[1] = '=';
                     value[2] = '\0';
-                    return create_token(TOKEN_NOT_EQUAL, value);
+                    return create_token(lexer, TOKEN_NOT_EQUAL, value);
                 } else {
                     // Unsupported operator
-                    printf("Unexpected operator: !\n");
+                    report_error(lexer->diagnostics, "Unexpected operator: !");
                     advance(lexer);
                     continue;
                 }
             }
             case ';': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = ';';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_SEMICOLON, value);
+                return create_token(lexer, TOKEN_SEMICOLON, value);
+            }
+            case ',': {
+                char* value = allocate(lexer->allocator, 2);
+                value[0] = ',';
+                value[1] = '\0';
+                advance(lexer);
+                return create_token(lexer, TOKEN_COMMA, value);
             }
             case '(': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '(';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_LPAREN, value);
+                return create_token(lexer, TOKEN_LPAREN, value);
             }
             case ')': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = ')';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_RPAREN, value);
+                return create_token(lexer, TOKEN_RPAREN, value);
             }
             case '{': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '{';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_LBRACE, value);
+                return create_token(lexer, TOKEN_LBRACE, value);
             }
             case '}': {
-                char* value = malloc(2);
+                char* value = allocate(lexer->allocator, 2);
                 value[0] = '}';
                 value[1] = '\0';
                 advance(lexer);
-                return create_token(TOKEN_RBRACE, value);
+                return create_token(lexer, TOKEN_RBRACE, value);
             }
             default: {
-                printf("Unknown character: %c\n", lexer->current_char);
+                report_error(lexer->diagnostics, "Unknown character: %c", lexer->current_char);
                 advance(lexer);
                 continue;
             }
         }
     }
     
-    return create_token(TOKEN_EOF, NULL);
+    lexer->token_start = lexer->position;
+    return create_token(lexer, TOKEN_EOF, NULL);
+}
+
+Token* get_next_token(Lexer* lexer) {
+    uint64_t start = lexer->stats ? stats_now_ns() : 0;
+    Token* token = scan_token(lexer);
+    token->start = lexer->token_start;
+    token->length = lexer->position - lexer->token_start;
+
+    TokenRecord* record = lexer->record;
+    if (record) {
+        if (record->used + 3 > record->capacity) {
+            record->capacity *= 2;
+            record->words = reallocate(lexer->allocator, record->words,
+                                       record->capacity * sizeof(int32_t));
+        }
+        record->words[record->used++] = (int32_t)token->type;
+        record->words[record->used++] = (int32_t)token->start;
+        record->words[record->used++] = (int32_t)token->length;
+    }
+
+    if (lexer->stats) {
+        lexer->stats->phase_ns[PHASE_LEX] += stats_now_ns() - start;
+        lexer->stats->token_count++;
+    }
+
+    return token;
+}
+
+// Sized for about one token per four bytes of source; the words come from
+// the same allocator as the lexer the record is attached to
+void init_token_record(TokenRecord* record, size_t source_length, const Allocator* allocator) {
+    record->capacity = 1 + 3 * (source_length / 4 + 16);
+    record->words = allocate(allocator, record->capacity * sizeof(int32_t));
+    record->used = 1;
+}
+
+// Stores the count in word 0 and hands the buffer to the caller
+int32_t* finish_token_record(TokenRecord* record, size_t* token_count) {
+    record->words[0] = (int32_t)((record->used - 1) / 3);
+    if (token_count) *token_count = (size_t)record->words[0];
+    return record->words;
+}
+
+void free_token(Lexer* lexer, Token* token) {
+    deallocate(lexer->allocator, token->value);
+    deallocate(lexer->allocator, token);
 }
 
 void free_lexer(Lexer* lexer) {
-    free(lexer);
-} 
\ No newline at end of file
+    deallocate(lexer->allocator, lexer);
+}
+
+const char* token_type_to_string(TokenType type) {
+    switch (type) {
+        case TOKEN_ID: return "IDENTIFIER";
+        case TOKEN_NUMBER: return "NUMBER";
+        case TOKEN_PLUS: return "PLUS";
+        case TOKEN_MINUS: return "MINUS";
+        case TOKEN_MULTIPLY: return "MULTIPLY";
+        case TOKEN_DIVIDE: return "DIVIDE";
+        case TOKEN_ASSIGN: return "ASSIGN";
+        case TOKEN_SEMICOLON: return "SEMICOLON";
+        case TOKEN_COMMA: return "COMMA";
+        case TOKEN_LPAREN: return "LPAREN";
+        case TOKEN_RPAREN: return "RPAREN";
+        case TOKEN_LBRACE: return "LBRACE";
+        case TOKEN_RBRACE: return "RBRACE";
+        case TOKEN_IF: return "IF";
+        case TOKEN_ELSE: return "ELSE";
+        case TOKEN_PRINT: return "PRINT";
+        case TOKEN_WHILE: return "WHILE";
+        case TOKEN_DEF: return "DEF";
+        case TOKEN_RETURN: return "RETURN";
+        case TOKEN_GREATER: return "GREATER";
+        case TOKEN_LESS: return "LESS";
+        case TOKEN_EQUAL: return "EQUAL";
+        case TOKEN_NOT_EQUAL: return "NOT_EQUAL";
+        case TOKEN_GREATER_EQUAL: return "GREATER_EQUAL";
+        case TOKEN_LESS_EQUAL: return "LESS_EQUAL";
+        case TOKEN_EOF: return "EOF";
+        default: return "UNKNOWN";
+    }
+}
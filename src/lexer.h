@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include "diagnostics.h"
+#include "stats.h"
+#include "allocator.h"
 
 typedef enum {
     TOKEN_ID,
@@ -15,6 +19,7 @@ typedef enum {
     TOKEN_DIVIDE,
     TOKEN_ASSIGN,
     TOKEN_SEMICOLON,
+    TOKEN_COMMA,
     TOKEN_LPAREN,
     TOKEN_RPAREN,
     TOKEN_LBRACE,
@@ -22,6 +27,9 @@ typedef enum {
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_PRINT,
+    TOKEN_WHILE,
+    TOKEN_DEF,
+    TOKEN_RETURN,
     TOKEN_GREATER,
     TOKEN_LESS,
     TOKEN_EQUAL,
@@ -34,22 +42,44 @@ typedef enum {
 typedef struct {
     TokenType type;
     char* value;
+    size_t start;    // byte offset of the token in the source
+    size_t length;   // bytes the token spans in the source
 } Token;
 
+// When attached to a lexer, get_next_token appends every token it hands
+// out: word 0 is left for the count, then one (type, start, length) triple
+// per token
+typedef struct {
+    int32_t* words;
+    size_t used;
+    size_t capacity;
+} TokenRecord;
+
 typedef struct {
     char* src;
     size_t position;
     size_t length;
     char current_char;
+    size_t token_start;
+    Diagnostics* diagnostics;
+    TokenRecord* record;
+    CompileStats* stats;
+    const Allocator* allocator;
 } Lexer;
 
 Lexer* init_lexer(char* src);
+Lexer* init_lexer_with_length(char* src, size_t length);
+Lexer* init_lexer_with_allocator(char* src, size_t length, const Allocator* allocator);
 void advance(Lexer* lexer);
 void skip_whitespace(Lexer* lexer);
 Token* get_next_token(Lexer* lexer);
-Token* create_token(TokenType type, char* value);
+Token* create_token(Lexer* lexer, TokenType type, char* value);
+void free_token(Lexer* lexer, Token* token);
 char* read_identifier(Lexer* lexer);
 char* read_number(Lexer* lexer);
 void free_lexer(Lexer* lexer);
+void init_token_record(TokenRecord* record, size_t source_length, const Allocator* allocator);
+int32_t* finish_token_record(TokenRecord* record, size_t* token_count);
+const char* token_type_to_string(TokenType type);
 
 #endif 
\ No newline at end of file
@@ -4,6 +4,12 @@
 #include "lexer.h"
 #include "parser.h"
 #include "codegen.h"
+#include "cache.h"
+#include "compiler.h"
+#include "server.h"
+#include "batch.h"
+#include "parcodegen.h"
+#include "tiny.h"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -28,129 +34,27 @@ char* read_file(const char* filename) {
     return buffer;
 }
 
-char* compile_string(const char* source) {
-    Lexer* lexer = init_lexer(strdup(source));
-    Parser* parser = init_parser(lexer);
-    
-    ASTNode* ast = parse(parser);
-    char* output = generate_code(ast);
-    
-    free_ast(ast);
-    free_parser(parser);
-    free_lexer(lexer);
-    
-    return output;
-}
-
-const char* token_type_to_string(TokenType type) {
-    switch (type) {
-        case TOKEN_ID: return "IDENTIFIER";
-        case TOKEN_NUMBER: return "NUMBER";
-        case TOKEN_PLUS: return "PLUS";
-        case TOKEN_MINUS: return "MINUS";
-        case TOKEN_MULTIPLY: return "MULTIPLY";
-        case TOKEN_DIVIDE: return "DIVIDE";
-        case TOKEN_ASSIGN: return "ASSIGN";
-        case TOKEN_SEMICOLON: return "SEMICOLON";
-        case TOKEN_LPAREN: return "LPAREN";
-        case TOKEN_RPAREN: return "RPAREN";
-        case TOKEN_LBRACE: return "LBRACE";
-        case TOKEN_RBRACE: return "RBRACE";
-        case TOKEN_IF: return "IF";
-        case TOKEN_ELSE: return "ELSE";
-        case TOKEN_PRINT: return "PRINT";
-        case TOKEN_GREATER: return "GREATER";
-        case TOKEN_LESS: return "LESS";
-        case TOKEN_EQUAL: return "EQUAL";
-        case TOKEN_NOT_EQUAL: return "NOT_EQUAL";
-        case TOKEN_GREATER_EQUAL: return "GREATER_EQUAL";
-        case TOKEN_LESS_EQUAL: return "LESS_EQUAL";
-        case TOKEN_EOF: return "EOF";
-        default: return "UNKNOWN";
-    }
-}
-
-char* tokenize_string(const char* source) {
-    Lexer* lexer = init_lexer(strdup(source));
-    
-    // Estimate buffer size (generous allocation)
-    size_t buffer_size = strlen(source) * 10 + 1000;
-    char* json_buffer = malloc(buffer_size);
-    strcpy(json_buffer, "[");
-    
-    Token* token;
-    int first = 1;
-    
-    while ((token = get_next_token(lexer))->type != TOKEN_EOF) {
-        if (!first) {
-            strcat(json_buffer, ",");
-        }
-        first = 0;
-        
-        // Add token object to JSON
-        char token_json[500];
-        if (token->value) {
-            // Escape quotes in value
-            char escaped_value[200];
-            int j = 0;
-            for (int i = 0; token->value[i] && j < 198; i++) {
-                if (token->value[i] == '"' || token->value[i] == '\\') {
-                    escaped_value[j++] = '\\';
-                }
-                escaped_value[j++] = token->value[i];
-            }
-            escaped_value[j] = '\0';
-            
-            snprintf(token_json, sizeof(token_json), 
-                "{\"type\":\"%s\",\"value\":\"%s\"}", 
-                token_type_to_string(token->type), escaped_value);
-        } else {
-            snprintf(token_json, sizeof(token_json), 
-                "{\"type\":\"%s\",\"value\":null}", 
-                token_type_to_string(token->type));
-        }
-        
-        strcat(json_buffer, token_json);
-        
-        // Free token
-        if (token->value) free(token->value);
-        free(token);
-    }
-    
-    // Handle EOF token
-    if (!first) {
-        strcat(json_buffer, ",");
+#ifdef __EMSCRIPTEN__
+#define WASM_CACHE_BUDGET (8 * 1024 * 1024)
+
+static CompileCache* playground_cache = NULL;
+
+EMSCRIPTEN_KEEPALIVE
+char* compile(const char* source) {
+    if (!playground_cache) {
+        playground_cache = init_cache(WASM_CACHE_BUDGET, NULL);
     }
-    strcat(json_buffer, "{\"type\":\"EOF\",\"value\":null}");
-    strcat(json_buffer, "]");
-    
-    // Free EOF token
-    if (token->value) free(token->value);
-    free(token);
-    
-    free_lexer(lexer);
-    
-    return json_buffer;
+    return compile_string_cached(playground_cache, source, 0);
 }
 
-char* parse_to_ast(const char* source) {
-    Lexer* lexer = init_lexer(strdup(source));
-    Parser* parser = init_parser(lexer);
-    
-    ASTNode* ast = parse(parser);
-    char* json = ast_to_json(ast);
-    
-    free_ast(ast);
-    free_parser(parser);
-    free_lexer(lexer);
-    
-    return json;
+EMSCRIPTEN_KEEPALIVE
+unsigned int cache_hit_count() {
+    return playground_cache ? (unsigned int)cache_stats(playground_cache).hits : 0;
 }
 
-#ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
-char* compile(const char* source) {
-    return compile_string(source);
+unsigned int cache_miss_count() {
+    return playground_cache ? (unsigned int)cache_stats(playground_cache).misses : 0;
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -158,11 +62,34 @@ char* tokenize(const char* source) {
     return tokenize_string(source);
 }
 
+// Token triples for public/token-array.js; `source` is `length` UTF-8 bytes
+// the caller keeps alive to slice token text out of
+EMSCRIPTEN_KEEPALIVE
+int32_t* tokenize_typed(const char* source, int length) {
+    return tokenize_source_to_array(source, (size_t)length, NULL, NULL);
+}
+
+EMSCRIPTEN_KEEPALIVE
+const char* token_type_name(int type) {
+    return token_type_to_string((TokenType)type);
+}
+
 EMSCRIPTEN_KEEPALIVE
 char* parse_ast(const char* source) {
     return parse_to_ast(source);
 }
 
+EMSCRIPTEN_KEEPALIVE
+char* parse_ast_compact(const char* source) {
+    return parse_source_to_compact_json(source, strlen(source), NULL);
+}
+
+// Binary tree for public/ast-binary.js; the buffer holds its own length
+EMSCRIPTEN_KEEPALIVE
+char* parse_ast_binary(const char* source) {
+    return parse_source_to_binary(source, strlen(source), NULL, NULL);
+}
+
 EMSCRIPTEN_KEEPALIVE
 void free_result(char* result) {
     free_code(result);
@@ -177,28 +104,439 @@ EMSCRIPTEN_KEEPALIVE
 void free_ast_json(char* ast_json) {
     free(ast_json);
 }
+
+// Buffer-based entry points. The source is `length` bytes the caller wrote
+// into its own heap buffer, so nothing is copied onto the stack or scanned
+// for a NUL. They return 0 on success with the result in *output and
+// *output_length, or 1 with the diagnostics there instead. Either way the
+// bytes belong to the playground context and stay valid until the next
+// call; there is nothing to free.
+static TinyContext* playground_context = NULL;
+static char* cached_output = NULL;
+
+static TinyContext* get_playground_context() {
+    if (!playground_context) {
+        TinyOptions options = { TINY_COMPACT_JSON, NULL, 0 };
+        playground_context = tiny_create_context(&options);
+    }
+    return playground_context;
+}
+
+static int finish_buf(TinyStatus status, const char* output, size_t length,
+                      const char** output_ptr, int* output_length) {
+    if (status != TINY_OK) {
+        output = tiny_diagnostics(playground_context);
+        length = strlen(output);
+    }
+    *output_ptr = output;
+    *output_length = (int)length;
+    return status;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int compile_buf(const char* source, int length, const char** output_ptr, int* output_length) {
+    TinyContext* context = get_playground_context();
+    if (!playground_cache) {
+        playground_cache = init_cache(WASM_CACHE_BUDGET, NULL);
+    }
+
+    free(cached_output);
+    cached_output = cache_lookup(playground_cache, source, length, 0);
+    if (cached_output) {
+        return finish_buf(TINY_OK, cached_output, strlen(cached_output), output_ptr, output_length);
+    }
+
+    const char* output;
+    size_t size;
+    TinyStatus status = tiny_compile(context, source, length, &output, &size);
+    if (status == TINY_OK) {
+        cache_store(playground_cache, source, length, 0, output);
+    }
+    return finish_buf(status, output, size, output_ptr, output_length);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int parse_buf(const char* source, int length, const char** output_ptr, int* output_length) {
+    const char* output;
+    size_t size;
+    TinyStatus status = tiny_parse(get_playground_context(), source, length, &output, &size);
+    return finish_buf(status, output, size, output_ptr, output_length);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int parse_binary_buf(const char* source, int length, const char** output_ptr, int* output_length) {
+    const char* output;
+    size_t size;
+    TinyStatus status = tiny_parse_binary(get_playground_context(), source, length, &output, &size);
+    return finish_buf(status, output, size, output_ptr, output_length);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int tokenize_buf(const char* source, int length, const char** output_ptr, int* output_length) {
+    const char* output;
+    size_t size;
+    TinyStatus status = tiny_tokenize(get_playground_context(), source, length, &output, &size);
+    return finish_buf(status, output, size, output_ptr, output_length);
+}
+
+// The result is the token triples alone; there are output_length / 12 tokens
+EMSCRIPTEN_KEEPALIVE
+int tokenize_typed_buf(const char* source, int length, const char** output_ptr, int* output_length) {
+    const int32_t* tokens;
+    size_t count;
+    TinyStatus status = tiny_tokenize_array(get_playground_context(), source, length, &tokens, &count);
+    return finish_buf(status, (const char*)tokens, count * 3 * sizeof(int32_t), output_ptr, output_length);
+}
+
+// Turns measurement of playground calls on or off. The context is
+// replaced, so earlier results are no longer valid.
+EMSCRIPTEN_KEEPALIVE
+void set_stats_enabled(int enabled) {
+    tiny_destroy_context(playground_context);
+    TinyOptions options = { TINY_COMPACT_JSON | (enabled ? TINY_COLLECT_STATS : 0), NULL, 0 };
+    playground_context = tiny_create_context(&options);
+}
+
+// Stores the TinyStats of the last playground call into `values`, one
+// double per field in declaration order
+EMSCRIPTEN_KEEPALIVE
+void last_stats(double* values) {
+    TinyStats stats;
+    tiny_get_stats(get_playground_context(), &stats);
+
+    values[0] = stats.lex_ms;
+    values[1] = stats.parse_ms;
+    values[2] = stats.codegen_ms;
+    values[3] = stats.serialize_ms;
+    values[4] = stats.token_count;
+    values[5] = stats.node_count;
+    values[6] = stats.alloc_count;
+    values[7] = stats.alloc_bytes;
+    values[8] = stats.peak_rss_bytes;
+    values[9] = stats.output_bytes;
+    values[10] = stats.optimize_ms;
+}
+
+// Lexes and parses once for every view the playground refreshes. `outputs`
+// takes the TINY_ANALYZE_* flags; `results` receives four (pointer, length)
+// pairs: token triples (length in tokens), AST (binary when requested,
+// JSON otherwise), JavaScript and diagnostics, with 0 for anything not
+// produced. Tokens are produced even when the source has a syntax error.
+EMSCRIPTEN_KEEPALIVE
+int analyze_buf(const char* source, int length, int outputs, int32_t* results) {
+    TinyContext* context = get_playground_context();
+    TinyAnalysis analysis;
+    TinyStatus status = tiny_analyze(context, source, length, outputs, &analysis);
+    const char* diagnostics = tiny_diagnostics(context);
+
+    results[0] = (int32_t)(uintptr_t)analysis.tokens;
+    results[1] = (int32_t)analysis.token_count;
+    if (analysis.ast_binary) {
+        results[2] = (int32_t)(uintptr_t)analysis.ast_binary;
+        results[3] = (int32_t)analysis.ast_binary_length;
+    } else {
+        results[2] = (int32_t)(uintptr_t)analysis.ast;
+        results[3] = (int32_t)analysis.ast_length;
+    }
+    results[4] = (int32_t)(uintptr_t)analysis.javascript;
+    results[5] = (int32_t)analysis.javascript_length;
+    results[6] = (int32_t)(uintptr_t)diagnostics;
+    results[7] = (int32_t)strlen(diagnostics);
+    return status;
+}
+#endif
+
+#ifndef __EMSCRIPTEN__
+static size_t parse_size(const char* text) {
+    char* end;
+    size_t size = strtoull(text, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': size *= 1024; break;
+        case 'm': case 'M': size *= 1024 * 1024; break;
+        case 'g': case 'G': size *= 1024 * 1024 * 1024; break;
+    }
+
+    return size;
+}
+
+// What -O and --passes keep of the flags given before them
+#define OPTION_FLAGS (ANALYZE_SHARE_EXPRESSIONS | ANALYZE_INSTRUMENT | ANALYZE_BUFFER_OUTPUT | \
+                      ANALYZE_VERIFY_PASSES)
+
+static char* generate_on_pool(ASTNode* program, Diagnostics* diagnostics, CompileStats* stats,
+                              const Allocator* allocator, void* pool) {
+    return generate_code_parallel(program, pool, diagnostics, stats, allocator);
+}
+
+// Compiles like compile_source_with_stats with the extra ANALYZE_* `flags`,
+// also writing the call graph when `path` is set. With a `pool`, code is
+// generated on its threads; with a `profile`, optimized by its counts.
+static char* compile_with_flags(const char* source, size_t length, CompileStats* stats,
+                                unsigned flags, const char* path, ThreadPool* pool,
+                                const Profile* profile) {
+    Analysis analysis;
+    CodegenHook codegen = { generate_on_pool, pool };
+    AnalyzeHooks hooks = { pool ? &codegen : NULL, profile };
+    unsigned outputs = ANALYZE_JAVASCRIPT | flags | (path ? ANALYZE_CALL_GRAPH : 0);
+    analyze_source_with_hooks(source, length, NULL, outputs, &analysis, stats, NULL, &hooks);
+
+    if (path) {
+        FILE* file = fopen(path, "w");
+        if (file) {
+            fwrite(analysis.call_graph, 1, analysis.call_graph_length, file);
+            fclose(file);
+        } else {
+            fprintf(stderr, "Error: Could not write call graph file %s\n", path);
+        }
+    }
+    free(analysis.call_graph);
+    return analysis.javascript;
+}
+
+static void print_usage(const char* program) {
+    printf("Usage: %s [options] <input_file> [output_file]\n", program);
+    printf("       %s [options] -o <output_dir> [-r] <inputs...>\n", program);
+    printf("Options:\n");
+    printf("  --cache-dir=DIR     Reuse compiled output stored in DIR\n");
+    printf("  --cache-size=BYTES  In-memory cache budget (K/M/G suffixes allowed)\n");
+    printf("  --cache-stats       Print cache hit/miss counters to stderr\n");
+    printf("  --stats             Print phase times, counts and memory use to stderr\n");
+    printf("  --trace=FILE        Write phase and statement spans as a Chrome trace\n");
+    printf("  --counters          Add hardware counters per phase to --stats (Linux)\n");
+    printf("  --call-graph=FILE   Write the call graph and inlining decisions as Graphviz\n");
+    printf("  -O0 .. -O3          Optimization level (default -O2); -O3 precomputes output\n");
+    printf("  --passes=LIST       Run these passes in order instead: evaluate, inline, loops\n");
+    printf("  --verify-passes     Check the tree after every pass (slow; for debugging)\n");
+    printf("  --share-expressions Parse repeated expressions into shared nodes\n");
+    printf("  --instrument        Count the statements and if arms that run into profile.json\n");
+    printf("  --profile-use=FILE  Optimize and order code by the counts an --instrument run saved\n");
+    printf("  --buffer-output     Collect printed output and write it in large pieces\n");
+    printf("  --serve             Compile length-prefixed requests from stdin to stdout\n");
+    printf("  --serve=unix:PATH   Compile requests from clients of a Unix domain socket\n");
+    printf("  --memory-limit=N    Fail served requests or batch files needing more (K/M/G)\n");
+    printf("  -j N                Number of compile worker threads (default: cores)\n");
+    printf("  --codegen-threads=N Generate the code of a single large file on N threads\n");
+    printf("  -o DIR              Compile every input in parallel into DIR\n");
+    printf("  -r                  Compile all .tiny files below input directories\n");
+}
 #endif
 
 int main(int argc, char** argv) {
 #ifndef __EMSCRIPTEN__
-    if (argc < 2) {
-        printf("Usage: %s <input_file> [output_file]\n", argv[0]);
+    const char* input_path = NULL;
+    const char* output_path = NULL;
+    const char* cache_dir = NULL;
+    size_t cache_size = CACHE_DEFAULT_BUDGET;
+    size_t memory_limit = 0;
+    int show_cache_stats = 0;
+    int show_stats = 0;
+    int show_counters = 0;
+    const char* trace_path = NULL;
+    const char* call_graph_path = NULL;
+    const char* profile_path = NULL;
+    unsigned flags = 0;
+    int serve = 0;
+    const char* socket_path = NULL;
+    int thread_count = 0;
+    int codegen_threads = 1;
+    const char* output_dir = NULL;
+    int recursive = 0;
+    char** inputs = malloc(sizeof(char*) * argc);
+    int input_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serve") == 0) {
+            serve = 1;
+        } else if (strncmp(argv[i], "--serve=unix:", 13) == 0) {
+            serve = 1;
+            socket_path = argv[i] + 13;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "--codegen-threads=", 18) == 0) {
+            codegen_threads = atoi(argv[i] + 18);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0) {
+            recursive = 1;
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            cache_dir = argv[i] + 12;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cache_size = parse_size(argv[i] + 13);
+        } else if (strncmp(argv[i], "--memory-limit=", 15) == 0) {
+            memory_limit = parse_size(argv[i] + 15);
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            show_cache_stats = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            show_stats = 1;
+            show_counters = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--call-graph=", 13) == 0) {
+            call_graph_path = argv[i] + 13;
+        } else if (strlen(argv[i]) == 3 && strncmp(argv[i], "-O", 2) == 0 &&
+                   argv[i][2] >= '0' && argv[i][2] <= '3') {
+            flags = (flags & OPTION_FLAGS) |
+                    analyze_pipeline_flags(optimization_level_pipeline(argv[i][2] - '0'));
+        } else if (strncmp(argv[i], "--passes=", 9) == 0) {
+            PassPipeline pipeline;
+            if (parse_pass_list(argv[i] + 9, &pipeline) != 0) {
+                fprintf(stderr, "Error: Invalid pass list %s (at most %d of evaluate, inline, loops)\n",
+                        argv[i] + 9, PIPELINE_MAX_PASSES);
+                free(inputs);
+                return 1;
+            }
+            flags = (flags & OPTION_FLAGS) |
+                    analyze_pipeline_flags(pipeline);
+        } else if (strcmp(argv[i], "--verify-passes") == 0) {
+            flags |= ANALYZE_VERIFY_PASSES;
+        } else if (strcmp(argv[i], "--share-expressions") == 0) {
+            flags |= ANALYZE_SHARE_EXPRESSIONS;
+        } else if (strcmp(argv[i], "--instrument") == 0) {
+            flags |= ANALYZE_INSTRUMENT;
+        } else if (strcmp(argv[i], "--buffer-output") == 0) {
+            flags |= ANALYZE_BUFFER_OUTPUT;
+        } else if (strncmp(argv[i], "--profile-use=", 14) == 0) {
+            profile_path = argv[i] + 14;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            print_usage(argv[0]);
+            free(inputs);
+            return 1;
+        } else {
+            inputs[input_count++] = argv[i];
+        }
+    }
+
+    if (input_count > 0) input_path = inputs[0];
+    if (input_count > 1) output_path = inputs[1];
+
+    // Options that only describe the compile of a single file
+    const char* single = profile_path ? "--profile-use" :
+                         codegen_threads != 1 ? "--codegen-threads" :
+                         show_counters ? "--counters" :
+                         show_stats ? "--stats" :
+                         trace_path ? "--trace" :
+                         call_graph_path ? "--call-graph" : NULL;
+
+    if (serve) {
+        if (single) {
+            fprintf(stderr, "Error: %s cannot be used with --serve\n", single);
+            free(inputs);
+            return 1;
+        }
+
+        ServerOptions options;
+        options.thread_count = thread_count;
+        options.socket_path = socket_path;
+        options.cache_size = cache_size;
+        options.cache_dir = cache_dir;
+        options.memory_limit = memory_limit;
+        options.flags = flags;
+        options.max_queued = 0;
+        free(inputs);
+        return run_server(&options);
+    }
+
+    if (output_dir || recursive) {
+        if (!output_dir || input_count == 0) {
+            print_usage(argv[0]);
+            free(inputs);
+            return 1;
+        }
+        if (single) {
+            fprintf(stderr, "Error: %s cannot be used with -o or -r\n", single);
+            free(inputs);
+            return 1;
+        }
+
+        BatchOptions options;
+        options.thread_count = thread_count;
+        options.output_dir = output_dir;
+        options.recursive = recursive;
+        options.cache = cache_dir ? init_cache(cache_size, cache_dir) : NULL;
+        options.memory_limit = memory_limit;
+        options.flags = flags;
+
+        int failed = compile_batch(&options, inputs, input_count);
+        free_cache(options.cache);
+        free(inputs);
+        return failed > 0 ? 1 : 0;
+    }
+    free(inputs);
+
+    if (!input_path) {
+        print_usage(argv[0]);
         return 1;
     }
     
-    char* source = read_file(argv[1]);
+    // Only measured on request: timing every token has a cost
+    CompileStats stats;
+    CompileStats* measure = show_stats || trace_path ? &stats : NULL;
+    PerfCounters counters;
+    init_compile_stats(&stats, trace_path != NULL);
+    if (show_counters) {
+        open_perf_counters(&counters);
+        stats.counters = &counters;
+    }
+
+    uint64_t start = begin_phase(&stats);
+    char* source = read_file(input_path);
     if (!source) {
+        if (show_counters) close_perf_counters(&counters);
+        free_compile_stats(&stats);
         return 1;
     }
+    size_t length = strlen(source);
+    if (measure) add_phase_time(measure, PHASE_READ, start);
     
-    char* output = compile_string(source);
+    Profile profile;
+    char* profile_text = profile_path ? read_file(profile_path) : NULL;
+    if (profile_path && (!profile_text ||
+                         parse_profile(profile_text, strlen(profile_text), &profile) != 0)) {
+        if (profile_text) fprintf(stderr, "Error: Invalid profile %s\n", profile_path);
+        free(profile_text);
+        free(source);
+        if (show_counters) close_perf_counters(&counters);
+        free_compile_stats(&stats);
+        return 1;
+    }
+    free(profile_text);
+
+    CompileCache* cache = cache_dir ? init_cache(cache_size, cache_dir) : NULL;
+    // Neither the call graph nor the profile is part of the cache key, so
+    // asking for either always compiles
+    int cacheable = cache && !call_graph_path && !profile_path;
+    char* output = cacheable ? cache_lookup(cache, source, length, flags) : NULL;
+    if (!output) {
+        // The output is the same either way, so the cache key ignores it
+        ThreadPool* pool = codegen_threads > 1 ? init_threadpool(codegen_threads) : NULL;
+        output = compile_with_flags(source, length, measure, flags, call_graph_path, pool,
+                                    profile_path ? &profile : NULL);
+        if (pool) free_threadpool(pool);
+        if (cacheable) cache_store(cache, source, length, flags, output);
+    }
+    if (profile_path) free_profile(&profile);
     free(source);
+
+    if (cache && show_cache_stats) {
+        CacheStats stats = cache_stats(cache);
+        fprintf(stderr, "cache: %llu hits (%llu from disk), %llu misses, %zu entries, %zu bytes\n",
+                (unsigned long long)stats.hits, (unsigned long long)stats.disk_hits,
+                (unsigned long long)stats.misses, stats.entries, stats.bytes);
+    }
+    free_cache(cache);
     
-    if (argc >= 3) {
-        FILE* file = fopen(argv[2], "w");
+    start = begin_phase(&stats);
+    if (output_path) {
+        FILE* file = fopen(output_path, "w");
         if (!file) {
-            fprintf(stderr, "Error: Could not open output file %s\n", argv[2]);
+            fprintf(stderr, "Error: Could not open output file %s\n", output_path);
             free_code(output);
+            if (show_counters) close_perf_counters(&counters);
+            free_compile_stats(&stats);
             return 1;
         }
         
@@ -206,10 +544,28 @@ int main(int argc, char** argv) {
         fclose(file);
     } else {
         printf("%s\n", output);
+        fflush(stdout);
     }
     
     free_code(output);
+
+    if (measure) {
+        add_phase_time(measure, PHASE_WRITE, start);
+        end_compile_stats(measure);
+    }
+    if (show_stats) {
+        print_compile_stats(&stats, stderr);
+    }
+    if (show_counters) {
+        close_perf_counters(&counters);
+    }
+    if (trace_path && write_trace(&stats, trace_path) != 0) {
+        fprintf(stderr, "Error: Could not write trace file %s\n", trace_path);
+        free_compile_stats(&stats);
+        return 1;
+    }
+    free_compile_stats(&stats);
 #endif
     
     return 0;
-} 
+}
\ No newline at end of file
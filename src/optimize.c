@@ -0,0 +1,506 @@
+#include "optimize.h"
+#include "scope.h"
+#include "profile.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_REDUCTIONS 8
+
+typedef struct {
+    const Allocator* allocator;
+    const NodeMap* profile;
+    Scope scope;    // variables declared at the statement being optimized
+    int invariant_count;
+    int induction_count;
+    LoopOptimizations result;
+} Optimizer;
+
+// Temporary holding `induction * factor`
+typedef struct {
+    int factor;
+    char* name;
+} Reduction;
+
+typedef struct {
+    ASTNode* loop;
+    Scope assigned;    // every variable assigned inside the loop, with counts
+    ASTNode** preheader;    // statements to run once in front of the loop
+    size_t preheader_count;
+    size_t preheader_capacity;
+    size_t first_invariant;    // preheader statements from here on hold invariants
+    const char* induction;
+    Reduction reductions[MAX_REDUCTIONS];
+    size_t reduction_count;
+} LoopInfo;
+
+typedef void (*ExpressionVisitor)(Optimizer* opt, LoopInfo* info, ASTNode** slot);
+
+static ASTNode* new_node(Optimizer* opt, ASTNodeType type) {
+    ASTNode* node = allocate(opt->allocator, sizeof(ASTNode));
+    memset(node, 0, sizeof(ASTNode));
+    node->type = type;
+    return node;
+}
+
+static ASTNode* new_variable(Optimizer* opt, const char* name) {
+    ASTNode* node = new_node(opt, AST_VARIABLE);
+    node->data.variable.name = copy_string(opt->allocator, name, strlen(name));
+    return node;
+}
+
+static ASTNode* new_number(Optimizer* opt, int value) {
+    ASTNode* node = new_node(opt, AST_NUMBER);
+    node->data.number.value = value;
+    return node;
+}
+
+static ASTNode* new_binary_op(Optimizer* opt, char op, ASTNode* left, ASTNode* right) {
+    ASTNode* node = new_node(opt, AST_BINARY_OP);
+    node->data.binary_op.op = op;
+    node->data.binary_op.left = left;
+    node->data.binary_op.right = right;
+    return node;
+}
+
+static ASTNode* new_assign(Optimizer* opt, const char* name, ASTNode* value) {
+    ASTNode* node = new_node(opt, AST_ASSIGN);
+    node->data.assign.name = copy_string(opt->allocator, name, strlen(name));
+    node->data.assign.value = value;
+    return node;
+}
+
+static char* temporary_name(Optimizer* opt, const char* prefix, int* counter) {
+    char name[32];
+    int length = snprintf(name, sizeof(name), "$%s%d", prefix, (*counter)++);
+    return copy_string(opt->allocator, name, (size_t)length);
+}
+
+// Makes room for `count` statements at `index` of a program node
+static void insert_statements(Optimizer* opt, ASTNode* block, size_t index,
+                              ASTNode** statements, size_t count) {
+    size_t total = block->data.program.statement_count + count;
+    ASTNode** list = reallocate(opt->allocator, block->data.program.statements,
+                                total * sizeof(ASTNode*));
+
+    memmove(list + index + count, list + index,
+            (block->data.program.statement_count - index) * sizeof(ASTNode*));
+    memcpy(list + index, statements, count * sizeof(ASTNode*));
+    block->data.program.statements = list;
+    block->data.program.statement_count = total;
+}
+
+static void remove_statement(ASTNode* block, size_t index) {
+    ASTNode** list = block->data.program.statements;
+    memmove(list + index, list + index + 1,
+            (block->data.program.statement_count - index - 1) * sizeof(ASTNode*));
+    block->data.program.statement_count--;
+}
+
+static void add_to_preheader(Optimizer* opt, LoopInfo* info, ASTNode* statement) {
+    if (info->preheader_count == info->preheader_capacity) {
+        info->preheader_capacity = info->preheader_capacity ? info->preheader_capacity * 2 : 8;
+        info->preheader = reallocate(opt->allocator, info->preheader,
+                                     info->preheader_capacity * sizeof(ASTNode*));
+    }
+    info->preheader[info->preheader_count++] = statement;
+}
+
+static void collect_assigned(Scope* assigned, ASTNode* node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                collect_assigned(assigned, node->data.program.statements[i]);
+            }
+            break;
+        case AST_ASSIGN:
+            declare_name(assigned, node->data.assign.name);
+            break;
+        case AST_IF:
+            collect_assigned(assigned, node->data.if_statement.if_body);
+            collect_assigned(assigned, node->data.if_statement.else_body);
+            break;
+        case AST_WHILE:
+            collect_assigned(assigned, node->data.while_loop.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static int assigns_name(ASTNode* node, const char* name) {
+    if (!node) return 0;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                if (assigns_name(node->data.program.statements[i], name)) return 1;
+            }
+            return 0;
+        case AST_ASSIGN:
+            return strcmp(node->data.assign.name, name) == 0;
+        case AST_IF:
+            return assigns_name(node->data.if_statement.if_body, name) ||
+                   assigns_name(node->data.if_statement.else_body, name);
+        case AST_WHILE:
+            return assigns_name(node->data.while_loop.body, name);
+        default:
+            return 0;
+    }
+}
+
+// Calls `visit` on the slot of every top-level expression in `node`
+static void visit_expressions(Optimizer* opt, LoopInfo* info, ASTNode* node,
+                              ExpressionVisitor visit) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                visit_expressions(opt, info, node->data.program.statements[i], visit);
+            }
+            break;
+        case AST_ASSIGN:
+            visit(opt, info, &node->data.assign.value);
+            break;
+        case AST_IF:
+            visit(opt, info, &node->data.if_statement.condition);
+            visit_expressions(opt, info, node->data.if_statement.if_body, visit);
+            visit_expressions(opt, info, node->data.if_statement.else_body, visit);
+            break;
+        case AST_PRINT:
+            visit(opt, info, &node->data.print.expression);
+            break;
+        case AST_WHILE:
+            visit(opt, info, &node->data.while_loop.condition);
+            visit_expressions(opt, info, node->data.while_loop.body, visit);
+            break;
+        case AST_CALL:
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                visit(opt, info, &node->data.call.args[i]);
+            }
+            break;
+        case AST_RETURN:
+            visit(opt, info, &node->data.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+// Calls `visit` on each argument slot when `node` is a call
+static void visit_arguments(Optimizer* opt, LoopInfo* info, ASTNode* node,
+                            ExpressionVisitor visit) {
+    if (node->type != AST_CALL) return;
+
+    for (size_t i = 0; i < node->data.call.arg_count; i++) {
+        visit(opt, info, &node->data.call.args[i]);
+    }
+}
+
+static int is_variable(ASTNode* node, const char* name) {
+    return node->type == AST_VARIABLE && strcmp(node->data.variable.name, name) == 0;
+}
+
+static int same_expression(ASTNode* a, ASTNode* b) {
+    if (a->type != b->type) return 0;
+
+    switch (a->type) {
+        case AST_NUMBER:
+            return a->data.number.value == b->data.number.value;
+        case AST_VARIABLE:
+            return strcmp(a->data.variable.name, b->data.variable.name) == 0;
+        case AST_BINARY_OP:
+            return a->data.binary_op.op == b->data.binary_op.op &&
+                   same_expression(a->data.binary_op.left, b->data.binary_op.left) &&
+                   same_expression(a->data.binary_op.right, b->data.binary_op.right);
+        default:
+            return 0;
+    }
+}
+
+// Whether `node` has the same value on every iteration and can already be
+// evaluated in front of the loop; calls never are, since they may print
+static int is_invariant(Optimizer* opt, LoopInfo* info, ASTNode* node) {
+    switch (node->type) {
+        case AST_NUMBER:
+            return 1;
+        case AST_VARIABLE:
+            return !is_declared(&info->assigned, node->data.variable.name) &&
+                   is_declared(&opt->scope, node->data.variable.name);
+        case AST_BINARY_OP:
+            return is_invariant(opt, info, node->data.binary_op.left) &&
+                   is_invariant(opt, info, node->data.binary_op.right);
+        default:
+            return 0;
+    }
+}
+
+static void hoist_invariant(Optimizer* opt, LoopInfo* info, ASTNode** slot) {
+    ASTNode* node = *slot;
+    if (node->type != AST_BINARY_OP) {
+        visit_arguments(opt, info, node, hoist_invariant);
+        return;
+    }
+
+    if (!is_invariant(opt, info, node)) {
+        // Operands may be replaced, which must not change other places
+        // the parser shared this expression with
+        node = unshare_ast_node(slot, opt->allocator);
+        hoist_invariant(opt, info, &node->data.binary_op.left);
+        hoist_invariant(opt, info, &node->data.binary_op.right);
+        return;
+    }
+
+    // The same expression hoisted twice shares one temporary
+    for (size_t i = info->first_invariant; i < info->preheader_count; i++) {
+        ASTNode* hoisted = info->preheader[i];
+        if (same_expression(hoisted->data.assign.value, node)) {
+            *slot = new_variable(opt, hoisted->data.assign.name);
+            free_ast_with_allocator(node, opt->allocator);
+            opt->result.hoisted++;
+            return;
+        }
+    }
+
+    char* name = temporary_name(opt, "inv", &opt->invariant_count);
+    add_to_preheader(opt, info, new_assign(opt, name, node));
+    *slot = new_variable(opt, name);
+    deallocate(opt->allocator, name);
+    opt->result.hoisted++;
+}
+
+// Moves the temporaries an inner loop hoisted into this loop's body further
+// out when they are invariant here too, then hoists this loop's own
+// invariant expressions
+static void move_invariant_code(Optimizer* opt, LoopInfo* info) {
+    ASTNode* body = info->loop->data.while_loop.body;
+    info->first_invariant = info->preheader_count;
+
+    for (size_t i = 0; i < body->data.program.statement_count;) {
+        ASTNode* statement = body->data.program.statements[i];
+        if (statement->type == AST_ASSIGN && statement->data.assign.name[0] == '$' &&
+            declaration_count(&info->assigned, statement->data.assign.name) == 1 &&
+            is_invariant(opt, info, statement->data.assign.value)) {
+            remove_statement(body, i);
+            add_to_preheader(opt, info, statement);
+            opt->result.hoisted++;
+        } else {
+            i++;
+        }
+    }
+
+    hoist_invariant(opt, info, &info->loop->data.while_loop.condition);
+    visit_expressions(opt, info, body, hoist_invariant);
+}
+
+static void replace_products(Optimizer* opt, LoopInfo* info, ASTNode** slot) {
+    ASTNode* node = *slot;
+    if (node->type != AST_BINARY_OP) {
+        visit_arguments(opt, info, node, replace_products);
+        return;
+    }
+
+    ASTNode* left = node->data.binary_op.left;
+    ASTNode* right = node->data.binary_op.right;
+    ASTNode* factor = NULL;
+    if (node->data.binary_op.op == '*') {
+        if (is_variable(left, info->induction) && right->type == AST_NUMBER) factor = right;
+        if (is_variable(right, info->induction) && left->type == AST_NUMBER) factor = left;
+    }
+    if (!factor) {
+        node = unshare_ast_node(slot, opt->allocator);
+        replace_products(opt, info, &node->data.binary_op.left);
+        replace_products(opt, info, &node->data.binary_op.right);
+        return;
+    }
+
+    Reduction* reduction = NULL;
+    for (size_t i = 0; i < info->reduction_count; i++) {
+        if (info->reductions[i].factor == factor->data.number.value) {
+            reduction = &info->reductions[i];
+        }
+    }
+    if (!reduction) {
+        if (info->reduction_count == MAX_REDUCTIONS) return;
+        reduction = &info->reductions[info->reduction_count++];
+        reduction->factor = factor->data.number.value;
+        reduction->name = temporary_name(opt, "iv", &opt->induction_count);
+        ASTNode* start = new_binary_op(opt, '*', new_variable(opt, info->induction),
+                                       new_number(opt, reduction->factor));
+        add_to_preheader(opt, info, new_assign(opt, reduction->name, start));
+    }
+
+    *slot = new_variable(opt, reduction->name);
+    free_ast_with_allocator(node, opt->allocator);
+    opt->result.reduced++;
+}
+
+// The step of `statement` when it is `name = name + c`, `name = c + name`
+// or `name = name - c`; 0 otherwise
+static long long induction_step(ASTNode* statement) {
+    if (statement->type != AST_ASSIGN) return 0;
+
+    const char* name = statement->data.assign.name;
+    ASTNode* value = statement->data.assign.value;
+    if (value->type != AST_BINARY_OP) return 0;
+
+    ASTNode* left = value->data.binary_op.left;
+    ASTNode* right = value->data.binary_op.right;
+    if (value->data.binary_op.op == '+') {
+        if (is_variable(left, name) && right->type == AST_NUMBER) return right->data.number.value;
+        if (is_variable(right, name) && left->type == AST_NUMBER) return left->data.number.value;
+    } else if (value->data.binary_op.op == '-') {
+        if (is_variable(left, name) && right->type == AST_NUMBER) return -right->data.number.value;
+    }
+    return 0;
+}
+
+// Whether `name` holds a whole number when the loop at `index` starts, so
+// repeated addition gives exactly the products it replaces
+static int starts_as_number(ASTNode* block, size_t index, const char* name) {
+    for (size_t i = index; i > 0; i--) {
+        ASTNode* statement = block->data.program.statements[i - 1];
+        if (assigns_name(statement, name)) {
+            return statement->type == AST_ASSIGN &&
+                   statement->data.assign.value->type == AST_NUMBER;
+        }
+    }
+    return 0;
+}
+
+static void reduce_induction_variables(Optimizer* opt, LoopInfo* info, ASTNode* block,
+                                       size_t index) {
+    ASTNode* body = info->loop->data.while_loop.body;
+
+    for (size_t i = 0; i < body->data.program.statement_count; i++) {
+        ASTNode* statement = body->data.program.statements[i];
+        long long step = induction_step(statement);
+        if (step == 0 || declaration_count(&info->assigned, statement->data.assign.name) != 1 ||
+            !starts_as_number(block, index, statement->data.assign.name)) {
+            continue;
+        }
+
+        info->induction = statement->data.assign.name;
+        info->reduction_count = 0;
+        replace_products(opt, info, &info->loop->data.while_loop.condition);
+        visit_expressions(opt, info, body, replace_products);
+
+        // Each temporary moves right after the variable does, so it equals
+        // the product everywhere the product was read
+        ASTNode* updates[MAX_REDUCTIONS];
+        for (size_t j = 0; j < info->reduction_count; j++) {
+            Reduction* reduction = &info->reductions[j];
+            long long delta = step * reduction->factor;
+            char op = delta < 0 ? '-' : '+';
+            if (delta < 0) delta = -delta;
+
+            // A step too large for a number literal keeps the product
+            ASTNode* amount = delta > INT_MAX
+                ? new_binary_op(opt, '*', new_number(opt, (int)(step < 0 ? -step : step)),
+                                new_number(opt, reduction->factor))
+                : new_number(opt, (int)delta);
+            updates[j] = new_assign(opt, reduction->name,
+                                    new_binary_op(opt, op, new_variable(opt, reduction->name), amount));
+            declare_name(&info->assigned, updates[j]->data.assign.name);
+            deallocate(opt->allocator, reduction->name);
+        }
+        insert_statements(opt, body, i + 1, updates, info->reduction_count);
+        i += info->reduction_count;
+    }
+}
+
+static void optimize_block(Optimizer* opt, ASTNode* block);
+
+// Returns how many statements were inserted in front of the loop
+static size_t optimize_loop(Optimizer* opt, ASTNode* block, size_t index) {
+    LoopInfo info;
+    memset(&info, 0, sizeof(LoopInfo));
+    info.loop = block->data.program.statements[index];
+
+    // Inner loops first, so what they hoist can move further out from here
+    optimize_block(opt, info.loop->data.while_loop.body);
+
+    init_scope(&info.assigned, opt->allocator);
+    collect_assigned(&info.assigned, info.loop->data.while_loop.body);
+    reduce_induction_variables(opt, &info, block, index);
+    move_invariant_code(opt, &info);
+
+    size_t count = info.preheader_count;
+    if (count > 0) {
+        insert_statements(opt, block, index, info.preheader, count);
+        for (size_t i = 0; i < count; i++) {
+            declare_name(&opt->scope, info.preheader[i]->data.assign.name);
+        }
+    }
+    deallocate(opt->allocator, info.preheader);
+    free_scope(&info.assigned);
+    return count;
+}
+
+// A function body only sees its parameters and its own variables
+static void optimize_function(Optimizer* opt, ASTNode* function) {
+    Scope outer = opt->scope;
+
+    init_scope(&opt->scope, opt->allocator);
+    for (size_t i = 0; i < function->data.function.param_count; i++) {
+        declare_name(&opt->scope, function->data.function.params[i]);
+    }
+    optimize_block(opt, function->data.function.body);
+    free_scope(&opt->scope);
+    opt->scope = outer;
+}
+
+static void optimize_block(Optimizer* opt, ASTNode* block) {
+    enter_block(&opt->scope);
+
+    for (size_t i = 0; i < block->data.program.statement_count; i++) {
+        ASTNode* statement = block->data.program.statements[i];
+
+        switch (statement->type) {
+            case AST_ASSIGN:
+                declare_name(&opt->scope, statement->data.assign.name);
+                break;
+            case AST_IF:
+                optimize_block(opt, statement->data.if_statement.if_body);
+                if (statement->data.if_statement.else_body) {
+                    optimize_block(opt, statement->data.if_statement.else_body);
+                }
+                break;
+            case AST_WHILE:
+                if (profile_count(opt->profile, statement->data.while_loop.body) == 0) {
+                    opt->result.cold++;
+                    break;
+                }
+                i += optimize_loop(opt, block, i);
+                break;
+            case AST_FUNCTION:
+                optimize_function(opt, statement);
+                break;
+            default:
+                break;
+        }
+    }
+
+    leave_block(&opt->scope);
+}
+
+void optimize_loops(ASTNode* program, const Allocator* allocator, LoopOptimizations* result) {
+    optimize_loops_with_profile(program, allocator, result, NULL);
+}
+
+void optimize_loops_with_profile(ASTNode* program, const Allocator* allocator,
+                                 LoopOptimizations* result, const NodeMap* profile) {
+    Optimizer opt;
+    memset(&opt, 0, sizeof(Optimizer));
+    opt.allocator = allocator;
+    opt.profile = profile;
+    init_scope(&opt.scope, allocator);
+
+    optimize_block(&opt, program);
+
+    free_scope(&opt.scope);
+    if (result) *result = opt.result;
+}
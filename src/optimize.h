@@ -0,0 +1,35 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "parser.h"
+
+// What optimize_loops changed
+typedef struct {
+    size_t hoisted;    // loop-invariant expressions now computed before their loop
+    size_t reduced;    // induction variable products now updated by addition
+    size_t cold;       // loops left alone since the profile says they never iterated
+} LoopOptimizations;
+
+// Rewrites every while loop in `program` in place:
+//
+//   loop-invariant code motion: the largest subexpressions that only read
+//   variables declared before the loop and never assigned inside it are
+//   computed once into a temporary in front of the loop. Expressions have
+//   no side effects, so this is safe even when the loop never runs.
+//
+//   strength reduction: for a variable `i` set to a number right before the
+//   loop and changed only by one `i = i + c` or `i = i - c` directly in its
+//   body, every `i * k` with a number `k` is replaced by a temporary that
+//   starts at i * k and moves by c * k next to the update.
+//
+// Temporaries are named $inv0, $iv0, ..., which no Tiny identifier can
+// collide with. New nodes come from `allocator`, which must be the one the
+// tree was parsed with. `result` may be NULL.
+void optimize_loops(ASTNode* program, const Allocator* allocator, LoopOptimizations* result);
+
+// optimize_loops, skipping the loops whose body never ran according to
+// `profile` (see apply_profile), along with the loops inside them
+void optimize_loops_with_profile(ASTNode* program, const Allocator* allocator,
+                                 LoopOptimizations* result, const NodeMap* profile);
+
+#endif
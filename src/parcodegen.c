@@ -0,0 +1,162 @@
+#include "parcodegen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define CHUNKS_PER_WORKER 4
+
+// The caller's allocator, which need not be thread-safe, taken in turns
+typedef struct {
+    const Allocator* parent;
+    pthread_mutex_t lock;
+} SharedAllocator;
+
+typedef struct {
+    SharedAllocator* shared;
+    ASTNode* program;
+    size_t first;
+    size_t last;
+    const char* const* declared;    // top-level names declared before `first`
+    size_t declared_count;
+    char* code;
+    size_t length;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    Diagnostics diagnostics;
+    int failed;
+} Chunk;
+
+// A refusal becomes a fatal error in the chunk's own diagnostics, raised
+// after the lock is released
+static void* chunk_alloc(void* user, size_t size) {
+    Chunk* chunk = user;
+    pthread_mutex_lock(&chunk->shared->lock);
+    void* memory = chunk->shared->parent->alloc(chunk->shared->parent->user, size);
+    pthread_mutex_unlock(&chunk->shared->lock);
+    if (!memory) report_fatal(&chunk->diagnostics, "Error: Out of memory allocating %zu bytes", size);
+    return memory;
+}
+
+static void* chunk_realloc(void* user, void* memory, size_t size) {
+    Chunk* chunk = user;
+    pthread_mutex_lock(&chunk->shared->lock);
+    void* moved = chunk->shared->parent->realloc(chunk->shared->parent->user, memory, size);
+    pthread_mutex_unlock(&chunk->shared->lock);
+    if (!moved) report_fatal(&chunk->diagnostics, "Error: Out of memory allocating %zu bytes", size);
+    return moved;
+}
+
+static void chunk_free(void* user, void* memory) {
+    Chunk* chunk = user;
+    pthread_mutex_lock(&chunk->shared->lock);
+    chunk->shared->parent->free(chunk->shared->parent->user, memory);
+    pthread_mutex_unlock(&chunk->shared->lock);
+}
+
+// Runs on a worker: fatal errors land here, in the chunk's own
+// diagnostics, and are reported on the calling thread
+static void generate_chunk(void* arg, int worker) {
+    Chunk* chunk = arg;
+    jmp_buf recover;
+    (void)worker;
+
+    Allocator allocator = { chunk_alloc, chunk_realloc, chunk_free, chunk };
+
+    init_diagnostics(&chunk->diagnostics);
+    chunk->diagnostics.recover = &recover;
+    chunk->start_ns = stats_now_ns();
+    if (setjmp(recover) == 0) {
+        chunk->code = generate_statements(chunk->program, chunk->first, chunk->last,
+                                          chunk->declared, chunk->declared_count,
+                                          &chunk->diagnostics, &chunk->length, &allocator);
+    } else {
+        chunk->failed = 1;
+    }
+    chunk->end_ns = stats_now_ns();
+}
+
+char* generate_code_parallel(ASTNode* program, ThreadPool* pool, Diagnostics* diagnostics,
+                             CompileStats* stats, const Allocator* allocator) {
+    size_t count = program->type == AST_PROGRAM ? program->data.program.statement_count : 0;
+    size_t chunk_count = count / PARALLEL_CODEGEN_MIN_CHUNK;
+    size_t max_chunks = (size_t)threadpool_size(pool) * CHUNKS_PER_WORKER;
+    if (chunk_count > max_chunks) chunk_count = max_chunks;
+    if (chunk_count < 2 || threadpool_size(pool) < 2) {
+        return generate_code_traced(program, diagnostics, stats, allocator);
+    }
+
+    SharedAllocator shared;
+    shared.parent = allocator ? allocator : &libc_allocator;
+    pthread_mutex_init(&shared.lock, NULL);
+
+    // Which names each chunk starts out with depends on every statement
+    // before it, so that much is found serially
+    Chunk* chunks = allocate(allocator, chunk_count * sizeof(Chunk));
+    memset(chunks, 0, chunk_count * sizeof(Chunk));
+    Scope top;
+    init_scope(&top, allocator);
+    for (size_t k = 0, i = 0; k < chunk_count; k++) {
+        chunks[k].shared = &shared;
+        chunks[k].program = program;
+        chunks[k].first = count * k / chunk_count;
+        chunks[k].last = count * (k + 1) / chunk_count;
+        for (; i < chunks[k].first; i++) {
+            declare_top_level_names(&top, program->data.program.statements[i]);
+        }
+        chunks[k].declared_count = top.declared_count;
+    }
+
+    // An allocator refusing memory on a worker must not jump to the
+    // caller's recover point from there; with it unset the refusal comes
+    // back as NULL and fails just the chunk
+    jmp_buf* recover = diagnostics ? diagnostics->recover : NULL;
+    if (diagnostics) diagnostics->recover = NULL;
+    for (size_t k = 0; k < chunk_count; k++) {
+        chunks[k].declared = top.declared;
+        threadpool_submit(pool, generate_chunk, &chunks[k]);
+    }
+    threadpool_wait(pool);
+    if (diagnostics) diagnostics->recover = recover;
+    pthread_mutex_destroy(&shared.lock);
+
+    // Prefix sums of the chunk sizes give where each one goes
+    size_t total = strlen(CODEGEN_HEADER);
+    char message[256] = "";
+    for (size_t k = 0; k < chunk_count; k++) {
+        if (chunks[k].failed && !message[0]) {
+            size_t length = chunks[k].diagnostics.length;
+            snprintf(message, sizeof(message), "%.*s", (int)(length ? length - 1 : 0),
+                     chunks[k].diagnostics.text ? chunks[k].diagnostics.text : "");
+        }
+        total += chunks[k].length;
+    }
+
+    char* output = NULL;
+    if (!message[0]) {
+        output = allocate(allocator, total + 1);
+        size_t offset = strlen(CODEGEN_HEADER);
+        memcpy(output, CODEGEN_HEADER, offset);
+        for (size_t k = 0; k < chunk_count; k++) {
+            memcpy(output + offset, chunks[k].code, chunks[k].length);
+            if (stats && stats->trace) {
+                trace_event(stats, "chunk", "codegen", chunks[k].start_ns, chunks[k].end_ns,
+                            (long)k, offset);
+            }
+            offset += chunks[k].length;
+        }
+        output[total] = '\0';
+    }
+
+    // What a failed chunk had allocated is left to the allocator, as for
+    // any abandoned compilation
+    for (size_t k = 0; k < chunk_count; k++) {
+        deallocate(allocator, chunks[k].code);
+        free_diagnostics(&chunks[k].diagnostics);
+    }
+    deallocate(allocator, chunks);
+    free_scope(&top);
+
+    if (message[0]) report_fatal(diagnostics, "%s", message);
+    return output;
+}
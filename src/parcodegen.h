@@ -0,0 +1,21 @@
+#ifndef PARCODEGEN_H
+#define PARCODEGEN_H
+
+#include "codegen.h"
+#include "threadpool.h"
+
+// Programs with fewer top-level statements than this per worker are
+// generated serially; splitting them costs more than it saves
+#define PARALLEL_CODEGEN_MIN_CHUNK 256
+
+// Like generate_code_traced, with the program's top-level statements split
+// into chunks generated on `pool` and copied out in order, so the output is
+// byte-identical. Tracing records one span per chunk instead of one per
+// statement. The workers allocate from `allocator` one at a time, so it
+// need not be thread-safe; while they run, a refusal from an allocator that
+// reports to `diagnostics` fails the compilation like any other error
+// instead of jumping from a worker thread.
+char* generate_code_parallel(ASTNode* program, ThreadPool* pool, Diagnostics* diagnostics,
+                             CompileStats* stats, const Allocator* allocator);
+
+#endif
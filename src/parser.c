@@ -1,9 +1,18 @@
 #include "parser.h"
+#include "strbuf.h"
 #include <stdio.h>
 
+// The parser and the tree come from the lexer's allocator
 Parser* init_parser(Lexer* lexer) {
-    Parser* parser = malloc(sizeof(Parser));
+    Parser* parser = allocate(lexer->allocator, sizeof(Parser));
     parser->lexer = lexer;
+    parser->depth = 0;
+    parser->in_function = 0;
+    parser->share_expressions = 0;
+    parser->expressions = NULL;
+    parser->nodes = NULL;
+    parser->node_count = 0;
+    parser->node_capacity = 0;
     parser->current_token = get_next_token(lexer);
     return parser;
 }
@@ -13,18 +22,235 @@ void advance_parser(Parser* parser) {
 }
 
 void eat(Parser* parser, TokenType type) {
-    if (parser->current_token->type == type) {
+    Token* token = parser->current_token;
+    if (token->type == type) {
         advance_parser(parser);
+        free_token(parser->lexer, token);
     } else {
-        fprintf(stderr, "Syntax error: Expected token type %d, got %d\n", 
-                type, parser->current_token->type);
-        exit(1);
+        report_fatal(parser->lexer->diagnostics, "Syntax error: Expected token type %d, got %d",
+                     type, parser->current_token->type);
     }
 }
 
-ASTNode* create_ast_node(ASTNodeType type) {
-    ASTNode* node = malloc(sizeof(ASTNode));
+// Eats an identifier and hands its name to the caller
+static char* eat_name(Parser* parser) {
+    Token* token = parser->current_token;
+    char* name = token->value;
+    if (token->type == TOKEN_ID) token->value = NULL;
+    eat(parser, TOKEN_ID);
+    return name;
+}
+
+// Nodes start out empty and on parser->nodes, so a syntax error can free
+// the part of the tree built so far
+ASTNode* create_ast_node(Parser* parser, ASTNodeType type) {
+    const Allocator* allocator = parser->lexer->allocator;
+    if (parser->node_count == parser->node_capacity) {
+        parser->node_capacity = parser->node_capacity ? parser->node_capacity * 2 : 64;
+        parser->nodes = reallocate(allocator, parser->nodes,
+                                   sizeof(ASTNode*) * parser->node_capacity);
+    }
+    ASTNode* node = allocate(allocator, sizeof(ASTNode));
+    memset(node, 0, sizeof(ASTNode));
     node->type = type;
+    parser->nodes[parser->node_count++] = node;
+    return node;
+}
+
+// Frees what each node on parser->nodes holds besides other nodes, which
+// are on the list themselves, and then the node
+static void free_unfinished_nodes(Parser* parser) {
+    const Allocator* allocator = parser->lexer->allocator;
+    for (size_t i = 0; i < parser->node_count; i++) {
+        ASTNode* node = parser->nodes[i];
+        switch (node->type) {
+            case AST_PROGRAM:
+                deallocate(allocator, node->data.program.statements);
+                break;
+            case AST_VARIABLE:
+                deallocate(allocator, node->data.variable.name);
+                break;
+            case AST_ASSIGN:
+                deallocate(allocator, node->data.assign.name);
+                break;
+            case AST_FUNCTION:
+                deallocate(allocator, node->data.function.name);
+                for (size_t j = 0; j < node->data.function.param_count; j++) {
+                    deallocate(allocator, node->data.function.params[j]);
+                }
+                deallocate(allocator, node->data.function.params);
+                break;
+            case AST_CALL:
+                deallocate(allocator, node->data.call.name);
+                deallocate(allocator, node->data.call.args);
+                break;
+            default:
+                break;
+        }
+        deallocate(allocator, node);
+    }
+    deallocate(allocator, parser->nodes);
+    parser->nodes = NULL;
+    parser->node_count = 0;
+    parser->node_capacity = 0;
+}
+
+// Every shared expression built so far. Children are shared before their
+// parents, so two binary operations are equal exactly when their
+// operators and child pointers are.
+struct ExpressionTable {
+    ASTNode** slots;
+    size_t capacity;    // a power of two
+    size_t count;
+};
+
+static uint64_t mix_hash(uint64_t hash, uint64_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+static uint64_t hash_expression(const ASTNode* node) {
+    uint64_t hash = mix_hash(0, node->type);
+
+    switch (node->type) {
+        case AST_NUMBER:
+            return mix_hash(hash, (uint32_t)node->data.number.value);
+        case AST_VARIABLE:
+            for (const char* c = node->data.variable.name; *c; c++) {
+                hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+            }
+            return mix_hash(hash, 0);
+        default:
+            hash = mix_hash(hash, (unsigned char)node->data.binary_op.op);
+            hash = mix_hash(hash, (uintptr_t)node->data.binary_op.left);
+            return mix_hash(hash, (uintptr_t)node->data.binary_op.right);
+    }
+}
+
+static int same_expression(const ASTNode* a, const ASTNode* b) {
+    if (a->type != b->type) return 0;
+
+    switch (a->type) {
+        case AST_NUMBER:
+            return a->data.number.value == b->data.number.value;
+        case AST_VARIABLE:
+            return strcmp(a->data.variable.name, b->data.variable.name) == 0;
+        default:
+            return a->data.binary_op.op == b->data.binary_op.op &&
+                   a->data.binary_op.left == b->data.binary_op.left &&
+                   a->data.binary_op.right == b->data.binary_op.right;
+    }
+}
+
+// The slot holding an expression equal to `probe`, or the empty slot where
+// it belongs
+static ASTNode** find_expression(struct ExpressionTable* table, const ASTNode* probe) {
+    size_t mask = table->capacity - 1;
+    size_t i = (size_t)hash_expression(probe) & mask;
+    while (table->slots[i] && !same_expression(table->slots[i], probe)) {
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+static void grow_expression_table(struct ExpressionTable* table, const Allocator* allocator) {
+    ASTNode** old = table->slots;
+    size_t old_capacity = table->capacity;
+
+    table->capacity = old_capacity ? old_capacity * 2 : 256;
+    table->slots = allocate(allocator, table->capacity * sizeof(ASTNode*));
+    memset(table->slots, 0, table->capacity * sizeof(ASTNode*));
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i]) *find_expression(table, old[i]) = old[i];
+    }
+    deallocate(allocator, old);
+}
+
+static void free_expression_table(Parser* parser) {
+    if (!parser->expressions) return;
+    deallocate(parser->lexer->allocator, parser->expressions->slots);
+    deallocate(parser->lexer->allocator, parser->expressions);
+    parser->expressions = NULL;
+}
+
+static int is_shared_expression(Parser* parser, const ASTNode* node) {
+    if (node->type != AST_NUMBER && node->type != AST_VARIABLE && node->type != AST_BINARY_OP) {
+        return 0;
+    }
+    return *find_expression(parser->expressions, node) == node;
+}
+
+// A number, variable or binary operation node with the contents of
+// `probe`, which hands over its name and children. With sharing on, an
+// equal expression built before is returned instead, with one more share;
+// a binary operation is only shared when both its operands are, so
+// nothing containing a call ever is.
+static ASTNode* expression_node(Parser* parser, const ASTNode* probe) {
+    struct ExpressionTable* table = parser->expressions;
+    const Allocator* allocator = parser->lexer->allocator;
+    ASTNode** slot = NULL;
+
+    if (table && (probe->type != AST_BINARY_OP ||
+                  (is_shared_expression(parser, probe->data.binary_op.left) &&
+                   is_shared_expression(parser, probe->data.binary_op.right)))) {
+        slot = find_expression(table, probe);
+        if (*slot) {
+            ASTNode* shared = *slot;
+            shared->shares++;
+            if (probe->type == AST_VARIABLE) {
+                deallocate(allocator, probe->data.variable.name);
+            } else if (probe->type == AST_BINARY_OP) {
+                // The operands were shared already, so this only drops
+                // the references the probe held
+                free_ast_with_allocator(probe->data.binary_op.left, allocator);
+                free_ast_with_allocator(probe->data.binary_op.right, allocator);
+            }
+            return shared;
+        }
+    }
+
+    ASTNode* node = create_ast_node(parser, probe->type);
+    node->data = probe->data;
+    if (slot) {
+        *slot = node;
+        // Kept at most half full so probing stays short
+        if (++table->count * 2 > table->capacity) grow_expression_table(table, allocator);
+    }
+    return node;
+}
+
+static ASTNode* binary_node(Parser* parser, char op, ASTNode* left, ASTNode* right) {
+    ASTNode probe;
+    probe.type = AST_BINARY_OP;
+    probe.data.binary_op.op = op;
+    probe.data.binary_op.left = left;
+    probe.data.binary_op.right = right;
+    return expression_node(parser, &probe);
+}
+
+// The arguments of a call to `name`, whose name was already eaten
+static ASTNode* call(Parser* parser, char* name) {
+    const Allocator* allocator = parser->lexer->allocator;
+    ASTNode* node = create_ast_node(parser, AST_CALL);
+    size_t capacity = 4;
+    node->data.call.name = name;
+    node->data.call.args = allocate(allocator, sizeof(ASTNode*) * capacity);
+    node->data.call.arg_count = 0;
+
+    eat(parser, TOKEN_LPAREN);
+    if (parser->current_token->type != TOKEN_RPAREN) {
+        for (;;) {
+            if (node->data.call.arg_count == capacity) {
+                capacity *= 2;
+                node->data.call.args = reallocate(allocator, node->data.call.args,
+                                                  sizeof(ASTNode*) * capacity);
+            }
+            node->data.call.args[node->data.call.arg_count++] = expression(parser);
+            if (parser->current_token->type != TOKEN_COMMA) break;
+            eat(parser, TOKEN_COMMA);
+        }
+    }
+    eat(parser, TOKEN_RPAREN);
     return node;
 }
 
@@ -32,27 +258,28 @@ ASTNode* factor(Parser* parser) {
     Token* token = parser->current_token;
     
     if (token->type == TOKEN_NUMBER) {
+        ASTNode probe;
+        probe.type = AST_NUMBER;
+        probe.data.number.value = atoi(token->value);
         eat(parser, TOKEN_NUMBER);
-        ASTNode* node = create_ast_node(AST_NUMBER);
-        node->data.number.value = atoi(token->value);
-        free(token->value);
-        free(token);
-        return node;
+        return expression_node(parser, &probe);
     } else if (token->type == TOKEN_LPAREN) {
         eat(parser, TOKEN_LPAREN);
         ASTNode* node = expression(parser);
         eat(parser, TOKEN_RPAREN);
         return node;
     } else if (token->type == TOKEN_ID) {
-        eat(parser, TOKEN_ID);
-        ASTNode* node = create_ast_node(AST_VARIABLE);
-        node->data.variable.name = token->value;
-        free(token);
-        return node;
+        char* name = eat_name(parser);
+        if (parser->current_token->type == TOKEN_LPAREN) {
+            return call(parser, name);
+        }
+        ASTNode probe;
+        probe.type = AST_VARIABLE;
+        probe.data.variable.name = name;
+        return expression_node(parser, &probe);
     }
     
-    fprintf(stderr, "Syntax error: Unexpected token in factor\n");
-    exit(1);
+    report_fatal(parser->lexer->diagnostics, "Syntax error: Unexpected token in factor");
 }
 
 ASTNode* term(Parser* parser) {
@@ -61,6 +288,7 @@ ASTNode* term(Parser* parser) {
     while (parser->current_token->type == TOKEN_MULTIPLY || 
            parser->current_token->type == TOKEN_DIVIDE) {
         Token* token = parser->current_token;
+        char op = token->value[0];
         
         if (token->type == TOKEN_MULTIPLY) {
             eat(parser, TOKEN_MULTIPLY);
@@ -68,15 +296,7 @@ ASTNode* term(Parser* parser) {
             eat(parser, TOKEN_DIVIDE);
         }
         
-        ASTNode* binary_op = create_ast_node(AST_BINARY_OP);
-        binary_op->data.binary_op.op = token->value[0];
-        binary_op->data.binary_op.left = node;
-        binary_op->data.binary_op.right = factor(parser);
-        
-        free(token->value);
-        free(token);
-        
-        node = binary_op;
+        node = binary_node(parser, op, node, factor(parser));
     }
     
     return node;
@@ -88,6 +308,7 @@ ASTNode* arithmetic_expr(Parser* parser) {
     while (parser->current_token->type == TOKEN_PLUS || 
            parser->current_token->type == TOKEN_MINUS) {
         Token* token = parser->current_token;
+        char op = token->value[0];
         
         if (token->type == TOKEN_PLUS) {
             eat(parser, TOKEN_PLUS);
@@ -95,15 +316,7 @@ ASTNode* arithmetic_expr(Parser* parser) {
             eat(parser, TOKEN_MINUS);
         }
         
-        ASTNode* binary_op = create_ast_node(AST_BINARY_OP);
-        binary_op->data.binary_op.op = token->value[0];
-        binary_op->data.binary_op.left = node;
-        binary_op->data.binary_op.right = term(parser);
-        
-        free(token->value);
-        free(token);
-        
-        node = binary_op;
+        node = binary_node(parser, op, node, term(parser));
     }
     
     return node;
@@ -143,15 +356,7 @@ ASTNode* comparison_expr(Parser* parser) {
             eat(parser, TOKEN_LESS_EQUAL);
         }
         
-        ASTNode* binary_op = create_ast_node(AST_BINARY_OP);
-        binary_op->data.binary_op.op = op_char;
-        binary_op->data.binary_op.left = node;
-        binary_op->data.binary_op.right = arithmetic_expr(parser);
-        
-        free(token->value);
-        free(token);
-        
-        node = binary_op;
+        node = binary_node(parser, op_char, node, arithmetic_expr(parser));
     }
     
     return node;
@@ -161,21 +366,69 @@ ASTNode* expression(Parser* parser) {
     return comparison_expr(parser);
 }
 
+// def name(a, b) { ... }
+static ASTNode* function_definition(Parser* parser) {
+    const Allocator* allocator = parser->lexer->allocator;
+    size_t capacity = 4;
+    eat(parser, TOKEN_DEF);
+
+    char* name = eat_name(parser);
+    ASTNode* node = create_ast_node(parser, AST_FUNCTION);
+    node->data.function.name = name;
+    node->data.function.params = allocate(allocator, sizeof(char*) * capacity);
+    node->data.function.param_count = 0;
+
+    eat(parser, TOKEN_LPAREN);
+    if (parser->current_token->type != TOKEN_RPAREN) {
+        for (;;) {
+            char* param = eat_name(parser);
+            if (node->data.function.param_count == capacity) {
+                capacity *= 2;
+                node->data.function.params = reallocate(allocator, node->data.function.params,
+                                                        sizeof(char*) * capacity);
+            }
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                if (strcmp(node->data.function.params[i], param) == 0) {
+                    deallocate(allocator, param);
+                    report_fatal(parser->lexer->diagnostics,
+                                 "Syntax error: Duplicate parameter %s in function %s",
+                                 node->data.function.params[i], name);
+                }
+            }
+            node->data.function.params[node->data.function.param_count++] = param;
+            if (parser->current_token->type != TOKEN_COMMA) break;
+            eat(parser, TOKEN_COMMA);
+        }
+    }
+    eat(parser, TOKEN_RPAREN);
+
+    eat(parser, TOKEN_LBRACE);
+    parser->in_function = 1;
+    node->data.function.body = program(parser);
+    parser->in_function = 0;
+    eat(parser, TOKEN_RBRACE);
+
+    return node;
+}
+
 ASTNode* statement(Parser* parser) {
     if (parser->current_token->type == TOKEN_ID) {
-        char* var_name = strdup(parser->current_token->value);
-        eat(parser, TOKEN_ID);
+        char* var_name = eat_name(parser);
         
         if (parser->current_token->type == TOKEN_ASSIGN) {
             eat(parser, TOKEN_ASSIGN);
-            ASTNode* node = create_ast_node(AST_ASSIGN);
+            ASTNode* node = create_ast_node(parser, AST_ASSIGN);
             node->data.assign.name = var_name;
             node->data.assign.value = expression(parser);
             eat(parser, TOKEN_SEMICOLON);
             return node;
+        } else if (parser->current_token->type == TOKEN_LPAREN) {
+            ASTNode* node = call(parser, var_name);
+            eat(parser, TOKEN_SEMICOLON);
+            return node;
         } else {
-            fprintf(stderr, "Syntax error: Expected assignment operator\n");
-            exit(1);
+            deallocate(parser->lexer->allocator, var_name);
+            report_fatal(parser->lexer->diagnostics, "Syntax error: Expected assignment operator");
         }
     } else if (parser->current_token->type == TOKEN_IF) {
         eat(parser, TOKEN_IF);
@@ -195,7 +448,7 @@ ASTNode* statement(Parser* parser) {
             eat(parser, TOKEN_RBRACE);
         }
         
-        ASTNode* node = create_ast_node(AST_IF);
+        ASTNode* node = create_ast_node(parser, AST_IF);
         node->data.if_statement.condition = condition;
         node->data.if_statement.if_body = if_body;
         node->data.if_statement.else_body = else_body;
@@ -208,89 +461,444 @@ ASTNode* statement(Parser* parser) {
         eat(parser, TOKEN_RPAREN);
         eat(parser, TOKEN_SEMICOLON);
         
-        ASTNode* node = create_ast_node(AST_PRINT);
+        ASTNode* node = create_ast_node(parser, AST_PRINT);
         node->data.print.expression = expr;
         
+        return node;
+    } else if (parser->current_token->type == TOKEN_WHILE) {
+        eat(parser, TOKEN_WHILE);
+        eat(parser, TOKEN_LPAREN);
+        ASTNode* condition = expression(parser);
+        eat(parser, TOKEN_RPAREN);
+
+        eat(parser, TOKEN_LBRACE);
+        ASTNode* body = program(parser);
+        eat(parser, TOKEN_RBRACE);
+
+        ASTNode* node = create_ast_node(parser, AST_WHILE);
+        node->data.while_loop.condition = condition;
+        node->data.while_loop.body = body;
+
+        return node;
+    } else if (parser->current_token->type == TOKEN_DEF) {
+        if (parser->depth > 1) {
+            report_fatal(parser->lexer->diagnostics,
+                         "Syntax error: Functions can only be defined at the top level");
+        }
+        return function_definition(parser);
+    } else if (parser->current_token->type == TOKEN_RETURN) {
+        if (!parser->in_function) {
+            report_fatal(parser->lexer->diagnostics, "Syntax error: return outside of a function");
+        }
+        eat(parser, TOKEN_RETURN);
+        ASTNode* node = create_ast_node(parser, AST_RETURN);
+        node->data.return_statement.value = expression(parser);
+        eat(parser, TOKEN_SEMICOLON);
         return node;
     } else {
-        fprintf(stderr, "Syntax error: Invalid statement\n");
-        exit(1);
+        report_fatal(parser->lexer->diagnostics, "Syntax error: Invalid statement");
     }
 }
 
 ASTNode* program(Parser* parser) {
-    ASTNode* node = create_ast_node(AST_PROGRAM);
-    node->data.program.statements = malloc(sizeof(ASTNode*) * 10); // Start with space for 10 statements
+    ASTNode* node = create_ast_node(parser, AST_PROGRAM);
+    const Allocator* allocator = parser->lexer->allocator;
+    node->data.program.statements = allocate(allocator, sizeof(ASTNode*) * 10); // Start with space for 10 statements
     node->data.program.statement_count = 0;
     size_t capacity = 10;
+    CompileStats* stats = parser->lexer->stats;
+    int traced = stats && stats->trace && parser->depth == 0;
+    parser->depth++;
     
     while (parser->current_token->type != TOKEN_EOF && 
            parser->current_token->type != TOKEN_RBRACE) {
         
         if (node->data.program.statement_count >= capacity) {
             capacity *= 2;
-            node->data.program.statements = realloc(
+            node->data.program.statements = reallocate(
+                allocator,
                 node->data.program.statements, 
                 sizeof(ASTNode*) * capacity
             );
         }
         
-        node->data.program.statements[node->data.program.statement_count++] = statement(parser);
+        if (traced) {
+            size_t index = node->data.program.statement_count;
+            size_t offset = parser->current_token->start;
+            uint64_t start = stats_now_ns();
+            ASTNode* child = statement(parser);
+            trace_event(stats, ast_node_type_to_string(child->type), "parse", start, stats_now_ns(),
+                        (long)index, offset);
+            node->data.program.statements[node->data.program.statement_count++] = child;
+        } else {
+            node->data.program.statements[node->data.program.statement_count++] = statement(parser);
+        }
     }
     
+    parser->depth--;
     return node;
 }
 
+// With share_expressions set, identical expressions in the result are one
+// shared node; the table that finds them only lives during the parse
+// The name and parameter count of a top-level definition; `order` is its
+// place in the program
+typedef struct {
+    const char* name;
+    size_t param_count;
+    size_t order;
+} Signature;
+
+static int compare_signatures(const void* a, const void* b) {
+    const Signature* x = a;
+    const Signature* y = b;
+    int order = strcmp(x->name, y->name);
+    if (order != 0) return order;
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// The definition a call to `name` runs: the last one, as in JavaScript
+static const Signature* find_signature(const Signature* signatures, size_t count,
+                                       const char* name) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (strcmp(signatures[middle].name, name) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0 || strcmp(signatures[low - 1].name, name) != 0) return NULL;
+    return &signatures[low - 1];
+}
+
+// Describes the first call in `node` to a function that is not defined, or
+// with the wrong number of arguments, in `message`; returns whether there is one
+static int find_bad_call(const Signature* signatures, size_t count, ASTNode* node,
+                         char* message, size_t size) {
+    if (!node) return 0;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                if (find_bad_call(signatures, count, node->data.program.statements[i],
+                                  message, size)) {
+                    return 1;
+                }
+            }
+            return 0;
+        case AST_BINARY_OP:
+            return find_bad_call(signatures, count, node->data.binary_op.left, message, size) ||
+                   find_bad_call(signatures, count, node->data.binary_op.right, message, size);
+        case AST_ASSIGN:
+            return find_bad_call(signatures, count, node->data.assign.value, message, size);
+        case AST_IF:
+            return find_bad_call(signatures, count, node->data.if_statement.condition, message, size) ||
+                   find_bad_call(signatures, count, node->data.if_statement.if_body, message, size) ||
+                   find_bad_call(signatures, count, node->data.if_statement.else_body, message, size);
+        case AST_PRINT:
+            return find_bad_call(signatures, count, node->data.print.expression, message, size);
+        case AST_WHILE:
+            return find_bad_call(signatures, count, node->data.while_loop.condition, message, size) ||
+                   find_bad_call(signatures, count, node->data.while_loop.body, message, size);
+        case AST_FUNCTION:
+            return find_bad_call(signatures, count, node->data.function.body, message, size);
+        case AST_RETURN:
+            return find_bad_call(signatures, count, node->data.return_statement.value, message, size);
+        case AST_CALL: {
+            const Signature* signature = find_signature(signatures, count, node->data.call.name);
+            if (!signature) {
+                snprintf(message, size, "Error: Call to undefined function %s", node->data.call.name);
+                return 1;
+            }
+            if (signature->param_count != node->data.call.arg_count) {
+                snprintf(message, size, "Error: Function %s takes %zu arguments, called with %zu",
+                         node->data.call.name, signature->param_count, node->data.call.arg_count);
+                return 1;
+            }
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                if (find_bad_call(signatures, count, node->data.call.args[i], message, size)) {
+                    return 1;
+                }
+            }
+            return 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Functions are hoisted, so calls are checked once the whole program is
+// parsed
+static void check_calls(Parser* parser, ASTNode* program) {
+    const Allocator* allocator = parser->lexer->allocator;
+    size_t count = 0;
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        if (program->data.program.statements[i]->type == AST_FUNCTION) count++;
+    }
+
+    Signature* signatures = allocate(allocator, sizeof(Signature) * (count ? count : 1));
+    count = 0;
+    for (size_t i = 0; i < program->data.program.statement_count; i++) {
+        ASTNode* statement = program->data.program.statements[i];
+        if (statement->type == AST_FUNCTION) {
+            signatures[count].name = statement->data.function.name;
+            signatures[count].param_count = statement->data.function.param_count;
+            signatures[count].order = i;
+            count++;
+        }
+    }
+    qsort(signatures, count, sizeof(Signature), compare_signatures);
+
+    char message[256];
+    int bad = find_bad_call(signatures, count, program, message, sizeof(message));
+    deallocate(allocator, signatures);
+    if (bad) report_fatal(parser->lexer->diagnostics, "%s", message);
+}
+
 ASTNode* parse(Parser* parser) {
-    return program(parser);
+    if (parser->share_expressions) {
+        parser->expressions = allocate(parser->lexer->allocator, sizeof(struct ExpressionTable));
+        memset(parser->expressions, 0, sizeof(struct ExpressionTable));
+        grow_expression_table(parser->expressions, parser->lexer->allocator);
+    }
+    ASTNode* ast = program(parser);
+    free_expression_table(parser);
+    check_calls(parser, ast);
+    // The nodes now belong to the tree
+    deallocate(parser->lexer->allocator, parser->nodes);
+    parser->nodes = NULL;
+    parser->node_count = 0;
+    parser->node_capacity = 0;
+    return ast;
 }
 
 void free_ast(ASTNode* node) {
+    free_ast_with_allocator(node, NULL);
+}
+
+// Frees a tree built by a parser whose lexer used `allocator`; a shared
+// node only loses one share
+void free_ast_with_allocator(ASTNode* node, const Allocator* allocator) {
     if (node == NULL) return;
+    if (node->shares > 0) {
+        node->shares--;
+        return;
+    }
     
     switch (node->type) {
         case AST_PROGRAM:
             for (size_t i = 0; i < node->data.program.statement_count; i++) {
-                free_ast(node->data.program.statements[i]);
+                free_ast_with_allocator(node->data.program.statements[i], allocator);
             }
-            free(node->data.program.statements);
+            deallocate(allocator, node->data.program.statements);
             break;
             
         case AST_VARIABLE:
-            free(node->data.variable.name);
+            deallocate(allocator, node->data.variable.name);
             break;
             
         case AST_BINARY_OP:
-            free_ast(node->data.binary_op.left);
-            free_ast(node->data.binary_op.right);
+            free_ast_with_allocator(node->data.binary_op.left, allocator);
+            free_ast_with_allocator(node->data.binary_op.right, allocator);
             break;
             
         case AST_ASSIGN:
-            free(node->data.assign.name);
-            free_ast(node->data.assign.value);
+            deallocate(allocator, node->data.assign.name);
+            free_ast_with_allocator(node->data.assign.value, allocator);
             break;
             
         case AST_IF:
-            free_ast(node->data.if_statement.condition);
-            free_ast(node->data.if_statement.if_body);
+            free_ast_with_allocator(node->data.if_statement.condition, allocator);
+            free_ast_with_allocator(node->data.if_statement.if_body, allocator);
             if (node->data.if_statement.else_body) {
-                free_ast(node->data.if_statement.else_body);
+                free_ast_with_allocator(node->data.if_statement.else_body, allocator);
             }
             break;
             
         case AST_PRINT:
-            free_ast(node->data.print.expression);
+            free_ast_with_allocator(node->data.print.expression, allocator);
+            break;
+
+        case AST_WHILE:
+            free_ast_with_allocator(node->data.while_loop.condition, allocator);
+            free_ast_with_allocator(node->data.while_loop.body, allocator);
+            break;
+
+        case AST_FUNCTION:
+            deallocate(allocator, node->data.function.name);
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                deallocate(allocator, node->data.function.params[i]);
+            }
+            deallocate(allocator, node->data.function.params);
+            free_ast_with_allocator(node->data.function.body, allocator);
+            break;
+
+        case AST_CALL:
+            deallocate(allocator, node->data.call.name);
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                free_ast_with_allocator(node->data.call.args[i], allocator);
+            }
+            deallocate(allocator, node->data.call.args);
+            break;
+
+        case AST_RETURN:
+            free_ast_with_allocator(node->data.return_statement.value, allocator);
+            break;
+
+        case AST_CONSTANT:
+            deallocate(allocator, node->data.constant.text);
             break;
             
         default:
             break;
     }
     
-    free(node);
+    deallocate(allocator, node);
+}
+
+// With `seen`, a shared node is only counted on its first visit
+static size_t count_nodes(ASTNode* node, NodeMap* seen) {
+    if (node == NULL) return 0;
+    if (seen && node->shares > 0 && !node_map_add(seen, node, 0)) return 0;
+
+    switch (node->type) {
+        case AST_PROGRAM: {
+            size_t count = 1;
+            for (size_t i = 0; i < node->data.program.statement_count; i++) {
+                count += count_nodes(node->data.program.statements[i], seen);
+            }
+            return count;
+        }
+        case AST_BINARY_OP:
+            return 1 + count_nodes(node->data.binary_op.left, seen) +
+                   count_nodes(node->data.binary_op.right, seen);
+        case AST_ASSIGN:
+            return 1 + count_nodes(node->data.assign.value, seen);
+        case AST_IF:
+            return 1 + count_nodes(node->data.if_statement.condition, seen) +
+                   count_nodes(node->data.if_statement.if_body, seen) +
+                   count_nodes(node->data.if_statement.else_body, seen);
+        case AST_PRINT:
+            return 1 + count_nodes(node->data.print.expression, seen);
+        case AST_WHILE:
+            return 1 + count_nodes(node->data.while_loop.condition, seen) +
+                   count_nodes(node->data.while_loop.body, seen);
+        case AST_FUNCTION:
+            return 1 + count_nodes(node->data.function.body, seen);
+        case AST_CALL: {
+            size_t count = 1;
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                count += count_nodes(node->data.call.args[i], seen);
+            }
+            return count;
+        }
+        case AST_RETURN:
+            return 1 + count_nodes(node->data.return_statement.value, seen);
+        default:
+            return 1;
+    }
+}
+
+// Nodes as written: a shared expression counts once per place it appears
+size_t count_ast_nodes(ASTNode* node) {
+    return count_nodes(node, NULL);
+}
+
+// Nodes in memory: a shared expression counts once
+size_t count_unique_ast_nodes(ASTNode* node) {
+    NodeMap seen;
+    init_node_map(&seen, NULL);
+    size_t count = count_nodes(node, &seen);
+    free_node_map(&seen);
+    return count;
+}
+
+// Gives the expression in `slot` to this slot alone, replacing a shared
+// node with a copy whose operands are shared one more time, and returns it
+ASTNode* unshare_ast_node(ASTNode** slot, const Allocator* allocator) {
+    ASTNode* node = *slot;
+    if (node->shares == 0) return node;
+
+    ASTNode* copy = allocate(allocator, sizeof(ASTNode));
+    *copy = *node;
+    copy->shares = 0;
+    if (node->type == AST_VARIABLE) {
+        const char* name = node->data.variable.name;
+        copy->data.variable.name = copy_string(allocator, name, strlen(name));
+    } else if (node->type == AST_BINARY_OP) {
+        copy->data.binary_op.left->shares++;
+        copy->data.binary_op.right->shares++;
+    }
+    node->shares--;
+    *slot = copy;
+    return copy;
+}
+
+void init_node_map(NodeMap* map, const Allocator* allocator) {
+    memset(map, 0, sizeof(NodeMap));
+    map->allocator = allocator;
+}
+
+static size_t node_map_index(const NodeMap* map, const ASTNode* node) {
+    size_t mask = map->capacity - 1;
+    size_t i = (size_t)(((uintptr_t)node >> 4) * 0x9e3779b97f4a7c15ULL >> 20) & mask;
+    while (map->keys[i] && map->keys[i] != node) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Stores `value` for `node`; returns 0 when the node was already there,
+// leaving its value alone
+int node_map_add(NodeMap* map, const ASTNode* node, int32_t value) {
+    if ((map->count + 1) * 2 > map->capacity) {
+        const ASTNode** keys = map->keys;
+        int32_t* values = map->values;
+        size_t capacity = map->capacity;
+
+        map->capacity = capacity ? capacity * 2 : 64;
+        map->keys = allocate(map->allocator, map->capacity * sizeof(ASTNode*));
+        map->values = allocate(map->allocator, map->capacity * sizeof(int32_t));
+        memset(map->keys, 0, map->capacity * sizeof(ASTNode*));
+        for (size_t i = 0; i < capacity; i++) {
+            if (!keys[i]) continue;
+            size_t j = node_map_index(map, keys[i]);
+            map->keys[j] = keys[i];
+            map->values[j] = values[i];
+        }
+        deallocate(map->allocator, keys);
+        deallocate(map->allocator, values);
+    }
+
+    size_t i = node_map_index(map, node);
+    if (map->keys[i]) return 0;
+    map->keys[i] = node;
+    map->values[i] = value;
+    map->count++;
+    return 1;
+}
+
+// The value stored for `node`, or -1
+int32_t node_map_get(const NodeMap* map, const ASTNode* node) {
+    if (map->count == 0) return -1;
+    size_t i = node_map_index(map, node);
+    return map->keys[i] ? map->values[i] : -1;
+}
+
+void free_node_map(NodeMap* map) {
+    deallocate(map->allocator, map->keys);
+    deallocate(map->allocator, map->values);
+    memset(map, 0, sizeof(NodeMap));
 }
 
 void free_parser(Parser* parser) {
-    free(parser);
+    // Still there when a syntax error ended the parse
+    free_expression_table(parser);
+    free_unfinished_nodes(parser);
+    free_token(parser->lexer, parser->current_token);
+    deallocate(parser->lexer->allocator, parser);
 }
 
 const char* ast_node_type_to_string(ASTNodeType type) {
@@ -302,242 +910,227 @@ const char* ast_node_type_to_string(ASTNodeType type) {
         case AST_ASSIGN: return "ASSIGN";
         case AST_IF: return "IF";
         case AST_PRINT: return "PRINT";
+        case AST_WHILE: return "WHILE";
+        case AST_FUNCTION: return "FUNCTION";
+        case AST_CALL: return "CALL";
+        case AST_RETURN: return "RETURN";
+        case AST_CONSTANT: return "CONSTANT";
         default: return "UNKNOWN";
     }
 }
 
-char* escape_json_string(const char* str) {
-    if (!str) return strdup("null");
-    
-    size_t len = strlen(str);
-    char* escaped = malloc(len * 2 + 3); // Worst case: all chars need escaping + quotes
-    strcpy(escaped, "\"");
-    
-    for (size_t i = 0; i < len; i++) {
-        if (str[i] == '"') {
-            strcat(escaped, "\\\"");
-        } else if (str[i] == '\\') {
-            strcat(escaped, "\\\\");
-        } else if (str[i] == '\n') {
-            strcat(escaped, "\\n");
-        } else if (str[i] == '\r') {
-            strcat(escaped, "\\r");
-        } else if (str[i] == '\t') {
-            strcat(escaped, "\\t");
-        } else {
-            size_t current_len = strlen(escaped);
-            escaped[current_len] = str[i];
-            escaped[current_len + 1] = '\0';
-        }
+typedef struct {
+    StringBuilder* sb;
+    JsonStyle style;
+} JsonWriter;
+
+static void write_json_string(JsonWriter* writer, const char* str) {
+    StringBuilder* sb = writer->sb;
+    if (!str) {
+        append_bytes(sb, "null", 4);
+        return;
     }
-    
-    strcat(escaped, "\"");
-    return escaped;
+
+    append_json_string(sb, str, strlen(str));
 }
 
-char* ast_to_json_recursive(ASTNode* node, int depth) {
-    if (!node) return strdup("null");
-    
-    // Calculate initial buffer size
-    size_t buffer_size = 1024;
-    char* json = malloc(buffer_size);
-    json[0] = '\0';
-    
-    // Helper function to ensure buffer size
-    #define ENSURE_BUFFER_SIZE(needed) \
-        if (strlen(json) + (needed) >= buffer_size) { \
-            buffer_size = (strlen(json) + (needed)) * 2; \
-            json = realloc(json, buffer_size); \
-        }
-    
-    // Add indentation
-    char indent[256] = "";
-    for (int i = 0; i < depth * 2; i++) {
-        strcat(indent, " ");
+// Starts the member `key` of an object nested `depth` levels deep
+static void write_json_key(JsonWriter* writer, int depth, const char* key) {
+    StringBuilder* sb = writer->sb;
+
+    if (writer->style == JSON_COMPACT) {
+        append_char(sb, ',');
+        append_char(sb, '"');
+        append_string(sb, key);
+        append_bytes(sb, "\":", 2);
+    } else {
+        append_bytes(sb, ",\n", 2);
+        append_repeated(sb, ' ', depth * 2 + 2);
+        append_char(sb, '"');
+        append_string(sb, key);
+        append_bytes(sb, "\": ", 3);
     }
-    
-    ENSURE_BUFFER_SIZE(512);
-    sprintf(json, "{\n%s  \"type\": \"%s\",\n%s  \"id\": \"%p\"", 
-            indent, ast_node_type_to_string(node->type), indent, (void*)node);
-    
+}
+
+static const char* binary_op_to_string(char op) {
+    // Comparisons are stored as single-character markers
+    switch (op) {
+        case 'G': return ">=";
+        case 'L': return "<=";
+        case '=': return "==";
+        case '!': return "!=";
+        case '+': return "+";
+        case '-': return "-";
+        case '*': return "*";
+        case '/': return "/";
+        case '>': return ">";
+        case '<': return "<";
+        default: return "?";
+    }
+}
+
+static void write_json_node(JsonWriter* writer, ASTNode* node, int depth) {
+    StringBuilder* sb = writer->sb;
+    int pretty = writer->style == JSON_PRETTY;
+
+    if (!node) {
+        append_bytes(sb, "null", 4);
+        return;
+    }
+
+    char id[32];
+    snprintf(id, sizeof(id), "%p", (void*)node);
+
+    if (pretty) {
+        append_bytes(sb, "{\n", 2);
+        append_repeated(sb, ' ', depth * 2 + 2);
+        append_bytes(sb, "\"type\": ", 8);
+    } else {
+        append_bytes(sb, "{\"type\":", 8);
+    }
+    write_json_string(writer, ast_node_type_to_string(node->type));
+    write_json_key(writer, depth, "id");
+    write_json_string(writer, id);
+
     switch (node->type) {
         case AST_PROGRAM: {
-            ENSURE_BUFFER_SIZE(256);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"statement_count\": ");
-            
-            char count_str[32];
-            sprintf(count_str, "%zu", node->data.program.statement_count);
-            strcat(json, count_str);
-            
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"statements\": [");
-            
-            for (size_t i = 0; i < node->data.program.statement_count; i++) {
-                if (i > 0) {
-                    strcat(json, ",");
-                }
-                strcat(json, "\n");
-                
-                char* child_json = ast_to_json_recursive(node->data.program.statements[i], depth + 2);
-                ENSURE_BUFFER_SIZE(strlen(child_json) + 64);
-                strcat(json, child_json);
-                free(child_json);
+            size_t count = node->data.program.statement_count;
+
+            write_json_key(writer, depth, "statement_count");
+            append_int(sb, (long long)count);
+            write_json_key(writer, depth, "statements");
+            append_char(sb, '[');
+
+            // Statements sit two levels deeper than the program so the
+            // array brackets get their own indentation level
+            for (size_t i = 0; i < count; i++) {
+                if (i > 0) append_char(sb, ',');
+                if (pretty) append_char(sb, '\n');
+                write_json_node(writer, node->data.program.statements[i], depth + 2);
             }
-            
-            if (node->data.program.statement_count > 0) {
-                strcat(json, "\n");
-                strcat(json, indent);
-                strcat(json, "  ");
+
+            if (pretty && count > 0) {
+                append_char(sb, '\n');
+                append_repeated(sb, ' ', depth * 2 + 2);
             }
-            strcat(json, "]");
+            append_char(sb, ']');
             break;
         }
-        
-        case AST_VARIABLE: {
-            char* escaped_name = escape_json_string(node->data.variable.name);
-            ENSURE_BUFFER_SIZE(strlen(escaped_name) + 64);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"name\": ");
-            strcat(json, escaped_name);
-            free(escaped_name);
+
+        case AST_VARIABLE:
+            write_json_key(writer, depth, "name");
+            write_json_string(writer, node->data.variable.name);
             break;
-        }
-        
-        case AST_NUMBER: {
-            ENSURE_BUFFER_SIZE(128);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"value\": ");
-            
-            char value_str[32];
-            sprintf(value_str, "%d", node->data.number.value);
-            strcat(json, value_str);
+
+        case AST_NUMBER:
+            write_json_key(writer, depth, "value");
+            append_int(sb, node->data.number.value);
             break;
-        }
-        
-        case AST_BINARY_OP: {
-            char op_str[8];
-            char op = node->data.binary_op.op;
-            
-            // Convert special operators back to readable form
-            if (op == 'G') {
-                strcpy(op_str, "\">=\"");
-            } else if (op == 'L') {
-                strcpy(op_str, "\"<=\"");
-            } else if (op == '=') {
-                strcpy(op_str, "\"==\"");
-            } else if (op == '!') {
-                strcpy(op_str, "\"!=\"");
-            } else {
-                sprintf(op_str, "\"%c\"", op);
-            }
-            
-            ENSURE_BUFFER_SIZE(strlen(op_str) + 128);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"operator\": ");
-            strcat(json, op_str);
-            
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"left\": ");
-            
-            char* left_json = ast_to_json_recursive(node->data.binary_op.left, depth + 1);
-            ENSURE_BUFFER_SIZE(strlen(left_json) + 64);
-            strcat(json, left_json);
-            free(left_json);
-            
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"right\": ");
-            
-            char* right_json = ast_to_json_recursive(node->data.binary_op.right, depth + 1);
-            ENSURE_BUFFER_SIZE(strlen(right_json) + 64);
-            strcat(json, right_json);
-            free(right_json);
+
+        case AST_BINARY_OP:
+            write_json_key(writer, depth, "operator");
+            write_json_string(writer, binary_op_to_string(node->data.binary_op.op));
+            write_json_key(writer, depth, "left");
+            write_json_node(writer, node->data.binary_op.left, depth + 1);
+            write_json_key(writer, depth, "right");
+            write_json_node(writer, node->data.binary_op.right, depth + 1);
             break;
-        }
-        
-        case AST_ASSIGN: {
-            char* escaped_name = escape_json_string(node->data.assign.name);
-            ENSURE_BUFFER_SIZE(strlen(escaped_name) + 128);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"variable\": ");
-            strcat(json, escaped_name);
-            free(escaped_name);
-            
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"value\": ");
-            
-            char* value_json = ast_to_json_recursive(node->data.assign.value, depth + 1);
-            ENSURE_BUFFER_SIZE(strlen(value_json) + 64);
-            strcat(json, value_json);
-            free(value_json);
+
+        case AST_ASSIGN:
+            write_json_key(writer, depth, "variable");
+            write_json_string(writer, node->data.assign.name);
+            write_json_key(writer, depth, "value");
+            write_json_node(writer, node->data.assign.value, depth + 1);
             break;
-        }
-        
-        case AST_IF: {
-            ENSURE_BUFFER_SIZE(256);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"condition\": ");
-            
-            char* condition_json = ast_to_json_recursive(node->data.if_statement.condition, depth + 1);
-            ENSURE_BUFFER_SIZE(strlen(condition_json) + 64);
-            strcat(json, condition_json);
-            free(condition_json);
-            
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"if_body\": ");
-            
-            char* if_body_json = ast_to_json_recursive(node->data.if_statement.if_body, depth + 1);
-            ENSURE_BUFFER_SIZE(strlen(if_body_json) + 64);
-            strcat(json, if_body_json);
-            free(if_body_json);
-            
+
+        case AST_IF:
+            write_json_key(writer, depth, "condition");
+            write_json_node(writer, node->data.if_statement.condition, depth + 1);
+            write_json_key(writer, depth, "if_body");
+            write_json_node(writer, node->data.if_statement.if_body, depth + 1);
             if (node->data.if_statement.else_body) {
-                strcat(json, ",\n");
-                strcat(json, indent);
-                strcat(json, "  \"else_body\": ");
-                
-                char* else_body_json = ast_to_json_recursive(node->data.if_statement.else_body, depth + 1);
-                ENSURE_BUFFER_SIZE(strlen(else_body_json) + 64);
-                strcat(json, else_body_json);
-                free(else_body_json);
+                write_json_key(writer, depth, "else_body");
+                write_json_node(writer, node->data.if_statement.else_body, depth + 1);
             }
             break;
-        }
-        
-        case AST_PRINT: {
-            ENSURE_BUFFER_SIZE(128);
-            strcat(json, ",\n");
-            strcat(json, indent);
-            strcat(json, "  \"expression\": ");
-            
-            char* expr_json = ast_to_json_recursive(node->data.print.expression, depth + 1);
-            ENSURE_BUFFER_SIZE(strlen(expr_json) + 64);
-            strcat(json, expr_json);
-            free(expr_json);
+
+        case AST_PRINT:
+            write_json_key(writer, depth, "expression");
+            write_json_node(writer, node->data.print.expression, depth + 1);
+            break;
+
+        case AST_WHILE:
+            write_json_key(writer, depth, "condition");
+            write_json_node(writer, node->data.while_loop.condition, depth + 1);
+            write_json_key(writer, depth, "body");
+            write_json_node(writer, node->data.while_loop.body, depth + 1);
+            break;
+
+        case AST_FUNCTION:
+            write_json_key(writer, depth, "name");
+            write_json_string(writer, node->data.function.name);
+            write_json_key(writer, depth, "parameters");
+            append_char(sb, '[');
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                if (i > 0) append_bytes(sb, pretty ? ", " : ",", pretty ? 2 : 1);
+                write_json_string(writer, node->data.function.params[i]);
+            }
+            append_char(sb, ']');
+            write_json_key(writer, depth, "body");
+            write_json_node(writer, node->data.function.body, depth + 1);
+            break;
+
+        case AST_CALL: {
+            size_t count = node->data.call.arg_count;
+
+            write_json_key(writer, depth, "name");
+            write_json_string(writer, node->data.call.name);
+            write_json_key(writer, depth, "arguments");
+            append_char(sb, '[');
+            for (size_t i = 0; i < count; i++) {
+                if (i > 0) append_char(sb, ',');
+                if (pretty) append_char(sb, '\n');
+                write_json_node(writer, node->data.call.args[i], depth + 2);
+            }
+            if (pretty && count > 0) {
+                append_char(sb, '\n');
+                append_repeated(sb, ' ', depth * 2 + 2);
+            }
+            append_char(sb, ']');
             break;
         }
+
+        case AST_RETURN:
+            write_json_key(writer, depth, "value");
+            write_json_node(writer, node->data.return_statement.value, depth + 1);
+            break;
+
+        case AST_CONSTANT:
+            write_json_key(writer, depth, "text");
+            write_json_string(writer, node->data.constant.text);
+            break;
     }
-    
-    ENSURE_BUFFER_SIZE(64);
-    strcat(json, "\n");
-    strcat(json, indent);
-    strcat(json, "}");
-    
-    #undef ENSURE_BUFFER_SIZE
-    return json;
+
+    if (pretty) {
+        append_char(sb, '\n');
+        append_repeated(sb, ' ', depth * 2);
+    }
+    append_char(sb, '}');
+}
+
+char* ast_to_json_styled(ASTNode* node, JsonStyle style) {
+    return ast_to_json_with_allocator(node, style, NULL);
+}
+
+// Serializes the whole tree in one pass into a single growing buffer
+char* ast_to_json_with_allocator(ASTNode* node, JsonStyle style, const Allocator* allocator) {
+    JsonWriter writer;
+    writer.sb = init_string_builder_with_allocator(allocator);
+    writer.style = style;
+    write_json_node(&writer, node, 0);
+    return finalize_string_builder(writer.sb);
 }
 
 char* ast_to_json(ASTNode* node) {
-    return ast_to_json_recursive(node, 0);
+    return ast_to_json_styled(node, JSON_PRETTY);
 }
@@ -10,11 +10,22 @@ typedef enum {
     AST_BINARY_OP,
     AST_ASSIGN,
     AST_IF,
-    AST_PRINT
+    AST_PRINT,
+    AST_WHILE,
+    AST_FUNCTION,
+    AST_CALL,
+    AST_RETURN,
+    AST_CONSTANT    // never parsed; a value evaluate_program computed
 } ASTNodeType;
 
+// With Parser.share_expressions on, structurally identical expressions
+// without calls are built once and shared, which turns the tree into a
+// DAG. `shares` counts the parents beyond the first: free_ast only frees a
+// node once every parent let go of it, and code that changes an expression
+// in place must call unshare_ast_node first.
 typedef struct ASTNode {
     ASTNodeType type;
+    uint32_t shares;
     union {
         struct {
             struct ASTNode** statements;
@@ -49,14 +60,63 @@ typedef struct ASTNode {
         struct {
             struct ASTNode* expression;
         } print;
+
+        struct {
+            struct ASTNode* condition;
+            struct ASTNode* body;
+        } while_loop;
+
+        struct {
+            char* name;
+            char** params;
+            size_t param_count;
+            struct ASTNode* body;
+        } function;
+
+        struct {
+            char* name;
+            struct ASTNode** args;
+            size_t arg_count;
+        } call;
+
+        struct {
+            struct ASTNode* value;
+        } return_statement;
+
+        struct {
+            char* text;    // JavaScript literal
+        } constant;
     } data;
 } ASTNode;
 
+typedef enum {
+    JSON_PRETTY,
+    JSON_COMPACT
+} JsonStyle;
+
+// Owns the current token and frees each one as eat() moves past it; an
+// identifier's name is handed over to the node that keeps it
 typedef struct {
     Lexer* lexer;
     Token* current_token;
+    size_t depth;    // nesting of program() calls; 1 for top-level statements
+    int in_function;
+    int share_expressions;                 // hash-cons expressions, off by default
+    struct ExpressionTable* expressions;   // while parse() runs with sharing on
+    ASTNode** nodes;       // every node created, until parse() hands over the tree
+    size_t node_count;
+    size_t node_capacity;
 } Parser;
 
+// Shared nodes by address, for walks that must visit each node only once
+typedef struct {
+    const ASTNode** keys;
+    int32_t* values;
+    size_t capacity;    // a power of two
+    size_t count;
+    const Allocator* allocator;
+} NodeMap;
+
 Parser* init_parser(Lexer* lexer);
 void advance_parser(Parser* parser);
 void eat(Parser* parser, TokenType type);
@@ -66,9 +126,20 @@ ASTNode* statement(Parser* parser);
 ASTNode* expression(Parser* parser);
 ASTNode* term(Parser* parser);
 ASTNode* factor(Parser* parser);
-ASTNode* create_ast_node(ASTNodeType type);
+ASTNode* create_ast_node(Parser* parser, ASTNodeType type);
 void free_ast(ASTNode* node);
+void free_ast_with_allocator(ASTNode* node, const Allocator* allocator);
+size_t count_ast_nodes(ASTNode* node);
+size_t count_unique_ast_nodes(ASTNode* node);
+ASTNode* unshare_ast_node(ASTNode** slot, const Allocator* allocator);
+void init_node_map(NodeMap* map, const Allocator* allocator);
+int node_map_add(NodeMap* map, const ASTNode* node, int32_t value);
+int32_t node_map_get(const NodeMap* map, const ASTNode* node);
+void free_node_map(NodeMap* map);
+const char* ast_node_type_to_string(ASTNodeType type);
 void free_parser(Parser* parser);
 char* ast_to_json(ASTNode* node);
+char* ast_to_json_styled(ASTNode* node, JsonStyle style);
+char* ast_to_json_with_allocator(ASTNode* node, JsonStyle style, const Allocator* allocator);
 
 #endif 
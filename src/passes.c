@@ -0,0 +1,272 @@
+#include "passes.h"
+#include "optimize.h"
+#include "evaluate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    // `graph` is the call graph still waiting to be filled, or NULL
+    void (*run)(ASTNode* program, const Allocator* allocator, CallGraph** graph,
+                const NodeMap* profile);
+} Pass;
+
+static void run_evaluate(ASTNode* program, const Allocator* allocator, CallGraph** graph,
+                         const NodeMap* profile) {
+    (void)graph;
+    (void)profile;
+    evaluate_program(program, allocator, NULL);
+}
+
+static void run_inline(ASTNode* program, const Allocator* allocator, CallGraph** graph,
+                       const NodeMap* profile) {
+    inline_functions_with_profile(program, allocator, *graph, profile);
+    *graph = NULL;
+}
+
+static void run_loops(ASTNode* program, const Allocator* allocator, CallGraph** graph,
+                      const NodeMap* profile) {
+    (void)graph;
+    optimize_loops_with_profile(program, allocator, NULL, profile);
+}
+
+static const Pass passes[PASS_KIND_END] = {
+    [PASS_EVALUATE] = { "evaluate", run_evaluate },
+    [PASS_INLINE] = { "inline", run_inline },
+    [PASS_LOOPS] = { "loops", run_loops },
+};
+
+PassPipeline optimization_level_pipeline(int level) {
+    if (level <= 0) return 0;
+    if (level == 1) return PASS_LOOPS;
+    if (level == 2) return PASS_INLINE | PASS_LOOPS << 4;
+    return PASS_EVALUATE | PASS_INLINE << 4 | PASS_LOOPS << 8;
+}
+
+int parse_pass_list(const char* list, PassPipeline* pipeline) {
+    PassPipeline result = 0;
+    size_t count = 0;
+
+    while (*list) {
+        const char* end = strchr(list, ',');
+        size_t length = end ? (size_t)(end - list) : strlen(list);
+        PassKind kind = 0;
+
+        for (int i = 1; i < PASS_KIND_END; i++) {
+            if (strlen(passes[i].name) == length && strncmp(passes[i].name, list, length) == 0) {
+                kind = (PassKind)i;
+            }
+        }
+        if (!kind || count == PIPELINE_MAX_PASSES) return -1;
+        result |= (PassPipeline)kind << (4 * count++);
+
+        if (!end) break;
+        list = end + 1;
+        if (!*list) return -1;    // trailing comma
+    }
+
+    *pipeline = result;
+    return 0;
+}
+
+const char* pass_name(PassKind kind) {
+    return kind > 0 && kind < PASS_KIND_END ? passes[kind].name : NULL;
+}
+
+static int run_pipeline(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                        CallGraph* graph, CompileStats* stats, const NodeMap* profile,
+                        int verify, Diagnostics* diagnostics) {
+    if (graph) {
+        memset(graph, 0, sizeof(CallGraph));
+        graph->allocator = allocator;
+    }
+
+    for (; pipeline; pipeline >>= 4) {
+        PassKind kind = (PassKind)(pipeline & 0xf);
+        if (!pass_name(kind)) break;
+
+        const Pass* pass = &passes[kind];
+        size_t nodes_before = stats ? count_unique_ast_nodes(program) : 0;
+        uint64_t start = stats ? stats_now_ns() : 0;
+        pass->run(program, allocator, &graph, profile);
+
+        if (stats) {
+            uint64_t end = stats_now_ns();
+            PassStats* entry = &stats->passes[kind];
+            entry->name = pass->name;
+            entry->runs++;
+            entry->ns += end - start;
+            entry->nodes_before += nodes_before;
+            entry->nodes_after += count_unique_ast_nodes(program);
+            trace_event(stats, pass->name, "pass", start, end, -1, 0);
+        }
+
+        const char* problem = verify ? verify_ast(program) : NULL;
+        if (problem) {
+            report_error(diagnostics, "Error: AST invalid after the %s pass: %s", pass->name, problem);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void run_passes(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                CallGraph* graph, CompileStats* stats) {
+    run_passes_with_profile(program, pipeline, allocator, graph, stats, NULL);
+}
+
+void run_passes_with_profile(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                             CallGraph* graph, CompileStats* stats, const NodeMap* profile) {
+    run_pipeline(program, pipeline, allocator, graph, stats, profile, 0, NULL);
+}
+
+int run_passes_verified(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                        CallGraph* graph, CompileStats* stats, const NodeMap* profile,
+                        Diagnostics* diagnostics) {
+    return run_pipeline(program, pipeline, allocator, graph, stats, profile, 1, diagnostics);
+}
+
+typedef struct {
+    ASTNode** nodes;    // every reference visited, to check the shares
+    size_t count;
+    size_t capacity;
+    NodeMap shared;     // shared expressions already walked
+    const char* problem;
+} Verifier;
+
+static int fail(Verifier* v, const char* problem) {
+    if (!v->problem) v->problem = problem;
+    return 0;
+}
+
+static int visit(Verifier* v, ASTNode* node) {
+    if (!node) return fail(v, "missing node");
+    if (v->count == v->capacity) {
+        v->capacity = v->capacity ? v->capacity * 2 : 64;
+        v->nodes = realloc(v->nodes, v->capacity * sizeof(ASTNode*));
+    }
+    v->nodes[v->count++] = node;
+    return 1;
+}
+
+static void verify_expression(Verifier* v, ASTNode* node) {
+    if (!visit(v, node)) return;
+    if (node->shares > 0 && !node_map_add(&v->shared, node, 0)) return;
+
+    switch (node->type) {
+        case AST_NUMBER:
+            break;
+        case AST_VARIABLE:
+            if (!node->data.variable.name) fail(v, "variable without a name");
+            break;
+        case AST_CONSTANT:
+            if (!node->data.constant.text) fail(v, "constant without text");
+            break;
+        case AST_BINARY_OP:
+            if (!node->data.binary_op.op || !strchr("+-*/<>=!GL", node->data.binary_op.op)) {
+                fail(v, "unknown binary operator");
+            }
+            verify_expression(v, node->data.binary_op.left);
+            verify_expression(v, node->data.binary_op.right);
+            break;
+        case AST_CALL:
+            if (!node->data.call.name) fail(v, "call without a name");
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                verify_expression(v, node->data.call.args[i]);
+            }
+            break;
+        default:
+            fail(v, "statement where an expression belongs");
+    }
+}
+
+static void verify_block(Verifier* v, ASTNode* block, int top_level, int in_function);
+
+static void verify_statement(Verifier* v, ASTNode* node, int top_level, int in_function) {
+    if (!visit(v, node)) return;
+    if (node->shares > 0) fail(v, "shared statement");
+
+    switch (node->type) {
+        case AST_ASSIGN:
+            if (!node->data.assign.name) fail(v, "assignment without a name");
+            verify_expression(v, node->data.assign.value);
+            break;
+        case AST_PRINT:
+            verify_expression(v, node->data.print.expression);
+            break;
+        case AST_CALL:
+            if (!node->data.call.name) fail(v, "call without a name");
+            for (size_t i = 0; i < node->data.call.arg_count; i++) {
+                verify_expression(v, node->data.call.args[i]);
+            }
+            break;
+        case AST_IF:
+            verify_expression(v, node->data.if_statement.condition);
+            verify_block(v, node->data.if_statement.if_body, 0, in_function);
+            if (node->data.if_statement.else_body) {
+                verify_block(v, node->data.if_statement.else_body, 0, in_function);
+            }
+            break;
+        case AST_WHILE:
+            verify_expression(v, node->data.while_loop.condition);
+            verify_block(v, node->data.while_loop.body, 0, in_function);
+            break;
+        case AST_FUNCTION:
+            if (!top_level) fail(v, "function defined below the top level");
+            if (!node->data.function.name) fail(v, "function without a name");
+            for (size_t i = 0; i < node->data.function.param_count; i++) {
+                if (!node->data.function.params[i]) fail(v, "parameter without a name");
+            }
+            verify_block(v, node->data.function.body, 0, 1);
+            break;
+        case AST_RETURN:
+            if (!in_function) fail(v, "return outside a function");
+            verify_expression(v, node->data.return_statement.value);
+            break;
+        default:
+            fail(v, "expression where a statement belongs");
+    }
+}
+
+static void verify_block(Verifier* v, ASTNode* block, int top_level, int in_function) {
+    if (!visit(v, block)) return;
+    if (block->shares > 0) fail(v, "shared statement");
+    if (block->type != AST_PROGRAM) {
+        fail(v, "block that is not a program node");
+        return;
+    }
+    for (size_t i = 0; i < block->data.program.statement_count; i++) {
+        verify_statement(v, block->data.program.statements[i], top_level, in_function);
+    }
+}
+
+static int compare_pointers(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(ASTNode* const*)a;
+    uintptr_t y = (uintptr_t)*(ASTNode* const*)b;
+    return x < y ? -1 : x > y;
+}
+
+const char* verify_ast(ASTNode* program) {
+    Verifier v;
+    memset(&v, 0, sizeof(Verifier));
+    init_node_map(&v.shared, NULL);
+    verify_block(&v, program, 1, 0);
+
+    // free_ast frees a node once its shares are used up, so a node with
+    // more parents than shares would be freed twice and one with fewer
+    // never
+    if (!v.problem) {
+        qsort(v.nodes, v.count, sizeof(ASTNode*), compare_pointers);
+        for (size_t i = 0, parents; i < v.count; i += parents) {
+            for (parents = 1; i + parents < v.count && v.nodes[i + parents] == v.nodes[i]; parents++) {
+            }
+            if (parents != v.nodes[i]->shares + 1) {
+                fail(&v, v.nodes[i]->shares == 0 ? "node reachable twice" : "wrong share count");
+            }
+        }
+    }
+    free(v.nodes);
+    free_node_map(&v.shared);
+    return v.problem;
+}
@@ -0,0 +1,68 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <stdint.h>
+#include "parser.h"
+#include "inline.h"
+#include "stats.h"
+#include "diagnostics.h"
+
+// AST transformations run between parsing and code generation
+typedef enum {
+    PASS_EVALUATE = 1,    // evaluate_program
+    PASS_INLINE,          // inline_functions
+    PASS_LOOPS,           // optimize_loops
+    PASS_KIND_END
+} PassKind;
+
+#define PIPELINE_MAX_PASSES 5
+
+// An ordered list of passes, 4 bits per PassKind with the first pass in the
+// lowest bits and 0 after the last, so a pipeline fits next to the
+// ANALYZE_* flags and into cache keys
+typedef uint32_t PassPipeline;
+
+// -O0: nothing; -O1: loops; -O2 (the default): inline, loops;
+// -O3: evaluate, inline, loops
+PassPipeline optimization_level_pipeline(int level);
+
+// Parses a comma-separated list of pass names such as "inline,loops"; an
+// empty list runs nothing. Returns 0, or -1 for an unknown name or more
+// than PIPELINE_MAX_PASSES passes.
+int parse_pass_list(const char* list, PassPipeline* pipeline);
+
+const char* pass_name(PassKind kind);
+
+// Runs the passes of `pipeline` over `program` in order. New nodes come
+// from `allocator`, which must be the one the tree was parsed with. The
+// first inline pass fills `graph` when it is not NULL; without one the
+// graph is left empty. With `stats`, each pass adds its time and the node
+// counts before and after it.
+void run_passes(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                CallGraph* graph, CompileStats* stats);
+
+// run_passes guided by the execution counts apply_profile found for
+// `program`, or by none when `profile` is NULL: the inliner weighs calls
+// by how often they ran and the loop optimizer leaves loops that never
+// iterated alone
+void run_passes_with_profile(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                             CallGraph* graph, CompileStats* stats, const NodeMap* profile);
+
+// run_passes_with_profile checking the tree with verify_ast after every
+// pass. Returns 0, or -1 once a pass broke the tree: that is reported
+// through `diagnostics` (on stderr without), and the passes after it do
+// not run. A broken tree may share nodes it should not, so it is only safe
+// to leak. Too slow for every compile; see ANALYZE_VERIFY_PASSES.
+int run_passes_verified(ASTNode* program, PassPipeline pipeline, const Allocator* allocator,
+                        CallGraph* graph, CompileStats* stats, const NodeMap* profile,
+                        Diagnostics* diagnostics);
+
+// Checks what code generation and the other passes rely on: statements and
+// expressions only where they belong, `def` only at the top level and
+// `return` only inside it, block bodies that are program nodes, known
+// operators, names everywhere one is needed, and exactly shares + 1
+// parents for every node (see ASTNode.shares).
+// Returns NULL, or a message describing the first problem found.
+const char* verify_ast(ASTNode* program);
+
+#endif
@@ -0,0 +1,94 @@
+#include "perfcount.h"
+#include <string.h>
+
+static const char* counter_names[COUNTER_COUNT] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+const char* counter_name(CounterKind kind) {
+    return counter_names[kind];
+}
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const uint64_t counter_configs[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+void open_perf_counters(PerfCounters* counters) {
+    counters->available = 0;
+    counters->error = 0;
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counter_configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fds[i] >= 0) {
+            counters->available = 1;
+        } else if (!counters->error) {
+            counters->error = errno;
+        }
+    }
+}
+
+void close_perf_counters(PerfCounters* counters) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+    counters->available = 0;
+}
+
+// Counters share the PMU, so the kernel may time-slice them; values are
+// scaled up by enabled / running time
+void read_perf_counters(const PerfCounters* counters, CounterSample* sample) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        uint64_t data[3];
+        sample->values[i] = 0;
+
+        if (counters->fds[i] < 0 || read(counters->fds[i], data, sizeof(data)) != sizeof(data)) {
+            continue;
+        }
+        if (data[2] > 0 && data[2] < data[1]) {
+            sample->values[i] = (uint64_t)((double)data[0] * data[1] / data[2]);
+        } else {
+            sample->values[i] = data[0];
+        }
+    }
+}
+
+#else
+
+void open_perf_counters(PerfCounters* counters) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counters->fds[i] = -1;
+    }
+    counters->available = 0;
+    counters->error = 0;
+}
+
+void close_perf_counters(PerfCounters* counters) {
+    (void)counters;
+}
+
+void read_perf_counters(const PerfCounters* counters, CounterSample* sample) {
+    (void)counters;
+    memset(sample, 0, sizeof(CounterSample));
+}
+
+#endif
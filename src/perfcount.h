@@ -0,0 +1,32 @@
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdint.h>
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+} CounterKind;
+
+// Hardware counters for the calling thread, user space only. Counters the
+// kernel or the container refuses are left closed (fd -1) and read as 0;
+// `available` is 0 when none could be opened at all.
+typedef struct {
+    int fds[COUNTER_COUNT];
+    int available;
+    int error;       // errno of the first counter that failed to open
+} PerfCounters;
+
+typedef struct {
+    uint64_t values[COUNTER_COUNT];
+} CounterSample;
+
+void open_perf_counters(PerfCounters* counters);
+void close_perf_counters(PerfCounters* counters);
+void read_perf_counters(const PerfCounters* counters, CounterSample* sample);
+const char* counter_name(CounterKind kind);
+
+#endif
@@ -0,0 +1,223 @@
+#include "profile.h"
+#include "scope.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    size_t next;              // the site of the next statement or arm
+    uint64_t hash;
+    const Profile* profile;   // NULL when only numbering
+    NodeMap* counts;
+} SiteWalk;
+
+static void mix(SiteWalk* walk, uint64_t value) {
+    walk->hash = (walk->hash ^ value) * 0x100000001b3ULL;
+}
+
+static void mix_name(SiteWalk* walk, const char* name) {
+    for (const char* c = name; *c; c++) mix(walk, (unsigned char)*c);
+    mix(walk, 0);
+}
+
+// Takes the next site and returns how often it ran
+static int32_t count_site(SiteWalk* walk) {
+    size_t site = walk->next++;
+    if (!walk->profile) return 0;
+    uint64_t count = walk->profile->counts[site];
+    return count > INT32_MAX ? INT32_MAX : (int32_t)count;
+}
+
+static void store(SiteWalk* walk, const ASTNode* node, int32_t count) {
+    if (walk->counts) node_map_add(walk->counts, node, count);
+}
+
+static int32_t walk_block(SiteWalk* walk, ASTNode* block);
+
+// Only what decides the sites goes into the hash, so a profile still
+// applies after an expression was edited
+static int32_t walk_statement(SiteWalk* walk, ASTNode* node) {
+    int32_t count = count_site(walk);
+    store(walk, node, count);
+    mix(walk, node->type);
+
+    switch (node->type) {
+        case AST_ASSIGN:
+            mix_name(walk, node->data.assign.name);
+            break;
+        case AST_CALL:
+            mix_name(walk, node->data.call.name);
+            break;
+        case AST_IF:
+            store(walk, node->data.if_statement.if_body, count_site(walk));
+            walk_block(walk, node->data.if_statement.if_body);
+            if (node->data.if_statement.else_body) {
+                store(walk, node->data.if_statement.else_body, count_site(walk));
+                walk_block(walk, node->data.if_statement.else_body);
+            }
+            break;
+        case AST_WHILE:
+            store(walk, node->data.while_loop.body, walk_block(walk, node->data.while_loop.body));
+            break;
+        case AST_FUNCTION:
+            mix_name(walk, node->data.function.name);
+            mix(walk, node->data.function.param_count);
+            store(walk, node->data.function.body, walk_block(walk, node->data.function.body));
+            break;
+        default:
+            break;
+    }
+    return count;
+}
+
+// Returns how often the first statement ran
+static int32_t walk_block(SiteWalk* walk, ASTNode* block) {
+    int32_t first = 0;
+    mix(walk, '{');
+    for (size_t i = 0; i < block->data.program.statement_count; i++) {
+        int32_t count = walk_statement(walk, block->data.program.statements[i]);
+        if (i == 0) first = count;
+    }
+    mix(walk, '}');
+    return first;
+}
+
+size_t profile_sites(ASTNode* program, uint64_t* hash) {
+    SiteWalk walk = { 0, 0xcbf29ce484222325ULL, NULL, NULL };
+    walk_block(&walk, program);
+    *hash = walk.hash;
+    return walk.next;
+}
+
+static const char* skip_space(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    return p;
+}
+
+// Just past the colon after "key", or NULL
+static const char* find_value(const char* text, const char* key) {
+    size_t length = strlen(key);
+    for (const char* p = strchr(text, '"'); p; p = strchr(p + 1, '"')) {
+        if (strncmp(p + 1, key, length) == 0 && p[length + 1] == '"') {
+            p = skip_space(p + length + 2);
+            return *p == ':' ? skip_space(p + 1) : NULL;
+        }
+    }
+    return NULL;
+}
+
+static int parse_counts(const char* p, Profile* profile) {
+    size_t capacity = 0;
+    if (*p != '[') return -1;
+    p = skip_space(p + 1);
+    if (*p == ']') return 0;
+
+    for (;;) {
+        char* end;
+        double value = strtod(p, &end);
+        if (end == p || !(value >= 0)) return -1;
+        if (profile->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            profile->counts = realloc(profile->counts, capacity * sizeof(uint64_t));
+        }
+        // Counts come from a Float64Array, so they can be past 2^64
+        profile->counts[profile->count++] = value >= 18446744073709551615.0 ? UINT64_MAX
+                                                                           : (uint64_t)value;
+        p = skip_space(end);
+        if (*p == ']') return 0;
+        if (*p != ',') return -1;
+        p = skip_space(p + 1);
+    }
+}
+
+int parse_profile(const char* json, size_t length, Profile* profile) {
+    char* text = malloc(length + 1);
+    memcpy(text, json, length);
+    text[length] = '\0';
+    memset(profile, 0, sizeof(Profile));
+
+    const char* program = find_value(text, "program");
+    const char* counts = find_value(text, "counts");
+    char* end = NULL;
+    int status = -1;
+    if (program && counts && *program == '"') {
+        profile->program = strtoull(program + 1, &end, 16);
+        if (end == program + 17 && *end == '"') status = parse_counts(counts, profile);
+    }
+
+    free(text);
+    if (status != 0) free_profile(profile);
+    return status;
+}
+
+void free_profile(Profile* profile) {
+    free(profile->counts);
+    memset(profile, 0, sizeof(Profile));
+}
+
+int apply_profile(const Profile* profile, ASTNode* program, const Allocator* allocator,
+                  NodeMap* counts) {
+    uint64_t hash;
+    init_node_map(counts, allocator);
+    if (profile_sites(program, &hash) != profile->count || hash != profile->program) return -1;
+
+    SiteWalk walk = { 0, 0, profile, counts };
+    walk_block(&walk, program);
+    return 0;
+}
+
+int32_t profile_count(const NodeMap* counts, const ASTNode* node) {
+    return counts ? node_map_get(counts, node) : -1;
+}
+
+typedef struct {
+    ASTNode* statement;
+    int32_t count;
+    size_t index;
+} RankedFunction;
+
+static int compare_ranked(const void* a, const void* b) {
+    const RankedFunction* x = a;
+    const RankedFunction* y = b;
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+void order_hot_functions(ASTNode* program, const NodeMap* counts, const Allocator* allocator) {
+    ASTNode** statements = program->data.program.statements;
+    size_t count = program->data.program.statement_count;
+    size_t function_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (statements[i]->type == AST_FUNCTION) function_count++;
+    }
+    if (function_count == 0) return;
+
+    RankedFunction* ranked = allocate(allocator, function_count * sizeof(RankedFunction));
+    ASTNode** others = allocate(allocator, (count - function_count + 1) * sizeof(ASTNode*));
+    Scope names;
+    int redefined = 0;
+    init_scope(&names, allocator);
+    for (size_t i = 0, f = 0, o = 0; i < count; i++) {
+        ASTNode* statement = statements[i];
+        if (statement->type != AST_FUNCTION) {
+            others[o++] = statement;
+            continue;
+        }
+        if (!declare_once(&names, statement->data.function.name)) redefined = 1;
+        ranked[f].statement = statement;
+        ranked[f].count = profile_count(counts, statement->data.function.body);
+        ranked[f].index = i;
+        f++;
+    }
+
+    if (!redefined) {
+        qsort(ranked, function_count, sizeof(RankedFunction), compare_ranked);
+        for (size_t i = 0; i < function_count; i++) {
+            statements[i] = ranked[i].statement;
+        }
+        memcpy(statements + function_count, others, (count - function_count) * sizeof(ASTNode*));
+    }
+
+    free_scope(&names);
+    deallocate(allocator, ranked);
+    deallocate(allocator, others);
+}
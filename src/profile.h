@@ -0,0 +1,49 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "parser.h"
+
+// Execution counts recorded by a program compiled with --instrument (see
+// generate_code_instrumented). Sites are numbered in source order over the
+// tree as parsed: every statement, and right after an if statement its
+// if arm, that arm's statements, then its else arm when there is one.
+typedef struct {
+    uint64_t program;    // profile_sites hash of the program that ran
+    uint64_t* counts;    // one per site
+    size_t count;
+} Profile;
+
+// Returns the number of sites in `program` and stores a hash of its
+// statement structure in `hash`, which tells whether a profile was
+// recorded for this program
+size_t profile_sites(ASTNode* program, uint64_t* hash);
+
+// Reads the JSON an instrumented program writes on exit,
+// {"program":"<hex hash>","counts":[...]}. Returns 0, or -1 when it is
+// malformed.
+int parse_profile(const char* json, size_t length, Profile* profile);
+void free_profile(Profile* profile);
+
+// Fills `counts`, which is initialized from `allocator`, with how often
+// each statement of `program` ran and how often each block was entered:
+// an if arm by its own site, a loop or function body as often as its first
+// statement ran. Returns 0, or -1 with `counts` left empty when the profile
+// was recorded for a different program. The counts keep to what an
+// int32_t holds.
+int apply_profile(const Profile* profile, ASTNode* program, const Allocator* allocator,
+                  NodeMap* counts);
+
+// The count apply_profile stored for `node`, or -1 without a profile or
+// for a node the passes made since
+int32_t profile_count(const NodeMap* counts, const ASTNode* node);
+
+// Moves the top-level function definitions in front of the other
+// statements, the most called first and equally called ones in their
+// original order. JavaScript hoists function declarations, so this only
+// changes the layout; a program that defines a name twice, where the last
+// definition wins, is left as it is.
+void order_hot_functions(ASTNode* program, const NodeMap* counts, const Allocator* allocator);
+
+#endif
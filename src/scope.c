@@ -0,0 +1,136 @@
+#include "scope.h"
+#include <string.h>
+
+#define INITIAL_ENTRIES 64
+
+// Eight bytes per step, since identifiers can be hundreds of bytes long
+static uint32_t hash_name(const char* name, size_t length) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ length;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        uint64_t k;
+        memcpy(&k, name + i, 8);
+        h = (h ^ k) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, name + i, length - i);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+    return (uint32_t)(h >> 32);
+}
+
+// The slot holding `name`, or the empty slot where it would go
+static ScopeEntry* find_entry(ScopeEntry* entries, size_t capacity, const char* name,
+                              size_t length, uint32_t hash) {
+    size_t i = hash & (capacity - 1);
+    while (entries[i].name && (entries[i].hash != hash || entries[i].length != length ||
+                               memcmp(entries[i].name, name, length) != 0)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &entries[i];
+}
+
+static ScopeEntry* lookup(const Scope* scope, const char* name) {
+    size_t length = strlen(name);
+    return find_entry(scope->entries, scope->capacity, name, length, hash_name(name, length));
+}
+
+static void grow_entries(Scope* scope) {
+    size_t capacity = scope->capacity * 2;
+    ScopeEntry* entries = allocate(scope->allocator, capacity * sizeof(ScopeEntry));
+    memset(entries, 0, capacity * sizeof(ScopeEntry));
+
+    for (size_t i = 0; i < scope->capacity; i++) {
+        ScopeEntry* entry = &scope->entries[i];
+        if (entry->name) {
+            *find_entry(entries, capacity, entry->name, entry->length, entry->hash) = *entry;
+        }
+    }
+    deallocate(scope->allocator, scope->entries);
+    scope->entries = entries;
+    scope->capacity = capacity;
+}
+
+void init_scope(Scope* scope, const Allocator* allocator) {
+    memset(scope, 0, sizeof(Scope));
+    scope->allocator = allocator;
+    scope->capacity = INITIAL_ENTRIES;
+    scope->entries = allocate(allocator, INITIAL_ENTRIES * sizeof(ScopeEntry));
+    memset(scope->entries, 0, INITIAL_ENTRIES * sizeof(ScopeEntry));
+}
+
+void free_scope(Scope* scope) {
+    deallocate(scope->allocator, scope->entries);
+    deallocate(scope->allocator, scope->declared);
+    deallocate(scope->allocator, scope->blocks);
+    memset(scope, 0, sizeof(Scope));
+}
+
+void enter_block(Scope* scope) {
+    if (scope->depth == scope->blocks_capacity) {
+        scope->blocks_capacity = scope->blocks_capacity ? scope->blocks_capacity * 2 : 16;
+        scope->blocks = reallocate(scope->allocator, scope->blocks,
+                                   scope->blocks_capacity * sizeof(size_t));
+    }
+    scope->blocks[scope->depth++] = scope->declared_count;
+}
+
+// Forgets everything declared since the matching enter_block
+void leave_block(Scope* scope) {
+    size_t start = scope->blocks[--scope->depth];
+    while (scope->declared_count > start) {
+        const char* name = scope->declared[--scope->declared_count];
+        lookup(scope, name)->count--;
+    }
+}
+
+// Counts one more declaration of the entry's name
+static void add_declaration(Scope* scope, ScopeEntry* entry) {
+    entry->count++;
+    if (scope->declared_count == scope->declared_capacity) {
+        scope->declared_capacity = scope->declared_capacity ? scope->declared_capacity * 2 : 64;
+        scope->declared = reallocate(scope->allocator, scope->declared,
+                                     scope->declared_capacity * sizeof(const char*));
+    }
+    scope->declared[scope->declared_count++] = entry->name;
+}
+
+static ScopeEntry* insert_entry(Scope* scope, const char* name) {
+    // Entries are never removed, only their count drops to zero
+    if ((scope->used + 1) * 4 > scope->capacity * 3) {
+        grow_entries(scope);
+    }
+
+    size_t length = strlen(name);
+    uint32_t hash = hash_name(name, length);
+    ScopeEntry* entry = find_entry(scope->entries, scope->capacity, name, length, hash);
+    if (!entry->name) {
+        entry->name = name;
+        entry->length = (uint32_t)length;
+        entry->hash = hash;
+        scope->used++;
+    }
+    return entry;
+}
+
+void declare_name(Scope* scope, const char* name) {
+    add_declaration(scope, insert_entry(scope, name));
+}
+
+// Declares `name` unless it is already visible; returns whether it was not
+int declare_once(Scope* scope, const char* name) {
+    ScopeEntry* entry = insert_entry(scope, name);
+    if (entry->count > 0) return 0;
+
+    add_declaration(scope, entry);
+    return 1;
+}
+
+size_t declaration_count(const Scope* scope, const char* name) {
+    return lookup(scope, name)->count;
+}
+
+int is_declared(const Scope* scope, const char* name) {
+    return declaration_count(scope, name) > 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "allocator.h"
+
+// Variable names visible at a point of a program, following JavaScript's
+// block scoping: a name declared inside a block stops being visible when
+// the block is left. Names are not copied and must outlive the scope.
+typedef struct {
+    const char* name;
+    uint32_t hash;
+    uint32_t length;
+    size_t count;    // declarations of the name currently visible
+} ScopeEntry;
+
+typedef struct {
+    const Allocator* allocator;
+    ScopeEntry* entries;       // open addressing, NULL name when empty
+    size_t capacity;
+    size_t used;
+    const char** declared;     // every visible declaration, innermost last
+    size_t declared_count;
+    size_t declared_capacity;
+    size_t* blocks;            // declared_count when each open block began
+    size_t depth;
+    size_t blocks_capacity;
+} Scope;
+
+void init_scope(Scope* scope, const Allocator* allocator);
+void free_scope(Scope* scope);
+void enter_block(Scope* scope);
+void leave_block(Scope* scope);
+void declare_name(Scope* scope, const char* name);
+int declare_once(Scope* scope, const char* name);
+int is_declared(const Scope* scope, const char* name);
+size_t declaration_count(const Scope* scope, const char* name);
+
+#endif
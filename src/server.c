@@ -0,0 +1,386 @@
+#include "server.h"
+#include "compiler.h"
+#include "threadpool.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define WORKER_ARENA_SIZE (64 * 1024)
+
+typedef struct {
+    Arena arena;
+    Diagnostics diagnostics;
+} WorkerState;
+
+struct Server {
+    ThreadPool* pool;
+    CompileCache* cache;
+    WorkerState* workers;
+    size_t memory_limit;
+    unsigned flags;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_space;
+    size_t queued;          // requests read and not yet answered
+    size_t queued_bytes;
+    size_t max_queued;
+};
+
+typedef struct {
+    int input_fd;
+    int output_fd;
+    pthread_mutex_t write_lock;
+    pthread_mutex_t state_lock;
+    pthread_cond_t drained;
+    int pending;
+} Connection;
+
+typedef struct {
+    Server* server;
+    Connection* connection;
+    uint32_t id;
+    char* source;
+    size_t length;
+} Request;
+
+typedef struct {
+    Server* server;
+    int fd;
+} SocketClient;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void put_u32(char* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (char)(value >> (8 * i));
+    }
+}
+
+static void put_u64(char* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (char)(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const unsigned char* in) {
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// Returns 1 when `size` bytes were read, 0 on end of input, -1 on error
+static int read_full(int fd, void* buffer, size_t size) {
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = read(fd, (char*)buffer + done, size - done);
+        if (n == 0) return done == 0 ? 0 : -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return 1;
+}
+
+static int write_full(int fd, const void* buffer, size_t size) {
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = write(fd, (const char*)buffer + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+static void release_connection(Connection* connection) {
+    pthread_mutex_lock(&connection->state_lock);
+    if (--connection->pending == 0) {
+        pthread_cond_signal(&connection->drained);
+    }
+    pthread_mutex_unlock(&connection->state_lock);
+}
+
+// Blocks until a request of `length` bytes fits in the queue; one always
+// does when the queue is empty
+static void enter_queue(Server* server, size_t length) {
+    pthread_mutex_lock(&server->queue_lock);
+    while (server->queued > 0 && (server->queued >= server->max_queued ||
+                                  server->queued_bytes + length > SERVER_MAX_QUEUED_BYTES)) {
+        pthread_cond_wait(&server->queue_space, &server->queue_lock);
+    }
+    server->queued++;
+    server->queued_bytes += length;
+    pthread_mutex_unlock(&server->queue_lock);
+}
+
+static void leave_queue(Server* server, size_t length) {
+    pthread_mutex_lock(&server->queue_lock);
+    server->queued--;
+    server->queued_bytes -= length;
+    // Readers of every connection may be waiting, each for a different size
+    pthread_cond_broadcast(&server->queue_space);
+    pthread_mutex_unlock(&server->queue_lock);
+}
+
+static void handle_request(void* arg, int worker) {
+    Request* request = arg;
+    Server* server = request->server;
+    WorkerState* state = &server->workers[worker];
+
+    reset_arena(&state->arena);
+    reset_diagnostics(&state->diagnostics);
+
+    // The compilation allocates from the worker's arena too, so nothing is
+    // freed piecemeal and an aborted request leaves nothing behind
+    Allocator arena = arena_allocator(&state->arena);
+    const Allocator* allocator = &arena;
+    CountingAllocator counting;
+    Allocator limited;
+    if (server->memory_limit > 0) {
+        init_counting_allocator(&counting, &arena, server->memory_limit, &state->diagnostics);
+        limited = counting_allocator(&counting);
+        allocator = &limited;
+    }
+
+    uint64_t start = now_ns();
+    char* cached = NULL;
+    char* output = NULL;
+
+    if (server->cache) {
+        cached = cache_lookup(server->cache, request->source, request->length, server->flags);
+        output = cached;
+    }
+    if (!output) {
+        Analysis analysis;
+        analyze_source(request->source, request->length, &state->diagnostics,
+                       ANALYZE_JAVASCRIPT | server->flags, &analysis, NULL, allocator);
+        output = analysis.javascript;
+        if (output && server->cache) {
+            cache_store(server->cache, request->source, request->length, server->flags, output);
+        }
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    size_t js_length = output ? strlen(output) : 0;
+    size_t diagnostics_length = state->diagnostics.length;
+    size_t payload_length = 4 + 4 + 8 + 4 + js_length + 4 + diagnostics_length;
+
+    // The whole frame is assembled in the worker's arena so it goes out in
+    // a single write and the memory is reused by the next request
+    char* frame = arena_alloc(&state->arena, 4 + payload_length);
+    char* cursor = frame;
+
+    put_u32(cursor, (uint32_t)payload_length);
+    put_u32(cursor + 4, request->id);
+    put_u32(cursor + 8, output ? 0 : 1);
+    put_u64(cursor + 12, elapsed);
+    put_u32(cursor + 20, (uint32_t)js_length);
+    cursor += 24;
+    // Either may be NULL when empty, which memcpy must not be given
+    if (js_length) memcpy(cursor, output, js_length);
+    cursor += js_length;
+    put_u32(cursor, (uint32_t)diagnostics_length);
+    if (diagnostics_length) memcpy(cursor + 4, state->diagnostics.text, diagnostics_length);
+
+    pthread_mutex_lock(&request->connection->write_lock);
+    write_full(request->connection->output_fd, frame, 4 + payload_length);
+    pthread_mutex_unlock(&request->connection->write_lock);
+
+    free(cached);
+    leave_queue(server, request->length + 4);
+    release_connection(request->connection);
+    free(request->source);
+    free(request);
+}
+
+Server* init_server(const ServerOptions* options) {
+    Server* server = calloc(1, sizeof(Server));
+    server->pool = init_threadpool(options->thread_count);
+    server->memory_limit = options->memory_limit;
+    server->flags = options->flags;
+    server->max_queued = options->max_queued > 0 ? options->max_queued : SERVER_DEFAULT_MAX_QUEUED;
+    pthread_mutex_init(&server->queue_lock, NULL);
+    pthread_cond_init(&server->queue_space, NULL);
+
+    int worker_count = threadpool_size(server->pool);
+    server->workers = calloc(worker_count, sizeof(WorkerState));
+    for (int i = 0; i < worker_count; i++) {
+        init_arena(&server->workers[i].arena, WORKER_ARENA_SIZE);
+        init_diagnostics(&server->workers[i].diagnostics);
+    }
+
+    if (options->cache_size > 0 || options->cache_dir) {
+        size_t budget = options->cache_size > 0 ? options->cache_size : CACHE_DEFAULT_BUDGET;
+        server->cache = init_cache(budget, options->cache_dir);
+    }
+
+    return server;
+}
+
+// Reads requests until end of input and hands each one to the pool; returns
+// once every response for this stream has been written
+void serve_stream(Server* server, int input_fd, int output_fd) {
+    Connection connection;
+    connection.input_fd = input_fd;
+    connection.output_fd = output_fd;
+    connection.pending = 0;
+    pthread_mutex_init(&connection.write_lock, NULL);
+    pthread_mutex_init(&connection.state_lock, NULL);
+    pthread_cond_init(&connection.drained, NULL);
+
+    unsigned char header[4];
+
+    while (read_full(input_fd, header, 4) == 1) {
+        uint32_t length = get_u32(header);
+        if (length == 0) break;
+        if (length < 4 || length > SERVER_MAX_FRAME) {
+            fprintf(stderr, "Error: Invalid request frame of %u bytes\n", length);
+            break;
+        }
+
+        // Not reading on while the queue is full pushes back on the client
+        enter_queue(server, length);
+        char* payload = malloc(length + 1);
+        if (read_full(input_fd, payload, length) != 1) {
+            free(payload);
+            leave_queue(server, length);
+            break;
+        }
+        payload[length] = '\0';
+
+        Request* request = malloc(sizeof(Request));
+        request->server = server;
+        request->connection = &connection;
+        request->id = get_u32((unsigned char*)payload);
+        request->length = length - 4;
+
+        // Shift the source to the front so it owns the whole allocation
+        memmove(payload, payload + 4, request->length + 1);
+        request->source = payload;
+
+        pthread_mutex_lock(&connection.state_lock);
+        connection.pending++;
+        pthread_mutex_unlock(&connection.state_lock);
+
+        threadpool_submit(server->pool, handle_request, request);
+    }
+
+    pthread_mutex_lock(&connection.state_lock);
+    while (connection.pending > 0) {
+        pthread_cond_wait(&connection.drained, &connection.state_lock);
+    }
+    pthread_mutex_unlock(&connection.state_lock);
+
+    pthread_mutex_destroy(&connection.write_lock);
+    pthread_mutex_destroy(&connection.state_lock);
+    pthread_cond_destroy(&connection.drained);
+}
+
+static void* socket_client_main(void* arg) {
+    SocketClient* client = arg;
+    serve_stream(client->server, client->fd, client->fd);
+    close(client->fd);
+    free(client);
+    return NULL;
+}
+
+int serve_socket(Server* server, const char* socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listener, 64) < 0) {
+        perror(socket_path);
+        close(listener);
+        return 1;
+    }
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+
+        SocketClient* client = malloc(sizeof(SocketClient));
+        client->server = server;
+        client->fd = fd;
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, socket_client_main, client);
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return 1;
+}
+
+void free_server(Server* server) {
+    threadpool_wait(server->pool);
+
+    int worker_count = threadpool_size(server->pool);
+    free_threadpool(server->pool);
+
+    for (int i = 0; i < worker_count; i++) {
+        free_arena(&server->workers[i].arena);
+        free_diagnostics(&server->workers[i].diagnostics);
+    }
+
+    free(server->workers);
+    free_cache(server->cache);
+    pthread_mutex_destroy(&server->queue_lock);
+    pthread_cond_destroy(&server->queue_space);
+    free(server);
+}
+
+int run_server(const ServerOptions* options) {
+    // A client hanging up must not take the whole server down
+    signal(SIGPIPE, SIG_IGN);
+
+    Server* server = init_server(options);
+    int status = 0;
+
+    if (options->socket_path) {
+        status = serve_socket(server, options->socket_path);
+    } else {
+        serve_stream(server, STDIN_FILENO, STDOUT_FILENO);
+    }
+
+    free_server(server);
+    return status;
+}
@@ -0,0 +1,43 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+// Compile-server wire protocol. Every frame is a little-endian u32 payload
+// length followed by the payload; all integers are little-endian.
+//
+//   request:  u32 id, source bytes (the rest of the payload)
+//   response: u32 id, u32 status (0 = ok, 1 = error), u64 compile time in ns,
+//             u32 js length, js bytes, u32 diagnostics length, diagnostics
+//
+// Requests on one connection are compiled concurrently, so responses may
+// arrive out of order; clients match them up by id. A zero-length frame or
+// end of input closes the connection once all pending responses are written.
+//
+// Once max_queued requests, or SERVER_MAX_QUEUED_BYTES of them, are read
+// and not yet answered across all connections, the server stops reading
+// until some are, so a client sending faster than it compiles blocks.
+
+#define SERVER_MAX_FRAME (256u * 1024 * 1024)
+#define SERVER_DEFAULT_MAX_QUEUED 256
+#define SERVER_MAX_QUEUED_BYTES SERVER_MAX_FRAME
+
+typedef struct {
+    int thread_count;
+    const char* socket_path;
+    size_t cache_size;
+    const char* cache_dir;
+    size_t memory_limit;    // per request, 0 for no limit
+    unsigned flags;         // extra ANALYZE_* flags for every request; also part of the cache key
+    size_t max_queued;      // 0 for SERVER_DEFAULT_MAX_QUEUED
+} ServerOptions;
+
+typedef struct Server Server;
+
+Server* init_server(const ServerOptions* options);
+void serve_stream(Server* server, int input_fd, int output_fd);
+int serve_socket(Server* server, const char* socket_path);
+void free_server(Server* server);
+int run_server(const ServerOptions* options);
+
+#endif
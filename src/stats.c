@@ -0,0 +1,228 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef __EMSCRIPTEN__
+#include <sys/resource.h>
+#endif
+
+static const char* phase_names[PHASE_COUNT] = {
+    "read", "lex", "parse", "optimize", "codegen", "serialize", "write"
+};
+
+uint64_t stats_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+const char* phase_name(CompilePhase phase) {
+    return phase_names[phase];
+}
+
+void init_compile_stats(CompileStats* stats, int trace) {
+    memset(stats, 0, sizeof(CompileStats));
+    if (trace) {
+        stats->trace = init_string_builder();
+    }
+    stats->trace_origin_ns = stats_now_ns();
+}
+
+// Clears the measurements but keeps tracing and counters on, for the next
+// compilation
+void reset_compile_stats(CompileStats* stats) {
+    StringBuilder* trace = stats->trace;
+    uint64_t origin = stats->trace_origin_ns;
+    PerfCounters* counters = stats->counters;
+
+    memset(stats, 0, sizeof(CompileStats));
+    stats->trace = trace;
+    stats->trace_origin_ns = origin;
+    stats->counters = counters;
+    if (trace) {
+        trace->size = 0;
+        trace->buffer[0] = '\0';
+    }
+}
+
+void free_compile_stats(CompileStats* stats) {
+    if (stats->trace) {
+        free(finalize_string_builder(stats->trace));
+    }
+    memset(stats, 0, sizeof(CompileStats));
+}
+
+void begin_compile_stats(CompileStats* stats) {
+    if (count_allocations) {
+        count_allocations(&stats->alloc_count_base, &stats->alloc_bytes_base);
+    }
+}
+
+void end_compile_stats(CompileStats* stats) {
+    if (count_allocations) {
+        size_t count, bytes;
+        count_allocations(&count, &bytes);
+        stats->alloc_count += count - stats->alloc_count_base;
+        stats->alloc_bytes += bytes - stats->alloc_bytes_base;
+
+        // A later call only adds what was allocated since this one
+        stats->alloc_count_base = count;
+        stats->alloc_bytes_base = bytes;
+    }
+
+#ifdef __EMSCRIPTEN__
+    // Linear memory only grows, so its size is the peak
+    stats->peak_rss_bytes = __builtin_wasm_memory_size(0) * 65536;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stats->peak_rss_bytes = (size_t)usage.ru_maxrss * 1024;
+    }
+#endif
+}
+
+// Marks the start of a phase: samples the counters and returns the time to
+// pass to add_phase_time
+uint64_t begin_phase(CompileStats* stats) {
+    if (stats->counters && stats->counters->available) {
+        read_perf_counters(stats->counters, &stats->counter_base);
+    }
+    return stats_now_ns();
+}
+
+// Adds the time since `start_ns` to `phase` and records it as a span
+void add_phase_time(CompileStats* stats, CompilePhase phase, uint64_t start_ns) {
+    uint64_t end = stats_now_ns();
+    stats->phase_ns[phase] += end - start_ns;
+    add_phase_counters(stats, phase);
+    trace_event(stats, phase_names[phase], "phase", start_ns, end, -1, 0);
+}
+
+// Adds the counter deltas since the last begin_phase to `phase`
+void add_phase_counters(CompileStats* stats, CompilePhase phase) {
+    if (!stats->counters || !stats->counters->available) return;
+
+    CounterSample now;
+    read_perf_counters(stats->counters, &now);
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        stats->phase_counters[phase].values[i] += now.values[i] - stats->counter_base.values[i];
+    }
+}
+
+// Appends a complete ("X") event; `index` and `offset` are added as
+// arguments when index is not negative
+void trace_event(CompileStats* stats, const char* name, const char* category,
+                 uint64_t start_ns, uint64_t end_ns, long index, size_t offset) {
+    StringBuilder* sb = stats->trace;
+    if (!sb) return;
+
+    char timing[96];
+    snprintf(timing, sizeof(timing), "\"ts\":%.3f,\"dur\":%.3f",
+             (start_ns - stats->trace_origin_ns) / 1e3, (end_ns - start_ns) / 1e3);
+
+    if (sb->size > 0) append_bytes(sb, ",\n", 2);
+    append_bytes(sb, "{\"name\":", 8);
+    append_json_string(sb, name, strlen(name));
+    append_bytes(sb, ",\"cat\":", 7);
+    append_json_string(sb, category, strlen(category));
+    append_bytes(sb, ",\"ph\":\"X\",\"pid\":1,\"tid\":1,", 26);
+    append_string(sb, timing);
+    if (index >= 0) {
+        append_bytes(sb, ",\"args\":{\"index\":", 17);
+        append_int(sb, index);
+        append_bytes(sb, ",\"offset\":", 10);
+        append_int(sb, (long long)offset);
+        append_char(sb, '}');
+    }
+    append_char(sb, '}');
+}
+
+// Ratio column, or "n/a" when either counter could not be opened
+static void print_ratio(FILE* stream, const PerfCounters* counters, const CounterSample* sample,
+                        CounterKind numerator, CounterKind denominator, double scale) {
+    if (counters->fds[numerator] < 0 || counters->fds[denominator] < 0 ||
+        sample->values[denominator] == 0) {
+        fprintf(stream, " %11s", "n/a");
+    } else {
+        fprintf(stream, " %11.3f", scale * sample->values[numerator] / sample->values[denominator]);
+    }
+}
+
+static void print_phase_counters(const CompileStats* stats, FILE* stream) {
+    const PerfCounters* counters = stats->counters;
+    if (!counters->available) {
+        fprintf(stream, "counters:    unavailable (%s)\n",
+                counters->error ? strerror(counters->error) : "not supported on this platform");
+        return;
+    }
+
+    fprintf(stream, "%-10s %14s %14s %14s %14s %11s %11s %11s\n", "phase", "cycles", "instructions",
+            "cache miss", "branch miss", "IPC", "cache MPKI", "branch MPKI");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const CounterSample* sample = &stats->phase_counters[i];
+
+        fprintf(stream, "%-10s", phase_names[i]);
+        for (int j = 0; j < COUNTER_COUNT; j++) {
+            if (counters->fds[j] < 0) {
+                fprintf(stream, " %14s", "n/a");
+            } else {
+                fprintf(stream, " %14llu", (unsigned long long)sample->values[j]);
+            }
+        }
+        print_ratio(stream, counters, sample, COUNTER_INSTRUCTIONS, COUNTER_CYCLES, 1);
+        print_ratio(stream, counters, sample, COUNTER_CACHE_MISSES, COUNTER_INSTRUCTIONS, 1000);
+        print_ratio(stream, counters, sample, COUNTER_BRANCH_MISSES, COUNTER_INSTRUCTIONS, 1000);
+        fputc('\n', stream);
+    }
+}
+
+// One indented row per pass that ran, under the optimize phase it is part of
+static void print_pass_stats(const CompileStats* stats, FILE* stream) {
+    for (int i = 0; i < PASS_STATS_SLOTS; i++) {
+        const PassStats* pass = &stats->passes[i];
+        if (!pass->name) continue;
+        fprintf(stream, "  %-8s %10.3f  %zu -> %zu nodes (%+lld)\n", pass->name, pass->ns / 1e6,
+                pass->nodes_before, pass->nodes_after,
+                (long long)pass->nodes_after - (long long)pass->nodes_before);
+    }
+}
+
+void print_compile_stats(const CompileStats* stats, FILE* stream) {
+    uint64_t total = 0;
+
+    fprintf(stream, "%-10s %10s\n", "phase", "ms");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(stream, "%-10s %10.3f\n", phase_names[i], stats->phase_ns[i] / 1e6);
+        total += stats->phase_ns[i];
+        if (i == PHASE_OPTIMIZE) print_pass_stats(stats, stream);
+    }
+    fprintf(stream, "%-10s %10.3f\n", "total", total / 1e6);
+
+    fprintf(stream, "source:      %zu bytes\n", stats->source_bytes);
+    fprintf(stream, "tokens:      %zu\n", stats->token_count);
+    fprintf(stream, "AST nodes:   %zu\n", stats->node_count);
+    if (count_allocations) {
+        fprintf(stream, "allocations: %zu (%zu bytes)\n", stats->alloc_count, stats->alloc_bytes);
+    }
+    fprintf(stream, "peak RSS:    %.1f MB\n", stats->peak_rss_bytes / (1024.0 * 1024.0));
+    fprintf(stream, "output:      %zu bytes\n", stats->output_bytes);
+
+    if (stats->counters) {
+        print_phase_counters(stats, stream);
+    }
+}
+
+// Writes the events in the JSON object format Perfetto and chrome://tracing
+// load; returns 0 on success
+int write_trace(const CompileStats* stats, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return -1;
+
+    fputs("{\"traceEvents\":[\n", file);
+    if (stats->trace) {
+        fwrite(stats->trace->buffer, 1, stats->trace->size, file);
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
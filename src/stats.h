@@ -0,0 +1,75 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "strbuf.h"
+#include "perfcount.h"
+
+typedef enum {
+    PHASE_READ,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_OPTIMIZE,
+    PHASE_CODEGEN,
+    PHASE_SERIALIZE,
+    PHASE_WRITE,
+    PHASE_COUNT
+} CompilePhase;
+
+#define PASS_STATS_SLOTS 16    // one per 4-bit PassKind, see passes.h
+
+// Time and tree size around every run of one optimization pass
+typedef struct {
+    const char* name;    // NULL until the pass ran
+    size_t runs;
+    uint64_t ns;
+    size_t nodes_before;
+    size_t nodes_after;
+} PassStats;
+
+// Measurements for one compilation. Lexing runs interleaved with parsing,
+// so PHASE_LEX is summed per token and PHASE_PARSE is the rest of the front
+// end. With tracing on, every phase and top-level statement is also
+// recorded as a Chrome trace event. With `counters` attached, hardware
+// counters are read at every phase boundary as well.
+typedef struct CompileStats {
+    uint64_t phase_ns[PHASE_COUNT];
+    PassStats passes[PASS_STATS_SLOTS];    // by PassKind; part of PHASE_OPTIMIZE
+    size_t source_bytes;
+    size_t token_count;
+    size_t node_count;
+    size_t output_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t peak_rss_bytes;
+    StringBuilder* trace;
+    uint64_t trace_origin_ns;
+    size_t alloc_count_base;
+    size_t alloc_bytes_base;
+    PerfCounters* counters;
+    CounterSample phase_counters[PHASE_COUNT];
+    CounterSample counter_base;
+} CompileStats;
+
+// Defined by hosts that count heap allocations (the CLI does, see
+// allocstats.c); the totals are sampled around each compilation
+void count_allocations(size_t* count, size_t* bytes) __attribute__((weak));
+
+uint64_t stats_now_ns();
+const char* phase_name(CompilePhase phase);
+void init_compile_stats(CompileStats* stats, int trace);
+void reset_compile_stats(CompileStats* stats);
+void free_compile_stats(CompileStats* stats);
+void begin_compile_stats(CompileStats* stats);
+void end_compile_stats(CompileStats* stats);
+uint64_t begin_phase(CompileStats* stats);
+void add_phase_time(CompileStats* stats, CompilePhase phase, uint64_t start_ns);
+void add_phase_counters(CompileStats* stats, CompilePhase phase);
+void trace_event(CompileStats* stats, const char* name, const char* category,
+                 uint64_t start_ns, uint64_t end_ns, long index, size_t offset);
+void print_compile_stats(const CompileStats* stats, FILE* stream);
+int write_trace(const CompileStats* stats, const char* path);
+
+#endif
@@ -0,0 +1,90 @@
+#include "strbuf.h"
+#include <stdio.h>
+#include <string.h>
+
+#define INITIAL_BUFFER_SIZE 1024
+
+StringBuilder* init_string_builder() {
+    return init_string_builder_with_allocator(NULL);
+}
+
+// The builder and the buffer finalize_string_builder returns both come
+// from `allocator`
+StringBuilder* init_string_builder_with_allocator(const Allocator* allocator) {
+    StringBuilder* sb = allocate(allocator, sizeof(StringBuilder));
+    sb->allocator = allocator;
+    sb->capacity = INITIAL_BUFFER_SIZE;
+    sb->buffer = allocate(allocator, sb->capacity);
+    sb->size = 0;
+    sb->buffer[0] = '\0';
+    return sb;
+}
+
+void reserve_string_builder(StringBuilder* sb, size_t additional) {
+    if (sb->size + additional + 1 > sb->capacity) {
+        while (sb->size + additional + 1 > sb->capacity) {
+            sb->capacity *= 2;
+        }
+        sb->buffer = reallocate(sb->allocator, sb->buffer, sb->capacity);
+    }
+}
+
+void append_bytes(StringBuilder* sb, const char* bytes, size_t length) {
+    reserve_string_builder(sb, length);
+    memcpy(sb->buffer + sb->size, bytes, length);
+    sb->size += length;
+    sb->buffer[sb->size] = '\0';
+}
+
+void append_string(StringBuilder* sb, const char* str) {
+    append_bytes(sb, str, strlen(str));
+}
+
+void append_char(StringBuilder* sb, char c) {
+    reserve_string_builder(sb, 1);
+    sb->buffer[sb->size++] = c;
+    sb->buffer[sb->size] = '\0';
+}
+
+void append_repeated(StringBuilder* sb, char c, size_t count) {
+    reserve_string_builder(sb, count);
+    memset(sb->buffer + sb->size, c, count);
+    sb->size += count;
+    sb->buffer[sb->size] = '\0';
+}
+
+void append_int(StringBuilder* sb, long long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%lld", value);
+    append_bytes(sb, digits, length);
+}
+
+// Appends `length` bytes as a quoted JSON string, escaping as needed
+void append_json_string(StringBuilder* sb, const char* str, size_t length) {
+    append_char(sb, '"');
+    for (size_t i = 0; i < length; i++) {
+        char c = str[i];
+        switch (c) {
+            case '"': append_bytes(sb, "\\\"", 2); break;
+            case '\\': append_bytes(sb, "\\\\", 2); break;
+            case '\n': append_bytes(sb, "\\n", 2); break;
+            case '\r': append_bytes(sb, "\\r", 2); break;
+            case '\t': append_bytes(sb, "\\t", 2); break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+                    append_bytes(sb, escaped, 6);
+                } else {
+                    append_char(sb, c);
+                }
+        }
+    }
+    append_char(sb, '"');
+}
+
+char* finalize_string_builder(StringBuilder* sb) {
+    char* result = sb->buffer;
+    deallocate(sb->allocator, sb);
+    return result;
+}
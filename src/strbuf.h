@@ -0,0 +1,27 @@
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include <stddef.h>
+#include "allocator.h"
+
+// Growable, always NUL-terminated output buffer. Appends are amortized O(1)
+// because the current length is tracked instead of recomputed.
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t capacity;
+    const Allocator* allocator;
+} StringBuilder;
+
+StringBuilder* init_string_builder();
+StringBuilder* init_string_builder_with_allocator(const Allocator* allocator);
+void reserve_string_builder(StringBuilder* sb, size_t additional);
+void append_bytes(StringBuilder* sb, const char* bytes, size_t length);
+void append_string(StringBuilder* sb, const char* str);
+void append_char(StringBuilder* sb, char c);
+void append_repeated(StringBuilder* sb, char c, size_t count);
+void append_int(StringBuilder* sb, long long value);
+void append_json_string(StringBuilder* sb, const char* str, size_t length);
+char* finalize_string_builder(StringBuilder* sb);
+
+#endif
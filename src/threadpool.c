@@ -0,0 +1,207 @@
+#include "threadpool.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct Task {
+    TaskFunction function;
+    void* arg;
+    struct Task* prev;
+    struct Task* next;
+} Task;
+
+// Every worker owns a deque: it takes work from the front of its own deque
+// and, when that runs dry, steals from the back of the others
+typedef struct {
+    ThreadPool* pool;
+    int index;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Task* head;
+    Task* tail;
+} Worker;
+
+struct ThreadPool {
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t idle;
+    int queued;
+    int active;
+    int shutdown;
+    int thread_count;
+    unsigned int next_worker;
+    Worker* workers;
+};
+
+int default_thread_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+static Task* pop_front(Worker* worker) {
+    pthread_mutex_lock(&worker->lock);
+    Task* task = worker->head;
+    if (task) {
+        worker->head = task->next;
+        if (worker->head) {
+            worker->head->prev = NULL;
+        } else {
+            worker->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+static Task* pop_back(Worker* worker) {
+    pthread_mutex_lock(&worker->lock);
+    Task* task = worker->tail;
+    if (task) {
+        worker->tail = task->prev;
+        if (worker->tail) {
+            worker->tail->next = NULL;
+        } else {
+            worker->head = NULL;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+static Task* find_task(Worker* worker) {
+    Task* task = pop_front(worker);
+    if (task) return task;
+
+    ThreadPool* pool = worker->pool;
+    for (int i = 1; i < pool->thread_count; i++) {
+        Worker* victim = &pool->workers[(worker->index + i) % pool->thread_count];
+        task = pop_back(victim);
+        if (task) return task;
+    }
+
+    return NULL;
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    ThreadPool* pool = worker->pool;
+
+    for (;;) {
+        Task* task = find_task(worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!task) {
+            // Another worker may be between taking a task and updating the
+            // count; queued only drops to zero once every task is claimed
+            while (pool->queued == 0 && !pool->shutdown) {
+                pthread_cond_wait(&pool->task_ready, &pool->lock);
+            }
+            int done = pool->queued == 0 && pool->shutdown;
+            pthread_mutex_unlock(&pool->lock);
+            if (done) break;
+            continue;
+        }
+        pool->queued--;
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->function(task->arg, worker->index);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+        if (pool->queued == 0 && pool->active == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+ThreadPool* init_threadpool(int thread_count) {
+    if (thread_count < 1) thread_count = default_thread_count();
+
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->thread_count = thread_count;
+    pool->workers = calloc(thread_count, sizeof(Worker));
+
+    for (int i = 0; i < thread_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+int threadpool_size(ThreadPool* pool) {
+    return pool->thread_count;
+}
+
+// Tasks are dealt round-robin, so submitting in priority order gives every
+// worker a deque in that same order
+void threadpool_submit(ThreadPool* pool, TaskFunction function, void* arg) {
+    Task* task = malloc(sizeof(Task));
+    task->function = function;
+    task->arg = arg;
+    task->next = NULL;
+
+    // Count the task before publishing it so queued never goes negative
+    pthread_mutex_lock(&pool->lock);
+    Worker* worker = &pool->workers[pool->next_worker++ % pool->thread_count];
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_lock(&worker->lock);
+    task->prev = worker->tail;
+    if (worker->tail) {
+        worker->tail->next = task;
+    } else {
+        worker->head = task;
+    }
+    worker->tail = task;
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Blocks until every submitted task has finished
+void threadpool_wait(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued > 0 || pool->active > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_threadpool(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    // Workers still running may steal from the others' deques, so no lock
+    // goes away before every worker is done
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,17 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Tasks receive the index of the worker running them so callers can keep
+// per-worker state (scratch buffers, arenas) without locking.
+typedef void (*TaskFunction)(void* arg, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+int default_thread_count();
+ThreadPool* init_threadpool(int thread_count);
+int threadpool_size(ThreadPool* pool);
+void threadpool_submit(ThreadPool* pool, TaskFunction function, void* arg);
+void threadpool_wait(ThreadPool* pool);
+void free_threadpool(ThreadPool* pool);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef TINY_H
+#define TINY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Embeddable compiler API (libtiny). A TinyContext owns everything one
+// compilation needs: options, diagnostics and the memory behind its results.
+// Contexts share no mutable state, so each thread can compile with its own
+// context concurrently; a single context must not be used by two threads at
+// the same time.
+
+// The shared library is built with hidden visibility; only these symbols
+// are exported
+#if defined(__GNUC__)
+#define TINY_API __attribute__((visibility("default")))
+#else
+#define TINY_API
+#endif
+
+typedef struct TinyContext TinyContext;
+
+typedef enum {
+    TINY_OK = 0,
+    TINY_ERROR = 1
+} TinyStatus;
+
+// TinyOptions.flags
+#define TINY_COMPACT_JSON  0x1   // tiny_parse emits JSON without whitespace
+#define TINY_COLLECT_STATS 0x2   // measure every call, see tiny_get_stats
+#define TINY_BUFFER_OUTPUT 0x4   // generated print() writes through a buffer
+
+// Memory for the tokens, trees and results a context allocates while
+// compiling. `free` may be a no-op for allocators released in bulk.
+typedef struct {
+    void* (*alloc)(void* user, size_t size);
+    void* (*realloc)(void* user, void* memory, size_t size);
+    void (*free)(void* user, void* memory);
+    void* user;
+} TinyAllocator;
+
+typedef struct {
+    uint32_t flags;
+    const TinyAllocator* allocator;   // NULL for malloc and free
+    size_t memory_limit;              // most bytes live during one call; 0 for no limit
+} TinyOptions;
+
+// Outputs for tiny_analyze, combined with |
+#define TINY_ANALYZE_TOKENS     0x1   // triples as from tiny_tokenize_array
+#define TINY_ANALYZE_AST        0x2   // JSON as from tiny_parse
+#define TINY_ANALYZE_AST_BINARY 0x4   // as from tiny_parse_binary
+#define TINY_ANALYZE_JAVASCRIPT 0x8
+
+// Outputs that were not requested are NULL
+typedef struct {
+    const int32_t* tokens;
+    size_t token_count;
+    const char* ast;
+    size_t ast_length;
+    const char* ast_binary;
+    size_t ast_binary_length;
+    const char* javascript;
+    size_t javascript_length;
+} TinyAnalysis;
+
+TINY_API TinyContext* tiny_create_context(const TinyOptions* options);
+TINY_API void tiny_destroy_context(TinyContext* context);
+
+// Results stay valid until the next call on the same context. The source
+// does not need to be NUL-terminated. A call that would exceed
+// memory_limit fails with a diagnostic and releases what it allocated.
+TINY_API TinyStatus tiny_compile(TinyContext* context, const char* source, size_t length,
+                                 const char** output, size_t* output_length);
+TINY_API TinyStatus tiny_tokenize(TinyContext* context, const char* source, size_t length,
+                                  const char** output, size_t* output_length);
+TINY_API TinyStatus tiny_parse(TinyContext* context, const char* source, size_t length,
+                               const char** output, size_t* output_length);
+
+// Flat binary AST in the layout documented in astbin.h
+TINY_API TinyStatus tiny_parse_binary(TinyContext* context, const char* source, size_t length,
+                                      const char** output, size_t* output_length);
+
+// One (type, start, length) triple per token including the final EOF, with
+// start and length in bytes of `source`. Only a context's memory_limit
+// makes it fail, with NULL tokens and a count of 0 on TINY_ERROR.
+TINY_API TinyStatus tiny_tokenize_array(TinyContext* context, const char* source, size_t length,
+                                        const int32_t** tokens, size_t* token_count);
+
+// Lexes and parses `source` once and builds every output requested in
+// `outputs` from the same tokens and tree. On a syntax error only the
+// tokens are produced.
+TINY_API TinyStatus tiny_analyze(TinyContext* context, const char* source, size_t length,
+                                 uint32_t outputs, TinyAnalysis* analysis);
+
+// Measurements of the most recent call on a context created with
+// TINY_COLLECT_STATS. Lexing runs inside parsing, so parse_ms excludes the
+// time spent in the lexer.
+typedef struct {
+    double lex_ms;
+    double parse_ms;
+    double codegen_ms;
+    double serialize_ms;      // AST and token JSON or binary output
+    size_t token_count;
+    size_t node_count;
+    size_t alloc_count;       // made by the compiler for this call
+    size_t alloc_bytes;
+    size_t peak_rss_bytes;    // of the whole process; linear memory size in WASM
+    size_t output_bytes;
+    double optimize_ms;       // loop optimizations ahead of codegen
+} TinyStats;
+
+TINY_API void tiny_get_stats(const TinyContext* context, TinyStats* stats);
+
+// Messages from the most recent call, one per line ("" when there were none)
+TINY_API const char* tiny_diagnostics(const TinyContext* context);
+
+#endif
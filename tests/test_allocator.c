@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/arena.h"
+#include "../src/tiny.h"
+
+static const char* source =
+    "a = 5;\n"
+    "b = (a + 10) * 3;\n"
+    "if (b >= 40) {\n"
+    "    print(b);\n"
+    "} else {\n"
+    "    print(a);\n"
+    "}\n";
+
+static const unsigned all_outputs = ANALYZE_TOKENS | ANALYZE_TOKENS_JSON | ANALYZE_AST_COMPACT_JSON |
+                                    ANALYZE_AST_BINARY | ANALYZE_JAVASCRIPT;
+
+// Outputs other than the pointer-bearing AST JSON must not depend on the
+// allocator
+static void assert_same_outputs(const Analysis* a, const Analysis* b) {
+    assert(a->token_count == b->token_count);
+    assert(memcmp(a->tokens, b->tokens, (1 + 3 * a->token_count) * sizeof(int32_t)) == 0);
+    assert(strcmp(a->tokens_json, b->tokens_json) == 0);
+    assert(a->ast_binary_length == b->ast_binary_length);
+    assert(memcmp(a->ast_binary, b->ast_binary, a->ast_binary_length) == 0);
+    assert(strcmp(a->javascript, b->javascript) == 0);
+}
+
+void test_counting_allocator() {
+    Diagnostics diagnostics;
+    Analysis expected, counted;
+    CountingAllocator counting;
+    init_diagnostics(&diagnostics);
+    init_counting_allocator(&counting, NULL, 0, &diagnostics);
+    Allocator allocator = counting_allocator(&counting);
+
+    assert(analyze_source(source, strlen(source), NULL, all_outputs, &expected, NULL, NULL) == 0);
+    assert(analyze_source(source, strlen(source), &diagnostics, all_outputs, &counted, NULL,
+                          &allocator) == 0);
+    assert_same_outputs(&expected, &counted);
+
+    assert(counting.alloc_count > 0);
+    assert(counting.peak_bytes >= counting.live_bytes);
+    assert(counting.live_bytes > 0);
+    assert(!counting.failed);
+
+    size_t live = counting.live_bytes;
+    free_analysis(&counted);
+    assert(counting.live_bytes < live);
+    release_counted_blocks(&counting);
+    assert(counting.live_bytes == 0);
+    assert(counting.blocks == NULL);
+
+    free_analysis(&expected);
+    free_diagnostics(&diagnostics);
+}
+
+void test_arena_allocator() {
+    Arena arena;
+    Analysis expected, in_arena;
+    init_arena(&arena, 256);
+    Allocator allocator = arena_allocator(&arena);
+
+    // The newest block grows in place
+    char* grown = allocate(&allocator, 16);
+    memcpy(grown, "0123456789abcdef", 16);
+    assert(reallocate(&allocator, grown, 200) == grown);
+    assert(memcmp(grown, "0123456789abcdef", 16) == 0);
+
+    // An older one is copied
+    allocate(&allocator, 8);
+    char* moved = reallocate(&allocator, grown, 400);
+    assert(moved != grown);
+    assert(memcmp(moved, "0123456789abcdef", 16) == 0);
+
+    assert(analyze_source(source, strlen(source), NULL, all_outputs, &expected, NULL, NULL) == 0);
+    assert(analyze_source(source, strlen(source), NULL, all_outputs, &in_arena, NULL,
+                          &allocator) == 0);
+    assert_same_outputs(&expected, &in_arena);
+
+    free_analysis(&expected);
+    free_arena(&arena);
+}
+
+void test_memory_limit() {
+    Diagnostics diagnostics;
+    Analysis analysis;
+    CountingAllocator counting;
+    init_diagnostics(&diagnostics);
+    init_counting_allocator(&counting, NULL, 4096, &diagnostics);
+    Allocator allocator = counting_allocator(&counting);
+
+    size_t length = 64 * strlen(source);
+    char* large = malloc(length + 1);
+    for (int i = 0; i < 64; i++) {
+        memcpy(large + i * strlen(source), source, strlen(source));
+    }
+    large[length] = '\0';
+
+    // Too much for the limit, in the front end and while building tokens
+    assert(analyze_source(large, length, &diagnostics, ANALYZE_JAVASCRIPT, &analysis, NULL,
+                          &allocator) == 1);
+    assert(counting.failed);
+    assert(analysis.javascript == NULL);
+    assert(strstr(diagnostics.text, "Memory limit of 4096 bytes exceeded") != NULL);
+    free_analysis(&analysis);
+    release_counted_blocks(&counting);
+    assert(counting.live_bytes == 0);
+
+    reset_diagnostics(&diagnostics);
+    reset_allocation_counts(&counting);
+    assert(analyze_source(large, length, &diagnostics, ANALYZE_TOKENS, &analysis, NULL,
+                          &allocator) == 1);
+    assert(counting.failed && analysis.tokens == NULL);
+    release_counted_blocks(&counting);
+
+    // A small program still fits
+    reset_diagnostics(&diagnostics);
+    reset_allocation_counts(&counting);
+    assert(analyze_source("x = 1;", 6, &diagnostics, ANALYZE_JAVASCRIPT, &analysis, NULL,
+                          &allocator) == 0);
+    assert(!counting.failed);
+    assert(strstr(analysis.javascript, "let x = 1;") != NULL);
+    free_analysis(&analysis);
+    release_counted_blocks(&counting);
+
+    free(large);
+    free_diagnostics(&diagnostics);
+}
+
+typedef struct {
+    size_t allocs;
+    size_t frees;
+} HostCounts;
+
+static void* host_alloc(void* user, size_t size) {
+    ((HostCounts*)user)->allocs++;
+    return malloc(size);
+}
+
+static void* host_realloc(void* user, void* memory, size_t size) {
+    if (!memory) ((HostCounts*)user)->allocs++;
+    return realloc(memory, size);
+}
+
+static void host_free(void* user, void* memory) {
+    ((HostCounts*)user)->frees++;
+    free(memory);
+}
+
+void test_context_allocator() {
+    HostCounts counts = { 0, 0 };
+    TinyAllocator host = { host_alloc, host_realloc, host_free, &counts };
+    TinyOptions options = { TINY_COLLECT_STATS, &host, 8192 };
+    TinyContext* context = tiny_create_context(&options);
+    const char* output;
+    TinyStats stats;
+
+    assert(tiny_compile(context, source, strlen(source), &output, NULL) == TINY_OK);
+    assert(strstr(output, "console.log(b);") != NULL);
+    assert(counts.allocs > 0);
+    tiny_get_stats(context, &stats);
+    assert(stats.alloc_count > 0 && stats.alloc_bytes > 0);
+
+    char large[16384];
+    size_t length = 0;
+    while (length + 16 < sizeof(large)) {
+        memcpy(large + length, "print(1 + 2);\n", 14);
+        length += 14;
+    }
+    assert(tiny_compile(context, large, length, &output, NULL) == TINY_ERROR);
+    assert(output == NULL);
+    assert(strstr(tiny_diagnostics(context), "Memory limit") != NULL);
+
+    const int32_t* tokens;
+    size_t count;
+    assert(tiny_tokenize_array(context, large, length, &tokens, &count) == TINY_ERROR);
+    assert(tokens == NULL && count == 0);
+
+    // The abandoned calls' memory went back to the host
+    assert(tiny_compile(context, "x = 1;", 6, &output, NULL) == TINY_OK);
+    tiny_destroy_context(context);
+    assert(counts.allocs == counts.frees);
+}
+
+int main() {
+    test_counting_allocator();
+    test_arena_allocator();
+    test_memory_limit();
+    test_context_allocator();
+    printf("All allocator tests passed!\n");
+    return 0;
+}
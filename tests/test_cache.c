@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "../src/cache.h"
+
+#define READER_THREADS 4
+#define READS_PER_THREAD 10000
+
+// Enough ~1 KB entries to fill a 4 MB cache five times over
+#define FULL_BUDGET (4 * 1024 * 1024)
+#define FULL_STORES 20000
+#define HOT_ENTRIES 64
+
+#define WRITER_THREADS 4
+#define WRITES_PER_THREAD 200
+#define WRITER_OUTPUT 64 * 1024
+
+void test_hit_and_miss() {
+    CompileCache* cache = init_cache(CACHE_DEFAULT_BUDGET, NULL);
+    const char* source = "x = 1;";
+
+    assert(cache_lookup(cache, source, strlen(source), 0) == NULL);
+    cache_store(cache, source, strlen(source), 0, "let x = 1;\n");
+
+    char* output = cache_lookup(cache, source, strlen(source), 0);
+    assert(output != NULL);
+    assert(strcmp(output, "let x = 1;\n") == 0);
+    free(output);
+
+    // Different options must not share an entry
+    assert(cache_lookup(cache, source, strlen(source), 1) == NULL);
+
+    CacheStats stats = cache_stats(cache);
+    assert(stats.hits == 1);
+    assert(stats.misses == 2);
+    assert(stats.entries == 1);
+
+    free_cache(cache);
+}
+
+void test_lru_eviction() {
+    // Budget fits roughly two small entries
+    CompileCache* cache = init_cache(200, NULL);
+
+    cache_store(cache, "a", 1, 0, "A");
+    cache_store(cache, "b", 1, 0, "B");
+
+    // Touch "a" so "b" becomes the least recently used entry
+    free(cache_lookup(cache, "a", 1, 0));
+    cache_store(cache, "c", 1, 0, "C");
+
+    char* a = cache_lookup(cache, "a", 1, 0);
+    char* b = cache_lookup(cache, "b", 1, 0);
+    char* c = cache_lookup(cache, "c", 1, 0);
+    assert(a != NULL && b == NULL && c != NULL);
+    free(a);
+    free(c);
+
+    CacheStats stats = cache_stats(cache);
+    assert(stats.evictions == 1);
+    assert(stats.bytes <= 200);
+
+    free_cache(cache);
+}
+
+static size_t entry_source(char* source, size_t size, int i) {
+    return (size_t)snprintf(source, size, "x = %d;", i);
+}
+
+// A cache kept full evicts in the order entries were stored, apart from
+// those hit since, and each eviction looks at O(1) entries on average
+void test_full_cache() {
+    CompileCache* cache = init_cache(FULL_BUDGET, NULL);
+    char source[32];
+    char output[1024];
+    memset(output, 'x', sizeof(output) - 1);
+    output[sizeof(output) - 1] = '\0';
+
+    for (int i = 0; i < FULL_STORES; i++) {
+        size_t length = entry_source(source, sizeof(source), i);
+        cache_store(cache, source, length, 0, output);
+
+        // The first entries stay in use throughout
+        int hot = i % HOT_ENTRIES;
+        length = entry_source(source, sizeof(source), hot);
+        char* hit = cache_lookup(cache, source, length, 0);
+        assert(hit != NULL);
+        free(hit);
+    }
+
+    CacheStats stats = cache_stats(cache);
+    assert(stats.bytes <= FULL_BUDGET);
+    assert(stats.entries > 1000 && stats.evictions == FULL_STORES - stats.entries);
+    assert(stats.eviction_scans <= stats.evictions + stats.hits);
+
+    // Every hot entry survived, and the cold ones left are the newest
+    size_t present = 0;
+    for (int i = 0; i < FULL_STORES; i++) {
+        size_t length = entry_source(source, sizeof(source), i);
+        char* hit = cache_lookup(cache, source, length, 0);
+        int newest = i >= FULL_STORES - (int)stats.entries + HOT_ENTRIES;
+        assert(i < HOT_ENTRIES || newest == (hit != NULL));
+        if (i < HOT_ENTRIES) assert(hit != NULL);
+        present += hit != NULL;
+        free(hit);
+    }
+    assert(present == stats.entries);
+
+    free_cache(cache);
+}
+
+void* reader_thread(void* arg) {
+    CompileCache* cache = arg;
+    char source[32];
+
+    for (int i = 0; i < READS_PER_THREAD; i++) {
+        snprintf(source, sizeof(source), "x = %d;", i % 16);
+        char* output = cache_lookup(cache, source, strlen(source), 0);
+        assert(output != NULL);
+        assert(strncmp(output, "let x", 5) == 0);
+        free(output);
+    }
+
+    return NULL;
+}
+
+void test_concurrent_readers() {
+    CompileCache* cache = init_cache(CACHE_DEFAULT_BUDGET, NULL);
+    char source[32], output[32];
+
+    for (int i = 0; i < 16; i++) {
+        snprintf(source, sizeof(source), "x = %d;", i);
+        snprintf(output, sizeof(output), "let x = %d;\n", i);
+        cache_store(cache, source, strlen(source), 0, output);
+    }
+
+    pthread_t threads[READER_THREADS];
+    for (int i = 0; i < READER_THREADS; i++) {
+        pthread_create(&threads[i], NULL, reader_thread, cache);
+    }
+    for (int i = 0; i < READER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    CacheStats stats = cache_stats(cache);
+    assert(stats.hits == READER_THREADS * READS_PER_THREAD);
+    assert(stats.misses == 0);
+
+    free_cache(cache);
+}
+
+typedef struct {
+    CompileCache* cache;
+    char* output;
+} Writer;
+
+void* writer_thread(void* arg) {
+    Writer* writer = arg;
+    for (int i = 0; i < WRITES_PER_THREAD; i++) {
+        cache_store(writer->cache, "x = 1;", 6, 0, writer->output);
+    }
+    return NULL;
+}
+
+// Threads of one process storing the same entry each write a temp file of
+// their own, so the entry on disk is always one whole output
+void test_concurrent_disk_stores() {
+    char dir[] = "/tmp/tiny-cache-test-XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    CompileCache* cache = init_cache(CACHE_DEFAULT_BUDGET, dir);
+
+    Writer writers[WRITER_THREADS];
+    pthread_t threads[WRITER_THREADS];
+    for (int i = 0; i < WRITER_THREADS; i++) {
+        writers[i].cache = cache;
+        writers[i].output = malloc(WRITER_OUTPUT + 1);
+        memset(writers[i].output, 'a' + i, WRITER_OUTPUT);
+        writers[i].output[WRITER_OUTPUT] = '\0';
+        pthread_create(&threads[i], NULL, writer_thread, &writers[i]);
+    }
+    for (int i = 0; i < WRITER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free_cache(cache);
+
+    // A new cache only finds the entry on disk
+    cache = init_cache(CACHE_DEFAULT_BUDGET, dir);
+    char* output = cache_lookup(cache, "x = 1;", 6, 0);
+    assert(output != NULL && strlen(output) == WRITER_OUTPUT);
+    for (size_t i = 1; i < WRITER_OUTPUT; i++) {
+        assert(output[i] == output[0]);
+    }
+    assert(cache_stats(cache).disk_hits == 1);
+    free(output);
+    free_cache(cache);
+
+    // No temp file is left behind
+    DIR* entries = opendir(dir);
+    struct dirent* entry;
+    int files = 0;
+    char path[sizeof(dir) + 256];
+    while ((entry = readdir(entries)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        files++;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        remove(path);
+    }
+    closedir(entries);
+    assert(files == 1);
+    rmdir(dir);
+    for (int i = 0; i < WRITER_THREADS; i++) {
+        free(writers[i].output);
+    }
+}
+
+int main() {
+    test_hit_and_miss();
+    test_lru_eviction();
+    test_full_cache();
+    test_concurrent_readers();
+    test_concurrent_disk_stores();
+    printf("All cache tests passed!\n");
+    return 0;
+}
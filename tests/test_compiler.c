@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/lexer.h"
+
+#define LONG_IDENTIFIER 1000
+
+void test_tokenize_json() {
+    char* json = tokenize_string("x = 10;");
+    assert(strcmp(json, "[{\"type\":\"IDENTIFIER\",\"value\":\"x\"},"
+                        "{\"type\":\"ASSIGN\",\"value\":\"=\"},"
+                        "{\"type\":\"NUMBER\",\"value\":\"10\"},"
+                        "{\"type\":\"SEMICOLON\",\"value\":\";\"},"
+                        "{\"type\":\"EOF\",\"value\":null}]") == 0);
+    free(json);
+
+    // Long token values used to be cut off at about 200 characters
+    char source[LONG_IDENTIFIER + 8];
+    memset(source, 'a', LONG_IDENTIFIER);
+    strcpy(source + LONG_IDENTIFIER, " = 1;");
+
+    json = tokenize_string(source);
+    char* value = strstr(json, "\"value\":\"") + 9;
+    assert(strspn(value, "a") == LONG_IDENTIFIER);
+    assert(value[LONG_IDENTIFIER] == '"');
+    free(json);
+}
+
+void test_tokenize_array() {
+    const char* source = "if (y > 7) { print(y); }";
+    size_t count;
+    int32_t* tokens = tokenize_source_to_array(source, strlen(source), NULL, &count);
+
+    assert(count == 14);
+    assert(tokens[0] == 14);
+
+    int32_t* first = tokens + 1;
+    assert(first[0] == TOKEN_IF && first[1] == 0 && first[2] == 2);
+
+    int32_t* print = tokens + 1 + 7 * 3;
+    assert(print[0] == TOKEN_PRINT && print[1] == 13 && print[2] == 5);
+
+    int32_t* eof = tokens + 1 + 13 * 3;
+    assert(eof[0] == TOKEN_EOF && eof[1] == (int32_t)strlen(source) && eof[2] == 0);
+
+    free(tokens);
+}
+
+void test_phase_counters() {
+    const char* source = "x = 1 + 2;\nif (x > 2) { print(x * 3); }";
+    PerfCounters counters;
+    CompileStats stats;
+
+    open_perf_counters(&counters);
+    init_compile_stats(&stats, 0);
+    stats.counters = &counters;
+
+    char* expected = compile_source_with_stats(source, strlen(source), NULL, NULL);
+    char* output = compile_source_with_stats(source, strlen(source), NULL, &stats);
+    assert(strcmp(output, expected) == 0);
+    assert(stats.token_count == 22);
+
+    if (counters.available) {
+        assert(counters.fds[COUNTER_INSTRUCTIONS] < 0 ||
+               stats.phase_counters[PHASE_CODEGEN].values[COUNTER_INSTRUCTIONS] > 0);
+    } else {
+        // Unavailable counters leave every phase at zero
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            for (int j = 0; j < COUNTER_COUNT; j++) {
+                assert(stats.phase_counters[i].values[j] == 0);
+            }
+        }
+    }
+
+    free(output);
+    free(expected);
+    free_compile_stats(&stats);
+    close_perf_counters(&counters);
+}
+
+int main() {
+    test_tokenize_json();
+    test_tokenize_array();
+    test_phase_counters();
+    printf("All compiler tests passed!\n");
+    return 0;
+}
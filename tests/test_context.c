@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../src/tiny.h"
+
+// How well this scales is measured by tiny-bench --context-threads
+#define MAX_THREADS 8
+#define COMPILES_PER_THREAD 500
+
+static const char* good_source =
+    "a = 5;\n"
+    "b = 10;\n"
+    "c = (a + b) * 3 - a / 2;\n"
+    "if (c >= 40) {\n"
+    "    print(c);\n"
+    "} else {\n"
+    "    print(a);\n"
+    "}\n";
+
+static const char* bad_source = "x = (1 + ;";
+
+static char* reference_output;
+
+void* compile_worker(void* arg) {
+    int iterations = *(int*)arg;
+    TinyContext* context = tiny_create_context(NULL);
+
+    for (int i = 0; i < iterations; i++) {
+        const char* output;
+        size_t length;
+
+        // Interleave failures so a leaked error state would corrupt the
+        // next successful compile on this context or another thread's
+        if (i % 8 == 7) {
+            TinyStatus status = tiny_compile(context, bad_source, strlen(bad_source),
+                                             &output, &length);
+            assert(status == TINY_ERROR);
+            assert(output == NULL);
+            assert(strstr(tiny_diagnostics(context), "Syntax error") != NULL);
+            continue;
+        }
+
+        TinyStatus status = tiny_compile(context, good_source, strlen(good_source),
+                                         &output, &length);
+        assert(status == TINY_OK);
+        assert(tiny_diagnostics(context)[0] == '\0');
+        assert(length == strlen(reference_output));
+        assert(memcmp(output, reference_output, length) == 0);
+    }
+
+    tiny_destroy_context(context);
+    return NULL;
+}
+
+void run_threads(int thread_count, int iterations) {
+    pthread_t threads[MAX_THREADS];
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, compile_worker, &iterations);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+void test_isolated_contexts() {
+    TinyContext* context = tiny_create_context(NULL);
+    const char* output;
+    size_t length;
+
+    assert(tiny_compile(context, good_source, strlen(good_source), &output, &length) == TINY_OK);
+    reference_output = strdup(output);
+
+    // Source without a terminating NUL is read only up to `length`
+    const char* padded = "print(1);GARBAGE";
+    assert(tiny_compile(context, padded, 9, &output, &length) == TINY_OK);
+    assert(strstr(output, "console.log(1);") != NULL);
+
+    assert(tiny_tokenize(context, "x = 1;", 6, &output, &length) == TINY_OK);
+    assert(strncmp(output, "[{\"type\":\"IDENTIFIER\"", 20) == 0);
+
+    assert(tiny_parse(context, bad_source, strlen(bad_source), &output, &length) == TINY_ERROR);
+    assert(tiny_diagnostics(context)[0] != '\0');
+
+    tiny_destroy_context(context);
+
+    run_threads(MAX_THREADS, COMPILES_PER_THREAD);
+}
+
+void test_raw_outputs() {
+    TinyContext* context = tiny_create_context(NULL);
+    const char* output;
+    size_t length;
+
+    assert(tiny_parse_binary(context, good_source, strlen(good_source), &output, &length) == TINY_OK);
+    const int32_t* header = (const int32_t*)output;
+    assert(header[0] == 0x54534154);
+    assert((size_t)header[2] == length);
+
+    const int32_t* tokens;
+    size_t count;
+    assert(tiny_tokenize_array(context, "x = 10;", 7, &tokens, &count) == TINY_OK);
+    assert(count == 5);
+    assert(tokens[3 * 2 + 1] == 4 && tokens[3 * 2 + 2] == 2);
+    assert(tokens[3 * 4 + 2] == 0);
+
+    assert(tiny_parse_binary(context, bad_source, strlen(bad_source), &output, &length) == TINY_ERROR);
+    assert(output == NULL);
+
+    tiny_destroy_context(context);
+}
+
+// Every output of one analyze call matches the dedicated call for it
+void test_analyze() {
+    TinyContext* context = tiny_create_context(NULL);
+    TinyContext* reference = tiny_create_context(NULL);
+    uint32_t all = TINY_ANALYZE_TOKENS | TINY_ANALYZE_AST | TINY_ANALYZE_AST_BINARY |
+                   TINY_ANALYZE_JAVASCRIPT;
+    TinyAnalysis analysis;
+    const char* output;
+    const int32_t* tokens;
+    size_t length;
+
+    assert(tiny_analyze(context, good_source, strlen(good_source), all, &analysis) == TINY_OK);
+
+    tiny_tokenize_array(reference, good_source, strlen(good_source), &tokens, &length);
+    assert(analysis.token_count == length);
+    assert(memcmp(analysis.tokens, tokens, length * 3 * sizeof(int32_t)) == 0);
+
+    // Node ids in the JSON are addresses, so only the shape is compared
+    assert(analysis.ast_length == strlen(analysis.ast));
+    assert(strncmp(analysis.ast, "{\n  \"type\": \"PROGRAM\"", 21) == 0);
+
+    tiny_parse_binary(reference, good_source, strlen(good_source), &output, &length);
+    assert(analysis.ast_binary_length == length && memcmp(analysis.ast_binary, output, length) == 0);
+
+    tiny_compile(reference, good_source, strlen(good_source), &output, &length);
+    assert(analysis.javascript_length == length && memcmp(analysis.javascript, output, length) == 0);
+
+    // Only what was asked for is built
+    assert(tiny_analyze(context, good_source, strlen(good_source), TINY_ANALYZE_JAVASCRIPT,
+                        &analysis) == TINY_OK);
+    assert(analysis.tokens == NULL && analysis.ast == NULL && analysis.javascript != NULL);
+
+    // A syntax error still yields every token through EOF
+    assert(tiny_analyze(context, bad_source, strlen(bad_source), all, &analysis) == TINY_ERROR);
+    assert(analysis.javascript == NULL && analysis.ast == NULL);
+    assert(strstr(tiny_diagnostics(context), "Syntax error") != NULL);
+    tiny_tokenize_array(reference, bad_source, strlen(bad_source), &tokens, &length);
+    assert(analysis.token_count == length);
+    assert(memcmp(analysis.tokens, tokens, length * 3 * sizeof(int32_t)) == 0);
+
+    tiny_destroy_context(reference);
+    tiny_destroy_context(context);
+}
+
+void test_stats() {
+    TinyOptions options = { TINY_COLLECT_STATS, NULL, 0 };
+    TinyContext* context = tiny_create_context(&options);
+    const char* output;
+    size_t length;
+    TinyStats stats;
+
+    // x = 1 + 2; -> 7 tokens with EOF; PROGRAM, ASSIGN, BINARY_OP, 2 NUMBERs
+    assert(tiny_compile(context, "x = 1 + 2;", 10, &output, &length) == TINY_OK);
+    tiny_get_stats(context, &stats);
+    assert(stats.token_count == 7);
+    assert(stats.node_count == 5);
+    assert(stats.output_bytes == length);
+    assert(stats.lex_ms >= 0 && stats.parse_ms >= 0 && stats.codegen_ms >= 0);
+    assert(stats.peak_rss_bytes > 0);
+
+    // Each call starts from zero
+    assert(tiny_tokenize(context, "y;", 2, &output, &length) == TINY_OK);
+    tiny_get_stats(context, &stats);
+    assert(stats.token_count == 3 && stats.node_count == 0);
+
+    tiny_destroy_context(context);
+}
+
+// The same program with print() writing through the buffered runtime
+void test_buffered_output() {
+    TinyOptions options = { TINY_BUFFER_OUTPUT, NULL, 0 };
+    TinyContext* context = tiny_create_context(&options);
+    const char* output;
+    size_t length;
+
+    assert(tiny_compile(context, good_source, strlen(good_source), &output, &length) == TINY_OK);
+    assert(strncmp(output, "// Generated by TinyCompiler\n\n// print() output", 47) == 0);
+    assert(strstr(output, "const $print = value => {\n"));
+    assert(strstr(output, "  $print(c);\n} else {\n  $print(a);\n}\n"));
+    assert(strstr(output, "console.log(c)") == NULL);
+    assert(length > 10 && strcmp(output + length - 10, "$flush();\n") == 0);
+
+    // The program itself is compiled as without the buffer up to the prints
+    const char* program = strstr(output, "let a = 5;");
+    const char* expected = strstr(reference_output, "let a = 5;");
+    size_t assignments = strstr(expected, "if (") - expected;
+    assert(program && strncmp(program, expected, assignments + 4) == 0);
+
+    tiny_destroy_context(context);
+}
+
+int main() {
+    test_isolated_contexts();
+    test_raw_outputs();
+    test_analyze();
+    test_stats();
+    test_buffered_output();
+    free(reference_output);
+    printf("All context tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/evaluate.h"
+
+static ASTNode* parse_string(const char* source) {
+    Lexer* lexer = init_lexer((char*)source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+static char* evaluate_string(const char* source) {
+    Analysis analysis;
+    unsigned outputs = ANALYZE_JAVASCRIPT | analyze_pipeline_flags(optimization_level_pipeline(3));
+    int status = analyze_source(source, strlen(source), NULL, outputs, &analysis, NULL, NULL);
+    assert(status == 0);
+    return analysis.javascript;
+}
+
+// Prints before the division by zero fold into one constant; what follows
+// it runs, with the variables it reads assigned first
+void test_division_by_zero() {
+    const char* source = "x = 6; print(x * 7); print(x + 1); y = x / 0; print(y);";
+    char* output = evaluate_string(source);
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "console.log(\"42\\n7\");\n"
+                          "let x = 6;\n"
+                          "let y = (x / 0);\n"
+                          "console.log(y);\n") == 0);
+    free(output);
+
+    PartialEvaluation result;
+    ASTNode* ast = parse_string(source);
+    evaluate_program(ast, NULL, &result);
+    assert(result.folded == 3 && result.residual == 2 && result.steps > 0);
+    free_ast(ast);
+}
+
+// Printed the way console.log prints JavaScript values
+void test_javascript_values() {
+    char* output = evaluate_string("def half(n) { return n / 2; }\n"
+                                   "def none() { x = 1; }\n"
+                                   "print(half(3)); print(1 / 3); print(0 * (0 - 1));\n"
+                                   "print(1000000000 * 1000000000 * 1000);\n"
+                                   "print(1 / 1000000); print(1 / 10000000);\n"
+                                   "print(2 > 1); print(none()); print(none() + 1);\n"
+                                   "print((1 > 0) == (2 > 1)); print(123456789 * 1000);\n");
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "console.log(\"1.5\\n0.3333333333333333\\n-0\\n1e+21\\n0.000001\\n1e-7\\n"
+                          "true\\nundefined\\nNaN\\ntrue\\n123456789000\");\n") == 0);
+    free(output);
+}
+
+// A loop that never ends uses up the program's step budget, so it and
+// everything after it are kept
+void test_step_budget() {
+    char* output = evaluate_string("print(1); i = 0; while (1 > 0) { i = i + 1; } print(i); print(2);");
+    assert(strncmp(output, "// Generated by TinyCompiler\n\nconsole.log(\"1\");\nlet i = 0;\n", 59) == 0);
+    assert(strstr(output, "}\nconsole.log(i);\nconsole.log(2);\n"));
+    free(output);
+}
+
+// Reading a `let` before it runs throws, so the statement is kept as it is
+void test_dead_zone() {
+    char* output = evaluate_string("if (1 > 0) { print(q); q = 1; } print(2);");
+    assert(strstr(output, "if ((1 > 0)) {\n  console.log(q);\n  let q = 1;\n}\n"
+                          "console.log(\"2\");\n"));
+    free(output);
+}
+
+// An assignment in an if body updates the variable declared outside it
+void test_assignment_in_if() {
+    char* output = evaluate_string("x = 1; if (x > 0) { x = 2; y = 3; } print(x);");
+    assert(strstr(output, "console.log(\"2\");\n"));
+    free(output);
+}
+
+// Only functions a remaining statement calls stay, and the top-level
+// variables they read are assigned before the call
+void test_functions() {
+    char* output = evaluate_string("def sq(n) { return n * n; }\n"
+                                   "def sq2(n) { return sq(n) + g; }\n"
+                                   "def fact(n) { x = 1; if (n > 1) { x = n * fact(n - 1); } return x; }\n"
+                                   "g = 2; g = g + 1;\n"
+                                   "print(sq(4)); print(fact(10)); print(fact(200));\n"
+                                   "d = 1 / 0;\n"
+                                   "print(sq2(d));\n");
+    assert(strstr(output, "console.log(\"16\\n3628800\\nInfinity\");\n"
+                          "let d = (1 / 0);\n"
+                          "let g = 3;\n"
+                          "console.log(sq2(d));\n"));
+    assert(strstr(output, "function sq2(n) {\n"));
+    assert(strstr(output, "function fact") == NULL);
+    free(output);
+}
+
+// A variable and a function of the same name do not load in JavaScript, so
+// nothing is evaluated
+void test_unloadable() {
+    const char* source = "f = 1; def f() { return 2; } print(f);";
+    char* evaluated = evaluate_string(source);
+    char* compiled = compile_string(source);
+    assert(strcmp(evaluated, compiled) == 0);
+    free(evaluated);
+    free(compiled);
+}
+
+int main() {
+    test_division_by_zero();
+    test_javascript_values();
+    test_step_budget();
+    test_dead_zone();
+    test_assignment_in_if();
+    test_functions();
+    test_unloadable();
+    printf("All partial evaluator tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/inline.h"
+
+static ASTNode* parse_string(const char* source) {
+    Lexer* lexer = init_lexer((char*)source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+// A body smaller than the call it replaces is always copied, and its
+// definition goes away
+void test_small_function() {
+    char* output = compile_string("def square(x) { return x * x; }\n"
+                                  "y = 3;\n"
+                                  "print(square(y) + square(2));\n");
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "let y = 3;\n"
+                          "console.log(((y * y) + (2 * 2)));\n") == 0);
+    free(output);
+}
+
+// The recursive call runs before the inlined print, as it did as a call
+void test_evaluation_order() {
+    char* output = compile_string("def fact(n) { x = 1; if (n > 1) { x = n * fact(n - 1); } return x; }\n"
+                                  "def show(v) { print(v); return v + 1; }\n"
+                                  "print(fact(3) + show(4 * 2));\n");
+    assert(strstr(output, "function fact(n) {\n"));
+    assert(strstr(output, "function show") == NULL);
+    assert(strstr(output, "let fact$0 = fact(3);\n"
+                          "let v$1 = (4 * 2);\n"
+                          "console.log(v$1);\n"
+                          "console.log((fact$0 + (v$1 + 1)));\n"));
+    free(output);
+}
+
+// Callees are inlined into their callers first, and locals of every copy
+// get names of their own
+void test_nested_calls() {
+    char* output = compile_string("def twice(a) { t = a + a; return t; }\n"
+                                  "def quad(b) { return twice(twice(b)); }\n"
+                                  "print(quad(1));\n"
+                                  "print(quad(2));\n");
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "let t$2 = (1 + 1);\n"
+                          "let t$3 = (t$2 + t$2);\n"
+                          "console.log(t$3);\n"
+                          "let t$4 = (2 + 2);\n"
+                          "let t$5 = (t$4 + t$4);\n"
+                          "console.log(t$5);\n") == 0);
+    free(output);
+}
+
+// A call in a while condition runs on every iteration, so it stays a call
+// and keeps the definition alive
+void test_while_condition() {
+    char* output = compile_string("def lim(n) { return n * 2; }\n"
+                                  "i = 0;\n"
+                                  "while (i < lim(3)) { i = i + 1; }\n"
+                                  "print(lim(i));\n");
+    assert(strstr(output, "function lim(n) {\n  return (n * 2);\n}\n"));
+    assert(strstr(output, "while ((i < lim(3))) {\n"));
+    assert(strstr(output, "console.log((i * 2));\n"));
+    free(output);
+}
+
+static InlineDecision decision_of(const CallGraph* graph, const char* name) {
+    InlineDecision decision = INLINE_YES;
+    for (size_t i = 0; i < graph->function_count; i++) {
+        if (strcmp(graph->functions[i].name, name) == 0) decision = graph->functions[i].decision;
+    }
+    return decision;
+}
+
+void test_decisions() {
+    ASTNode* ast = parse_string(
+        "def rec(n) { x = 0; if (n > 0) { x = rec(n - 1); } return x; }\n"
+        "def outer(n) { return n + g; }\n"
+        "def early(n) { if (n > 0) { return 1; } return 2; }\n"
+        "def unused(n) { return n; }\n"
+        "def dup(n) { return n; }\n"
+        "def dup(n) { return n + 1; }\n"
+        "def mid(n) { a = n * 2 + 1; b = a * a - n; c = b / 3 + a; return a + b + c; }\n"
+        "def hot(n) { a = n * 2 + 1; b = a * a - n; c = b / 3 + a; return a + b + c; }\n"
+        "g = 1;\n"
+        "print(rec(2) + outer(1) + early(1) + dup(1));\n"
+        "print(mid(1)); print(mid(2)); print(mid(3));\n"
+        "i = 0;\n"
+        "while (i < 3) { print(hot(i)); print(hot(i + 1)); i = i + 1; }\n");
+    CallGraph graph;
+    inline_functions(ast, NULL, &graph);
+
+    assert(graph.function_count == 8);
+    assert(decision_of(&graph, "rec") == INLINE_RECURSIVE);
+    assert(decision_of(&graph, "outer") == INLINE_OUTER_VARIABLES);
+    assert(decision_of(&graph, "early") == INLINE_EARLY_RETURN);
+    assert(decision_of(&graph, "unused") == INLINE_NOT_CALLED);
+    assert(graph.functions[4].decision == INLINE_REDEFINED);
+    assert(graph.functions[5].decision == INLINE_YES && graph.functions[5].removed);
+    // The same body pays for itself only where a loop runs the calls
+    assert(decision_of(&graph, "mid") == INLINE_NOT_WORTH_IT);
+    assert(decision_of(&graph, "hot") == INLINE_YES);
+    assert(graph.functions[7].call_sites == 2 && graph.functions[7].weight == 16);
+    assert(graph.inlined_calls == 3);
+
+    char* dot = call_graph_to_dot(&graph, NULL);
+    assert(strncmp(dot, "digraph calls {\n", 16) == 0);
+    assert(strstr(dot, "    f0 [label=\"rec\\n15 nodes, 2 call sites\\nrecursive\"];\n"));
+    assert(strstr(dot, "    f0 -> f0;\n"));
+    assert(strstr(dot, "    program -> f6 [label=\"3\"];\n"));
+    assert(strstr(dot, "style=dashed"));
+    free(dot);
+
+    free_call_graph(&graph);
+    free_ast(ast);
+}
+
+void test_syntax_errors() {
+    const char* sources[][2] = {
+        { "return 1;", "return outside of a function" },
+        { "if (1 > 0) { def f() { return 1; } }", "only be defined at the top level" },
+        { "def f(a b) { return a; }", "Expected token" },
+        { "def f(a, a) { return a; } print(f(1, 2));", "Duplicate parameter a in function f" },
+        { "print(g(1));", "Call to undefined function g" },
+        { "def f(a) { return a; } x = f(1); if (x > 0) { print(f(1, 2)); }",
+          "Function f takes 1 arguments, called with 2" },
+        { "print(f()); def f(a) { return a; }", "Function f takes 1 arguments, called with 0" },
+        { "def f(a) { return h(a); } print(f(1));", "Call to undefined function h" },
+    };
+    Diagnostics diagnostics;
+    init_diagnostics(&diagnostics);
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        reset_diagnostics(&diagnostics);
+        char* output = compile_source(sources[i][0], strlen(sources[i][0]), &diagnostics);
+        assert(output == NULL && diagnostics.error_count == 1);
+        assert(strstr(diagnostics.text, sources[i][1]));
+    }
+    free_diagnostics(&diagnostics);
+}
+
+// Functions are hoisted, and a later definition replaces an earlier one
+void test_call_checks() {
+    char* output = compile_string("print(f(1, 2)); def f(a) { return a; } def f(a, b) { return b; }\n");
+    assert(strstr(output, "console.log("));
+    free(output);
+}
+
+// The call graph comes with the JavaScript from the same parse
+void test_analysis_output() {
+    const char* source = "def one() { return 1; } print(one());";
+    Analysis analysis;
+
+    int status = analyze_source(source, strlen(source), NULL,
+                                ANALYZE_JAVASCRIPT | ANALYZE_CALL_GRAPH, &analysis, NULL, NULL);
+    assert(status == 0);
+    assert(strstr(analysis.call_graph, "program -> f0;\n"));
+    assert(analysis.call_graph_length == strlen(analysis.call_graph));
+    assert(strstr(analysis.javascript, "console.log(1);\n"));
+    free_analysis(&analysis);
+}
+
+int main() {
+    test_small_function();
+    test_evaluation_order();
+    test_nested_calls();
+    test_while_condition();
+    test_decisions();
+    test_syntax_errors();
+    test_call_checks();
+    test_analysis_output();
+    printf("All inliner tests passed!\n");
+    return 0;
+}
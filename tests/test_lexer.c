@@ -156,11 +156,60 @@ void test_lexer() {
     free(token);
     
     free_lexer(lexer);
-    
-    printf("All lexer tests passed!\n");
+}
+
+// Every token records the exact span of source it came from
+void test_token_spans() {
+    char* input = "  total_1 >= 42; // note\n}";
+    size_t expected[][2] = { {2, 7}, {10, 2}, {13, 2}, {15, 1}, {25, 1}, {26, 0} };
+    Lexer* lexer = init_lexer(input);
+
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        Token* token = get_next_token(lexer);
+        assert(token->start == expected[i][0]);
+        assert(token->length == expected[i][1]);
+        if (token->value) {
+            assert(strncmp(input + token->start, token->value, token->length) == 0);
+        }
+        free(token->value);
+        free(token);
+    }
+
+    free_lexer(lexer);
+}
+
+// Keywords are only recognized as whole identifiers
+void test_while_keyword() {
+    Lexer* lexer = init_lexer("while whiles");
+    Token* token = get_next_token(lexer); verify_token(token, TOKEN_WHILE, "while");
+    free(token->value); free(token);
+
+    token = get_next_token(lexer); verify_token(token, TOKEN_ID, "whiles");
+    free(token->value); free(token);
+    free_lexer(lexer);
+}
+
+void test_function_tokens() {
+    Lexer* lexer = init_lexer("def f(a, b) { return a; }");
+    TokenType expected[] = {
+        TOKEN_DEF, TOKEN_ID, TOKEN_LPAREN, TOKEN_ID, TOKEN_COMMA, TOKEN_ID, TOKEN_RPAREN,
+        TOKEN_LBRACE, TOKEN_RETURN, TOKEN_ID, TOKEN_SEMICOLON, TOKEN_RBRACE, TOKEN_EOF
+    };
+
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        Token* token = get_next_token(lexer);
+        assert(token->type == expected[i]);
+        free(token->value); free(token);
+    }
+    assert(strcmp(token_type_to_string(TOKEN_COMMA), "COMMA") == 0);
+    free_lexer(lexer);
 }
 
 int main() {
     test_lexer();
+    test_token_spans();
+    test_while_keyword();
+    test_function_tokens();
+    printf("All lexer tests passed!\n");
     return 0;
 } 
\ No newline at end of file
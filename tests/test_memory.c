@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/tiny.h"
+
+#define COMPILATIONS 10000
+
+// Programs that compile, and programs that stop at each kind of syntax
+// error the parser reports, part way into every construct that owns memory
+static const char* sources[] = {
+    "def scale(a, b) { t = a * b; return t + 1; }\n"
+    "s = 0;\n"
+    "i = 0;\n"
+    "while (i < 10) {\n"
+    "  if (i >= 5) { s = s + scale(i, 2); } else { s = s - i * 4; }\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "print(s);\n",
+    "x = (1 + 2) * 3; y = x + x; print(y != 9); print(x / 2 == y - 1);\n",
+    "def f() { return 1; }\nf();\nprint(f() + f());\n",
+    "x = (1 + ;",
+    "y = 2; x = y * (y - 1",
+    "def f(a, { return a; }",
+    "def f(a, b) { return a + b; \n",
+    "def f(a) { def g(b) { return b; } }",
+    "if (x > 1) { print(x); } else { y = 2;",
+    "while (1 < 2) { print(g(1, 2; }",
+    "x y;",
+    "print(1)",
+    "return 1;",
+    "x = 1 @ 2;",
+    "def f(x, y, x) { return x; }",
+    "def f(a) { return a + g(a); }\nprint(f(1));\n",
+    "def f(a) { return a; }\nprint(f(1, 2 * 3));\n",
+    "",
+};
+
+#define SOURCE_COUNT (sizeof(sources) / sizeof(sources[0]))
+
+// Counts the blocks a TinyContext holds through its host allocator
+static long live_blocks = 0;
+
+static void* counted_alloc(void* user, size_t size) {
+    (void)user;
+    live_blocks++;
+    return malloc(size);
+}
+
+static void* counted_realloc(void* user, void* memory, size_t size) {
+    (void)user;
+    if (!memory) live_blocks++;
+    return realloc(memory, size);
+}
+
+static void counted_free(void* user, void* memory) {
+    (void)user;
+    if (memory) live_blocks--;
+    free(memory);
+}
+
+static unsigned output_set(size_t round) {
+    static const unsigned sets[] = {
+        ANALYZE_JAVASCRIPT,
+        ANALYZE_TOKENS | ANALYZE_TOKENS_JSON | ANALYZE_AST_JSON | ANALYZE_AST_BINARY,
+        ANALYZE_JAVASCRIPT | ANALYZE_CALL_GRAPH,
+        ANALYZE_JAVASCRIPT | ANALYZE_SHARE_EXPRESSIONS | ANALYZE_AST_COMPACT_JSON,
+        ANALYZE_JAVASCRIPT | ANALYZE_INSTRUMENT,
+    };
+    unsigned outputs = sets[round % (sizeof(sets) / sizeof(sets[0]))];
+    if (outputs & ANALYZE_INSTRUMENT) return outputs;
+    return outputs | analyze_pipeline_flags(optimization_level_pipeline((int)(round % 4)));
+}
+
+// Every byte a compilation takes comes back once its outputs are freed,
+// whether it finished or stopped at a syntax error
+void test_heap_returns_to_baseline() {
+    Diagnostics diagnostics;
+    CountingAllocator counting;
+    init_diagnostics(&diagnostics);
+    init_counting_allocator(&counting, NULL, 0, &diagnostics);
+    Allocator allocator = counting_allocator(&counting);
+    size_t failures = 0;
+
+    for (size_t i = 0; i < COMPILATIONS; i++) {
+        Analysis analysis;
+        const char* source = sources[i % SOURCE_COUNT];
+        unsigned outputs = output_set(i / SOURCE_COUNT);
+        if (analyze_source(source, strlen(source), &diagnostics, outputs, &analysis, NULL,
+                           &allocator) != 0) {
+            failures++;
+        }
+        free_analysis(&analysis);
+        reset_diagnostics(&diagnostics);
+
+        assert(!counting.failed);
+        assert(counting.live_bytes == 0);
+        assert(counting.blocks == NULL);
+    }
+    assert(failures > 0 && failures < COMPILATIONS);
+    free_diagnostics(&diagnostics);
+}
+
+// The same sources through the default libc allocator, which nothing
+// counts; under the sanitizers (make asan) a leak here fails the run
+void test_compile_source_frees_everything() {
+    Diagnostics diagnostics;
+    init_diagnostics(&diagnostics);
+    for (size_t i = 0; i < COMPILATIONS; i++) {
+        const char* source = sources[i % SOURCE_COUNT];
+        free(compile_source(source, strlen(source), &diagnostics));
+        reset_diagnostics(&diagnostics);
+    }
+    free_diagnostics(&diagnostics);
+}
+
+// A long-lived context, as in the playground, holds only its latest result
+void test_context_keeps_steady_heap() {
+    TinyAllocator host = { counted_alloc, counted_realloc, counted_free, NULL };
+    TinyOptions options = { 0, &host, 0 };
+    TinyContext* context = tiny_create_context(&options);
+    long baseline = -1;
+
+    for (size_t i = 0; i < COMPILATIONS; i++) {
+        const char* source = sources[i % SOURCE_COUNT];
+        tiny_compile(context, source, strlen(source), NULL, NULL);
+        if (i % SOURCE_COUNT == 0) {
+            if (baseline < 0) baseline = live_blocks;
+            assert(live_blocks == baseline);
+        }
+    }
+    tiny_destroy_context(context);
+    assert(live_blocks == 0);
+}
+
+int main() {
+    test_heap_returns_to_baseline();
+    test_compile_source_frees_everything();
+    test_context_keeps_steady_heap();
+    printf("All memory tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/optimize.h"
+#include "../src/arena.h"
+
+// Output of a program without loops does not depend on the optimizer, and
+// only the first assignment in scope declares
+void test_declarations() {
+    char* output = compile_string("x = 1;\n"
+                                  "if (x > 0) {\n"
+                                  "  y = 2;\n"
+                                  "  x = y;\n"
+                                  "}\n"
+                                  "y = 3;\n"
+                                  "x = x + y;\n");
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "let x = 1;\n"
+                          "if ((x > 0)) {\n"
+                          "  let y = 2;\n"
+                          "  x = y;\n"
+                          "}\n"
+                          "let y = 3;\n"
+                          "x = (x + y);\n") == 0);
+    free(output);
+}
+
+void test_invariant_code_motion() {
+    char* output = compile_string("a = 2; b = 3; s = 0; n = 0;\n"
+                                  "while (n < a * b) {\n"
+                                  "  s = s + a * b + (n - b / a);\n"
+                                  "  n = n + 2;\n"
+                                  "}\n"
+                                  "print(s);\n");
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "let a = 2;\n"
+                          "let b = 3;\n"
+                          "let s = 0;\n"
+                          "let n = 0;\n"
+                          "let $inv0 = (a * b);\n"
+                          "let $inv1 = (b / a);\n"
+                          "while ((n < $inv0)) {\n"
+                          "  s = ((s + $inv0) + (n - $inv1));\n"
+                          "  n = (n + 2);\n"
+                          "}\n"
+                          "console.log(s);\n") == 0);
+    free(output);
+}
+
+void test_nothing_to_hoist() {
+    // `s` changes in the loop and `c` is only declared after it, so
+    // neither expression can move in front of the loop
+    const char* source = "s = 1; i = 0;\n"
+                         "while (i < 3) {\n"
+                         "  s = s * 2;\n"
+                         "  if (i > 1) { print(c * 2); }\n"
+                         "  i = i + s;\n"
+                         "}\n"
+                         "c = 4;\n";
+    char* output = compile_string(source);
+    assert(strstr(output, "$") == NULL);
+    free(output);
+}
+
+void test_strength_reduction() {
+    char* output = compile_string("i = 10;\n"
+                                  "while (i > 0) {\n"
+                                  "  print(i * 3 + 4 * i);\n"
+                                  "  i = i - 2;\n"
+                                  "}\n");
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "let i = 10;\n"
+                          "let $iv0 = (i * 3);\n"
+                          "let $iv1 = (i * 4);\n"
+                          "while ((i > 0)) {\n"
+                          "  console.log(($iv0 + $iv1));\n"
+                          "  i = (i - 2);\n"
+                          "  $iv0 = ($iv0 - 6);\n"
+                          "  $iv1 = ($iv1 - 8);\n"
+                          "}\n") == 0);
+    free(output);
+
+    // A start that is not a number, or a second update, keeps the products
+    output = compile_string("x = 5; i = x / 2;\n"
+                            "while (i < 9) { print(i * 3); i = i + 1; }\n"
+                            "j = 0;\n"
+                            "while (j < 9) { print(j * 3); j = j + 1; if (j > 4) { j = j + 1; } }\n");
+    assert(strstr(output, "$iv") == NULL);
+    free(output);
+}
+
+void test_nested_loops() {
+    const char* source = "a = 3; j = 0;\n"
+                         "while (j < 2) {\n"
+                         "  k = 0;\n"
+                         "  while (k < 2) {\n"
+                         "    print(a * a + j * 5 + k);\n"
+                         "    k = k + 1;\n"
+                         "  }\n"
+                         "  j = j + 1;\n"
+                         "}\n";
+    Lexer* lexer = init_lexer((char*)source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+    LoopOptimizations result;
+
+    optimize_loops(ast, NULL, &result);
+
+    // a * a + j * 5 is hoisted out of the inner loop; the outer loop then
+    // hoists a * a from it and strength-reduces j * 5
+    assert(ast->data.program.statement_count == 5);
+    ASTNode* reduced = ast->data.program.statements[2];
+    assert(reduced->type == AST_ASSIGN && strcmp(reduced->data.assign.name, "$iv0") == 0);
+    ASTNode* hoisted = ast->data.program.statements[3];
+    assert(hoisted->type == AST_ASSIGN && strcmp(hoisted->data.assign.name, "$inv1") == 0);
+    assert(hoisted->data.assign.value->data.binary_op.op == '*');
+    assert(result.hoisted == 2 && result.reduced == 1);
+
+    free_ast(ast);
+    free_parser(parser);
+    free_lexer(lexer);
+}
+
+// The tree outputs show the program as written
+void test_analysis_outputs() {
+    const char* source = "a = 1; i = 0; while (i < 4) { print(a * 2); i = i + 1; }";
+    Arena arena;
+    init_arena(&arena, 64 * 1024);
+    Allocator allocator = arena_allocator(&arena);
+    Analysis analysis;
+
+    int status = analyze_source(source, strlen(source), NULL,
+                                ANALYZE_AST_COMPACT_JSON | ANALYZE_JAVASCRIPT, &analysis, NULL,
+                                &allocator);
+    assert(status == 0);
+    assert(strstr(analysis.ast_json, "$inv") == NULL);
+    assert(strstr(analysis.javascript, "let $inv0 = (a * 2);\n"));
+
+    free_arena(&arena);
+}
+
+int main() {
+    test_declarations();
+    test_invariant_code_motion();
+    test_nothing_to_hoist();
+    test_strength_reduction();
+    test_nested_loops();
+    test_analysis_outputs();
+    printf("All optimizer tests passed!\n");
+    return 0;
+}
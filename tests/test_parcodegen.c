@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parcodegen.h"
+#include "../src/arena.h"
+
+#define STATEMENTS 6000
+
+static char* build_source() {
+    StringBuilder* sb = init_string_builder();
+    append_string(sb, "def f(a) { z = a * 2; return z; }\n");
+    for (int i = 0; i < STATEMENTS; i++) {
+        // Each name is first assigned in a different chunk, after blocks
+        // that assign it in a scope of their own
+        int name = (i * 7) % 97;
+        switch (i % 5) {
+            case 0:
+                append_string(sb, "if (i > 0) { x");
+                append_int(sb, name);
+                append_string(sb, " = 1; y = 2; }\n");
+                break;
+            case 1:
+                append_string(sb, "x");
+                append_int(sb, name);
+                append_string(sb, " = f(");
+                append_int(sb, i);
+                append_string(sb, ") + 1;\n");
+                break;
+            case 2:
+                append_string(sb, "i = 0; while (i < 3) { s = i * 4; i = i + 1; }\n");
+                break;
+            case 3:
+                append_string(sb, "print(x");
+                append_int(sb, name);
+                append_string(sb, " + z);\n");
+                break;
+            default:
+                append_string(sb, "y = ");
+                append_int(sb, i);
+                append_string(sb, ";\n");
+        }
+    }
+    return finalize_string_builder(sb);
+}
+
+static ASTNode* parse_string(const char* source) {
+    Lexer* lexer = init_lexer((char*)source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+static char* generate_on_pool(ASTNode* program, Diagnostics* diagnostics, CompileStats* stats,
+                              const Allocator* allocator, void* pool) {
+    return generate_code_parallel(program, pool, diagnostics, stats, allocator);
+}
+
+void test_identical(const char* source) {
+    ASTNode* ast = parse_string(source);
+    char* serial = generate_code(ast);
+    assert(strstr(serial, "let x7 = (f(1) + 1);"));
+
+    for (int threads = 1; threads <= 8; threads++) {
+        ThreadPool* pool = init_threadpool(threads);
+        char* parallel = generate_code_parallel(ast, pool, NULL, NULL, NULL);
+        assert(strcmp(parallel, serial) == 0);
+        free(parallel);
+        free_threadpool(pool);
+    }
+
+    free(serial);
+    free_ast(ast);
+}
+
+// The same through analyze_source, after the passes rewrote the tree
+void test_optimized(const char* source) {
+    ThreadPool* pool = init_threadpool(4);
+    CodegenHook codegen = { generate_on_pool, pool };
+    AnalyzeHooks hooks = { &codegen, NULL };
+
+    for (int level = 0; level <= 3; level++) {
+        PassPipeline pipeline = optimization_level_pipeline(level);
+        unsigned outputs = ANALYZE_JAVASCRIPT | analyze_pipeline_flags(pipeline);
+        Analysis serial, parallel;
+        assert(analyze_source(source, strlen(source), NULL, outputs, &serial, NULL, NULL) == 0);
+        assert(analyze_source_with_hooks(source, strlen(source), NULL, outputs, &parallel, NULL,
+                                         NULL, &hooks) == 0);
+        assert(serial.javascript_length == parallel.javascript_length);
+        assert(strcmp(serial.javascript, parallel.javascript) == 0);
+        free_analysis(&serial);
+        free_analysis(&parallel);
+    }
+
+    free_threadpool(pool);
+}
+
+// Chunks record spans where their code landed in the output
+void test_trace(const char* source) {
+    ThreadPool* pool = init_threadpool(4);
+    CompileStats stats;
+    init_compile_stats(&stats, 1);
+    ASTNode* ast = parse_string(source);
+
+    char* code = generate_code_parallel(ast, pool, NULL, &stats, NULL);
+    assert(strstr(stats.trace->buffer, "\"name\":\"chunk\""));
+    assert(strstr(stats.trace->buffer, "\"name\":\"ASSIGN\"") == NULL);
+
+    free(code);
+    free_ast(ast);
+    free_compile_stats(&stats);
+    free_threadpool(pool);
+}
+
+// A failure on a worker is reported on the calling thread
+void test_error(const char* source) {
+    ThreadPool* pool = init_threadpool(4);
+    Diagnostics diagnostics;
+    jmp_buf recover;
+    ASTNode* ast = parse_string(source);
+    ASTNode** statements = ast->data.program.statements;
+    ASTNode* value = NULL;
+
+    // An `x = f(i) + 1` in the last chunk
+    for (size_t i = ast->data.program.statement_count; !value; i--) {
+        ASTNode* statement = statements[i - 1];
+        if (statement->type == AST_ASSIGN && statement->data.assign.value->type == AST_BINARY_OP) {
+            value = statement->data.assign.value;
+        }
+    }
+
+    init_diagnostics(&diagnostics);
+    diagnostics.recover = &recover;
+    value->data.binary_op.op = '%';
+    if (setjmp(recover) == 0) {
+        generate_code_parallel(ast, pool, &diagnostics, NULL, NULL);
+        assert(0);
+    }
+    assert(strcmp(diagnostics.text, "Error: Unknown binary operator: %\n") == 0);
+    value->data.binary_op.op = '+';
+
+    free_diagnostics(&diagnostics);
+    free_ast(ast);
+    free_threadpool(pool);
+}
+
+// The workers allocate from the caller's allocator, even one that is not
+// thread-safe, and stay within its limit
+void test_allocator(const char* source) {
+    ThreadPool* pool = init_threadpool(4);
+    ASTNode* ast = parse_string(source);
+    char* serial = generate_code(ast);
+
+    Arena arena;
+    init_arena(&arena, 4096);
+    Allocator arena_alloc = arena_allocator(&arena);
+    char* parallel = generate_code_parallel(ast, pool, NULL, NULL, &arena_alloc);
+    assert(strcmp(parallel, serial) == 0);
+    free_arena(&arena);
+
+    Diagnostics diagnostics;
+    jmp_buf recover;
+    CountingAllocator counting;
+    init_diagnostics(&diagnostics);
+    init_counting_allocator(&counting, NULL, 0, &diagnostics);
+    Allocator counted = counting_allocator(&counting);
+    parallel = generate_code_parallel(ast, pool, &diagnostics, NULL, &counted);
+    assert(strcmp(parallel, serial) == 0);
+    assert(counting.alloc_count > 2 * 4 && counting.live_bytes == strlen(serial) + 1);
+    deallocate(&counted, parallel);
+    assert(counting.live_bytes == 0 && counting.blocks == NULL);
+
+    init_counting_allocator(&counting, NULL, strlen(serial) / 2, &diagnostics);
+    counted = counting_allocator(&counting);
+    diagnostics.recover = &recover;
+    if (setjmp(recover) == 0) {
+        generate_code_parallel(ast, pool, &diagnostics, NULL, &counted);
+        assert(0);
+    }
+    assert(counting.failed && diagnostics.recover == &recover);
+    assert(strncmp(diagnostics.text, "Error: Out of memory", 20) == 0);
+    release_counted_blocks(&counting);
+
+    free_diagnostics(&diagnostics);
+    free(serial);
+    free_ast(ast);
+    free_threadpool(pool);
+}
+
+// Too small to be worth splitting
+void test_small_program() {
+    ThreadPool* pool = init_threadpool(4);
+    ASTNode* ast = parse_string("x = 1; print(x);");
+    char* serial = generate_code(ast);
+    char* parallel = generate_code_parallel(ast, pool, NULL, NULL, NULL);
+    assert(strcmp(serial, parallel) == 0);
+    free(serial);
+    free(parallel);
+    free_ast(ast);
+    free_threadpool(pool);
+}
+
+int main() {
+    char* source = build_source();
+    test_identical(source);
+    test_optimized(source);
+    test_trace(source);
+    test_error(source);
+    test_allocator(source);
+    test_small_program();
+    free(source);
+    printf("All parallel codegen tests passed!\n");
+    return 0;
+}
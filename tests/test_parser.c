@@ -4,6 +4,7 @@
 #include <assert.h>
 #include "../src/parser.h"
 #include "../src/lexer.h"
+#include "../src/astbin.h"
 
 // Helper function to check if the AST structure is correct
 void test_ast_structure(ASTNode* node) {
@@ -44,8 +45,134 @@ void test_ast_structure(ASTNode* node) {
     assert(if_body->type == AST_PROGRAM);
     assert(if_body->data.program.statement_count == 1);
     assert(if_body->data.program.statements[0]->type == AST_PRINT);
-    
-    printf("All parser tests passed!\n");
+}
+
+void test_json(ASTNode* ast) {
+    char* pretty = ast_to_json(ast);
+    char* compact = ast_to_json_styled(ast, JSON_COMPACT);
+
+    assert(strncmp(pretty, "{\n  \"type\": \"PROGRAM\"", 21) == 0);
+    assert(strncmp(compact, "{\"type\":\"PROGRAM\"", 17) == 0);
+    assert(strchr(compact, '\n') == NULL && strchr(compact, ' ') == NULL);
+    assert(strlen(compact) < strlen(pretty));
+
+    // Dropping whitespace outside strings must turn one into the other
+    size_t j = 0;
+    for (size_t i = 0; pretty[i]; i++) {
+        if (pretty[i] == ' ' || pretty[i] == '\n') continue;
+        assert(pretty[i] == compact[j++]);
+    }
+    assert(compact[j] == '\0');
+
+    free(pretty);
+    free(compact);
+}
+
+void test_binary(ASTNode* ast) {
+    size_t length;
+    char* buffer = ast_to_binary(ast, &length);
+    int32_t* header = (int32_t*)buffer;
+
+    assert((uint32_t)header[0] == AST_BINARY_MAGIC);
+    assert(header[1] == AST_BINARY_VERSION);
+    assert((size_t)header[2] == length && length % 4 == 0);
+
+    // PROGRAM, ASSIGN x, NUMBER, ASSIGN y, BINARY_OP, VARIABLE, NUMBER,
+    // IF, BINARY_OP, VARIABLE, NUMBER, PROGRAM, PRINT, VARIABLE
+    assert(header[3] == 14);
+    assert(header[5] == 4);
+
+    int32_t* nodes = header + AST_BINARY_HEADER_WORDS;
+    int32_t* lists = (int32_t*)(buffer + header[4]);
+    const char* strings = buffer + header[6];
+
+    assert(nodes[0] == AST_PROGRAM && nodes[1] == 3 && nodes[2] == 0);
+    assert(lists[0] == 1 && lists[1] == 3 && lists[2] == 7);
+
+    int32_t* assign = nodes + 3 * AST_BINARY_NODE_WORDS;
+    assert(assign[0] == AST_ASSIGN);
+    assert(assign[2] == 1 && strings[assign[1]] == 'y');
+
+    int32_t* sum = nodes + assign[3] * AST_BINARY_NODE_WORDS;
+    assert(sum[0] == AST_BINARY_OP && sum[1] == '+');
+    assert(nodes[sum[3] * AST_BINARY_NODE_WORDS + 1] == 3);
+
+    int32_t* if_node = nodes + 7 * AST_BINARY_NODE_WORDS;
+    assert(if_node[0] == AST_IF && if_node[3] == AST_BINARY_NONE);
+    int32_t* body = nodes + if_node[2] * AST_BINARY_NODE_WORDS;
+    assert(body[0] == AST_PROGRAM && body[1] == 1 && lists[body[2]] == 12);
+
+    free(buffer);
+}
+
+void test_while() {
+    Lexer* lexer = init_lexer("while (i < 3) { i = i + 1; }");
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+
+    ASTNode* loop = ast->data.program.statements[0];
+    assert(loop->type == AST_WHILE);
+    assert(loop->data.while_loop.condition->data.binary_op.op == '<');
+    assert(loop->data.while_loop.body->data.program.statement_count == 1);
+    assert(loop->data.while_loop.body->data.program.statements[0]->type == AST_ASSIGN);
+    assert(count_ast_nodes(ast) == 10);
+
+    char* json = ast_to_json_styled(ast, JSON_COMPACT);
+    assert(strstr(json, "\"type\":\"WHILE\"") && strstr(json, "\"body\":{\"type\":\"PROGRAM\""));
+    free(json);
+
+    // PROGRAM, WHILE, BINARY_OP, VARIABLE, NUMBER, PROGRAM, ...
+    size_t length;
+    char* buffer = ast_to_binary(ast, &length);
+    int32_t* nodes = (int32_t*)buffer + AST_BINARY_HEADER_WORDS;
+    int32_t* record = nodes + AST_BINARY_NODE_WORDS;
+    assert(record[0] == AST_WHILE && record[1] == 2 && record[2] == 5);
+    free(buffer);
+
+    free_ast(ast);
+    free_parser(parser);
+    free_lexer(lexer);
+}
+
+void test_functions() {
+    Lexer* lexer = init_lexer("def add(a, b) { return a + b; }\nprint(add(1, 2));");
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+
+    ASTNode* function = ast->data.program.statements[0];
+    assert(function->type == AST_FUNCTION);
+    assert(strcmp(function->data.function.name, "add") == 0);
+    assert(function->data.function.param_count == 2);
+    assert(strcmp(function->data.function.params[1], "b") == 0);
+    assert(function->data.function.body->data.program.statements[0]->type == AST_RETURN);
+
+    ASTNode* call = ast->data.program.statements[1]->data.print.expression;
+    assert(call->type == AST_CALL && strcmp(call->data.call.name, "add") == 0);
+    assert(call->data.call.arg_count == 2 && call->data.call.args[1]->data.number.value == 2);
+    assert(count_ast_nodes(ast) == 11);
+
+    char* json = ast_to_json_styled(ast, JSON_COMPACT);
+    assert(strstr(json, "\"parameters\":[\"a\",\"b\"]"));
+    assert(strstr(json, "\"type\":\"CALL\"") && strstr(json, "\"arguments\":[{\"type\":\"NUMBER\""));
+    free(json);
+
+    // PROGRAM, FUNCTION, then its name and parameters as VARIABLE nodes
+    // before the body
+    size_t length;
+    char* buffer = ast_to_binary(ast, &length);
+    int32_t* header = (int32_t*)buffer;
+    int32_t* nodes = header + AST_BINARY_HEADER_WORDS;
+    int32_t* lists = (int32_t*)(buffer + header[4]);
+    int32_t* record = nodes + AST_BINARY_NODE_WORDS;
+    assert(record[0] == AST_FUNCTION && record[1] == 2 && record[2] == 2 && record[3] == 5);
+    assert(lists[2] == 2 && lists[3] == 3 && lists[4] == 4);
+    assert(nodes[2 * AST_BINARY_NODE_WORDS] == AST_VARIABLE);
+    assert(nodes[5 * AST_BINARY_NODE_WORDS] == AST_PROGRAM);
+    free(buffer);
+
+    free_ast(ast);
+    free_parser(parser);
+    free_lexer(lexer);
 }
 
 int main() {
@@ -64,12 +191,17 @@ int main() {
     ASTNode* ast = parse(parser);
     
     // Test the AST structure
+    test_while();
+    test_functions();
     test_ast_structure(ast);
+    test_json(ast);
+    test_binary(ast);
     
     // Clean up
     free_ast(ast);
     free_parser(parser);
     free_lexer(lexer);
     
+    printf("All parser tests passed!\n");
     return 0;
 } 
\ No newline at end of file
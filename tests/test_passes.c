@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/passes.h"
+
+static ASTNode* parse_string(const char* source) {
+    Lexer* lexer = init_lexer((char*)source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+static char* compile_with_passes(const char* source, const char* list) {
+    PassPipeline pipeline;
+    Analysis analysis;
+    assert(parse_pass_list(list, &pipeline) == 0);
+    unsigned outputs = ANALYZE_JAVASCRIPT | analyze_pipeline_flags(pipeline);
+    assert(analyze_source(source, strlen(source), NULL, outputs, &analysis, NULL, NULL) == 0);
+    return analysis.javascript;
+}
+
+void test_levels() {
+    PassPipeline pipeline;
+
+    assert(optimization_level_pipeline(0) == 0);
+    assert(optimization_level_pipeline(1) == PASS_LOOPS);
+    assert(parse_pass_list("inline,loops", &pipeline) == 0);
+    assert(pipeline == optimization_level_pipeline(2));
+    assert(parse_pass_list("evaluate,inline,loops", &pipeline) == 0);
+    assert(pipeline == optimization_level_pipeline(3));
+    assert(parse_pass_list("", &pipeline) == 0 && pipeline == 0);
+
+    // -O2 is the default, so asking for it changes no cache key
+    assert(analyze_pipeline_flags(optimization_level_pipeline(2)) == 0);
+    assert(analyze_pipeline_flags(0) == ANALYZE_PIPELINE);
+    assert(strcmp(pass_name(PASS_INLINE), "inline") == 0);
+    assert(pass_name(0) == NULL);
+}
+
+void test_invalid_lists() {
+    PassPipeline pipeline = 7;
+
+    assert(parse_pass_list("inline,unroll", &pipeline) == -1);
+    assert(parse_pass_list("inline,", &pipeline) == -1);
+    assert(parse_pass_list(",inline", &pipeline) == -1);
+    assert(parse_pass_list("inline,,loops", &pipeline) == -1);
+    assert(parse_pass_list("in", &pipeline) == -1);
+    assert(parse_pass_list("loops,loops,loops,loops,loops,loops", &pipeline) == -1);
+    assert(pipeline == 7);
+    assert(parse_pass_list("loops,loops,loops,loops,loops", &pipeline) == 0);
+}
+
+// Passes run in the order given: inlined first, the product is loop
+// invariant; hoisted first, the call was still in the way
+void test_order() {
+    const char* source = "def k(x, y) { return x * y; }\n"
+                         "n = 3; s = 0; a = 2; b = 5; i = 0;\n"
+                         "while (i < n) { s = s + k(a, b); i = i + 1; }\n"
+                         "print(s);\n";
+
+    char* none = compile_with_passes(source, "");
+    assert(strstr(none, "function k(x, y)") && strstr(none, "s = (s + k(a, b));"));
+    free(none);
+
+    char* inline_first = compile_with_passes(source, "inline,loops");
+    assert(strstr(inline_first, "let $inv0 = (a * b);\n"));
+    assert(strstr(inline_first, "s = (s + $inv0);"));
+    char* standard = compile_string(source);
+    assert(strcmp(inline_first, standard) == 0);
+    free(standard);
+    free(inline_first);
+
+    char* loops_first = compile_with_passes(source, "loops,inline");
+    assert(strstr(loops_first, "$inv") == NULL);
+    assert(strstr(loops_first, "s = (s + (a * b));"));
+    free(loops_first);
+}
+
+void test_stats() {
+    CompileStats stats;
+    init_compile_stats(&stats, 0);
+    ASTNode* ast = parse_string("def twice(n) { return n * 2; } x = 6; print(twice(x) + 1);");
+
+    run_passes(ast, optimization_level_pipeline(3), NULL, NULL, &stats);
+    const PassStats* evaluate = &stats.passes[PASS_EVALUATE];
+    assert(strcmp(evaluate->name, "evaluate") == 0 && evaluate->runs == 1);
+    // Everything folds into one print of a constant
+    assert(evaluate->nodes_before == 14 && evaluate->nodes_after == 3);
+    assert(stats.passes[PASS_INLINE].runs == 1 && stats.passes[PASS_LOOPS].runs == 1);
+    assert(stats.passes[PASS_LOOPS].nodes_after == count_ast_nodes(ast));
+
+    free_ast(ast);
+    free_compile_stats(&stats);
+}
+
+// Without an inline pass the call graph has no functions in it
+void test_call_graph() {
+    const char* source = "def f(a) { return a + 1; } print(f(1));";
+    unsigned outputs = ANALYZE_CALL_GRAPH | analyze_pipeline_flags(optimization_level_pipeline(1));
+    Analysis analysis;
+
+    assert(analyze_source(source, strlen(source), NULL, outputs, &analysis, NULL, NULL) == 0);
+    assert(strcmp(analysis.call_graph, "digraph calls {\n"
+                                       "    program [shape=box, label=\"<program>\"];\n"
+                                       "}\n") == 0);
+    free_analysis(&analysis);
+
+    outputs = ANALYZE_CALL_GRAPH | analyze_pipeline_flags(optimization_level_pipeline(2));
+    assert(analyze_source(source, strlen(source), NULL, outputs, &analysis, NULL, NULL) == 0);
+    assert(strstr(analysis.call_graph, "program -> "));
+    free_analysis(&analysis);
+}
+
+void test_verify() {
+    ASTNode* ast = parse_string("def f() { return 1; }\n"
+                                "x = 1 + 2;\n"
+                                "print(x);\n"
+                                "if (x > 0) { y = 1; }\n");
+    ASTNode** statements = ast->data.program.statements;
+    ASTNode* function = statements[0];
+    ASTNode* assign = statements[1];
+    ASTNode* print = statements[2];
+    ASTNode* if_body = statements[3]->data.if_statement.if_body;
+    assert(verify_ast(ast) == NULL);
+
+    ASTNode* expression = print->data.print.expression;
+    print->data.print.expression = assign->data.assign.value;
+    assert(strcmp(verify_ast(ast), "node reachable twice") == 0);
+    print->data.print.expression = expression;
+
+    assign->data.assign.value->data.binary_op.op = '%';
+    assert(strcmp(verify_ast(ast), "unknown binary operator") == 0);
+    assign->data.assign.value->data.binary_op.op = '+';
+
+    print->type = AST_RETURN;    // the same layout as print
+    assert(strcmp(verify_ast(ast), "return outside a function") == 0);
+    print->type = AST_PRINT;
+
+    statements[2] = expression;
+    assert(strcmp(verify_ast(ast), "expression where a statement belongs") == 0);
+    statements[2] = print;
+
+    ASTNode* nested = if_body->data.program.statements[0];
+    if_body->data.program.statements[0] = function;
+    statements[0] = nested;
+    assert(strcmp(verify_ast(ast), "function defined below the top level") == 0);
+    if_body->data.program.statements[0] = nested;
+    statements[0] = function;
+
+    assert(verify_ast(ast) == NULL);
+    free_ast(ast);
+}
+
+// A pass that leaves a broken tree is reported, and the passes after it
+// do not run
+void test_verified_passes() {
+    ASTNode* ast = parse_string("x = 1;\nprint(x);\n");
+    Diagnostics diagnostics;
+    init_diagnostics(&diagnostics);
+    assert(run_passes_verified(ast, optimization_level_pipeline(1), NULL, NULL, NULL, NULL,
+                               &diagnostics) == 0);
+    assert(diagnostics.error_count == 0);
+
+    ASTNode* print = ast->data.program.statements[1];
+    print->type = AST_RETURN;
+    PassPipeline pipeline;
+    assert(parse_pass_list("loops,inline", &pipeline) == 0);
+    CompileStats stats;
+    init_compile_stats(&stats, 0);
+    assert(run_passes_verified(ast, pipeline, NULL, NULL, &stats, NULL, &diagnostics) == -1);
+    assert(strcmp(diagnostics.text,
+                  "Error: AST invalid after the loops pass: return outside a function\n") == 0);
+    assert(diagnostics.error_count == 1);
+    assert(stats.passes[PASS_LOOPS].runs == 1 && stats.passes[PASS_INLINE].runs == 0);
+
+    print->type = AST_PRINT;
+    free_ast(ast);
+    free_compile_stats(&stats);
+    free_diagnostics(&diagnostics);
+}
+
+// Verifying is a compile option, and a valid program passes it
+void test_verify_option() {
+    const char* source = "def f(a) { return a * 2; } i = 0; while (i < 3) { print(f(i)); i = i + 1; }";
+    Diagnostics diagnostics;
+    Analysis analysis;
+    init_diagnostics(&diagnostics);
+    assert(analyze_source(source, strlen(source), &diagnostics,
+                          ANALYZE_JAVASCRIPT | ANALYZE_VERIFY_PASSES |
+                          analyze_pipeline_flags(optimization_level_pipeline(3)),
+                          &analysis, NULL, NULL) == 0);
+    assert(diagnostics.error_count == 0 && analysis.javascript);
+    free_analysis(&analysis);
+    free_diagnostics(&diagnostics);
+}
+
+int main() {
+    test_levels();
+    test_invalid_lists();
+    test_order();
+    test_stats();
+    test_call_graph();
+    test_verify();
+    test_verified_passes();
+    test_verify_option();
+    printf("All pass manager tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/profile.h"
+
+static const char* loop_source =
+    "def cold(a) { return a * 3; }\n"
+    "def hot(b) { t = b + 1; return t * 2; }\n"
+    "s = 0;\n"
+    "i = 0;\n"
+    "while (i < 100) {\n"
+    "  if (i > 1000) {\n"
+    "    s = s + cold(i);\n"
+    "    j = 0;\n"
+    "    while (j < 3) { s = s + j * 4 + i * 2; j = j + 1; }\n"
+    "  } else { s = s + hot(i); }\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "print(s);\n";
+
+// What running the instrumented loop_source counted
+static const char* loop_counts = "1,0,1,100,100,1,1,1,100,0,0,0,0,0,0,100,100,100,1";
+
+static ASTNode* parse_string(const char* source) {
+    Lexer* lexer = init_lexer((char*)source);
+    Parser* parser = init_parser(lexer);
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+// The profile an instrumented `source` would write with `counts`
+static void make_profile(const char* source, const char* counts, Profile* profile) {
+    char json[1024];
+    uint64_t hash;
+    ASTNode* ast = parse_string(source);
+    profile_sites(ast, &hash);
+    snprintf(json, sizeof(json), "{\"program\": \"%016llx\", \"counts\": [%s]}\n",
+             (unsigned long long)hash, counts);
+    assert(parse_profile(json, strlen(json), profile) == 0);
+    free_ast(ast);
+}
+
+static char* compile_with_profile(const char* source, unsigned flags, const Profile* profile,
+                                  char** call_graph, Diagnostics* diagnostics) {
+    Analysis analysis;
+    AnalyzeHooks hooks = { NULL, profile };
+    unsigned outputs = ANALYZE_JAVASCRIPT | flags | (call_graph ? ANALYZE_CALL_GRAPH : 0);
+    assert(analyze_source_with_hooks(source, strlen(source), diagnostics, outputs, &analysis, NULL,
+                                     NULL, &hooks) == 0);
+    if (call_graph) *call_graph = analysis.call_graph;
+    return analysis.javascript;
+}
+
+void test_instrumented_output() {
+    const char* source = "x = 1;\n"
+                         "if (x > 0) { print(x); } else { }\n";
+    char* output = compile_with_profile(source, ANALYZE_INSTRUMENT, NULL, NULL, NULL);
+    uint64_t hash;
+    char header[64];
+    ASTNode* ast = parse_string(source);
+
+    assert(profile_sites(ast, &hash) == 5);
+    snprintf(header, sizeof(header), "program: \"%016llx\"", (unsigned long long)hash);
+    assert(strstr(output, "const $profile = new Float64Array(5);\n"));
+    assert(strstr(output, header));
+    assert(strstr(output, "\n\n"
+                          "$profile[0]++; let x = 1;\n"
+                          "$profile[1]++; if ((x > 0)) {\n"
+                          "  $profile[2]++;\n"
+                          "  $profile[3]++; console.log(x);\n"
+                          "} else {\n"
+                          "  $profile[4]++;\n"
+                          "}\n"));
+    free(output);
+    free_ast(ast);
+
+    // No pass runs, so the sites are those of the program as written
+    output = compile_with_profile(loop_source, ANALYZE_INSTRUMENT, NULL, NULL, NULL);
+    char* optimized = compile_with_profile(loop_source, ANALYZE_INSTRUMENT |
+                                           analyze_pipeline_flags(optimization_level_pipeline(3)),
+                                           NULL, NULL, NULL);
+    assert(strcmp(output, optimized) == 0);
+    assert(strstr(output, "$profile[18]++; console.log(s);\n"));
+    free(output);
+    free(optimized);
+}
+
+void test_parse_profile() {
+    Profile profile;
+    const char* valid = "{\"program\":\"00000000000000ff\",\"counts\":[0, 3,1e+20 ,7]}";
+    assert(parse_profile(valid, strlen(valid), &profile) == 0);
+    assert(profile.program == 0xff && profile.count == 4);
+    assert(profile.counts[1] == 3 && profile.counts[2] == UINT64_MAX && profile.counts[3] == 7);
+    free_profile(&profile);
+
+    const char* empty = "{ \"counts\" : [ ], \"program\" : \"0123456789abcdef\" }";
+    assert(parse_profile(empty, strlen(empty), &profile) == 0);
+    assert(profile.count == 0 && profile.program == 0x0123456789abcdefULL);
+    free_profile(&profile);
+
+    const char* malformed[] = {
+        "{\"program\":\"ff\",\"counts\":[1]}",
+        "{\"program\":\"00000000000000ff\"}",
+        "{\"program\":\"00000000000000ff\",\"counts\":[1,]}",
+        "{\"program\":\"00000000000000ff\",\"counts\":[-1]}",
+        "{\"program\":\"00000000000000ff\",\"counts\":[1 2]}",
+        "",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        assert(parse_profile(malformed[i], strlen(malformed[i]), &profile) == -1);
+        assert(profile.counts == NULL);
+    }
+}
+
+// Counts land on statements and on the blocks they enter
+void test_apply_profile() {
+    Profile profile;
+    NodeMap counts;
+    ASTNode* ast = parse_string(loop_source);
+    make_profile(loop_source, loop_counts, &profile);
+    assert(apply_profile(&profile, ast, NULL, &counts) == 0);
+
+    ASTNode** statements = ast->data.program.statements;
+    ASTNode* loop = statements[4];
+    ASTNode* branch = loop->data.while_loop.body->data.program.statements[0];
+    assert(profile_count(&counts, statements[1]->data.function.body) == 100);
+    assert(profile_count(&counts, statements[0]->data.function.body) == 0);
+    assert(profile_count(&counts, loop) == 1);
+    assert(profile_count(&counts, loop->data.while_loop.body) == 100);
+    assert(profile_count(&counts, branch->data.if_statement.if_body) == 0);
+    assert(profile_count(&counts, branch->data.if_statement.else_body) == 100);
+    assert(profile_count(&counts, statements[5]) == 1);
+    assert(profile_count(NULL, statements[5]) == -1);
+    free_node_map(&counts);
+    free_profile(&profile);
+
+    // One statement more, and the profile no longer fits
+    ASTNode* edited = parse_string("x = 1;\n");
+    make_profile(loop_source, loop_counts, &profile);
+    assert(apply_profile(&profile, edited, NULL, &counts) == -1);
+    assert(counts.count == 0);
+    free_node_map(&counts);
+    free_profile(&profile);
+    free_ast(edited);
+    free_ast(ast);
+}
+
+// Code that never ran is not optimized: its calls are not inlined and its
+// loops keep their products
+void test_cold_code() {
+    Profile profile;
+    char* graph;
+    make_profile(loop_source, loop_counts, &profile);
+    char* output = compile_with_profile(loop_source, 0, &profile, &graph, NULL);
+    char* plain = compile_with_profile(loop_source, 0, NULL, NULL, NULL);
+
+    assert(strstr(graph, "cold\\n5 nodes, 1 call site\\ncold"));
+    assert(strstr(graph, "hot\\n9 nodes, 1 call site\\ninlined"));
+    assert(strstr(output, "function cold(a) {\n"));
+    assert(strstr(output, "s = (s + cold(i));\n"));
+    assert(strstr(output, "let t$0 = (i + 1);\n"));
+    assert(strstr(output, "s = ((s + (j * 4)) + "));
+
+    assert(strstr(plain, "function cold") == NULL);
+    assert(strstr(plain, "s = ((s + (j * 4)) + ") == NULL);
+    free(output);
+    free(plain);
+    free(graph);
+    free_profile(&profile);
+}
+
+// The functions called most come first; JavaScript hoists them either way
+void test_hot_functions_first() {
+    const char* source = "def once(x) { return x; }\n"
+                         "print(once(1));\n"
+                         "def often(x) { return x + 1; }\n"
+                         "i = 0;\n"
+                         "while (i < 5) { print(often(i)); i = i + 1; }\n";
+    unsigned flags = analyze_pipeline_flags(optimization_level_pipeline(0));
+    Profile profile;
+    make_profile(source, "1,1,1,1,5,1,1,5,5", &profile);
+    char* output = compile_with_profile(source, flags, &profile, NULL, NULL);
+    assert(strcmp(output, "// Generated by TinyCompiler\n\n"
+                          "function often(x) {\n"
+                          "  return (x + 1);\n"
+                          "}\n"
+                          "function once(x) {\n"
+                          "  return x;\n"
+                          "}\n"
+                          "console.log(once(1));\n"
+                          "let i = 0;\n"
+                          "while ((i < 5)) {\n"
+                          "  console.log(often(i));\n"
+                          "  i = (i + 1);\n"
+                          "}\n") == 0);
+    free(output);
+    free_profile(&profile);
+
+    // With two definitions of a name the last one wins, so nothing moves
+    const char* redefined = "def f(x) { return x; }\n"
+                            "print(f(1));\n"
+                            "def f(x) { return x + 1; }\n";
+    make_profile(redefined, "1,0,1,1,1", &profile);
+    output = compile_with_profile(redefined, flags, &profile, NULL, NULL);
+    char* plain = compile_with_profile(redefined, flags, NULL, NULL, NULL);
+    assert(strcmp(output, plain) == 0);
+    free(output);
+    free(plain);
+    free_profile(&profile);
+}
+
+// A stale profile is reported and changes nothing
+void test_stale_profile() {
+    Profile profile;
+    Diagnostics diagnostics;
+    init_diagnostics(&diagnostics);
+    make_profile("x = 1;\n", "1", &profile);
+
+    char* output = compile_with_profile(loop_source, 0, &profile, NULL, &diagnostics);
+    char* plain = compile_with_profile(loop_source, 0, NULL, NULL, NULL);
+    assert(strcmp(output, plain) == 0);
+    assert(strcmp(diagnostics.text,
+                  "Warning: Ignoring a profile recorded for a different program\n") == 0);
+    // A warning, so the compile still succeeds without errors
+    assert(diagnostics.error_count == 0 && diagnostics.warning_count == 1);
+    free(output);
+    free(plain);
+    free_profile(&profile);
+    free_diagnostics(&diagnostics);
+}
+
+int main() {
+    test_instrumented_output();
+    test_parse_profile();
+    test_apply_profile();
+    test_cold_code();
+    test_hot_functions_first();
+    test_stale_profile();
+    printf("All profile tests passed!\n");
+    return 0;
+}
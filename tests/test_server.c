@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include "../src/server.h"
+#include "../src/compiler.h"
+
+#define REQUEST_COUNT 32
+
+typedef struct {
+    Server* server;
+    int fd;
+} StreamArgs;
+
+void* stream_thread(void* arg) {
+    StreamArgs* args = arg;
+    serve_stream(args->server, args->fd, args->fd);
+    return NULL;
+}
+
+void write_u32(unsigned char* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+uint32_t read_u32(const unsigned char* in) {
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+void read_exact(int fd, void* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (char*)buffer + done, size - done);
+        assert(n > 0);
+        done += n;
+    }
+}
+
+void send_request(int fd, uint32_t id, const char* source) {
+    size_t length = strlen(source);
+    unsigned char header[8];
+    write_u32(header, (uint32_t)(length + 4));
+    write_u32(header + 4, id);
+    assert(write(fd, header, 8) == 8);
+    assert(write(fd, source, length) == (ssize_t)length);
+}
+
+// Sends REQUEST_COUNT requests before reading any response and checks
+// every one comes back exactly once
+void run_requests(const ServerOptions* options) {
+    Server* server = init_server(options);
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    StreamArgs args = { server, fds[1] };
+    pthread_t thread;
+    pthread_create(&thread, NULL, stream_thread, &args);
+
+    // Even ids are valid programs, odd ids are syntax errors
+    for (uint32_t id = 0; id < REQUEST_COUNT; id++) {
+        send_request(fds[0], id, id % 2 == 0 ? "x = 1 + 2;\nprint(x);\n" : "x = ;");
+    }
+
+    int seen[REQUEST_COUNT] = {0};
+
+    for (int i = 0; i < REQUEST_COUNT; i++) {
+        unsigned char header[4];
+        read_exact(fds[0], header, 4);
+        uint32_t length = read_u32(header);
+
+        unsigned char* payload = malloc(length);
+        read_exact(fds[0], payload, length);
+
+        uint32_t id = read_u32(payload);
+        uint32_t status = read_u32(payload + 4);
+        uint32_t js_length = read_u32(payload + 16);
+        const char* js = (const char*)payload + 20;
+        uint32_t diagnostics_length = read_u32(payload + 20 + js_length);
+        const char* diagnostics = (const char*)payload + 24 + js_length;
+
+        assert(id < REQUEST_COUNT && !seen[id]);
+        seen[id] = 1;
+        assert(24 + js_length + diagnostics_length == length);
+
+        if (id % 2 == 0) {
+            assert(status == 0);
+            assert(strstr(js, "let x = (1 + 2);") != NULL);
+            assert(diagnostics_length == 0);
+        } else {
+            assert(status == 1);
+            assert(js_length == 0);
+            assert(strncmp(diagnostics, "Syntax error", 12) == 0);
+        }
+
+        free(payload);
+    }
+
+    // A zero-length frame closes the stream
+    unsigned char close_frame[4] = {0};
+    assert(write(fds[0], close_frame, 4) == 4);
+    pthread_join(thread, NULL);
+
+    close(fds[0]);
+    close(fds[1]);
+    free_server(server);
+}
+
+// Returns the JavaScript of one request served by a fresh server
+char* serve_one(const ServerOptions* options, const char* source) {
+    Server* server = init_server(options);
+
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    send_request(fds[0], 7, source);
+    unsigned char close_frame[4] = {0};
+    assert(write(fds[0], close_frame, 4) == 4);
+    serve_stream(server, fds[1], fds[1]);
+
+    unsigned char header[4];
+    read_exact(fds[0], header, 4);
+    unsigned char* payload = malloc(read_u32(header));
+    read_exact(fds[0], payload, read_u32(header));
+    assert(read_u32(payload) == 7 && read_u32(payload + 4) == 0);
+    uint32_t js_length = read_u32(payload + 16);
+    char* js = strndup((const char*)payload + 20, js_length);
+
+    free(payload);
+    close(fds[0]);
+    close(fds[1]);
+    free_server(server);
+    return js;
+}
+
+// Requests are compiled with the server's flags, which are part of the
+// cache key, so servers with different flags sharing a cache directory
+// never answer with each other's output
+void test_flags() {
+    const char* source = "x = 1 + 2;\nprint(x);\n";
+    char dir[] = "/tmp/tiny-server-test-XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+
+    ServerOptions options = { 1, NULL, 1024 * 1024, dir, 0, 0, 0 };
+    char* plain = serve_one(&options, source);
+    assert(strstr(plain, "console.log(x);") && !strstr(plain, "$print"));
+
+    options.flags = ANALYZE_BUFFER_OUTPUT;
+    char* buffered = serve_one(&options, source);
+    assert(strstr(buffered, "$print(x);") && strstr(buffered, "$flush();"));
+
+    options.flags = 0;
+    char* again = serve_one(&options, source);
+    assert(strcmp(again, plain) == 0);
+
+    DIR* entries = opendir(dir);
+    struct dirent* entry;
+    int files = 0;
+    char path[sizeof(dir) + 256];
+    while ((entry = readdir(entries)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        files++;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        remove(path);
+    }
+    closedir(entries);
+    assert(files == 2);
+    rmdir(dir);
+
+    free(plain);
+    free(buffered);
+    free(again);
+}
+
+int main() {
+    ServerOptions options = { 4, NULL, 1024 * 1024, NULL, 0, 0, 0 };
+    run_requests(&options);
+
+    // A queue of two makes the reader wait for answers between requests
+    options.max_queued = 2;
+    run_requests(&options);
+    options.thread_count = 1;
+    options.max_queued = 1;
+    run_requests(&options);
+
+    test_flags();
+
+    printf("All server tests passed!\n");
+    return 0;
+}
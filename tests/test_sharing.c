@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/passes.h"
+#include "../src/astbin.h"
+
+#define STATEMENTS 200
+
+static char source[STATEMENTS * 48];
+
+// The same expression over and over, as generated sources tend to have
+static void build_repetitive_source() {
+    size_t used = 0;
+    for (int i = 0; i < STATEMENTS; i++) {
+        used += snprintf(source + used, sizeof(source) - used,
+                         "v%d = (x + y) * (x - y) + (x + y);\n", i);
+    }
+    snprintf(source + used, sizeof(source) - used, "print(v0);\n");
+}
+
+static ASTNode* parse_string(const char* text, int share) {
+    Lexer* lexer = init_lexer((char*)text);
+    Parser* parser = init_parser(lexer);
+    parser->share_expressions = share;
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+    return ast;
+}
+
+void test_node_counts() {
+    ASTNode* tree = parse_string(source, 0);
+    ASTNode* dag = parse_string(source, 1);
+
+    // 12 nodes per assignment written out; shared, one assignment each
+    // plus the six distinct expression nodes
+    assert(count_ast_nodes(tree) == count_ast_nodes(dag));
+    assert(count_unique_ast_nodes(tree) == count_ast_nodes(tree));
+    assert(count_unique_ast_nodes(dag) * 10 < count_ast_nodes(dag));
+
+    ASTNode* first = dag->data.program.statements[0]->data.assign.value;
+    ASTNode* second = dag->data.program.statements[1]->data.assign.value;
+    assert(first == second && first->shares == STATEMENTS - 1);
+    // (x + y) twice in every statement, but once inside the shared product
+    assert(first->data.binary_op.right == first->data.binary_op.left->data.binary_op.left);
+
+    assert(verify_ast(tree) == NULL && verify_ast(dag) == NULL);
+    free_ast(tree);
+    free_ast(dag);
+}
+
+// Sharing changes how the tree is stored, never what it says
+void test_same_outputs() {
+    for (int level = 0; level <= 3; level++) {
+        PassPipeline pipeline = optimization_level_pipeline(level);
+        unsigned outputs = ANALYZE_JAVASCRIPT | analyze_pipeline_flags(pipeline);
+        Analysis plain, shared;
+
+        assert(analyze_source(source, strlen(source), NULL, outputs, &plain, NULL, NULL) == 0);
+        assert(analyze_source(source, strlen(source), NULL, outputs | ANALYZE_SHARE_EXPRESSIONS,
+                              &shared, NULL, NULL) == 0);
+        assert(strcmp(plain.javascript, shared.javascript) == 0);
+        free_analysis(&plain);
+        free_analysis(&shared);
+    }
+}
+
+// Returns the bytes freeing the parsed tree of `source` gives back, and
+// how many allocations the lexer and parser made for it
+static size_t tree_bytes(int share, size_t* allocations) {
+    CountingAllocator counting;
+    init_counting_allocator(&counting, NULL, 0, NULL);
+    Allocator allocator = counting_allocator(&counting);
+    Lexer* lexer = init_lexer_with_allocator(source, strlen(source), &allocator);
+    Parser* parser = init_parser(lexer);
+    parser->share_expressions = share;
+    ASTNode* ast = parse(parser);
+    free_parser(parser);
+    free_lexer(lexer);
+
+    size_t before = counting.live_bytes;
+    size_t count = counting.alloc_count;
+    free_ast_with_allocator(ast, &allocator);
+    size_t held = before - counting.live_bytes;
+    release_counted_blocks(&counting);
+    *allocations = count;
+    return held;
+}
+
+void test_allocations() {
+    size_t plain_count, shared_count;
+    size_t plain = tree_bytes(0, &plain_count);
+    size_t shared = tree_bytes(1, &shared_count);
+
+    // What is left per statement is the assignment itself and its name
+    assert(shared * 8 < plain);
+    assert(shared_count < plain_count);
+
+    // Sharing also lowers the peak of a whole compilation
+    CountingAllocator whole[2];
+    for (int share = 0; share <= 1; share++) {
+        Analysis analysis;
+        init_counting_allocator(&whole[share], NULL, 0, NULL);
+        Allocator allocator = counting_allocator(&whole[share]);
+        unsigned outputs = ANALYZE_JAVASCRIPT | (share ? ANALYZE_SHARE_EXPRESSIONS : 0);
+        assert(analyze_source(source, strlen(source), NULL, outputs, &analysis, NULL, &allocator) == 0);
+        free_analysis(&analysis);
+    }
+    assert(whole[1].peak_bytes < whole[0].peak_bytes);
+    // Every shared node was freed, and only once
+    assert(whole[1].live_bytes == whole[0].live_bytes);
+    release_counted_blocks(&whole[0]);
+    release_counted_blocks(&whole[1]);
+}
+
+// Each shared node is written once and referred back to
+void test_binary() {
+    ASTNode* tree = parse_string("a = (x + y) * (x + y);", 0);
+    ASTNode* dag = parse_string("a = (x + y) * (x + y);", 1);
+    size_t tree_length, dag_length;
+    char* tree_buffer = ast_to_binary(tree, &tree_length);
+    char* dag_buffer = ast_to_binary(dag, &dag_length);
+
+    // PROGRAM, ASSIGN, *, then x + y as three nodes once or twice
+    assert(((int32_t*)tree_buffer)[3] == 9);
+    assert(((int32_t*)dag_buffer)[3] == 6);
+    assert(dag_length < tree_length);
+    int32_t* product = (int32_t*)dag_buffer + AST_BINARY_HEADER_WORDS + 2 * AST_BINARY_NODE_WORDS;
+    assert(product[0] == AST_BINARY_OP && product[1] == '*');
+    assert(product[2] == 3 && product[3] == 3);
+
+    free(tree_buffer);
+    free(dag_buffer);
+
+    // The JSON writes the shared operand out twice under the same "id"
+    char* json = ast_to_json_styled(dag, JSON_COMPACT);
+    const char* id = strstr(strstr(json, "\"operator\":\"*\""), "\"id\"");
+    const char* end = strchr(id + 6, '"');
+    char repeated[64];
+    snprintf(repeated, sizeof(repeated), "%.*s", (int)(end - id + 1), id);
+    assert(strstr(strstr(json, repeated) + 1, repeated));
+    free(json);
+    free_ast(tree);
+    free_ast(dag);
+}
+
+// The loop optimizer rewrites inside expressions, so it first takes its
+// own copy of a shared one; the other uses keep the original
+void test_copy_on_write() {
+    const char* text = "n = 3; a = 2; b = 5; s = 0; i = 0;\n"
+                       "t = a * b + i;\n"
+                       "while (i < n) { s = s + (a * b + i); i = i + 1; }\n"
+                       "print(s + t);\n";
+    ASTNode* dag = parse_string(text, 1);
+    ASTNode* outside = dag->data.program.statements[5]->data.assign.value;
+    assert(outside->shares == 1);
+
+    run_passes(dag, optimization_level_pipeline(1), NULL, NULL, NULL);
+    assert(verify_ast(dag) == NULL);
+    assert(outside->shares == 0 && outside->data.binary_op.op == '+');
+    assert(outside->data.binary_op.left->data.binary_op.op == '*');
+
+    Analysis plain, shared;
+    unsigned outputs = ANALYZE_JAVASCRIPT | analyze_pipeline_flags(optimization_level_pipeline(1));
+    assert(analyze_source(text, strlen(text), NULL, outputs, &plain, NULL, NULL) == 0);
+    assert(analyze_source(text, strlen(text), NULL, outputs | ANALYZE_SHARE_EXPRESSIONS, &shared,
+                          NULL, NULL) == 0);
+    assert(strstr(plain.javascript, "$inv0 = (a * b);"));
+    assert(strcmp(plain.javascript, shared.javascript) == 0);
+    free_analysis(&plain);
+    free_analysis(&shared);
+    free_ast(dag);
+}
+
+int main() {
+    build_repetitive_source();
+    test_node_counts();
+    test_same_outputs();
+    test_allocations();
+    test_binary();
+    test_copy_on_write();
+    printf("All expression sharing tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../src/threadpool.h"
+
+#define THREAD_COUNT 4
+#define TASK_COUNT 10000
+
+typedef struct {
+    int done[TASK_COUNT];
+    int per_worker[THREAD_COUNT];
+} Counters;
+
+typedef struct {
+    Counters* counters;
+    int index;
+} CountTask;
+
+void count_task(void* arg, int worker) {
+    CountTask* task = arg;
+    assert(worker >= 0 && worker < THREAD_COUNT);
+
+    // Uneven task sizes give idle workers something to steal
+    volatile unsigned long spin = 0;
+    for (int i = 0; i < (task->index % 7) * 100; i++) {
+        spin += i;
+    }
+
+    __atomic_fetch_add(&task->counters->done[task->index], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&task->counters->per_worker[worker], 1, __ATOMIC_RELAXED);
+    free(task);
+}
+
+int main() {
+    Counters* counters = calloc(1, sizeof(Counters));
+    ThreadPool* pool = init_threadpool(THREAD_COUNT);
+    assert(threadpool_size(pool) == THREAD_COUNT);
+
+    // Run two rounds to check the pool is reusable after threadpool_wait
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < TASK_COUNT; i++) {
+            CountTask* task = malloc(sizeof(CountTask));
+            task->counters = counters;
+            task->index = i;
+            threadpool_submit(pool, count_task, task);
+        }
+        threadpool_wait(pool);
+
+        for (int i = 0; i < TASK_COUNT; i++) {
+            assert(counters->done[i] == round + 1);
+        }
+    }
+
+    int total = 0;
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        total += counters->per_worker[i];
+    }
+    assert(total == 2 * TASK_COUNT);
+
+    free_threadpool(pool);
+    free(counters);
+
+    printf("All threadpool tests passed!\n");
+    return 0;
+}